@@ -39,6 +39,8 @@
 #include "gss-playready.h"
 #include "gss-sglist.h"
 #include "gss-utils.h"
+#include "gss-compress.h"
+#include "gss-tsmux.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -69,8 +71,14 @@
 
 #define GSS_ISM_SECOND 10000000
 
+/* more ranges than this in a DASH request are ignored */
+#define GSS_ADAPTIVE_MAX_RANGES 32
+
+/* interval over which fragment requests are counted to find cold streams */
+#define GSS_ADAPTIVE_REQUEST_WINDOW (60 * G_USEC_PER_SEC)
+
 static void gss_adaptive_resource_get_manifest (GssTransaction * t,
-    GssAdaptive * adaptive);
+    GssAdaptive * adaptive, GssAdaptiveManifest * manifest);
 static void gss_adaptive_resource_get_content (GssTransaction * t,
     GssAdaptive * adaptive);
 static void load_file (GssAdaptive * adaptive, const char *filename);
@@ -81,48 +89,185 @@ static void gss_adaptive_async_assemble_chunk_finish (GssTransaction * t,
 static void gss_adaptive_dash_range_async (GssTransaction * t, gpointer priv);
 static void gss_adaptive_dash_range_async_finish (GssTransaction * t,
     gpointer priv);
+static void gss_adaptive_dash_stream_fill (GssAdaptiveQuery * query);
+static void gss_adaptive_dash_stream_wrote_body_data (SoupMessage * msg,
+    SoupBuffer * chunk, gpointer priv);
+static void gss_adaptive_dash_stream_finished (SoupMessage * msg,
+    gpointer priv);
 
 
-static guint8 *
-gss_adaptive_assemble_chunk (GssTransaction * t, GssAdaptive * adaptive,
-    GssAdaptiveLevel * level, GssIsomFragment * fragment)
+/* Reads the mdat of @fragment, including the 8-byte box header, into
+ * @mdat_data.  Errors are reported on @t, if it is not NULL.  The time
+ * taken is counted in the server's I/O latency histogram. */
+static gboolean
+gss_adaptive_read_mdat (GssTransaction * t, GssAdaptive * adaptive,
+    GssAdaptiveLevel * level, GssIsomFragment * fragment, guint8 * mdat_data)
 {
   GError *error = NULL;
-  guint8 *mdat_data;
-  int fd;
+  GssServer *server = adaptive->server;
+  GssFdCacheEntry *file;
+  gint64 start;
   gboolean ret;
 
-  g_return_val_if_fail (t != NULL, NULL);
+  start = g_get_monotonic_time ();
+  file = gss_fd_cache_open (server->fd_cache, level->filename, &error);
+  if (file == NULL) {
+    GST_WARNING ("failed to open \"%s\", broken manifest?", level->filename);
+    if (t) {
+      gss_transaction_error_not_found (t,
+          "failed to open file (broken manifest?)");
+    }
+    g_error_free (error);
+    return FALSE;
+  }
+
+  GST_WRITE_UINT32_BE (mdat_data, fragment->mdat_size);
+  GST_WRITE_UINT32_LE (mdat_data + 4, GST_MAKE_FOURCC ('m', 'd', 'a', 't'));
+
+  ret = gss_sglist_load (fragment->sglist, file->fd, mdat_data + 8, &error);
+  gss_fd_cache_release (server->fd_cache, file);
+  gss_latency_histogram_add (server->io_latency,
+      g_get_monotonic_time () - start);
+  if (!ret) {
+    if (t)
+      gss_transaction_error_not_found (t, error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Returns a buffer holding the complete fragment as it is sent on the
+ * wire: the moof followed by the (encrypted, if necessary) mdat.  Encrypted
+ * fragments are looked up in and offered to the server's fragment cache,
+ * since reading and encrypting them is much more expensive than keeping
+ * the result around.  @t may be NULL if the response has been started
+ * already and errors cannot be reported anymore. */
+static SoupBuffer *
+gss_adaptive_get_fragment_buffer (GssTransaction * t, GssAdaptive * adaptive,
+    GssAdaptiveLevel * level, GssIsomFragment * fragment)
+{
+  GssFragmentCache *cache = adaptive->server->fragment_cache;
+  SoupBuffer *buffer;
+  char *key = NULL;
+  guint8 *data;
+  gsize moof_size;
+
   g_return_val_if_fail (adaptive != NULL, NULL);
   g_return_val_if_fail (level != NULL, NULL);
   g_return_val_if_fail (fragment != NULL, NULL);
 
-  fd = open (level->filename, O_RDONLY);
-  if (fd < 0) {
-    GST_WARNING ("failed to open \"%s\", error=\"%s\", broken manifest?",
-        level->filename, g_strerror (errno));
-    gss_transaction_error_not_found (t,
-        "failed to open file (broken manifest?)");
+  if (adaptive->drm_type != GSS_DRM_CLEAR) {
+    /* the audio and video levels of a muxed file share the filename, so
+     * the level's own track id is part of the key */
+    key = g_strdup_printf ("%s%s/%d/%d", adaptive->cache_prefix,
+        level->filename, level->track_id, fragment->index);
+    buffer = gss_fragment_cache_lookup (cache, key);
+    if (buffer) {
+      g_free (key);
+      return buffer;
+    }
+  }
+
+  /* strip off mdat header at end of moof_data */
+  moof_size = fragment->moof_size - 8;
+  data = g_malloc (moof_size + fragment->mdat_size);
+  memcpy (data, fragment->moof_data, moof_size);
+  if (!gss_adaptive_read_mdat (t, adaptive, level, fragment,
+          data + moof_size)) {
+    g_free (data);
+    g_free (key);
     return NULL;
   }
+  if (adaptive->drm_type != GSS_DRM_CLEAR) {
+    gint64 start = g_get_monotonic_time ();
 
-  mdat_data = g_malloc (fragment->mdat_size);
+    gss_playready_encrypt_samples (fragment, data + moof_size,
+        adaptive->cipher);
+    gss_latency_histogram_add (adaptive->server->encrypt_latency,
+        g_get_monotonic_time () - start);
+  }
 
-  GST_WRITE_UINT32_BE (mdat_data, fragment->mdat_size);
-  GST_WRITE_UINT32_LE (mdat_data + 4, GST_MAKE_FOURCC ('m', 'd', 'a', 't'));
+  buffer = soup_buffer_new (SOUP_MEMORY_TAKE, data,
+      moof_size + fragment->mdat_size);
+  if (key) {
+    gss_fragment_cache_insert (cache, key, buffer);
+    g_free (key);
+  }
 
-  ret = gss_sglist_load (fragment->sglist, fd, mdat_data + 8, &error);
-  if (!ret) {
-    gss_transaction_error_not_found (t, error->message);
-    g_error_free (error);
-    g_free (mdat_data);
-    close (fd);
-    return NULL;
+  return buffer;
+}
+
+/* Counts a fragment request.  Called from the main thread.  Returns TRUE
+ * if the stream is cold, i.e., it had fewer than cold_request_rate
+ * fragment requests both in the current and in the previous minute.
+ * A stream that was loaded within the last minute has no request history
+ * yet, so it is never cold. */
+static gboolean
+gss_adaptive_count_request (GssAdaptive * adaptive)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 elapsed = now - adaptive->request_window_start;
+
+  if (elapsed >= GSS_ADAPTIVE_REQUEST_WINDOW) {
+    adaptive->n_requests_previous =
+        (elapsed < 2 * GSS_ADAPTIVE_REQUEST_WINDOW) ? adaptive->n_requests : 0;
+    adaptive->n_requests = 0;
+    adaptive->request_window_start = now;
   }
+  adaptive->n_requests++;
 
-  close (fd);
+  if (now - adaptive->load_time < GSS_ADAPTIVE_REQUEST_WINDOW)
+    return FALSE;
+
+  return (adaptive->n_requests < adaptive->cold_request_rate &&
+      adaptive->n_requests_previous < adaptive->cold_request_rate);
+}
+
+/* Gives the kernel page cache hints after @fragment has been served.
+ * Clients almost always ask for the next fragment of the same level
+ * next, so the following fragments are read ahead.  For cold streams,
+ * nobody is likely to ask for @fragment again soon, so its pages are
+ * dropped instead of pushing out those of popular streams. */
+static void
+gss_adaptive_advise_fragment (GssAdaptive * adaptive, GssAdaptiveLevel * level,
+    GssIsomFragment * fragment, gboolean cold)
+{
+  GssIsomTrack *track = level->track;
+  GssFdCacheEntry *file;
+  int start;
+  int end;
+  int i;
+
+  end = MIN (fragment->index + 1 + adaptive->readahead_fragments,
+      track->n_fragments);
+  start = g_atomic_int_get (&level->readahead_end);
+  if (start <= fragment->index || start > end) {
+    /* first request, or the client seeked */
+    start = fragment->index + 1;
+  }
+  if (start >= end && !cold)
+    return;
+
+  file = gss_fd_cache_open (adaptive->server->fd_cache, level->filename,
+      NULL);
+  if (file == NULL)
+    return;
+
+  if (cold) {
+    gss_sglist_advise (fragment->sglist, file->fd,
+        GSS_SGLIST_ADVICE_DONTNEED);
+  }
+  for (i = start; i < end; i++) {
+    gss_sglist_advise (track->fragments[i]->sglist, file->fd,
+        GSS_SGLIST_ADVICE_WILLNEED);
+  }
+  if (start < end) {
+    g_atomic_int_set (&level->readahead_end, end);
+  }
 
-  return mdat_data;
+  gss_fd_cache_release (adaptive->server->fd_cache, file);
 }
 
 
@@ -188,23 +333,233 @@ manifest_query_check_video (ManifestQuery * mq, GssAdaptiveLevel * level)
   return TRUE;
 }
 
+/* Manifests are rendered once per stream, when it is loaded, as a list
+ * of parts.  Most parts are fixed text, including the fragment
+ * timelines, which make up the bulk of a manifest for long content.
+ * The parts that depend on the request (video levels that may be
+ * filtered out by the manifest query, the protection header, which
+ * contains the auth token, and the query passed on to the URIs of HLS
+ * media playlists) are spliced in per request.  Text parts are appended
+ * to the response by reference. */
+typedef enum
+{
+  GSS_MANIFEST_PART_TEXT,
+  GSS_MANIFEST_PART_VIDEO_LEVEL,
+  GSS_MANIFEST_PART_PROTECTION,
+  GSS_MANIFEST_PART_QUERY
+} GssManifestPartType;
+
+typedef struct _GssManifestPart GssManifestPart;
+struct _GssManifestPart
+{
+  GssManifestPartType type;
+  SoupBuffer *buffer;
+  GssAdaptiveLevel *level;
+};
+
+struct _GssAdaptiveManifest
+{
+  GArray *parts;
+  const char *content_type;
+  gsize size;
+  gboolean has_protection;
+  gboolean has_query;
+
+  /* bitmask of included video levels -> GssManifestVariant */
+  GHashTable *gzip_variants;
+  gsize gzip_size;
+};
+
+/* compressed manifest for one combination of video levels */
+typedef struct _GssManifestVariant GssManifestVariant;
+struct _GssManifestVariant
+{
+  SoupBuffer *buffer;
+  char *etag;
+};
+
+static void
+gss_manifest_variant_free (GssManifestVariant * variant)
+{
+  if (variant->buffer)
+    soup_buffer_free (variant->buffer);
+  g_free (variant->etag);
+  g_free (variant);
+}
+
+/* Adds a part holding the text in @s, and clears @s */
+static void
+manifest_add_text (GssAdaptiveManifest * manifest, GssManifestPartType type,
+    GString * s, GssAdaptiveLevel * level)
+{
+  GssManifestPart part;
+
+  if (s->len == 0)
+    return;
+
+  part.type = type;
+  part.buffer = soup_buffer_new (SOUP_MEMORY_COPY, s->str, s->len);
+  part.level = level;
+  g_array_append_val (manifest->parts, part);
+  manifest->size += s->len;
+
+  g_string_truncate (s, 0);
+}
+
+static void
+manifest_add_protection (GssAdaptiveManifest * manifest, GString * s)
+{
+  GssManifestPart part;
+
+  manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+
+  part.type = GSS_MANIFEST_PART_PROTECTION;
+  part.buffer = NULL;
+  part.level = NULL;
+  g_array_append_val (manifest->parts, part);
+  manifest->has_protection = TRUE;
+}
+
+/* Adds the text in @s, followed by the query string that carries the
+ * auth token on to a child URI.  @level is the video level the URI
+ * belongs to, if any, so that both are left out together. */
+static void
+manifest_add_query (GssAdaptiveManifest * manifest, GssManifestPartType type,
+    GString * s, GssAdaptiveLevel * level)
+{
+  GssManifestPart part;
+
+  manifest_add_text (manifest, type, s, level);
+
+  part.type = GSS_MANIFEST_PART_QUERY;
+  part.buffer = NULL;
+  part.level = level;
+  g_array_append_val (manifest->parts, part);
+  manifest->has_query = TRUE;
+}
+
+static GssAdaptiveManifest *
+gss_adaptive_manifest_new (const char *content_type)
+{
+  GssAdaptiveManifest *manifest;
+
+  manifest = g_new0 (GssAdaptiveManifest, 1);
+  manifest->parts = g_array_new (FALSE, FALSE, sizeof (GssManifestPart));
+  manifest->content_type = content_type;
+  manifest->gzip_variants = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, NULL, (GDestroyNotify) gss_manifest_variant_free);
+
+  return manifest;
+}
+
+static void
+gss_adaptive_manifest_free (GssAdaptiveManifest * manifest)
+{
+  guint i;
+
+  for (i = 0; i < manifest->parts->len; i++) {
+    GssManifestPart *part = &g_array_index (manifest->parts,
+        GssManifestPart, i);
+
+    if (part->buffer)
+      soup_buffer_free (part->buffer);
+  }
+  g_array_free (manifest->parts, TRUE);
+  g_hash_table_unref (manifest->gzip_variants);
+  g_free (manifest);
+}
+
+static gsize
+gss_adaptive_manifest_get_memory_size (GssAdaptiveManifest * manifest)
+{
+  if (manifest == NULL)
+    return 0;
+  return manifest->size + manifest->parts->len * sizeof (GssManifestPart) +
+      manifest->gzip_size;
+}
+
+/* Returns the number of fragments starting at @index that have the same
+ * duration. */
+static int
+get_fragment_run_length (GssAdaptiveLevel * level, int index)
+{
+  guint64 duration;
+  int i;
+
+  duration = gss_isom_track_get_fragment (level->track, index)->duration;
+  for (i = index + 1; i < level->n_fragments; i++) {
+    if (gss_isom_track_get_fragment (level->track, i)->duration != duration)
+      break;
+  }
+  return i - index;
+}
+
+static gboolean
+level_has_fragment_runs (GssAdaptiveLevel * level)
+{
+  int i;
+
+  for (i = 0; i + 1 < level->n_fragments; i++) {
+    if (gss_isom_track_get_fragment (level->track, i)->duration ==
+        gss_isom_track_get_fragment (level->track, i + 1)->duration)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Appends the fragment durations of @level, run-length encoded.  DASH
+ * (<S>) counts repeats after the first fragment, Smooth Streaming (<c>)
+ * counts all fragments in the run. */
 static void
-gss_adaptive_resource_get_manifest (GssTransaction * t, GssAdaptive * adaptive)
+append_timeline (GString * s, GssAdaptiveLevel * level, gboolean dash)
 {
+  int i;
+  int n;
+
+  for (i = 0; i < level->n_fragments; i += n) {
+    GssIsomFragment *fragment;
+
+    fragment = gss_isom_track_get_fragment (level->track, i);
+    n = get_fragment_run_length (level, i);
+    if (dash) {
+      if (n > 1) {
+        GSS_P ("        <S d=\"%" G_GUINT64_FORMAT "\" r=\"%d\" />\n",
+            (guint64) fragment->duration, n - 1);
+      } else {
+        GSS_P ("        <S d=\"%" G_GUINT64_FORMAT "\" />\n",
+            (guint64) fragment->duration);
+      }
+    } else {
+      if (n > 1) {
+        GSS_P ("    <c d=\"%" G_GUINT64_FORMAT "\" r=\"%d\" />\n",
+            (guint64) fragment->duration, n);
+      } else {
+        GSS_P ("    <c d=\"%" G_GUINT64_FORMAT "\" />\n",
+            (guint64) fragment->duration);
+      }
+    }
+  }
+}
+
+static GssAdaptiveManifest *
+gss_adaptive_render_smooth_manifest (GssAdaptive * adaptive)
+{
+  GssAdaptiveManifest *manifest;
   GString *s = g_string_new ("");
-  ManifestQuery mq;
   int i;
   int show_audio_levels;
 
-  t->s = s;
-
-  parse_manifest_query (&mq, t);
+  manifest = gss_adaptive_manifest_new (NULL);
 
   GSS_A ("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
 
+  /* repeated chunks (r attribute) need version 2.2 */
   GSS_P
-      ("<SmoothStreamingMedia MajorVersion=\"2\" MinorVersion=\"1\" Duration=\"%"
-      G_GUINT64_FORMAT "\">\n", adaptive->duration);
+      ("<SmoothStreamingMedia MajorVersion=\"2\" MinorVersion=\"%d\" Duration=\"%"
+      G_GUINT64_FORMAT "\">\n",
+      (level_has_fragment_runs (&adaptive->video_levels[0]) ||
+          level_has_fragment_runs (&adaptive->audio_levels[0])) ? 2 : 1,
+      adaptive->duration);
   GSS_P
       ("  <StreamIndex Type=\"video\" Name=\"video\" Chunks=\"%d\" QualityLevels=\"%d\" MaxWidth=\"%d\" MaxHeight=\"%d\" "
       "DisplayWidth=\"%d\" DisplayHeight=\"%d\" "
@@ -217,23 +572,14 @@ gss_adaptive_resource_get_manifest (GssTransaction * t, GssAdaptive * adaptive)
   for (i = 0; i < adaptive->n_video_levels; i++) {
     GssAdaptiveLevel *level = &adaptive->video_levels[i];
 
-    if (manifest_query_check_video (&mq, level)) {
-      GSS_P ("    <QualityLevel Index=\"%d\" Bitrate=\"%d\" "
-          "FourCC=\"H264\" MaxWidth=\"%d\" MaxHeight=\"%d\" "
-          "CodecPrivateData=\"%s\" />\n", i, level->bitrate, level->video_width,
-          level->video_height, level->codec_data);
-    }
-  }
-  {
-    GssAdaptiveLevel *level = &adaptive->video_levels[0];
-
-    for (i = 0; i < level->n_fragments; i++) {
-      GssIsomFragment *fragment;
-      fragment = gss_isom_track_get_fragment (level->track, i);
-      GSS_P ("    <c d=\"%" G_GUINT64_FORMAT "\" />\n",
-          (guint64) fragment->duration);
-    }
+    manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+    GSS_P ("    <QualityLevel Index=\"%d\" Bitrate=\"%d\" "
+        "FourCC=\"H264\" MaxWidth=\"%d\" MaxHeight=\"%d\" "
+        "CodecPrivateData=\"%s\" />\n", i, level->bitrate, level->video_width,
+        level->video_height, level->codec_data);
+    manifest_add_text (manifest, GSS_MANIFEST_PART_VIDEO_LEVEL, s, level);
   }
+  append_timeline (s, &adaptive->video_levels[0], FALSE);
   GSS_A ("  </StreamIndex>\n");
 
   show_audio_levels = 1;
@@ -250,72 +596,42 @@ gss_adaptive_resource_get_manifest (GssTransaction * t, GssAdaptive * adaptive)
         level->bitrate, level->audio_rate, level->codec_data);
     break;
   }
-  {
-    GssAdaptiveLevel *level = &adaptive->audio_levels[0];
-
-    for (i = 0; i < level->n_fragments; i++) {
-      GssIsomFragment *fragment;
-      fragment = gss_isom_track_get_fragment (level->track, i);
-      GSS_P ("    <c d=\"%" G_GUINT64_FORMAT "\" />\n",
-          (guint64) fragment->duration);
-    }
-  }
+  append_timeline (s, &adaptive->audio_levels[0], FALSE);
 
   GSS_A ("  </StreamIndex>\n");
   if (adaptive->drm_type == GSS_DRM_PLAYREADY) {
-    char *prot_header_base64;
-
     GSS_A ("<Protection>\n");
     GSS_A ("  <ProtectionHeader "
         "SystemID=\"9a04f079-9840-4286-ab92-e65be0885f95\">");
-
-    prot_header_base64 = gss_playready_get_protection_header_base64 (adaptive,
-        t->server->playready->license_url, mq.auth_token);
-    GSS_P ("%s", prot_header_base64);
-    g_free (prot_header_base64);
-
+    manifest_add_protection (manifest, s);
     GSS_A ("</ProtectionHeader>\n");
     GSS_A ("</Protection>\n");
   }
   GSS_A ("</SmoothStreamingMedia>\n");
 
+  manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+  g_string_free (s, TRUE);
+
+  return manifest;
 }
 
 static void
-append_content_protection (GssTransaction * t, GssAdaptive * adaptive,
-    const char *auth_token)
+append_content_protection (GssAdaptiveManifest * manifest,
+    GssAdaptive * adaptive, GString * s)
 {
-  GString *s = t->s;
-
   if (adaptive->drm_type == GSS_DRM_PLAYREADY) {
-    char *prot_header_base64;
-    GSS_A ("      <ContentProtection schemeIdUri=\"urn:mpeg:dash:"
-        "mp4protection:2011\" value=\"cenc\"/>\n");
-    GSS_A ("      <ContentProtection "
-        "schemeIdUri=\"urn:uuid:9a04f079-9840-4286-ab92-e65be0885f95\">\n");
-    prot_header_base64 =
-        gss_playready_get_protection_header_base64 (adaptive,
-        t->server->playready->license_url, auth_token);
-    GSS_P ("        <mspr:pro>%s</mspr:pro>\n", prot_header_base64);
-    g_free (prot_header_base64);
-    GSS_A ("      </ContentProtection>\n");
+    manifest_add_protection (manifest, s);
   }
-
 }
 
-static void
-gss_adaptive_resource_get_dash_range_mpd (GssTransaction * t,
-    GssAdaptive * adaptive)
+static GssAdaptiveManifest *
+gss_adaptive_render_dash_range_mpd (GssAdaptive * adaptive)
 {
+  GssAdaptiveManifest *manifest;
   GString *s = g_string_new ("");
   int i;
-  ManifestQuery mq;
-
-  parse_manifest_query (&mq, t);
-  t->s = s;
 
-  soup_message_headers_replace (t->msg->response_headers, "Content-Type",
-      "application/octet-stream");
+  manifest = gss_adaptive_manifest_new ("application/octet-stream");
 
   GSS_A ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
   GSS_A ("<MPD xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
@@ -335,7 +651,7 @@ gss_adaptive_resource_get_dash_range_mpd (GssTransaction * t,
       "lang=\"en\" "
       "segmentAlignment=\"true\" "
       "subsegmentAlignment=\"true\" " "subsegmentStartsWithSAP=\"1\">\n");
-  append_content_protection (t, adaptive, mq.auth_token);
+  append_content_protection (manifest, adaptive, s);
   for (i = 0; i < adaptive->n_audio_levels; i++) {
     GssAdaptiveLevel *level = &adaptive->audio_levels[i];
     GssIsomTrack *track = level->track;
@@ -356,24 +672,107 @@ gss_adaptive_resource_get_dash_range_mpd (GssTransaction * t,
   GSS_A ("    <AdaptationSet mimeType=\"video/mp4\" "
       "segmentAlignment=\"true\" "
       "subsegmentAlignment=\"true\" " "subsegmentStartsWithSAP=\"1\">\n");
-  append_content_protection (t, adaptive, mq.auth_token);
+  append_content_protection (manifest, adaptive, s);
   for (i = 0; i < adaptive->n_video_levels; i++) {
     GssAdaptiveLevel *level = &adaptive->video_levels[i];
     GssIsomTrack *track = level->track;
 
-    if (manifest_query_check_video (&mq, level)) {
-      GSS_P ("      <Representation id=\"v%d\" bandwidth=\"%d\" "
-          "codecs=\"%s\" width=\"%d\" height=\"%d\">\n",
-          i, level->bitrate, level->codec,
-          level->video_width, level->video_height);
-      GSS_P ("        <BaseURL>content/v%d</BaseURL>\n", i);
-      GSS_P ("        <SegmentBase indexRange=\"%" G_GSIZE_FORMAT "-%"
-          G_GSIZE_FORMAT "\">" "<Initialization range=\"%" G_GSIZE_FORMAT "-%"
-          G_GSIZE_FORMAT "\" /></SegmentBase>\n", track->dash_header_size,
-          track->dash_header_and_sidx_size - 1, (gsize) 0,
-          track->dash_header_size - 1);
-      GSS_A ("      </Representation>\n");
-    }
+    manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+    GSS_P ("      <Representation id=\"v%d\" bandwidth=\"%d\" "
+        "codecs=\"%s\" width=\"%d\" height=\"%d\">\n",
+        i, level->bitrate, level->codec,
+        level->video_width, level->video_height);
+    GSS_P ("        <BaseURL>content/v%d</BaseURL>\n", i);
+    GSS_P ("        <SegmentBase indexRange=\"%" G_GSIZE_FORMAT "-%"
+        G_GSIZE_FORMAT "\">" "<Initialization range=\"%" G_GSIZE_FORMAT "-%"
+        G_GSIZE_FORMAT "\" /></SegmentBase>\n", track->dash_header_size,
+        track->dash_header_and_sidx_size - 1, (gsize) 0,
+        track->dash_header_size - 1);
+    GSS_A ("      </Representation>\n");
+    manifest_add_text (manifest, GSS_MANIFEST_PART_VIDEO_LEVEL, s, level);
+  }
+  GSS_A ("    </AdaptationSet>\n");
+
+  GSS_A ("  </Period>\n");
+  GSS_A ("</MPD>\n");
+  GSS_A ("\n");
+
+  manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+  g_string_free (s, TRUE);
+
+  return manifest;
+}
+
+static GssAdaptiveManifest *
+gss_adaptive_render_dash_live_mpd (GssAdaptive * adaptive)
+{
+  GssAdaptiveManifest *manifest;
+  GString *s = g_string_new ("");
+  int i;
+
+  manifest = gss_adaptive_manifest_new ("application/octet-stream");
+
+  GSS_P ("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+  GSS_A ("<MPD xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
+      "  xmlns=\"urn:mpeg:dash:schema:mpd:2011\"\n");
+  if (adaptive->drm_type == GSS_DRM_PLAYREADY) {
+    GSS_A ("  xmlns:mspr=\"urn:microsoft:playready\"\n");
+  }
+  GSS_P ("  xsi:schemaLocation=\"urn:mpeg:dash:schema:mpd:2011 DASH-MPD.xsd\"\n"
+      "  type=\"static\"\n"
+      "  mediaPresentationDuration=\"PT%dS\"\n"
+      "  minBufferTime=\"PT10S\"\n"
+      "  profiles=\"urn:mpeg:dash:profile:isoff-live:2011\">\n",
+      (int) (adaptive->duration / GSS_ISM_SECOND));
+  GSS_P ("  <Period>\n");
+
+  GSS_A ("    <AdaptationSet " "id=\"1\" "
+      "profiles=\"ccff\" "
+      "bitstreamSwitching=\"true\" "
+      "segmentAlignment=\"true\" "
+      "contentType=\"audio\" " "mimeType=\"audio/mp4\" " "lang=\"en\">\n");
+  append_content_protection (manifest, adaptive, s);
+  GSS_A ("    <SegmentTemplate timescale=\"10000000\" "
+      "media=\"content?stream=audio&amp;bitrate=$Bandwidth$&amp;start_time=$Time$\" "
+      "initialization=\"content?stream=audio&amp;bitrate=$Bandwidth$&amp;start_time=init\">\n");
+  GSS_A ("      <SegmentTimeline>\n");
+  append_timeline (s, &adaptive->audio_levels[0], TRUE);
+  GSS_A ("      </SegmentTimeline>\n");
+  GSS_A ("    </SegmentTemplate>\n");
+  for (i = 0; i < adaptive->n_audio_levels; i++) {
+    GssAdaptiveLevel *level = &adaptive->audio_levels[i];
+
+    GSS_P ("      <Representation id=\"a%d\" codecs=\"%s\" "
+        "bandwidth=\"%d\" audioSamplingRate=\"%d\"/>\n",
+        i, level->codec, level->bitrate, level->audio_rate);
+  }
+  GSS_A ("    </AdaptationSet>\n");
+
+  GSS_P ("    <AdaptationSet " "id=\"2\" "
+      "profiles=\"ccff\" "
+      "bitstreamSwitching=\"true\" "
+      "segmentAlignment=\"true\" "
+      "contentType=\"video\" "
+      "mimeType=\"video/mp4\" "
+      "maxWidth=\"1920\" " "maxHeight=\"1080\" " "startWithSAP=\"1\">\n");
+  append_content_protection (manifest, adaptive, s);
+
+  GSS_A ("    <SegmentTemplate timescale=\"10000000\" "
+      "media=\"content?stream=video&amp;bitrate=$Bandwidth$&amp;start_time=$Time$\" "
+      "initialization=\"content?stream=video&amp;bitrate=$Bandwidth$&amp;start_time=init\">\n");
+  GSS_A ("      <SegmentTimeline>\n");
+  append_timeline (s, &adaptive->video_levels[0], TRUE);
+  GSS_A ("      </SegmentTimeline>\n");
+  GSS_A ("    </SegmentTemplate>\n");
+  for (i = 0; i < adaptive->n_video_levels; i++) {
+    GssAdaptiveLevel *level = &adaptive->video_levels[i];
+
+    manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+    GSS_P ("      <Representation id=\"v%d\" bandwidth=\"%d\" "
+        "codecs=\"%s\" width=\"%d\" height=\"%d\"/>\n",
+        i, level->bitrate, level->codec,
+        level->video_width, level->video_height);
+    manifest_add_text (manifest, GSS_MANIFEST_PART_VIDEO_LEVEL, s, level);
   }
   GSS_A ("    </AdaptationSet>\n");
 
@@ -381,6 +780,387 @@ gss_adaptive_resource_get_dash_range_mpd (GssTransaction * t,
   GSS_A ("</MPD>\n");
   GSS_A ("\n");
 
+  manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+  g_string_free (s, TRUE);
+
+  return manifest;
+}
+
+/* HLS (RFC 8216), with either fragmented MP4 or MPEG-TS segments.  The
+ * media playlists list the same fragments as the other manifests.  For
+ * fragmented MP4, the CCFF header is the initialization section and the
+ * segments are the content URLs, so they are assembled and encrypted as
+ * for Smooth Streaming.  MPEG-TS segments are muxed from the fragments
+ * of a video level and the first audio level, if those are aligned.
+ * Otherwise audio is a separate rendition, as for fragmented MP4.  The
+ * auth token is passed on to the media playlists, which carry the
+ * protection header. */
+static GssAdaptiveManifest *
+gss_adaptive_render_hls_master_playlist (GssAdaptive * adaptive)
+{
+  GssAdaptiveManifest *manifest;
+  GString *s = g_string_new ("");
+  gboolean is_ts = (adaptive->stream_type == GSS_ADAPTIVE_STREAM_HLS_TS);
+  gboolean muxed = (is_ts && adaptive->ts_audio_muxed);
+  int audio_bitrate = 0;
+  int i;
+
+  manifest = gss_adaptive_manifest_new ("application/vnd.apple.mpegurl");
+
+  GSS_A ("#EXTM3U\n");
+  GSS_P ("#EXT-X-VERSION:%d\n", is_ts ? 3 : 7);
+  GSS_A ("#EXT-X-INDEPENDENT-SEGMENTS\n");
+
+  for (i = 0; i < adaptive->n_audio_levels; i++) {
+    GssAdaptiveLevel *level = &adaptive->audio_levels[i];
+
+    if (muxed) {
+      /* the first audio level is muxed into the video segments */
+      audio_bitrate = level->bitrate;
+      break;
+    }
+    GSS_P ("#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"audio\",NAME=\"audio%d\","
+        "LANGUAGE=\"en\",DEFAULT=%s,AUTOSELECT=YES,URI=\"a%d.m3u8",
+        i, (i == 0) ? "YES" : "NO", i);
+    manifest_add_query (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+    GSS_A ("\"\n");
+    audio_bitrate = MAX (audio_bitrate, level->bitrate);
+  }
+
+  for (i = 0; i < adaptive->n_video_levels; i++) {
+    GssAdaptiveLevel *level = &adaptive->video_levels[i];
+
+    manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+    GSS_P ("#EXT-X-STREAM-INF:BANDWIDTH=%d,CODECS=\"%s%s%s\","
+        "RESOLUTION=%dx%d%s\n", level->bitrate + audio_bitrate, level->codec,
+        adaptive->n_audio_levels ? "," : "",
+        adaptive->n_audio_levels ? adaptive->audio_levels[0].codec : "",
+        level->video_width, level->video_height,
+        (adaptive->n_audio_levels && !muxed) ? ",AUDIO=\"audio\"" : "");
+    GSS_P ("v%d.m3u8", i);
+    manifest_add_query (manifest, GSS_MANIFEST_PART_VIDEO_LEVEL, s, level);
+    GSS_A ("\n");
+    manifest_add_text (manifest, GSS_MANIFEST_PART_VIDEO_LEVEL, s, level);
+  }
+  if (adaptive->n_video_levels == 0) {
+    for (i = 0; i < adaptive->n_audio_levels; i++) {
+      GssAdaptiveLevel *level = &adaptive->audio_levels[i];
+
+      GSS_P ("#EXT-X-STREAM-INF:BANDWIDTH=%d,CODECS=\"%s\"\n",
+          level->bitrate, level->codec);
+      GSS_P ("a%d.m3u8", i);
+      manifest_add_query (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+      GSS_A ("\n");
+    }
+  }
+
+  manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+  g_string_free (s, TRUE);
+
+  return manifest;
+}
+
+static GssAdaptiveManifest *
+gss_adaptive_render_hls_media_playlist (GssAdaptive * adaptive,
+    GssAdaptiveLevel * level, gboolean is_video, int index)
+{
+  GssAdaptiveManifest *manifest;
+  GString *s = g_string_new ("");
+  gboolean is_ts = (adaptive->stream_type == GSS_ADAPTIVE_STREAM_HLS_TS);
+  const char *stream = is_video ? "video" : "audio";
+  guint64 max_duration = 0;
+  int i;
+
+  manifest = gss_adaptive_manifest_new ("application/vnd.apple.mpegurl");
+
+  for (i = 0; i < level->n_fragments; i++) {
+    max_duration = MAX (max_duration,
+        gss_isom_track_get_fragment (level->track, i)->duration);
+  }
+
+  GSS_A ("#EXTM3U\n");
+  GSS_P ("#EXT-X-VERSION:%d\n", is_ts ? 3 : 7);
+  GSS_P ("#EXT-X-TARGETDURATION:%d\n",
+      (int) ((max_duration + GSS_ISM_SECOND - 1) / GSS_ISM_SECOND));
+  GSS_A ("#EXT-X-MEDIA-SEQUENCE:0\n");
+  GSS_A ("#EXT-X-PLAYLIST-TYPE:VOD\n");
+  GSS_A ("#EXT-X-INDEPENDENT-SEGMENTS\n");
+  if (adaptive->drm_type == GSS_DRM_PLAYREADY) {
+    manifest_add_protection (manifest, s);
+  }
+  if (!is_ts) {
+    GSS_P ("#EXT-X-MAP:URI=\"content?stream=%s&bitrate=%d&"
+        "start_time=init\"\n", stream, level->bitrate);
+  }
+
+  for (i = 0; i < level->n_fragments; i++) {
+    GssIsomFragment *fragment;
+    char duration[G_ASCII_DTOSTR_BUF_SIZE];
+
+    fragment = gss_isom_track_get_fragment (level->track, i);
+    g_ascii_formatd (duration, sizeof (duration), "%.3f",
+        (double) fragment->duration / GSS_ISM_SECOND);
+    GSS_P ("#EXTINF:%s,\n", duration);
+    if (is_ts) {
+      GSS_P ("%c%d/%d.ts\n", stream[0], index, i);
+    } else {
+      GSS_P ("content?stream=%s&bitrate=%d&start_time=%" G_GUINT64_FORMAT
+          "\n", stream, level->bitrate, (guint64) fragment->timestamp);
+    }
+  }
+  GSS_A ("#EXT-X-ENDLIST\n");
+
+  manifest_add_text (manifest, GSS_MANIFEST_PART_TEXT, s, NULL);
+  g_string_free (s, TRUE);
+
+  return manifest;
+}
+
+static void
+gss_adaptive_render_hls_media_playlists (GssAdaptive * adaptive)
+{
+  int i;
+
+  for (i = 0; i < adaptive->n_audio_levels; i++) {
+    adaptive->audio_levels[i].playlist =
+        gss_adaptive_render_hls_media_playlist (adaptive,
+        &adaptive->audio_levels[i], FALSE, i);
+  }
+  for (i = 0; i < adaptive->n_video_levels; i++) {
+    adaptive->video_levels[i].playlist =
+        gss_adaptive_render_hls_media_playlist (adaptive,
+        &adaptive->video_levels[i], TRUE, i);
+  }
+}
+
+static char *
+gss_adaptive_get_protection (GssTransaction * t, GssAdaptive * adaptive,
+    const char *auth_token)
+{
+  char *prot_header_base64;
+  char *s;
+
+  prot_header_base64 = gss_playready_get_protection_header_base64 (adaptive,
+      t->server->playready->license_url, auth_token);
+  if (adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISM) {
+    return prot_header_base64;
+  }
+  if (adaptive->stream_type == GSS_ADAPTIVE_STREAM_HLS_FMP4) {
+    s = g_strdup_printf ("#EXT-X-KEY:METHOD=SAMPLE-AES-CTR,"
+        "KEYFORMAT=\"com.microsoft.playready\",KEYFORMATVERSIONS=\"1\","
+        "URI=\"data:text/plain;charset=UTF-16;base64,%s\"\n",
+        prot_header_base64);
+    g_free (prot_header_base64);
+    return s;
+  }
+
+  s = g_strdup_printf ("      <ContentProtection schemeIdUri=\"urn:mpeg:dash:"
+      "mp4protection:2011\" value=\"cenc\"/>\n"
+      "      <ContentProtection "
+      "schemeIdUri=\"urn:uuid:9a04f079-9840-4286-ab92-e65be0885f95\">\n"
+      "        <mspr:pro>%s</mspr:pro>\n"
+      "      </ContentProtection>\n", prot_header_base64);
+  g_free (prot_header_base64);
+
+  return s;
+}
+
+static GssAdaptiveManifest *
+gss_adaptive_render_manifest (GssAdaptive * adaptive)
+{
+  switch (adaptive->stream_type) {
+    case GSS_ADAPTIVE_STREAM_ISM:
+      return gss_adaptive_render_smooth_manifest (adaptive);
+    case GSS_ADAPTIVE_STREAM_ISOFF_LIVE:
+      return gss_adaptive_render_dash_live_mpd (adaptive);
+    case GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND:
+      return gss_adaptive_render_dash_range_mpd (adaptive);
+    case GSS_ADAPTIVE_STREAM_HLS_FMP4:
+    case GSS_ADAPTIVE_STREAM_HLS_TS:
+      return gss_adaptive_render_hls_master_playlist (adaptive);
+    default:
+      return NULL;
+  }
+}
+
+static gboolean
+manifest_part_is_included (GssManifestPart * part, ManifestQuery * mq)
+{
+  return (part->level == NULL || manifest_query_check_video (mq, part->level));
+}
+
+/* Returns the text of a part that is rendered per request */
+static char *
+gss_adaptive_manifest_part_render (GssTransaction * t,
+    GssAdaptive * adaptive, GssManifestPart * part, ManifestQuery * mq)
+{
+  char *token;
+  char *s;
+
+  if (part->type == GSS_MANIFEST_PART_PROTECTION) {
+    return gss_adaptive_get_protection (t, adaptive, mq->auth_token);
+  }
+
+  if (mq->auth_token == NULL)
+    return g_strdup ("");
+  token = g_uri_escape_string (mq->auth_token, NULL, FALSE);
+  s = g_strdup_printf ("?auth_token=%s", token);
+  g_free (token);
+
+  return s;
+}
+
+/* Returns the complete manifest text for @t, in one piece */
+static GString *
+gss_adaptive_manifest_render_text (GssTransaction * t, GssAdaptive * adaptive,
+    GssAdaptiveManifest * manifest, ManifestQuery * mq)
+{
+  GString *s;
+  guint i;
+
+  s = g_string_sized_new (manifest->size + 1024);
+  for (i = 0; i < manifest->parts->len; i++) {
+    GssManifestPart *part = &g_array_index (manifest->parts,
+        GssManifestPart, i);
+
+    if (!manifest_part_is_included (part, mq))
+      continue;
+    if (part->buffer == NULL) {
+      char *text;
+
+      text = gss_adaptive_manifest_part_render (t, adaptive, part, mq);
+      g_string_append (s, text);
+      g_free (text);
+    } else {
+      g_string_append_len (s, part->buffer->data, part->buffer->length);
+    }
+  }
+
+  return s;
+}
+
+/* Sends the manifest gzip compressed.  Manifests that don't contain
+ * the auth token are compressed once for each combination of video
+ * levels that is asked for, and kept along with their own ETag.
+ * Returns FALSE if the manifest should be sent uncompressed. */
+static gboolean
+gss_adaptive_send_gzip_manifest (GssTransaction * t, GssAdaptive * adaptive,
+    GssAdaptiveManifest * manifest, ManifestQuery * mq)
+{
+  GssManifestVariant *variant;
+  const char *inm;
+  SoupBuffer *buffer;
+  GString *s;
+
+  if (!manifest->has_protection &&
+      (!manifest->has_query || mq->auth_token == NULL) &&
+      adaptive->n_video_levels <= 32) {
+    guint32 mask = 0;
+    gsize size;
+    guint i;
+
+    /* a level may have several parts */
+    for (i = 0; i < manifest->parts->len; i++) {
+      GssManifestPart *part = &g_array_index (manifest->parts,
+          GssManifestPart, i);
+
+      if (part->level && manifest_part_is_included (part, mq))
+        mask |= (1U << (part->level - adaptive->video_levels));
+    }
+
+    variant = g_hash_table_lookup (manifest->gzip_variants,
+        GUINT_TO_POINTER (mask));
+    if (variant == NULL) {
+      char *checksum;
+
+      s = gss_adaptive_manifest_render_text (t, adaptive, manifest, mq);
+      variant = g_new0 (GssManifestVariant, 1);
+      variant->buffer = gss_compress_gzip (s->str, s->len);
+      checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, s->str,
+          s->len);
+      variant->etag = gss_compress_get_gzip_etag (checksum);
+      g_free (checksum);
+      g_string_free (s, TRUE);
+      g_hash_table_insert (manifest->gzip_variants, GUINT_TO_POINTER (mask),
+          variant);
+
+      /* Variants that are not worth compressing are kept as well, without
+       * a buffer, so that compression is not tried again.  Either way
+       * the variant is part of the stream's memory. */
+      size = sizeof (GssManifestVariant) + strlen (variant->etag) + 1;
+      if (variant->buffer)
+        size += variant->buffer->length;
+      manifest->gzip_size += size;
+      adaptive->memory_size += size;
+    }
+    if (variant->buffer == NULL)
+      return FALSE;
+
+    inm = soup_message_headers_get_one (t->msg->request_headers,
+        "If-None-Match");
+    if (inm && strcmp (inm, variant->etag) == 0) {
+      soup_message_set_status (t->msg, SOUP_STATUS_NOT_MODIFIED);
+      return TRUE;
+    }
+    soup_message_headers_replace (t->msg->response_headers, "Etag",
+        variant->etag);
+    gss_compress_set_gzip_headers (t);
+    soup_message_body_append_buffer (t->msg->response_body, variant->buffer);
+    return TRUE;
+  }
+
+  s = gss_adaptive_manifest_render_text (t, adaptive, manifest, mq);
+  buffer = gss_compress_gzip (s->str, s->len);
+  g_string_free (s, TRUE);
+  if (buffer == NULL)
+    return FALSE;
+
+  gss_compress_set_gzip_headers (t);
+  soup_message_body_append_buffer (t->msg->response_body, buffer);
+  soup_buffer_free (buffer);
+  return TRUE;
+}
+
+static void
+gss_adaptive_resource_get_manifest (GssTransaction * t, GssAdaptive * adaptive,
+    GssAdaptiveManifest * manifest)
+{
+  ManifestQuery mq;
+  guint i;
+
+  if (manifest == NULL) {
+    gss_transaction_error_not_found (t, "no manifest for stream type");
+    return;
+  }
+
+  parse_manifest_query (&mq, t);
+
+  if (manifest->content_type) {
+    soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+        manifest->content_type);
+  }
+
+  if (gss_compress_accept_gzip (t) &&
+      gss_adaptive_send_gzip_manifest (t, adaptive, manifest, &mq)) {
+    return;
+  }
+
+  for (i = 0; i < manifest->parts->len; i++) {
+    GssManifestPart *part = &g_array_index (manifest->parts,
+        GssManifestPart, i);
+
+    if (!manifest_part_is_included (part, &mq))
+      continue;
+    if (part->buffer == NULL) {
+      char *s;
+
+      s = gss_adaptive_manifest_part_render (t, adaptive, part, &mq);
+      soup_message_body_append (t->msg->response_body, SOUP_MEMORY_TAKE,
+          s, strlen (s));
+    } else {
+      soup_message_body_append_buffer (t->msg->response_body, part->buffer);
+    }
+  }
 }
 
 static gboolean
@@ -425,6 +1205,195 @@ gss_soup_message_body_append_clipped (SoupMessageBody * body,
   soup_message_body_append (body, use, data + offset, end - start);
 }
 
+/* Like gss_soup_message_body_append_clipped(), but appends a sub-buffer
+ * of @buffer, starting at @buffer_offset, without copying. */
+static void
+gss_soup_message_body_append_buffer_clipped (SoupMessageBody * body,
+    SoupBuffer * buffer, gsize buffer_offset, guint64 start1, guint64 size1,
+    guint64 start2, guint64 size2)
+{
+  SoupBuffer *sub;
+  guint64 start;
+  guint64 end;
+
+  start = MAX (start1, start2);
+  end = MIN (start1 + size1, start2 + size2);
+  if (start >= end)
+    return;
+
+  sub = soup_buffer_new_subbuffer (buffer, buffer_offset + (start - start2),
+      end - start);
+  soup_message_body_append_buffer (body, sub);
+  soup_buffer_free (sub);
+}
+
+/* Appends the part of the mdat payload of @fragment that overlaps the
+ * requested range as buffers pointing into the memory-mapped source
+ * file, avoiding both the read into a temporary buffer and the copy
+ * into the message body.  The pages are faulted in here, on the worker,
+ * so that the socket write on the main loop does not wait for the disk.
+ * Only valid for clear content.  Returns FALSE without appending
+ * anything if the file cannot be mapped. */
+static gboolean
+gss_adaptive_append_mapped_mdat (SoupMessageBody * body,
+    GssAdaptive * adaptive, GssAdaptiveLevel * level,
+    GssIsomFragment * fragment, guint64 offset, guint64 n_bytes,
+    guint64 payload_offset)
+{
+  GssFdCache *cache = adaptive->server->fd_cache;
+  GssFdCacheEntry *file;
+  const guint8 *map_data;
+  gsize map_size;
+  struct stat st;
+  guint64 pos;
+  int i;
+
+  file = gss_fd_cache_open (cache, level->filename, NULL);
+  if (file == NULL)
+    return FALSE;
+
+  if (!gss_fd_cache_entry_map (file, &map_data, &map_size)) {
+    gss_fd_cache_release (cache, file);
+    return FALSE;
+  }
+  /* Reading a mapped page past the end of a file that was truncated
+   * since it was mapped raises SIGBUS, so the current size is checked
+   * as well.  Such files are read the normal way. */
+  if (fstat (file->fd, &st) < 0) {
+    gss_fd_cache_release (cache, file);
+    return FALSE;
+  }
+  map_size = MIN (map_size, st.st_size);
+  for (i = 0; i < fragment->sglist->n_chunks; i++) {
+    if (fragment->sglist->chunks[i].offset +
+        fragment->sglist->chunks[i].size > map_size) {
+      GST_WARNING ("fragment extends past end of \"%s\"", level->filename);
+      gss_fd_cache_release (cache, file);
+      return FALSE;
+    }
+  }
+
+  pos = payload_offset;
+  for (i = 0; i < fragment->sglist->n_chunks; i++) {
+    GssSGChunk *chunk = &fragment->sglist->chunks[i];
+    guint64 start;
+    guint64 end;
+
+    start = MAX (offset, pos);
+    end = MIN (offset + n_bytes, pos + chunk->size);
+    if (start < end) {
+      SoupBuffer *buffer;
+
+      gss_fd_cache_entry_fault_in (file, chunk->offset + (start - pos),
+          end - start);
+      buffer = soup_buffer_new_with_owner (map_data + chunk->offset +
+          (start - pos), end - start, gss_fd_cache_entry_ref (file),
+          (GDestroyNotify) gss_fd_cache_entry_unref);
+      soup_message_body_append_buffer (body, buffer);
+      soup_buffer_free (buffer);
+    }
+    pos += chunk->size;
+  }
+  gss_fd_cache_release (cache, file);
+
+  return TRUE;
+}
+
+/* Produces the body of a DASH byte range response, either in one go or,
+ * for large responses, a window at a time as the socket drains. */
+struct _GssAdaptiveRangeWriter
+{
+  const char *content_type;
+  SoupRange *ranges;
+  int n_ranges;
+  /* only set for multipart/byteranges responses */
+  char *boundary;
+  char **part_headers;
+  guint64 total_size;
+
+  /* position */
+  int range_index;
+  gboolean in_range;
+  guint64 offset;
+  gboolean done;
+  gboolean error;
+
+  /* streamed responses */
+  GssTransaction *t;
+  guint64 window;
+  guint64 pending;
+  guint64 fill_size;
+  gboolean busy;
+  gboolean finished;
+  SoupMessageBody *staging;
+};
+
+static GssAdaptiveRangeWriter *
+gss_adaptive_range_writer_new (GssAdaptiveLevel * level,
+    const char *content_type, SoupRange * ranges, int n_ranges)
+{
+  GssAdaptiveRangeWriter *writer;
+  int i;
+
+  writer = g_malloc0 (sizeof (GssAdaptiveRangeWriter));
+  writer->content_type = content_type;
+  if (n_ranges == 0) {
+    writer->ranges = g_malloc (sizeof (SoupRange));
+    writer->ranges[0].start = 0;
+    writer->ranges[0].end = level->track->dash_size - 1;
+    writer->n_ranges = 1;
+  } else {
+    writer->ranges = g_memdup (ranges, n_ranges * sizeof (SoupRange));
+    writer->n_ranges = n_ranges;
+  }
+
+  for (i = 0; i < writer->n_ranges; i++) {
+    writer->total_size += writer->ranges[i].end + 1 - writer->ranges[i].start;
+  }
+
+  if (writer->n_ranges > 1) {
+    /* multipart/byteranges, RFC 7233 appendix A */
+    writer->boundary = g_strdup_printf ("gss-%08x%08x", g_random_int (),
+        g_random_int ());
+    writer->part_headers = g_malloc0 ((writer->n_ranges + 1) * sizeof (char *));
+    for (i = 0; i < writer->n_ranges; i++) {
+      SoupRange *range = &writer->ranges[i];
+
+      writer->part_headers[i] = g_strdup_printf ("\r\n--%s\r\n"
+          "Content-Type: %s\r\n"
+          "Content-Range: bytes %" G_GINT64_FORMAT "-%" G_GINT64_FORMAT
+          "/%" G_GUINT64_FORMAT "\r\n\r\n", writer->boundary,
+          content_type, range->start, range->end,
+          (guint64) level->track->dash_size);
+      writer->total_size += strlen (writer->part_headers[i]);
+    }
+    /* "\r\n--" boundary "--\r\n" */
+    writer->total_size += strlen (writer->boundary) + 8;
+  }
+
+  return writer;
+}
+
+static void
+gss_adaptive_range_writer_free (GssAdaptiveRangeWriter * writer)
+{
+  if (writer->staging)
+    soup_message_body_free (writer->staging);
+  g_strfreev (writer->part_headers);
+  g_free (writer->boundary);
+  g_free (writer->ranges);
+  g_free (writer);
+}
+
+static void
+gss_adaptive_query_free (GssAdaptiveQuery * query)
+{
+  if (query->writer)
+    gss_adaptive_range_writer_free (query->writer);
+  gss_adaptive_unref (query->adaptive);
+  g_free (query);
+}
+
 static void
 gss_adaptive_resource_get_dash_range_fragment (GssTransaction * t,
     GssAdaptive * adaptive, const char *path)
@@ -434,6 +1403,9 @@ gss_adaptive_resource_get_dash_range_fragment (GssTransaction * t,
   int n_ranges;
   int index;
   GssAdaptiveLevel *level;
+  GssAdaptiveQuery *query;
+  GssAdaptiveRangeWriter *writer;
+  guint64 window;
   gsize start, end;
 
   /* skip over content/ */
@@ -470,101 +1442,235 @@ gss_adaptive_resource_get_dash_range_fragment (GssTransaction * t,
 
   have_range = soup_message_headers_get_ranges (t->msg->request_headers,
       level->track->dash_size, &ranges, &n_ranges);
+  if (have_range && n_ranges > GSS_ADAPTIVE_MAX_RANGES) {
+    /* ignoring the Range header is allowed, and cheaper than assembling
+     * lots of tiny parts */
+    GST_DEBUG ("%s: ignoring %d ranges", path, n_ranges);
+    soup_message_headers_free_ranges (t->msg->request_headers, ranges);
+    have_range = FALSE;
+  }
 
   if (have_range) {
-    if (n_ranges != 1) {
-      GST_ERROR ("too many ranges");
-    }
+    int i;
+
     start = ranges[0].start;
     end = ranges[0].end + 1;
+    for (i = 1; i < n_ranges; i++) {
+      start = MIN (start, ranges[i].start);
+      end = MAX (end, ranges[i].end + 1);
+    }
   } else {
     start = 0;
     end = level->track->dash_size;
   }
-  GST_DEBUG ("%s: range: %ld-%ld", path, start, end);
+  GST_DEBUG ("%s: range: %ld-%ld (%d ranges)", path, start, end,
+      have_range ? n_ranges : 0);
   t->start = start;
   t->end = end;
 
-  if (have_range) {
-    soup_message_headers_set_content_range (t->msg->response_headers,
-        ranges[0].start, ranges[0].end, level->track->dash_size);
+  query = g_malloc0 (sizeof (GssAdaptiveQuery));
+  query->adaptive = gss_adaptive_ref (adaptive);
+  query->level = level;
+  query->cold = gss_adaptive_count_request (adaptive);
+  query->writer = writer = gss_adaptive_range_writer_new (level,
+      (path[0] == 'v') ? "video/mp4" : "audio/mp4",
+      have_range ? ranges : NULL, have_range ? n_ranges : 0);
+  if (have_range)
+    soup_message_headers_free_ranges (t->msg->request_headers, ranges);
+
+  if (writer->boundary) {
+    char *content_type;
+
+    content_type = g_strdup_printf ("multipart/byteranges; boundary=%s",
+        writer->boundary);
+    soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+        content_type);
+    g_free (content_type);
 
     soup_message_set_status (t->msg, SOUP_STATUS_PARTIAL_CONTENT);
-
-    soup_message_headers_free_ranges (t->msg->response_headers, ranges);
   } else {
-    soup_message_set_status (t->msg, SOUP_STATUS_OK);
-  }
-
-  soup_message_headers_replace (t->msg->response_headers, "Content-Type",
-      (path[0] == 'v') ? "video/mp4" : "audio/mp4");
-
-  {
-    GssAdaptiveQuery *query;
+    if (have_range) {
+      soup_message_headers_set_content_range (t->msg->response_headers,
+          writer->ranges[0].start, writer->ranges[0].end,
+          level->track->dash_size);
+
+      soup_message_set_status (t->msg, SOUP_STATUS_PARTIAL_CONTENT);
+    } else {
+      soup_message_set_status (t->msg, SOUP_STATUS_OK);
+    }
 
-    soup_server_pause_message (t->soupserver, t->msg);
+    soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+        writer->content_type);
+  }
 
-    query = g_malloc0 (sizeof (GssAdaptiveQuery));
-    query->adaptive = adaptive;
-    query->level = level;
+  soup_server_pause_message (t->soupserver, t->msg);
 
+  window = (guint64) t->server->range_window_size << 10;
+  if (writer->total_size <= window) {
     gss_transaction_process_async (t, gss_adaptive_dash_range_async,
         gss_adaptive_dash_range_async_finish, query);
+    return;
   }
+
+  /* Too large to be assembled in one go.  The body is produced by the
+   * worker threads a window at a time, and written chunks are dropped,
+   * so at most about a window (plus one fragment) is held in memory. */
+  GST_DEBUG ("%s: streaming %" G_GUINT64_FORMAT " bytes", path,
+      writer->total_size);
+  writer->t = t;
+  writer->window = window;
+  soup_message_headers_set_encoding (t->msg->response_headers,
+      SOUP_ENCODING_CONTENT_LENGTH);
+  soup_message_headers_set_content_length (t->msg->response_headers,
+      writer->total_size);
+  soup_message_body_set_accumulate (t->msg->response_body, FALSE);
+  g_signal_connect (t->msg, "wrote-body-data",
+      G_CALLBACK (gss_adaptive_dash_stream_wrote_body_data), query);
+  g_signal_connect (t->msg, "finished",
+      G_CALLBACK (gss_adaptive_dash_stream_finished), query);
+  gss_adaptive_dash_stream_fill (query);
 }
 
-static void
-gss_adaptive_dash_range_async (GssTransaction * t, gpointer priv)
+/* Appends @n_bytes at @offset of the virtual DASH file of the level to
+ * @body.  Returns FALSE if a fragment could not be read. */
+static gboolean
+gss_adaptive_dash_append_range (GssTransaction * t, GssAdaptiveQuery * query,
+    SoupMessageBody * body, guint64 offset, guint64 n_bytes)
 {
-  GssAdaptiveQuery *query = priv;
-  guint64 offset;
-  guint64 n_bytes;
   guint64 header_size;
   GssAdaptiveLevel *level = query->level;
   int i;
 
-  offset = t->start;
-  n_bytes = t->end - t->start;
-
   if (ranges_overlap (offset, n_bytes, 0,
           level->track->dash_header_and_sidx_size)) {
-    gss_soup_message_body_append_clipped (t->msg->response_body,
+    gss_soup_message_body_append_clipped (body,
         SOUP_MEMORY_COPY, level->track->dash_header_data,
         offset, n_bytes, 0, level->track->dash_header_and_sidx_size);
   }
   header_size = level->track->dash_header_and_sidx_size;
 
-  for (i = 0; i < level->track->n_fragments; i++) {
+  i = gss_isom_track_find_fragment_by_offset (level->track,
+      (offset > header_size) ? offset - header_size : 0);
+  for (; i < level->track->n_fragments; i++) {
     GssIsomFragment *fragment = level->track->fragments[i];
-    guint8 *mdat_data;
+    SoupBuffer *buffer;
 
-    if (offset + n_bytes <= fragment->offset)
+    if (offset + n_bytes <= header_size + fragment->offset)
       break;
 
     if (ranges_overlap (offset, n_bytes, header_size + fragment->offset,
             fragment->moof_size)) {
-      gss_soup_message_body_append_clipped (t->msg->response_body,
+      gss_soup_message_body_append_clipped (body,
           SOUP_MEMORY_COPY, fragment->moof_data,
           offset, n_bytes, header_size + fragment->offset, fragment->moof_size);
     }
 
     if (ranges_overlap (offset, n_bytes, header_size + fragment->offset +
             fragment->moof_size, fragment->mdat_size)) {
-      mdat_data = gss_adaptive_assemble_chunk (t, query->adaptive, level,
-          fragment);
-      if (query->adaptive->drm_type != GSS_DRM_CLEAR) {
-        gss_playready_encrypt_samples (fragment, mdat_data,
-            query->adaptive->content_key);
+      if (query->adaptive->drm_type == GSS_DRM_CLEAR &&
+          query->adaptive->server->enable_zero_copy &&
+          gss_adaptive_append_mapped_mdat (body, query->adaptive, level,
+              fragment, offset, n_bytes,
+              header_size + fragment->offset + fragment->moof_size)) {
+        gss_adaptive_advise_fragment (query->adaptive, level, fragment,
+            query->cold);
+        continue;
       }
 
-      gss_soup_message_body_append_clipped (t->msg->response_body,
-          SOUP_MEMORY_COPY, mdat_data + 8,
-          offset, n_bytes, header_size + fragment->offset + fragment->moof_size,
+      buffer = gss_adaptive_get_fragment_buffer (t, query->adaptive, level,
+          fragment);
+      if (buffer == NULL)
+        return FALSE;
+
+      /* the fragment buffer starts at the moof, so the mdat payload
+       * starts moof_size bytes in */
+      gss_soup_message_body_append_buffer_clipped (body,
+          buffer, fragment->moof_size, offset, n_bytes,
+          header_size + fragment->offset + fragment->moof_size,
           fragment->mdat_size - 8);
-      g_free (mdat_data);
+      soup_buffer_free (buffer);
+      gss_adaptive_advise_fragment (query->adaptive, level, fragment,
+          query->cold);
+    }
+  }
+
+  return TRUE;
+}
+
+/* Produces the next part of the response into @body, until at least
+ * @limit bytes have been appended or the response is complete.  Data is
+ * produced up to fragment boundaries, so that a fragment is not read
+ * (and possibly encrypted) twice. */
+static void
+gss_adaptive_range_writer_produce (GssTransaction * t,
+    GssAdaptiveQuery * query, SoupMessageBody * body, guint64 limit)
+{
+  GssAdaptiveRangeWriter *writer = query->writer;
+  GssIsomTrack *track = query->level->track;
+  guint64 header_size = track->dash_header_and_sidx_size;
+  goffset start = body->length;
+
+  while (writer->range_index < writer->n_ranges &&
+      (guint64) (body->length - start) < limit) {
+    SoupRange *range = &writer->ranges[writer->range_index];
+    guint64 end = range->end + 1;
+    guint64 next;
+
+    if (!writer->in_range) {
+      if (writer->part_headers) {
+        soup_message_body_append (body, SOUP_MEMORY_COPY,
+            writer->part_headers[writer->range_index],
+            strlen (writer->part_headers[writer->range_index]));
+      }
+      writer->offset = range->start;
+      writer->in_range = TRUE;
+    }
+    if (writer->offset >= end) {
+      writer->range_index++;
+      writer->in_range = FALSE;
+      continue;
+    }
+
+    if (writer->offset < header_size) {
+      next = header_size;
+    } else {
+      GssIsomFragment *fragment;
+
+      fragment = track->fragments[gss_isom_track_find_fragment_by_offset
+          (track, writer->offset - header_size)];
+      next = header_size + fragment->offset + fragment->moof_size +
+          fragment->mdat_size;
+    }
+    if (next <= writer->offset || next > end)
+      next = end;
+
+    if (!gss_adaptive_dash_append_range (t, query, body, writer->offset,
+            next - writer->offset)) {
+      writer->error = TRUE;
+      return;
     }
+    writer->offset = next;
   }
 
+  if (writer->range_index == writer->n_ranges && !writer->done) {
+    if (writer->boundary) {
+      char *trailer;
+
+      trailer = g_strdup_printf ("\r\n--%s--\r\n", writer->boundary);
+      soup_message_body_append (body, SOUP_MEMORY_TAKE, trailer,
+          strlen (trailer));
+    }
+    writer->done = TRUE;
+  }
+}
+
+static void
+gss_adaptive_dash_range_async (GssTransaction * t, gpointer priv)
+{
+  GssAdaptiveQuery *query = priv;
+
+  gss_adaptive_range_writer_produce (t, query, t->msg->response_body,
+      G_MAXUINT64);
 }
 
 static void
@@ -572,112 +1678,102 @@ gss_adaptive_dash_range_async_finish (GssTransaction * t, gpointer priv)
 {
   GssAdaptiveQuery *query = priv;
 
-  soup_message_body_complete (t->msg->response_body);
-  soup_server_unpause_message (t->soupserver, t->msg);
-  g_free (query);
+  if (!t->finished) {
+    soup_message_body_complete (t->msg->response_body);
+    soup_server_unpause_message (t->soupserver, t->msg);
+  }
+  gss_adaptive_query_free (query);
 }
 
+/* streamed responses */
+
 static void
-gss_adaptive_resource_get_dash_live_mpd (GssTransaction * t,
-    GssAdaptive * adaptive)
+gss_adaptive_dash_stream_async (GssTransaction * t, gpointer priv)
 {
-  GString *s = g_string_new ("");
-  int i;
-  ManifestQuery mq;
-
-  parse_manifest_query (&mq, t);
-
-  t->s = s;
+  GssAdaptiveQuery *query = priv;
+  GssAdaptiveRangeWriter *writer = query->writer;
 
-  soup_message_headers_replace (t->msg->response_headers, "Content-Type",
-      "application/octet-stream");
+  /* the message body is being written by the main thread, so the data is
+   * staged in a separate body and moved over in the main thread */
+  writer->staging = soup_message_body_new ();
+  gss_adaptive_range_writer_produce (NULL, query, writer->staging,
+      writer->fill_size);
+}
 
-  GSS_P ("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
-  GSS_A ("<MPD xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
-      "  xmlns=\"urn:mpeg:dash:schema:mpd:2011\"\n");
-  if (adaptive->drm_type == GSS_DRM_PLAYREADY) {
-    GSS_A ("  xmlns:mspr=\"urn:microsoft:playready\"\n");
+static void
+gss_adaptive_dash_stream_async_finish (GssTransaction * t, gpointer priv)
+{
+  GssAdaptiveQuery *query = priv;
+  GssAdaptiveRangeWriter *writer = query->writer;
+  SoupBuffer *chunk;
+  goffset offset = 0;
+
+  writer->busy = FALSE;
+  if (writer->finished) {
+    /* the client went away while the worker was busy */
+    gss_adaptive_query_free (query);
+    return;
   }
-  GSS_P ("  xsi:schemaLocation=\"urn:mpeg:dash:schema:mpd:2011 DASH-MPD.xsd\"\n"
-      "  type=\"static\"\n"
-      "  mediaPresentationDuration=\"PT%dS\"\n"
-      "  minBufferTime=\"PT10S\"\n"
-      "  profiles=\"urn:mpeg:dash:profile:isoff-live:2011\">\n",
-      (int) (adaptive->duration / GSS_ISM_SECOND));
-  GSS_P ("  <Period>\n");
-
-  GSS_A ("    <AdaptationSet " "id=\"1\" "
-      "profiles=\"ccff\" "
-      "bitstreamSwitching=\"true\" "
-      "segmentAlignment=\"true\" "
-      "contentType=\"audio\" " "mimeType=\"audio/mp4\" " "lang=\"en\">\n");
-  append_content_protection (t, adaptive, mq.auth_token);
-  GSS_A ("    <SegmentTemplate timescale=\"10000000\" "
-      "media=\"content?stream=audio&amp;bitrate=$Bandwidth$&amp;start_time=$Time$\" "
-      "initialization=\"content?stream=audio&amp;bitrate=$Bandwidth$&amp;start_time=init\">\n");
-  GSS_A ("      <SegmentTimeline>\n");
-  {
-    GssAdaptiveLevel *level = &adaptive->audio_levels[0];
 
-    for (i = 0; i < level->n_fragments; i++) {
-      GssIsomFragment *fragment;
-      fragment = gss_isom_track_get_fragment (level->track, i);
-      GSS_P ("        <S d=\"%" G_GUINT64_FORMAT "\" />\n",
-          (guint64) fragment->duration);
-    }
+  while ((chunk = soup_message_body_get_chunk (writer->staging, offset))) {
+    offset += chunk->length;
+    writer->pending += chunk->length;
+    soup_message_body_append_buffer (t->msg->response_body, chunk);
+    soup_buffer_free (chunk);
   }
-  GSS_A ("      </SegmentTimeline>\n");
-  GSS_A ("    </SegmentTemplate>\n");
-  for (i = 0; i < adaptive->n_audio_levels; i++) {
-    GssAdaptiveLevel *level = &adaptive->audio_levels[i];
+  soup_message_body_free (writer->staging);
+  writer->staging = NULL;
 
-    GSS_P ("      <Representation id=\"a%d\" codecs=\"%s\" "
-        "bandwidth=\"%d\" audioSamplingRate=\"%d\"/>\n",
-        i, level->codec, level->bitrate, level->audio_rate);
+  if (writer->error) {
+    /* the headers have been sent already, so the only way left to
+     * tell the client is to close the connection early */
+    GST_WARNING ("failed to read fragment, closing connection");
+    soup_socket_disconnect (soup_client_context_get_socket (t->client));
+    return;
   }
-  GSS_A ("    </AdaptationSet>\n");
+  if (writer->done) {
+    soup_message_body_complete (t->msg->response_body);
+  }
+  soup_server_unpause_message (t->soupserver, t->msg);
+}
 
-  GSS_P ("    <AdaptationSet " "id=\"2\" "
-      "profiles=\"ccff\" "
-      "bitstreamSwitching=\"true\" "
-      "segmentAlignment=\"true\" "
-      "contentType=\"video\" "
-      "mimeType=\"video/mp4\" "
-      "maxWidth=\"1920\" " "maxHeight=\"1080\" " "startWithSAP=\"1\">\n");
-  append_content_protection (t, adaptive, mq.auth_token);
+/* Starts producing more data if less than half a window is waiting to
+ * be written. */
+static void
+gss_adaptive_dash_stream_fill (GssAdaptiveQuery * query)
+{
+  GssAdaptiveRangeWriter *writer = query->writer;
 
-  GSS_A ("    <SegmentTemplate timescale=\"10000000\" "
-      "media=\"content?stream=video&amp;bitrate=$Bandwidth$&amp;start_time=$Time$\" "
-      "initialization=\"content?stream=video&amp;bitrate=$Bandwidth$&amp;start_time=init\">\n");
-  GSS_A ("      <SegmentTimeline>\n");
-  {
-    GssAdaptiveLevel *level = &adaptive->video_levels[0];
+  if (writer->busy || writer->done || writer->error ||
+      writer->pending > writer->window / 2)
+    return;
 
-    for (i = 0; i < level->n_fragments; i++) {
-      GssIsomFragment *fragment;
-      fragment = gss_isom_track_get_fragment (level->track, i);
-      GSS_P ("        <S d=\"%" G_GUINT64_FORMAT "\" />\n",
-          (guint64) fragment->duration);
-    }
-  }
-  GSS_A ("      </SegmentTimeline>\n");
-  GSS_A ("    </SegmentTemplate>\n");
-  for (i = 0; i < adaptive->n_video_levels; i++) {
-    GssAdaptiveLevel *level = &adaptive->video_levels[i];
+  writer->busy = TRUE;
+  writer->fill_size = writer->window - writer->pending;
+  gss_transaction_process_async (writer->t, gss_adaptive_dash_stream_async,
+      gss_adaptive_dash_stream_async_finish, query);
+}
 
-    if (manifest_query_check_video (&mq, level)) {
-      GSS_P ("      <Representation id=\"v%d\" bandwidth=\"%d\" "
-          "codecs=\"%s\" width=\"%d\" height=\"%d\"/>\n",
-          i, level->bitrate, level->codec,
-          level->video_width, level->video_height);
-    }
-  }
-  GSS_A ("    </AdaptationSet>\n");
+static void
+gss_adaptive_dash_stream_wrote_body_data (SoupMessage * msg,
+    SoupBuffer * chunk, gpointer priv)
+{
+  GssAdaptiveQuery *query = priv;
 
-  GSS_A ("  </Period>\n");
-  GSS_A ("</MPD>\n");
-  GSS_A ("\n");
+  query->writer->pending -= chunk->length;
+  gss_adaptive_dash_stream_fill (query);
+}
+
+static void
+gss_adaptive_dash_stream_finished (SoupMessage * msg, gpointer priv)
+{
+  GssAdaptiveQuery *query = priv;
 
+  g_signal_handlers_disconnect_by_data (msg, query);
+  query->writer->finished = TRUE;
+  /* otherwise freed when the worker is done */
+  if (!query->writer->busy)
+    gss_adaptive_query_free (query);
 }
 
 static gboolean
@@ -786,9 +1882,10 @@ gss_adaptive_resource_get_content (GssTransaction * t, GssAdaptive * adaptive)
     soup_server_pause_message (t->soupserver, t->msg);
 
     query = g_malloc0 (sizeof (GssAdaptiveQuery));
-    query->adaptive = adaptive;
+    query->adaptive = gss_adaptive_ref (adaptive);
     query->level = level;
     query->fragment = fragment;
+    query->cold = gss_adaptive_count_request (adaptive);
 
     gss_transaction_process_async (t, gss_adaptive_async_assemble_chunk,
         gss_adaptive_async_assemble_chunk_finish, query);
@@ -800,11 +1897,11 @@ gss_adaptive_async_assemble_chunk (GssTransaction * t, gpointer priv)
 {
   GssAdaptiveQuery *query = priv;
 
-  query->data = gss_adaptive_assemble_chunk (t,
+  query->buffer = gss_adaptive_get_fragment_buffer (t,
       query->adaptive, query->level, query->fragment);
-  if (query->adaptive->drm_type != GSS_DRM_CLEAR) {
-    gss_playready_encrypt_samples (query->fragment, query->data,
-        query->adaptive->content_key);
+  if (query->buffer) {
+    gss_adaptive_advise_fragment (query->adaptive, query->level,
+        query->fragment, query->cold);
   }
 }
 
@@ -813,14 +1910,17 @@ gss_adaptive_async_assemble_chunk_finish (GssTransaction * t, gpointer priv)
 {
   GssAdaptiveQuery *query = priv;
 
-  soup_message_set_status (t->msg, SOUP_STATUS_OK);
-  /* strip off mdat header at end of moof_data */
-  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_COPY,
-      query->fragment->moof_data, query->fragment->moof_size - 8);
-  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_TAKE,
-      query->data, query->fragment->mdat_size);
-  soup_server_unpause_message (t->soupserver, t->msg);
-  g_free (query);
+  /* the client may have gone away while the worker was busy */
+  if (!t->finished) {
+    if (query->buffer) {
+      soup_message_set_status (t->msg, SOUP_STATUS_OK);
+      soup_message_body_append_buffer (t->msg->response_body, query->buffer);
+    }
+    soup_server_unpause_message (t->soupserver, t->msg);
+  }
+  if (query->buffer)
+    soup_buffer_free (query->buffer);
+  gss_adaptive_query_free (query);
 }
 
 GssAdaptive *
@@ -829,9 +1929,97 @@ gss_adaptive_new (void)
   GssAdaptive *adaptive;
 
   adaptive = g_malloc0 (sizeof (GssAdaptive));
+  adaptive->refcount = 1;
+  adaptive->load_time = g_get_monotonic_time ();
+  adaptive->request_window_start = adaptive->load_time;
+
+  return adaptive;
+
+}
+
+GssAdaptive *
+gss_adaptive_ref (GssAdaptive * adaptive)
+{
+  g_return_val_if_fail (adaptive != NULL, NULL);
+
+  g_atomic_int_inc (&adaptive->refcount);
 
   return adaptive;
+}
+
+/* The VOD cache and every transaction that is still using @adaptive
+ * asynchronously hold a reference, so evicting it from the cache does
+ * not free it from under a worker thread. */
+void
+gss_adaptive_unref (GssAdaptive * adaptive)
+{
+  g_return_if_fail (adaptive != NULL);
+
+  if (g_atomic_int_dec_and_test (&adaptive->refcount)) {
+    gss_adaptive_free (adaptive);
+  }
+}
+
+/**
+ * gss_adaptive_get_memory_size:
+ * @adaptive: a #GssAdaptive
+ *
+ * Returns: an estimate of the memory held by @adaptive, computed when
+ *   it was loaded and updated as compressed manifests are added
+ */
+gsize
+gss_adaptive_get_memory_size (GssAdaptive * adaptive)
+{
+  g_return_val_if_fail (adaptive != NULL, 0);
+
+  return adaptive->memory_size;
+}
+
+/* The tracks of a level are counted with their parsers */
+static gsize
+gss_adaptive_level_get_memory_size (GssAdaptiveLevel * level)
+{
+  gsize size;
+
+  size = sizeof (GssAdaptiveLevel);
+  if (level->filename)
+    size += strlen (level->filename) + 1;
+  if (level->codec_data)
+    size += strlen (level->codec_data) + 1;
+  if (level->codec)
+    size += strlen (level->codec) + 1;
+  size += gss_adaptive_manifest_get_memory_size (level->playlist);
+
+  return size;
+}
+
+/* Computed once the stream is loaded.  Later, gzip variants of the
+ * manifests are added to memory_size as they are created. */
+static gsize
+gss_adaptive_compute_memory_size (GssAdaptive * adaptive)
+{
+  gsize size;
+  int i;
+
+  size = sizeof (GssAdaptive);
+  size += adaptive->drm_info.data_len;
+  size += adaptive->kid_len;
+  if (adaptive->content_id)
+    size += strlen (adaptive->content_id) + 1;
+  if (adaptive->cache_prefix)
+    size += strlen (adaptive->cache_prefix) + 1;
+  size += gss_adaptive_manifest_get_memory_size (adaptive->manifest);
+  for (i = 0; i < adaptive->n_audio_levels; i++) {
+    size += gss_adaptive_level_get_memory_size (&adaptive->audio_levels[i]);
+  }
+  for (i = 0; i < adaptive->n_video_levels; i++) {
+    size += gss_adaptive_level_get_memory_size (&adaptive->video_levels[i]);
+  }
+  for (i = 0; i < adaptive->n_parsers; i++) {
+    size += gss_isom_parser_get_memory_size (adaptive->parsers[i]);
+  }
 
+  return size;
 }
 
 void
@@ -846,17 +2034,38 @@ gss_adaptive_free (GssAdaptive * adaptive)
   }
 
   for (i = 0; i < adaptive->n_audio_levels; i++) {
+    if (adaptive->server && adaptive->audio_levels[i].filename) {
+      gss_fd_cache_invalidate (adaptive->server->fd_cache,
+          adaptive->audio_levels[i].filename);
+    }
     adaptive->audio_levels[i].track = NULL;
     g_free (adaptive->audio_levels[i].codec_data);
     g_free (adaptive->audio_levels[i].filename);
     g_free (adaptive->audio_levels[i].codec);
+    if (adaptive->audio_levels[i].playlist)
+      gss_adaptive_manifest_free (adaptive->audio_levels[i].playlist);
   }
   for (i = 0; i < adaptive->n_video_levels; i++) {
+    if (adaptive->server && adaptive->video_levels[i].filename) {
+      gss_fd_cache_invalidate (adaptive->server->fd_cache,
+          adaptive->video_levels[i].filename);
+    }
     adaptive->video_levels[i].track = NULL;
     g_free (adaptive->video_levels[i].codec_data);
     g_free (adaptive->video_levels[i].filename);
     g_free (adaptive->video_levels[i].codec);
-  }
+    if (adaptive->video_levels[i].playlist)
+      gss_adaptive_manifest_free (adaptive->video_levels[i].playlist);
+  }
+  if (adaptive->cipher)
+    gss_playready_cipher_free (adaptive->cipher);
+  if (adaptive->server && adaptive->cache_prefix) {
+    gss_fragment_cache_invalidate_prefix (adaptive->server->fragment_cache,
+        adaptive->cache_prefix);
+  }
+  g_free (adaptive->cache_prefix);
+  if (adaptive->manifest)
+    gss_adaptive_manifest_free (adaptive->manifest);
   g_free (adaptive->drm_info.data);
   g_free (adaptive->audio_levels);
   g_free (adaptive->video_levels);
@@ -1003,6 +2212,49 @@ parse_json (GssAdaptive * adaptive, JsonParser * parser, const char *dir,
   return FALSE;
 }
 
+/* Audio fragments that start this close to the video fragment with the
+ * same index are muxed into the same MPEG-TS segment. */
+#define GSS_ADAPTIVE_TS_ALIGNMENT (GSS_ISM_SECOND / 10)
+
+/* Returns TRUE if every video level has exactly as many fragments as the
+ * first audio level, starting at about the same times.  Otherwise the
+ * audio of most segments would be missing or out of place if muxed
+ * with the video. */
+static gboolean
+gss_adaptive_check_ts_alignment (GssAdaptive * adaptive)
+{
+  GssAdaptiveLevel *audio_level;
+  int i, j;
+
+  if (adaptive->n_audio_levels == 0 || adaptive->n_video_levels == 0)
+    return FALSE;
+
+  audio_level = &adaptive->audio_levels[0];
+  for (i = 0; i < adaptive->n_video_levels; i++) {
+    GssAdaptiveLevel *level = &adaptive->video_levels[i];
+
+    if (level->n_fragments != audio_level->n_fragments)
+      goto misaligned;
+    for (j = 0; j < level->n_fragments; j++) {
+      guint64 video_ts, audio_ts;
+
+      video_ts = gss_isom_track_get_fragment (level->track, j)->timestamp;
+      audio_ts = gss_isom_track_get_fragment (audio_level->track,
+          j)->timestamp;
+      if (MAX (video_ts, audio_ts) - MIN (video_ts, audio_ts) >
+          GSS_ADAPTIVE_TS_ALIGNMENT)
+        goto misaligned;
+    }
+  }
+
+  return TRUE;
+
+misaligned:
+  GST_WARNING ("%s: audio fragments not aligned with video, serving "
+      "audio as a separate rendition", adaptive->content_id);
+  return FALSE;
+}
+
 GssAdaptive *
 gss_adaptive_load (GssServer * server, const char *key, const char *dir,
     const char *version, GssDrmType drm_type, GssAdaptiveStream stream_type)
@@ -1017,6 +2269,13 @@ gss_adaptive_load (GssServer * server, const char *key, const char *dir,
   g_return_val_if_fail (key != NULL, NULL);
   g_return_val_if_fail (dir != NULL, NULL);
 
+  if (!gss_adaptive_stream_supports_drm (stream_type, drm_type)) {
+    GST_WARNING ("%s: %s streams can't use %s", key,
+        gss_adaptive_stream_get_name (stream_type),
+        gss_drm_get_drm_name (drm_type));
+    return NULL;
+  }
+
   GST_DEBUG ("looking for %s", key);
 
   parser = json_parser_new ();
@@ -1045,6 +2304,25 @@ gss_adaptive_load (GssServer * server, const char *key, const char *dir,
 
   gss_playready_generate_key (server->playready, adaptive->content_key,
       adaptive->kid, adaptive->kid_len);
+  if (drm_type != GSS_DRM_CLEAR) {
+    char *key_hash;
+
+    adaptive->cipher = gss_playready_cipher_new (adaptive->content_key);
+    gss_playready_cipher_set_parallel_threshold (adaptive->cipher,
+        (gsize) server->playready->parallel_encrypt_size * 1024);
+
+    /* cached fragments depend on the content key, but the key itself
+     * shouldn't show up in cache keys */
+    key_hash = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+        adaptive->content_key, GSS_ADAPTIVE_KEY_LENGTH);
+    adaptive->cache_prefix = g_strdup_printf ("%s/%d/%d/%.8s/", key,
+        stream_type, drm_type, key_hash);
+    g_free (key_hash);
+  } else if (stream_type == GSS_ADAPTIVE_STREAM_HLS_TS) {
+    /* muxed segments are cached, too */
+    adaptive->cache_prefix = g_strdup_printf ("%s/%d/%d/", key,
+        stream_type, drm_type);
+  }
 
   ret = parse_json (adaptive, parser, dir, version);
   if (!ret) {
@@ -1056,7 +2334,17 @@ gss_adaptive_load (GssServer * server, const char *key, const char *dir,
 
   g_object_unref (parser);
 
-  GST_DEBUG ("loading done");
+  if (stream_type == GSS_ADAPTIVE_STREAM_HLS_TS) {
+    adaptive->ts_audio_muxed = gss_adaptive_check_ts_alignment (adaptive);
+  }
+  adaptive->manifest = gss_adaptive_render_manifest (adaptive);
+  if (stream_type == GSS_ADAPTIVE_STREAM_HLS_FMP4 ||
+      stream_type == GSS_ADAPTIVE_STREAM_HLS_TS) {
+    gss_adaptive_render_hls_media_playlists (adaptive);
+  }
+  adaptive->memory_size = gss_adaptive_compute_memory_size (adaptive);
+
+  GST_DEBUG ("loading done, %" G_GSIZE_FORMAT " bytes", adaptive->memory_size);
 
   return adaptive;
 }
@@ -1136,6 +2424,7 @@ gss_adaptive_convert_ism (GssAdaptive * adaptive, GssIsomMovie * movie,
     offset += fragment->mdat_size;
   }
   track->dash_size = offset;
+  gss_isom_track_build_fragment_index (track);
 
   gss_isom_movie_serialize_track_ccff (movie, track,
       &track->ccff_header_data, &track->ccff_header_size);
@@ -1177,6 +2466,7 @@ gss_adaptive_convert_isoff_ondemand (GssAdaptive * adaptive,
     offset += fragment->mdat_size;
   }
   track->dash_size = offset;
+  gss_isom_track_build_fragment_index (track);
 
   gss_isom_movie_serialize_track_dash (movie, track,
       &track->dash_header_data, &track->dash_header_size,
@@ -1226,7 +2516,8 @@ gss_level_from_track (GssAdaptive * adaptive, GssIsomTrack * track,
           fragment);
       /* Hack to prevent serialization of sample encryption UUID and
        * enable saiz/saio serialization */
-      if (adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND) {
+      if (adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND ||
+          adaptive->stream_type == GSS_ADAPTIVE_STREAM_HLS_FMP4) {
         fragment->sample_encryption.present = FALSE;
         fragment->saiz.present = TRUE;
         fragment->saio.present = TRUE;
@@ -1249,7 +2540,9 @@ gss_level_from_track (GssAdaptive * adaptive, GssIsomTrack * track,
   if (adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND) {
     gss_adaptive_convert_isoff_ondemand (adaptive, movie, track,
         adaptive->drm_type);
-  } else if (adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISM) {
+  } else if (adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISM ||
+      adaptive->stream_type == GSS_ADAPTIVE_STREAM_HLS_FMP4) {
+    /* HLS uses the same fragments and CCFF header as Smooth Streaming */
     gss_adaptive_convert_ism (adaptive, movie, track, adaptive->drm_type);
   }
 
@@ -1283,19 +2576,27 @@ load_file (GssAdaptive * adaptive, const char *filename)
   GssIsomParser *file;
   GssIsomTrack *video_track;
   GssIsomTrack *audio_track;
+  gboolean is_dash;
 
   g_return_if_fail (adaptive != 0);
   g_return_if_fail (filename != 0);
 
+  /* fragments need a tfdt for DASH and for HLS with fragmented MP4 */
+  is_dash = (adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND ||
+      adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISOFF_LIVE ||
+      adaptive->stream_type == GSS_ADAPTIVE_STREAM_HLS_FMP4);
+
   file = gss_isom_parser_new ();
+  if (!gss_isom_parser_load_index (file, filename, is_dash)) {
+    gss_isom_parser_free (file);
+    file = gss_isom_parser_new ();
+    gss_isom_parser_parse_file (file, filename);
+  }
   adaptive->parsers[adaptive->n_parsers] = file;
   adaptive->n_parsers++;
-  gss_isom_parser_parse_file (file, filename);
 
   if (file->movie->tracks[0]->n_fragments == 0) {
-    gss_isom_parser_fragmentize (file,
-        adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND ||
-        adaptive->stream_type == GSS_ADAPTIVE_STREAM_ISOFF_LIVE);
+    gss_isom_parser_fragmentize (file, is_dash);
   }
 #if 0
   if (adaptive->drm_type == GSS_DRM_PLAYREADY &&
@@ -1353,6 +2654,203 @@ load_file (GssAdaptive * adaptive, const char *filename)
 
 }
 
+/* Serves the media playlist for paths like "v0.m3u8" */
+static void
+gss_adaptive_resource_get_playlist (GssTransaction * t,
+    GssAdaptive * adaptive, const char *path)
+{
+  GssAdaptiveLevel *level = NULL;
+  char *end;
+  int index;
+
+  index = strtoul (path + 1, &end, 10);
+  if (end == path + 1 || strcmp (end, ".m3u8") != 0) {
+    gss_transaction_error_not_found (t, "invalid path for stream type");
+    return;
+  }
+
+  if (path[0] == 'a') {
+    if (index >= 0 && index < adaptive->n_audio_levels)
+      level = &adaptive->audio_levels[index];
+  } else {
+    if (index >= 0 && index < adaptive->n_video_levels)
+      level = &adaptive->video_levels[index];
+  }
+  if (level == NULL || level->playlist == NULL) {
+    gss_transaction_error_not_found (t, "level not found");
+    return;
+  }
+
+  gss_adaptive_resource_get_manifest (t, adaptive, level->playlist);
+}
+
+/* MPEG-TS segments are muxed on a worker thread from the mdats of the
+ * fragments, and kept in the server's fragment cache, since muxing
+ * touches every byte of the segment. */
+static gboolean
+gss_adaptive_read_ts_input (GssTransaction * t, GssAdaptive * adaptive,
+    GssAdaptiveLevel * level, GssIsomFragment * fragment,
+    GssTsMuxInput * input, guint8 ** mdat_data)
+{
+  *mdat_data = g_malloc (fragment->mdat_size);
+  if (!gss_adaptive_read_mdat (t, adaptive, level, fragment, *mdat_data)) {
+    g_free (*mdat_data);
+    *mdat_data = NULL;
+    return FALSE;
+  }
+
+  input->track = level->track;
+  input->fragment = fragment;
+  /* skip the mdat header */
+  input->data = *mdat_data + 8;
+
+  return TRUE;
+}
+
+static void
+gss_adaptive_ts_segment_async (GssTransaction * t, gpointer priv)
+{
+  GssAdaptiveQuery *query = priv;
+  GssAdaptive *adaptive = query->adaptive;
+  GssFragmentCache *cache = adaptive->server->fragment_cache;
+  GssTsMuxInput video;
+  GssTsMuxInput audio;
+  GssTsMuxInput *video_input = NULL;
+  GssTsMuxInput *audio_input = NULL;
+  guint8 *video_data = NULL;
+  guint8 *audio_data = NULL;
+  gboolean is_video;
+  guint8 *data;
+  gsize size;
+  char *key;
+
+  /* Levels of a muxed file share the filename, and a video segment with
+   * the audio muxed in differs from one without it. */
+  key = g_strdup_printf ("%sts/%s/%d/%d%s", adaptive->cache_prefix,
+      query->level->filename, query->level->track_id,
+      query->fragment->index, query->audio_fragment ? "+audio" : "");
+  query->buffer = gss_fragment_cache_lookup (cache, key);
+  if (query->buffer) {
+    g_free (key);
+    return;
+  }
+
+  is_video = (query->level->track->hdlr.handler_type ==
+      GST_MAKE_FOURCC ('v', 'i', 'd', 'e'));
+  if (is_video) {
+    if (!gss_adaptive_read_ts_input (t, adaptive, query->level,
+            query->fragment, &video, &video_data))
+      goto out;
+    video_input = &video;
+  }
+  if (!is_video || query->audio_fragment) {
+    if (!gss_adaptive_read_ts_input (t, adaptive,
+            is_video ? query->audio_level : query->level,
+            is_video ? query->audio_fragment : query->fragment,
+            &audio, &audio_data))
+      goto out;
+    audio_input = &audio;
+  }
+
+  size = gss_tsmux_write_segment (video_input, audio_input, NULL);
+  if (size == 0) {
+    GST_WARNING ("failed to mux segment %d of %s", query->fragment->index,
+        query->level->filename);
+    gss_transaction_error_not_found (t, "failed to mux segment");
+    goto out;
+  }
+  data = g_malloc (size);
+  gss_tsmux_write_segment (video_input, audio_input, data);
+
+  query->buffer = soup_buffer_new (SOUP_MEMORY_TAKE, data, size);
+  gss_fragment_cache_insert (cache, key, query->buffer);
+
+  gss_adaptive_advise_fragment (adaptive, query->level, query->fragment,
+      query->cold);
+  if (audio_input && is_video) {
+    gss_adaptive_advise_fragment (adaptive, query->audio_level,
+        query->audio_fragment, query->cold);
+  }
+
+out:
+  g_free (video_data);
+  g_free (audio_data);
+  g_free (key);
+}
+
+static void
+gss_adaptive_ts_segment_async_finish (GssTransaction * t, gpointer priv)
+{
+  GssAdaptiveQuery *query = priv;
+
+  if (!t->finished) {
+    if (query->buffer) {
+      soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+          "video/MP2T");
+      soup_message_body_append_buffer (t->msg->response_body, query->buffer);
+      soup_message_set_status (t->msg, SOUP_STATUS_OK);
+    }
+    soup_server_unpause_message (t->soupserver, t->msg);
+  }
+  if (query->buffer)
+    soup_buffer_free (query->buffer);
+  gss_adaptive_query_free (query);
+}
+
+/* Serves MPEG-TS segments for paths like "v0/12.ts".  Segments of video
+ * levels carry the fragment of the first audio level with the same
+ * index, if the levels were fragmented alike (ts_audio_muxed). */
+static void
+gss_adaptive_resource_get_ts_segment (GssTransaction * t,
+    GssAdaptive * adaptive, const char *path)
+{
+  GssAdaptiveLevel *level = NULL;
+  GssAdaptiveQuery *query;
+  const char *s;
+  char *end;
+  int index;
+
+  index = strtoul (path + 1, &end, 10);
+  if (end == path + 1 || end[0] != '/') {
+    gss_transaction_error_not_found (t, "invalid path for stream type");
+    return;
+  }
+  if (path[0] == 'a') {
+    if (index >= 0 && index < adaptive->n_audio_levels)
+      level = &adaptive->audio_levels[index];
+  } else {
+    if (index >= 0 && index < adaptive->n_video_levels)
+      level = &adaptive->video_levels[index];
+  }
+
+  s = end + 1;
+  index = strtoul (s, &end, 10);
+  if (end == s || strcmp (end, ".ts") != 0) {
+    gss_transaction_error_not_found (t, "invalid path for stream type");
+    return;
+  }
+  if (level == NULL || index < 0 || index >= level->n_fragments) {
+    gss_transaction_error_not_found (t, "segment not found");
+    return;
+  }
+
+  soup_server_pause_message (t->soupserver, t->msg);
+
+  query = g_malloc0 (sizeof (GssAdaptiveQuery));
+  query->adaptive = gss_adaptive_ref (adaptive);
+  query->level = level;
+  query->fragment = gss_isom_track_get_fragment (level->track, index);
+  query->cold = gss_adaptive_count_request (adaptive);
+  if (path[0] == 'v' && adaptive->ts_audio_muxed) {
+    query->audio_level = &adaptive->audio_levels[0];
+    query->audio_fragment =
+        gss_isom_track_get_fragment (query->audio_level->track, index);
+  }
+
+  gss_transaction_process_async (t, gss_adaptive_ts_segment_async,
+      gss_adaptive_ts_segment_async_finish, query);
+}
+
 void
 gss_adaptive_get_resource (GssTransaction * t, GssAdaptive * adaptive,
     const char *path)
@@ -1376,7 +2874,7 @@ gss_adaptive_get_resource (GssTransaction * t, GssAdaptive * adaptive,
   switch (adaptive->stream_type) {
     case GSS_ADAPTIVE_STREAM_ISM:
       if (strcmp (path, "Manifest") == 0) {
-        gss_adaptive_resource_get_manifest (t, adaptive);
+        gss_adaptive_resource_get_manifest (t, adaptive, adaptive->manifest);
       } else if (strcmp (path, "content") == 0) {
         gss_adaptive_resource_get_content (t, adaptive);
       } else {
@@ -1385,7 +2883,7 @@ gss_adaptive_get_resource (GssTransaction * t, GssAdaptive * adaptive,
       break;
     case GSS_ADAPTIVE_STREAM_ISOFF_LIVE:
       if (strcmp (path, "manifest.mpd") == 0) {
-        gss_adaptive_resource_get_dash_live_mpd (t, adaptive);
+        gss_adaptive_resource_get_manifest (t, adaptive, adaptive->manifest);
       } else if (strcmp (path, "content") == 0) {
         gss_adaptive_resource_get_content (t, adaptive);
       } else {
@@ -1394,13 +2892,36 @@ gss_adaptive_get_resource (GssTransaction * t, GssAdaptive * adaptive,
       break;
     case GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND:
       if (strcmp (path, "manifest.mpd") == 0) {
-        gss_adaptive_resource_get_dash_range_mpd (t, adaptive);
+        gss_adaptive_resource_get_manifest (t, adaptive, adaptive->manifest);
       } else if (strncmp (path, "content/", 8) == 0) {
         gss_adaptive_resource_get_dash_range_fragment (t, adaptive, path);
       } else {
         failed = TRUE;
       }
       break;
+    case GSS_ADAPTIVE_STREAM_HLS_FMP4:
+      if (strcmp (path, "master.m3u8") == 0) {
+        gss_adaptive_resource_get_manifest (t, adaptive, adaptive->manifest);
+      } else if (strcmp (path, "content") == 0) {
+        gss_adaptive_resource_get_content (t, adaptive);
+      } else if (path[0] == 'a' || path[0] == 'v') {
+        gss_adaptive_resource_get_playlist (t, adaptive, path);
+      } else {
+        failed = TRUE;
+      }
+      break;
+    case GSS_ADAPTIVE_STREAM_HLS_TS:
+      if (strcmp (path, "master.m3u8") == 0) {
+        gss_adaptive_resource_get_manifest (t, adaptive, adaptive->manifest);
+      } else if ((path[0] == 'a' || path[0] == 'v') &&
+          g_str_has_suffix (path, ".ts")) {
+        gss_adaptive_resource_get_ts_segment (t, adaptive, path);
+      } else if (path[0] == 'a' || path[0] == 'v') {
+        gss_adaptive_resource_get_playlist (t, adaptive, path);
+      } else {
+        failed = TRUE;
+      }
+      break;
     default:
       failed = TRUE;
   }
@@ -1421,6 +2942,10 @@ gss_adaptive_get_stream_type (const char *s)
     return GSS_ADAPTIVE_STREAM_ISOFF_LIVE;
   if (strcmp (s, "isoff-ondemand") == 0)
     return GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND;
+  if (strcmp (s, "hls-fmp4") == 0)
+    return GSS_ADAPTIVE_STREAM_HLS_FMP4;
+  if (strcmp (s, "hls-ts") == 0)
+    return GSS_ADAPTIVE_STREAM_HLS_TS;
   return GSS_ADAPTIVE_STREAM_UNKNOWN;
 }
 
@@ -1434,7 +2959,22 @@ gss_adaptive_stream_get_name (GssAdaptiveStream stream_type)
       return "isoff-live";
     case GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND:
       return "isoff-ondemand";
+    case GSS_ADAPTIVE_STREAM_HLS_FMP4:
+      return "hls-fmp4";
+    case GSS_ADAPTIVE_STREAM_HLS_TS:
+      return "hls-ts";
     default:
       return "unknown";
   }
 }
+
+/* MPEG-TS segments are muxed in the clear, there is no SAMPLE-AES
+ * packaging. */
+gboolean
+gss_adaptive_stream_supports_drm (GssAdaptiveStream stream_type,
+    GssDrmType drm_type)
+{
+  if (stream_type == GSS_ADAPTIVE_STREAM_HLS_TS)
+    return (drm_type == GSS_DRM_CLEAR);
+  return TRUE;
+}
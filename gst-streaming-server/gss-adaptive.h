@@ -32,12 +32,16 @@ G_BEGIN_DECLS
 typedef struct _GssAdaptive GssAdaptive;
 typedef struct _GssAdaptiveLevel GssAdaptiveLevel;
 typedef struct _GssAdaptiveQuery GssAdaptiveQuery;
+typedef struct _GssAdaptiveRangeWriter GssAdaptiveRangeWriter;
+typedef struct _GssAdaptiveManifest GssAdaptiveManifest;
 
 typedef enum {
   GSS_ADAPTIVE_STREAM_UNKNOWN,
   GSS_ADAPTIVE_STREAM_ISM,
   GSS_ADAPTIVE_STREAM_ISOFF_LIVE,
-  GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND
+  GSS_ADAPTIVE_STREAM_ISOFF_ONDEMAND,
+  GSS_ADAPTIVE_STREAM_HLS_FMP4,
+  GSS_ADAPTIVE_STREAM_HLS_TS
 } GssAdaptiveStream;
 
 typedef enum {
@@ -76,11 +80,37 @@ struct _GssAdaptive
   guint8 *kid;
   gsize kid_len;
   guint8 content_key[GSS_ADAPTIVE_KEY_LENGTH];
+  GssPlayreadyCipher *cipher;
 
   int n_parsers;
   GssIsomParser *parsers[20];
 
   GssDrmInfo drm_info;
+
+  /* pre-rendered manifest for stream_type */
+  GssAdaptiveManifest *manifest;
+  /* HLS MPEG-TS: the first audio level is muxed into the video
+   * segments, because its fragments line up with the video fragments */
+  gboolean ts_audio_muxed;
+
+  /* page cache hints, set by the owning GssVod.  After a fragment is
+   * served, the next readahead_fragments fragments of its level are
+   * read ahead.  If the stream had fewer than cold_request_rate fragment
+   * requests per minute, the pages of the fragment are dropped. */
+  int readahead_fragments;
+  int cold_request_rate;
+
+  /*< private >*/
+  int refcount;
+  gsize memory_size;
+  /* prefix of this stream's keys in the server's fragment cache */
+  char *cache_prefix;
+  /* fragment requests in the current and the previous minute; streams
+   * loaded less than a minute ago are never cold */
+  gint64 load_time;
+  gint64 request_window_start;
+  int n_requests;
+  int n_requests_previous;
 };
 
 struct _GssAdaptiveLevel
@@ -101,6 +131,12 @@ struct _GssAdaptiveLevel
   char *codec;
 
   guint64 iv;
+
+  /* fragments before this index have been read ahead already */
+  int readahead_end;
+
+  /* pre-rendered HLS media playlist */
+  GssAdaptiveManifest *playlist;
 };
 
 struct _GssAdaptiveQuery
@@ -111,10 +147,22 @@ struct _GssAdaptiveQuery
 
   guint8 *data;
   gsize size;
+  SoupBuffer *buffer;
+  gboolean cold;
+
+  /* DASH byte range requests */
+  GssAdaptiveRangeWriter *writer;
+
+  /* HLS MPEG-TS segments, muxed with the video fragment */
+  GssAdaptiveLevel *audio_level;
+  GssIsomFragment *audio_fragment;
 };
 
 GssAdaptive *gss_adaptive_new (void);
 void gss_adaptive_free (GssAdaptive * adaptive);
+GssAdaptive *gss_adaptive_ref (GssAdaptive * adaptive);
+void gss_adaptive_unref (GssAdaptive * adaptive);
+gsize gss_adaptive_get_memory_size (GssAdaptive * adaptive);
 GssAdaptiveLevel *gss_adaptive_get_level (GssAdaptive * adaptive, gboolean video, guint64 bitrate);
 
 GssAdaptiveStream gss_adaptive_get_stream_type (const char *s);
@@ -125,6 +173,8 @@ void gss_adaptive_get_resource (GssTransaction * t, GssAdaptive *adaptive,
     const char *subpath);
 
 const char *gss_adaptive_stream_get_name (GssAdaptiveStream stream_type);
+gboolean gss_adaptive_stream_supports_drm (GssAdaptiveStream stream_type,
+    GssDrmType drm_type);
 
 G_END_DECLS
 
@@ -0,0 +1,786 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+#include "gss-cmaf.h"
+#include "gss-html.h"
+#include "gss-log.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/* Live programs in MPEG-TS are demuxed again and packaged as chunked
+ * CMAF, served as LL-HLS and low-latency DASH:
+ *
+ *   /cmaf/<program>/master.m3u8
+ *   /cmaf/<program>/manifest.mpd
+ *   /cmaf/<program>/<stream>/v.m3u8, a.m3u8
+ *   /cmaf/<program>/<stream>/v/init.mp4
+ *   /cmaf/<program>/<stream>/v/<segment>.m4s
+ *   /cmaf/<program>/<stream>/v/<segment>.<part>.m4s
+ *
+ * Segments in progress are sent with chunked encoding as their chunks
+ * are written.  Requests for parts that are not available yet, and
+ * blocking playlist reloads, wait for the part. */
+
+#define GSS_CMAF_PIPELINE \
+  "appsrc name=src is-live=true " \
+  "caps=video/mpegts,systemstream=(boolean)true,packetsize=(int)188 ! " \
+  "tsdemux name=demux " \
+  "demux. ! h264parse ! video/x-h264,stream-format=avc,alignment=au ! " \
+  "queue ! appsink name=video emit-signals=true sync=false " \
+  "demux. ! aacparse ! audio/mpeg,stream-format=raw ! " \
+  "queue ! appsink name=audio emit-signals=true sync=false"
+
+typedef enum
+{
+  GSS_CMAF_WAIT_PLAYLIST,
+  GSS_CMAF_WAIT_PART,
+  GSS_CMAF_WAIT_SEGMENT
+} GssCmafWaitType;
+
+typedef struct _GssCmafWaiter GssCmafWaiter;
+struct _GssCmafWaiter
+{
+  GssTransaction *t;
+  GssStream *stream;
+  GssCmafTrack *track;
+  GssCmafWaitType type;
+  int index;
+  int part;
+  /* next chunk of the segment to be sent */
+  guint n_chunks_sent;
+  gulong finished_id;
+};
+
+typedef struct _GssCmafSample GssCmafSample;
+struct _GssCmafSample
+{
+  GssStream *stream;
+  GstSample *sample;
+  gboolean is_video;
+};
+
+#if GST_CHECK_VERSION(1,0,0)
+
+static GstPadProbeReturn
+gss_cmaf_sink_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GssStream *stream = GSS_STREAM (user_data);
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstFlowReturn flow_ret;
+
+    g_signal_emit_by_name (stream->cmaf.src, "push-buffer",
+        GST_BUFFER (info->data), &flow_ret);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GssCmafTrack *
+gss_cmaf_create_track (GssStream * stream, GstCaps * caps, gboolean is_video)
+{
+  GstStructure *structure = gst_caps_get_structure (caps, 0);
+  GssServer *server = GSS_OBJECT_SERVER (stream->program);
+  const GValue *value;
+  GssCmafTrack *track;
+  GstMapInfo map;
+  int width = 0, height = 0;
+  int rate = 0, channels = 0;
+
+  value = gst_structure_get_value (structure, "codec_data");
+  if (value == NULL || !GST_VALUE_HOLDS_BUFFER (value)) {
+    GST_WARNING ("no codec_data in %" GST_PTR_FORMAT, caps);
+    return NULL;
+  }
+  if (!gst_buffer_map (gst_value_get_buffer (value), &map, GST_MAP_READ)) {
+    GST_ERROR ("failed map");
+    return NULL;
+  }
+
+  if (is_video) {
+    gst_structure_get_int (structure, "width", &width);
+    gst_structure_get_int (structure, "height", &height);
+    track = gss_cmaf_track_new_video (map.data, map.size, width, height);
+  } else {
+    gst_structure_get_int (structure, "rate", &rate);
+    gst_structure_get_int (structure, "channels", &channels);
+    track = gss_cmaf_track_new_audio (map.data, map.size, rate, channels);
+  }
+  gst_buffer_unmap (gst_value_get_buffer (value), &map);
+
+  if (track) {
+    gss_cmaf_track_set_durations (track,
+        (guint64) server->cmaf_segment_duration * (GSS_CMAF_TIMESCALE / 1000),
+        (guint64) server->cmaf_chunk_duration * (GSS_CMAF_TIMESCALE / 1000));
+  }
+
+  return track;
+}
+
+static void gss_cmaf_track_notify (GssCmafTrack * track, gpointer priv);
+
+static gboolean
+gss_cmaf_add_sample_callback (gpointer data)
+{
+  GssCmafSample *s = data;
+  GssStream *stream = s->stream;
+  GssCmafTrack **track;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  guint64 dts, pts;
+
+  track = s->is_video ? &stream->cmaf.video : &stream->cmaf.audio;
+  buffer = gst_sample_get_buffer (s->sample);
+
+  /* samples still queued when the stream stops are dropped */
+  if (stream->cmaf.pipeline == NULL || buffer == NULL ||
+      !GST_BUFFER_PTS_IS_VALID (buffer))
+    goto out;
+
+  if (*track == NULL) {
+    *track = gss_cmaf_create_track (stream, gst_sample_get_caps (s->sample),
+        s->is_video);
+    if (*track == NULL)
+      goto out;
+    (*track)->notify = gss_cmaf_track_notify;
+    (*track)->notify_priv = stream;
+  }
+
+  pts = GST_BUFFER_PTS (buffer) / 100;
+  dts = GST_BUFFER_DTS_IS_VALID (buffer) ? GST_BUFFER_DTS (buffer) / 100 : pts;
+
+  if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    gss_cmaf_track_push_sample (*track, map.data, map.size, dts, pts,
+        !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT));
+    gst_buffer_unmap (buffer, &map);
+  } else {
+    GST_ERROR ("failed map");
+  }
+
+out:
+  gst_sample_unref (s->sample);
+  g_object_unref (s->stream);
+  g_free (s);
+
+  return FALSE;
+}
+
+static GstFlowReturn
+gss_cmaf_new_sample (GstElement * appsink, gpointer user_data)
+{
+  GssStream *stream = GSS_STREAM (user_data);
+  GssCmafSample *s;
+  GstSample *sample = NULL;
+
+  g_signal_emit_by_name (appsink, "pull-sample", &sample);
+  if (sample == NULL)
+    return GST_FLOW_OK;
+
+  /* tracks are only touched in the main thread */
+  s = g_malloc0 (sizeof (GssCmafSample));
+  s->stream = g_object_ref (stream);
+  s->sample = sample;
+  s->is_video = (strcmp (GST_OBJECT_NAME (appsink), "video") == 0);
+  g_idle_add (gss_cmaf_add_sample_callback, s);
+
+  return GST_FLOW_OK;
+}
+
+void
+gss_stream_add_cmaf (GssStream * stream)
+{
+  GstElement *pipeline;
+  GstElement *e;
+  GstPad *pad;
+  GError *error = NULL;
+
+  pipeline = gst_parse_launch (GSS_CMAF_PIPELINE, &error);
+  if (error) {
+    GST_ERROR ("pipeline parse error: %s", error->message);
+    g_error_free (error);
+    if (pipeline)
+      g_object_unref (pipeline);
+    return;
+  }
+
+  stream->cmaf.pipeline = pipeline;
+  stream->cmaf.src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+
+  e = gst_bin_get_by_name (GST_BIN (pipeline), "video");
+  g_signal_connect (e, "new-sample", G_CALLBACK (gss_cmaf_new_sample), stream);
+  g_object_unref (e);
+  e = gst_bin_get_by_name (GST_BIN (pipeline), "audio");
+  g_signal_connect (e, "new-sample", G_CALLBACK (gss_cmaf_new_sample), stream);
+  g_object_unref (e);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  pad = gst_element_get_static_pad (stream->sink, "sink");
+  stream->cmaf.probe_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      gss_cmaf_sink_probe, stream, NULL);
+  gst_object_unref (pad);
+}
+
+/* Called when the sink of the stream is removed.  The tracks are
+ * finished, which answers the waiting requests, and kept until the
+ * stream is freed. */
+void
+gss_stream_remove_cmaf (GssStream * stream)
+{
+  GstPad *pad;
+
+  if (stream->cmaf.pipeline == NULL)
+    return;
+
+  pad = gst_element_get_static_pad (stream->sink, "sink");
+  gst_pad_remove_probe (pad, stream->cmaf.probe_id);
+  gst_object_unref (pad);
+  stream->cmaf.probe_id = 0;
+
+  gst_element_set_state (stream->cmaf.pipeline, GST_STATE_NULL);
+  gst_object_unref (stream->cmaf.src);
+  stream->cmaf.src = NULL;
+  gst_object_unref (stream->cmaf.pipeline);
+  stream->cmaf.pipeline = NULL;
+
+  if (stream->cmaf.video)
+    gss_cmaf_track_finish (stream->cmaf.video);
+  if (stream->cmaf.audio)
+    gss_cmaf_track_finish (stream->cmaf.audio);
+}
+
+#else
+
+void
+gss_stream_add_cmaf (GssStream * stream)
+{
+  GST_WARNING ("CMAF packaging requires GStreamer 1.0");
+}
+
+void
+gss_stream_remove_cmaf (GssStream * stream)
+{
+}
+
+#endif
+
+
+static void
+gss_cmaf_append_segment_chunks (GssCmafWaiter * waiter,
+    GssCmafSegment * segment)
+{
+  SoupMessageBody *body = waiter->t->msg->response_body;
+
+  while (waiter->n_chunks_sent < segment->chunks->len) {
+    soup_message_body_append_buffer (body, g_array_index (segment->chunks,
+            GssCmafChunk, waiter->n_chunks_sent).buffer);
+    waiter->n_chunks_sent++;
+  }
+  if (segment->complete)
+    soup_message_body_complete (body);
+}
+
+static void
+gss_cmaf_respond_playlist (GssTransaction * t, GssCmafTrack * track)
+{
+  GString *s = g_string_new ("");
+
+  gss_cmaf_track_append_hls_playlist (track, s, track->is_video ? "v/" : "a/");
+
+  soup_message_set_status (t->msg, SOUP_STATUS_OK);
+  soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+      "application/vnd.apple.mpegurl");
+  soup_message_headers_replace (t->msg->response_headers,
+      "Cache-Control", "no-store");
+  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_TAKE,
+      s->str, s->len);
+  g_string_free (s, FALSE);
+}
+
+static void
+gss_cmaf_respond_part (GssTransaction * t, GssCmafTrack * track, int index,
+    int part)
+{
+  GssCmafSegment *segment;
+
+  segment = gss_cmaf_track_get_segment (track, index);
+  if (segment == NULL || part >= segment->chunks->len) {
+    gss_transaction_error_not_found (t, "part not available");
+    return;
+  }
+
+  soup_message_set_status (t->msg, SOUP_STATUS_OK);
+  soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+      track->is_video ? "video/mp4" : "audio/mp4");
+  soup_message_body_append_buffer (t->msg->response_body,
+      g_array_index (segment->chunks, GssCmafChunk, part).buffer);
+}
+
+static void
+gss_cmaf_waiter_free (GssCmafWaiter * waiter)
+{
+  GssStream *stream = waiter->stream;
+
+  stream->cmaf.waiters = g_list_remove (stream->cmaf.waiters, waiter);
+  g_signal_handler_disconnect (waiter->t->msg, waiter->finished_id);
+  g_free (waiter);
+}
+
+static void
+gss_cmaf_waiter_finished (SoupMessage * msg, GssCmafWaiter * waiter)
+{
+  GST_DEBUG ("client went away while waiting");
+  gss_cmaf_waiter_free (waiter);
+}
+
+/* Answers the request of @waiter if it can be.  Returns TRUE when the
+ * response is complete. */
+static gboolean
+gss_cmaf_waiter_update (GssCmafWaiter * waiter)
+{
+  GssTransaction *t = waiter->t;
+  GssCmafTrack *track = waiter->track;
+  GssCmafSegment *segment;
+
+  switch (waiter->type) {
+    case GSS_CMAF_WAIT_PLAYLIST:
+      if (!gss_cmaf_track_has_part (track, waiter->index, waiter->part))
+        return FALSE;
+      gss_cmaf_respond_playlist (t, track);
+      break;
+    case GSS_CMAF_WAIT_PART:
+      if (!gss_cmaf_track_has_part (track, waiter->index, waiter->part))
+        return FALSE;
+      gss_cmaf_respond_part (t, track, waiter->index, waiter->part);
+      break;
+    case GSS_CMAF_WAIT_SEGMENT:
+      segment = gss_cmaf_track_get_segment (track, waiter->index);
+      if (segment == NULL) {
+        if (!track->finished)
+          return FALSE;
+        /* the headers were sent already */
+        soup_message_body_complete (t->msg->response_body);
+      } else {
+        gss_cmaf_append_segment_chunks (waiter, segment);
+        soup_server_unpause_message (t->soupserver, t->msg);
+        return segment->complete;
+      }
+      break;
+  }
+
+  soup_server_unpause_message (t->soupserver, t->msg);
+  return TRUE;
+}
+
+static void
+gss_cmaf_track_notify (GssCmafTrack * track, gpointer priv)
+{
+  GssStream *stream = GSS_STREAM (priv);
+  GList *g, *next;
+
+  for (g = stream->cmaf.waiters; g; g = next) {
+    GssCmafWaiter *waiter = g->data;
+
+    next = g_list_next (g);
+    if (waiter->track != track)
+      continue;
+    if (gss_cmaf_waiter_update (waiter))
+      gss_cmaf_waiter_free (waiter);
+  }
+}
+
+/* Answers a request that can no longer be served, when the stream goes
+ * away before its part arrived. */
+static void
+gss_cmaf_waiter_cancel (GssCmafWaiter * waiter)
+{
+  GssTransaction *t = waiter->t;
+
+  if (waiter->type == GSS_CMAF_WAIT_SEGMENT) {
+    /* the headers were sent already */
+    soup_message_body_complete (t->msg->response_body);
+  } else {
+    gss_transaction_error_not_found (t, "stream stopped");
+  }
+  soup_server_unpause_message (t->soupserver, t->msg);
+  gss_cmaf_waiter_free (waiter);
+}
+
+void
+gss_stream_free_cmaf (GssStream * stream)
+{
+  /* finishing the tracks answers most of the remaining waiters */
+  if (stream->cmaf.video)
+    gss_cmaf_track_finish (stream->cmaf.video);
+  if (stream->cmaf.audio)
+    gss_cmaf_track_finish (stream->cmaf.audio);
+
+  while (stream->cmaf.waiters)
+    gss_cmaf_waiter_cancel (stream->cmaf.waiters->data);
+
+  if (stream->cmaf.video) {
+    gss_cmaf_track_free (stream->cmaf.video);
+    stream->cmaf.video = NULL;
+  }
+  if (stream->cmaf.audio) {
+    gss_cmaf_track_free (stream->cmaf.audio);
+    stream->cmaf.audio = NULL;
+  }
+}
+
+static void
+gss_cmaf_wait (GssTransaction * t, GssStream * stream, GssCmafTrack * track,
+    GssCmafWaitType type, int index, int part)
+{
+  GssCmafWaiter *waiter;
+
+  waiter = g_malloc0 (sizeof (GssCmafWaiter));
+  waiter->t = t;
+  waiter->stream = stream;
+  waiter->track = track;
+  waiter->type = type;
+  waiter->index = index;
+  waiter->part = part;
+
+  if (gss_cmaf_waiter_update (waiter)) {
+    g_free (waiter);
+    return;
+  }
+
+  GST_DEBUG ("%s: waiting for %d.%d", t->path, index, part);
+  if (type != GSS_CMAF_WAIT_SEGMENT)
+    soup_server_pause_message (t->soupserver, t->msg);
+  waiter->finished_id = g_signal_connect (t->msg, "finished",
+      G_CALLBACK (gss_cmaf_waiter_finished), waiter);
+  stream->cmaf.waiters = g_list_prepend (stream->cmaf.waiters, waiter);
+}
+
+static void
+gss_cmaf_handle_playlist (GssTransaction * t, GssStream * stream,
+    GssCmafTrack * track)
+{
+  const char *msn = NULL;
+  const char *part = NULL;
+  int index;
+
+  if (t->query) {
+    msn = g_hash_table_lookup (t->query, "_HLS_msn");
+    part = g_hash_table_lookup (t->query, "_HLS_part");
+  }
+  if (msn == NULL) {
+    gss_cmaf_respond_playlist (t, track);
+    return;
+  }
+
+  /* blocking playlist reload */
+  index = atoi (msn);
+  if (index > track->n_segments + 2) {
+    soup_message_set_status (t->msg, SOUP_STATUS_BAD_REQUEST);
+    return;
+  }
+  gss_cmaf_wait (t, stream, track, GSS_CMAF_WAIT_PLAYLIST, index,
+      part ? atoi (part) : -1);
+}
+
+static void
+gss_cmaf_handle_media (GssTransaction * t, GssStream * stream,
+    GssCmafTrack * track, const char *name)
+{
+  int index, part;
+
+  if (strcmp (name, "init.mp4") == 0) {
+    soup_message_set_status (t->msg, SOUP_STATUS_OK);
+    soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+        track->is_video ? "video/mp4" : "audio/mp4");
+    soup_message_body_append_buffer (t->msg->response_body,
+        track->init_segment);
+    return;
+  }
+
+  if (sscanf (name, "%d.%d.m4s", &index, &part) == 2) {
+    if (index < gss_cmaf_track_get_first_segment (track) ||
+        index > track->n_segments || part < 0) {
+      gss_transaction_error_not_found (t, "part not available");
+      return;
+    }
+    gss_cmaf_wait (t, stream, track, GSS_CMAF_WAIT_PART, index, part);
+    return;
+  }
+
+  if (sscanf (name, "%d.m4s", &index) == 1) {
+    if (index < gss_cmaf_track_get_first_segment (track) ||
+        index > track->n_segments ||
+        (index == track->n_segments && track->finished)) {
+      gss_transaction_error_not_found (t, "segment not available");
+      return;
+    }
+    /* the chunks are sent as they are written */
+    soup_message_set_status (t->msg, SOUP_STATUS_OK);
+    soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+        track->is_video ? "video/mp4" : "audio/mp4");
+    soup_message_headers_set_encoding (t->msg->response_headers,
+        SOUP_ENCODING_CHUNKED);
+    soup_message_body_set_accumulate (t->msg->response_body, FALSE);
+    gss_cmaf_wait (t, stream, track, GSS_CMAF_WAIT_SEGMENT, index, -1);
+    return;
+  }
+
+  gss_transaction_error_not_found (t, "unknown CMAF resource");
+}
+
+static void
+gss_cmaf_handle_master (GssTransaction * t, GssProgram * program)
+{
+  GString *s = g_string_new ("");
+  GssStream *audio_stream = NULL;
+  GList *g;
+  int i;
+
+  GSS_A ("#EXTM3U\n");
+  GSS_A ("#EXT-X-VERSION:9\n");
+  GSS_A ("#EXT-X-INDEPENDENT-SEGMENTS\n");
+
+  for (g = program->streams, i = 0; g; g = g_list_next (g), i++) {
+    GssStream *stream = g->data;
+
+    if (stream->cmaf.audio) {
+      audio_stream = stream;
+      GSS_P ("#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"aac\",NAME=\"audio\","
+          "DEFAULT=YES,AUTOSELECT=YES,URI=\"%d/a.m3u8\"\n", i);
+      break;
+    }
+  }
+
+  for (g = program->streams, i = 0; g; g = g_list_next (g), i++) {
+    GssStream *stream = g->data;
+    GssCmafTrack *video = stream->cmaf.video;
+
+    if (video == NULL)
+      continue;
+
+    GSS_P ("#EXT-X-STREAM-INF:BANDWIDTH=%d,CODECS=\"%s%s%s\","
+        "RESOLUTION=%dx%d%s\n", stream->bitrate, video->codec,
+        audio_stream ? "," : "",
+        audio_stream ? audio_stream->cmaf.audio->codec : "",
+        video->width, video->height, audio_stream ? ",AUDIO=\"aac\"" : "");
+    GSS_P ("%d/v.m3u8\n", i);
+  }
+
+  soup_message_set_status (t->msg, SOUP_STATUS_OK);
+  soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+      "application/vnd.apple.mpegurl");
+  soup_message_headers_replace (t->msg->response_headers,
+      "Cache-Control", "no-store");
+  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_TAKE,
+      s->str, s->len);
+  g_string_free (s, FALSE);
+}
+
+static void
+gss_cmaf_append_adaptation_set (GString * s, GssProgram * program,
+    gboolean is_video)
+{
+  GList *g;
+  int i;
+  gboolean started = FALSE;
+
+  for (g = program->streams, i = 0; g; g = g_list_next (g), i++) {
+    GssStream *stream = g->data;
+    GssCmafTrack *track = is_video ? stream->cmaf.video : stream->cmaf.audio;
+    char *prefix;
+
+    if (track == NULL || track->n_segments == 0)
+      continue;
+
+    if (!started) {
+      GSS_P ("<AdaptationSet mimeType=\"%s\" segmentAlignment=\"true\" "
+          "startWithSAP=\"1\">\n", is_video ? "video/mp4" : "audio/mp4");
+      started = TRUE;
+    }
+    GSS_P ("<Representation id=\"%c%d\" bandwidth=\"%d\" codecs=\"%s\"",
+        is_video ? 'v' : 'a', i, stream->bitrate, track->codec);
+    if (is_video) {
+      GSS_P (" width=\"%d\" height=\"%d\"", track->width, track->height);
+    }
+    GSS_A (">\n");
+    prefix = g_strdup_printf ("%d/%c/", i, is_video ? 'v' : 'a');
+    gss_cmaf_track_append_dash_segment_template (track, s, prefix);
+    g_free (prefix);
+    GSS_A ("</Representation>\n");
+    if (!is_video) {
+      /* one audio representation is enough */
+      break;
+    }
+  }
+  if (started) {
+    GSS_A ("</AdaptationSet>\n");
+  }
+}
+
+static char *
+gss_cmaf_format_time (gint64 time)
+{
+  GDateTime *datetime;
+  char *s;
+
+  datetime = g_date_time_new_from_unix_utc (time / G_USEC_PER_SEC);
+  s = g_date_time_format (datetime, "%Y-%m-%dT%H:%M:%SZ");
+  g_date_time_unref (datetime);
+
+  return s;
+}
+
+static void
+gss_cmaf_handle_mpd (GssTransaction * t, GssProgram * program)
+{
+  GString *s = g_string_new ("");
+  GssCmafTrack *reference = NULL;
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+  char *start_time;
+  char *now;
+  GList *g;
+
+  for (g = program->streams; g && reference == NULL; g = g_list_next (g)) {
+    GssStream *stream = g->data;
+
+    if (stream->cmaf.video && stream->cmaf.video->n_segments > 0)
+      reference = stream->cmaf.video;
+  }
+  if (reference == NULL) {
+    gss_transaction_error_not_found (t, "no CMAF segments yet");
+    return;
+  }
+
+  /* the availability start time is when the first sample arrived, less
+   * its decode time, so that media time maps to wall clock time */
+  start_time = gss_cmaf_format_time (reference->start_time -
+      reference->start_timestamp / (GSS_CMAF_TIMESCALE / G_USEC_PER_SEC));
+  now = gss_cmaf_format_time (g_get_real_time ());
+
+  GSS_A ("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+  GSS_P ("<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" "
+      "profiles=\"urn:mpeg:dash:profile:isoff-live:2011\" type=\"%s\" "
+      "availabilityStartTime=\"%s\" publishTime=\"%s\" "
+      "minimumUpdatePeriod=\"PT%sS\" ",
+      reference->finished ? "static" : "dynamic", start_time, now,
+      g_ascii_formatd (buf, sizeof (buf), "%.3f",
+          (double) reference->segment_duration / GSS_CMAF_TIMESCALE));
+  GSS_P ("minBufferTime=\"PT%sS\" ", g_ascii_formatd (buf, sizeof (buf),
+          "%.3f", (double) reference->chunk_duration / GSS_CMAF_TIMESCALE));
+  GSS_P ("suggestedPresentationDelay=\"PT%sS\" ",
+      g_ascii_formatd (buf, sizeof (buf), "%.3f",
+          (double) 3 * reference->chunk_duration / GSS_CMAF_TIMESCALE));
+  GSS_P ("timeShiftBufferDepth=\"PT%sS\">\n",
+      g_ascii_formatd (buf, sizeof (buf), "%.3f",
+          (double) GSS_CMAF_SEGMENTS * reference->segment_duration /
+          GSS_CMAF_TIMESCALE));
+  GSS_A ("<Period id=\"0\" start=\"PT0S\">\n");
+  gss_cmaf_append_adaptation_set (s, program, TRUE);
+  gss_cmaf_append_adaptation_set (s, program, FALSE);
+  GSS_A ("</Period>\n");
+  GSS_P ("<UTCTiming schemeIdUri=\"urn:mpeg:dash:utc:direct:2014\" "
+      "value=\"%s\"/>\n", now);
+  GSS_A ("</MPD>\n");
+
+  g_free (start_time);
+  g_free (now);
+
+  soup_message_set_status (t->msg, SOUP_STATUS_OK);
+  soup_message_headers_replace (t->msg->response_headers, "Content-Type",
+      "application/dash+xml");
+  soup_message_headers_replace (t->msg->response_headers,
+      "Cache-Control", "no-store");
+  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_TAKE,
+      s->str, s->len);
+  g_string_free (s, FALSE);
+}
+
+void
+gss_cmaf_get_resource (GssTransaction * t)
+{
+  GssProgram *program;
+  GssStream *stream;
+  GssCmafTrack *track;
+  char **parts;
+  int n_parts;
+
+  GST_DEBUG ("path: %s", t->path);
+
+  if (!t->server->enable_cmaf) {
+    gss_transaction_error_not_found (t, "CMAF is disabled");
+    return;
+  }
+
+  parts = g_strsplit (t->path + strlen ("/cmaf/"), "/", 0);
+  n_parts = g_strv_length (parts);
+
+  program = (n_parts > 0) ?
+      gss_server_get_program_by_name (t->server, parts[0]) : NULL;
+  if (program == NULL) {
+    gss_transaction_error_not_found (t, "program not found");
+    goto out;
+  }
+
+  if (n_parts == 2 && strcmp (parts[1], "master.m3u8") == 0) {
+    gss_cmaf_handle_master (t, program);
+    goto out;
+  }
+  if (n_parts == 2 && strcmp (parts[1], "manifest.mpd") == 0) {
+    gss_cmaf_handle_mpd (t, program);
+    goto out;
+  }
+
+  stream = (n_parts >= 3) ?
+      gss_program_get_stream (program, atoi (parts[1])) : NULL;
+  if (stream == NULL) {
+    gss_transaction_error_not_found (t, "stream not found");
+    goto out;
+  }
+
+  if (n_parts == 3 && strcmp (parts[2], "v.m3u8") == 0) {
+    track = stream->cmaf.video;
+  } else if (n_parts == 3 && strcmp (parts[2], "a.m3u8") == 0) {
+    track = stream->cmaf.audio;
+  } else if (n_parts == 4 && strcmp (parts[2], "v") == 0) {
+    track = stream->cmaf.video;
+  } else if (n_parts == 4 && strcmp (parts[2], "a") == 0) {
+    track = stream->cmaf.audio;
+  } else {
+    gss_transaction_error_not_found (t, "unknown CMAF resource");
+    goto out;
+  }
+  if (track == NULL) {
+    gss_transaction_error_not_found (t, "track not available");
+    goto out;
+  }
+
+  if (n_parts == 3) {
+    gss_cmaf_handle_playlist (t, stream, track);
+  } else {
+    gss_cmaf_handle_media (t, stream, track, parts[3]);
+  }
+
+out:
+  g_strfreev (parts);
+}
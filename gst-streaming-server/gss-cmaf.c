@@ -0,0 +1,599 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-cmaf.h"
+#include "gss-html.h"
+#include "gss-log.h"
+
+#include <string.h>
+
+/**
+ * SECTION:gss-cmaf
+ * @short_description: Live CMAF packager
+ *
+ * Packages the samples of a live track as CMAF segments that are made
+ * of several short chunks, each one a moof and an mdat.  Chunks can be
+ * sent to clients as soon as they are written, so the latency is on
+ * the order of the chunk duration instead of the segment duration.
+ * Segments start with a sync sample once the segment duration has been
+ * reached.  The last %GSS_CMAF_SEGMENTS segments of a track are kept.
+ *
+ * Chunks are written when a sample arrives that would make the chunk
+ * longer than the chunk duration, because only then the duration of the
+ * last sample is known.
+ * All functions are called from the main thread.
+ */
+
+/* default-base-is-moof */
+#define GSS_CMAF_TF_DEFAULT_BASE_IS_MOOF 0x020000
+
+/* sample_depends_on = 2 */
+#define GSS_CMAF_SAMPLE_FLAGS_SYNC 0x02000000
+/* sample_depends_on = 1, sample_is_non_sync_sample */
+#define GSS_CMAF_SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+/* number of segments at the end of HLS playlists that are listed with
+ * their parts */
+#define GSS_CMAF_HLS_PART_SEGMENTS 3
+
+
+static GssCmafTrack *
+gss_cmaf_track_new (gboolean is_video)
+{
+  GssCmafTrack *track;
+
+  track = g_malloc0 (sizeof (GssCmafTrack));
+  track->is_video = is_video;
+  track->segment_duration = 2 * GSS_CMAF_TIMESCALE;
+  track->chunk_duration = GSS_CMAF_TIMESCALE / 2;
+  track->samples = g_array_new (FALSE, FALSE, sizeof (GssBoxTrunSample));
+  track->data = g_byte_array_new ();
+
+  return track;
+}
+
+/* Creates the header from an otherwise empty ISO track with the sample
+ * description filled in. */
+static void
+gss_cmaf_track_create_init_segment (GssCmafTrack * track,
+    GssIsomTrack * isom_track)
+{
+  GssIsomMovie *movie;
+  guint8 *data;
+  gsize size;
+
+  movie = gss_isom_movie_new ();
+  movie->tracks[0] = isom_track;
+  movie->n_tracks = 1;
+  movie->mvhd.version = 1;
+  movie->mvhd.timescale = GSS_CMAF_TIMESCALE;
+  movie->mvhd.next_track_id = 2;
+
+  isom_track->tkhd.present = TRUE;
+  /* enabled, in movie */
+  isom_track->tkhd.flags = 0x000003;
+  isom_track->tkhd.track_id = 1;
+  isom_track->tkhd.matrix[0] = 0x00010000;
+  isom_track->tkhd.matrix[4] = 0x00010000;
+  isom_track->tkhd.matrix[8] = 0x40000000;
+
+  isom_track->mdhd.version = 1;
+  isom_track->mdhd.timescale = GSS_CMAF_TIMESCALE;
+  memcpy (isom_track->mdhd.language_code, "und", 4);
+
+  isom_track->hdlr.present = TRUE;
+
+  isom_track->stsd.present = TRUE;
+  isom_track->stsd.entry_count = 1;
+
+  isom_track->trex.track_id = 1;
+  isom_track->trex.default_sample_description_index = 1;
+
+  gss_isom_movie_serialize_track_cmaf (movie, isom_track, &data, &size);
+  track->init_segment = soup_buffer_new (SOUP_MEMORY_TAKE, data, size);
+
+  gss_isom_movie_free (movie);
+}
+
+GssCmafTrack *
+gss_cmaf_track_new_video (const guint8 * avcc, gsize avcc_len, int width,
+    int height)
+{
+  GssCmafTrack *track;
+  GssIsomTrack *isom_track;
+
+  g_return_val_if_fail (avcc != NULL, NULL);
+  g_return_val_if_fail (avcc_len >= 7 && avcc[0] == 1, NULL);
+
+  track = gss_cmaf_track_new (TRUE);
+  track->codec = g_strdup_printf ("avc1.%02x%02x%02x", avcc[1], avcc[2],
+      avcc[3]);
+  track->width = width;
+  track->height = height;
+
+  isom_track = gss_isom_track_new ();
+  isom_track->tkhd.width = width << 16;
+  isom_track->tkhd.height = height << 16;
+  isom_track->hdlr.handler_type = GST_MAKE_FOURCC ('v', 'i', 'd', 'e');
+  isom_track->hdlr.name = g_strdup ("VideoHandler");
+  isom_track->vmhd.present = TRUE;
+  isom_track->vmhd.flags = 1;
+  isom_track->stsd.entries = g_malloc0 (sizeof (GssBoxStsdEntry));
+  isom_track->stsd.entries[0].atom = GST_MAKE_FOURCC ('a', 'v', 'c', '1');
+  isom_track->mp4v.data_reference_index = 1;
+  isom_track->mp4v.width = width;
+  isom_track->mp4v.height = height;
+  isom_track->esds.codec_data = g_memdup (avcc, avcc_len);
+  isom_track->esds.codec_data_len = avcc_len;
+
+  gss_cmaf_track_create_init_segment (track, isom_track);
+
+  return track;
+}
+
+GssCmafTrack *
+gss_cmaf_track_new_audio (const guint8 * audio_specific_config,
+    gsize audio_specific_config_len, int rate, int channels)
+{
+  GssCmafTrack *track;
+  GssIsomTrack *isom_track;
+  guint8 *esds;
+  gsize len = audio_specific_config_len;
+
+  g_return_val_if_fail (audio_specific_config != NULL, NULL);
+  /* all descriptors need to fit into one-byte lengths */
+  g_return_val_if_fail (len >= 2 && len < 100, NULL);
+
+  track = gss_cmaf_track_new (FALSE);
+  track->codec = g_strdup_printf ("mp4a.40.%d", audio_specific_config[0] >> 3);
+
+  isom_track = gss_isom_track_new ();
+  isom_track->tkhd.volume = 0x0100;
+  isom_track->hdlr.handler_type = GST_MAKE_FOURCC ('s', 'o', 'u', 'n');
+  isom_track->hdlr.name = g_strdup ("SoundHandler");
+  isom_track->smhd.present = TRUE;
+  isom_track->stsd.entries = g_malloc0 (sizeof (GssBoxStsdEntry));
+  isom_track->stsd.entries[0].atom = GST_MAKE_FOURCC ('m', 'p', '4', 'a');
+  isom_track->mp4a.data_reference_index = 1;
+  isom_track->mp4a.channel_count = channels;
+  isom_track->mp4a.sample_size = 16;
+  isom_track->mp4a.sample_rate = (guint32) rate << 16;
+
+  /* esds contents: ES_Descriptor with a DecoderConfigDescriptor for AAC
+   * and an SLConfigDescriptor */
+  isom_track->esds_store.size = 29 + len;
+  isom_track->esds_store.data = esds = g_malloc0 (29 + len);
+  esds[4] = 0x03;
+  esds[5] = 23 + len;
+  GST_WRITE_UINT16_BE (esds + 6, 1);
+  esds[9] = 0x04;
+  esds[10] = 15 + len;
+  /* MPEG-4 audio, audio stream */
+  esds[11] = 0x40;
+  esds[12] = 0x15;
+  esds[24] = 0x05;
+  esds[25] = len;
+  memcpy (esds + 26, audio_specific_config, len);
+  esds[26 + len] = 0x06;
+  esds[27 + len] = 0x01;
+  esds[28 + len] = 0x02;
+
+  gss_cmaf_track_create_init_segment (track, isom_track);
+
+  return track;
+}
+
+static void
+gss_cmaf_segment_free (GssCmafSegment * segment)
+{
+  guint i;
+
+  for (i = 0; i < segment->chunks->len; i++) {
+    soup_buffer_free (g_array_index (segment->chunks, GssCmafChunk,
+            i).buffer);
+  }
+  g_array_free (segment->chunks, TRUE);
+  g_free (segment);
+}
+
+void
+gss_cmaf_track_free (GssCmafTrack * track)
+{
+  int i;
+
+  g_return_if_fail (track != NULL);
+
+  for (i = 0; i < GSS_CMAF_SEGMENTS; i++) {
+    if (track->segments[i])
+      gss_cmaf_segment_free (track->segments[i]);
+  }
+  soup_buffer_free (track->init_segment);
+  g_array_free (track->samples, TRUE);
+  g_byte_array_free (track->data, TRUE);
+  g_free (track->codec);
+  g_free (track);
+}
+
+void
+gss_cmaf_track_set_durations (GssCmafTrack * track, guint64 segment_duration,
+    guint64 chunk_duration)
+{
+  g_return_if_fail (track != NULL);
+  g_return_if_fail (chunk_duration > 0);
+  g_return_if_fail (segment_duration >= chunk_duration);
+
+  track->segment_duration = segment_duration;
+  track->chunk_duration = chunk_duration;
+}
+
+/* Writes the pending samples as one moof and mdat. */
+static void
+gss_cmaf_track_flush_chunk (GssCmafTrack * track)
+{
+  GssIsomFragment fragment;
+  GssCmafChunk chunk;
+  guint8 *data;
+  gsize moof_size;
+  guint i;
+
+  if (track->samples->len == 0)
+    return;
+
+  memset (&fragment, 0, sizeof (fragment));
+  fragment.mfhd.sequence_number = ++track->sequence_number;
+  fragment.tfhd.track_id = 1;
+  fragment.tfhd.flags = GSS_CMAF_TF_DEFAULT_BASE_IS_MOOF;
+  fragment.tfdt.present = TRUE;
+  fragment.tfdt.version = 1;
+  fragment.tfdt.start_time = track->chunk_timestamp;
+  fragment.trun.version = 1;
+  fragment.trun.flags = TR_DATA_OFFSET | TR_SAMPLE_DURATION | TR_SAMPLE_SIZE;
+  if (track->is_video) {
+    fragment.trun.flags |= TR_SAMPLE_FLAGS |
+        TR_SAMPLE_COMPOSITION_TIME_OFFSETS;
+  } else {
+    fragment.tfhd.flags |= TF_DEFAULT_SAMPLE_FLAGS;
+    fragment.tfhd.default_sample_flags = GSS_CMAF_SAMPLE_FLAGS_SYNC;
+  }
+  fragment.trun.sample_count = track->samples->len;
+  fragment.trun.samples = (GssBoxTrunSample *) track->samples->data;
+  fragment.mdat_size = 8 + track->data->len;
+
+  gss_isom_fragment_serialize (&fragment, &fragment.moof_data, &moof_size,
+      track->is_video);
+
+  chunk.duration = 0;
+  for (i = 0; i < track->samples->len; i++) {
+    chunk.duration += g_array_index (track->samples, GssBoxTrunSample,
+        i).duration;
+  }
+  chunk.independent = !(g_array_index (track->samples, GssBoxTrunSample,
+          0).flags & 0x00010000);
+
+  data = g_malloc (moof_size + track->data->len);
+  memcpy (data, fragment.moof_data, moof_size);
+  memcpy (data + moof_size, track->data->data, track->data->len);
+  chunk.buffer = soup_buffer_new (SOUP_MEMORY_TAKE, data,
+      moof_size + track->data->len);
+  g_free (fragment.moof_data);
+
+  g_array_append_val (track->current->chunks, chunk);
+  track->current->duration += chunk.duration;
+
+  g_array_set_size (track->samples, 0);
+  g_byte_array_set_size (track->data, 0);
+
+  if (track->notify)
+    track->notify (track, track->notify_priv);
+}
+
+static void
+gss_cmaf_track_finish_segment (GssCmafTrack * track)
+{
+  gss_cmaf_track_flush_chunk (track);
+  track->current->complete = TRUE;
+  track->current = NULL;
+
+  if (track->notify)
+    track->notify (track, track->notify_priv);
+}
+
+static void
+gss_cmaf_track_start_segment (GssCmafTrack * track, guint64 timestamp)
+{
+  GssCmafSegment **slot;
+
+  slot = &track->segments[track->n_segments % GSS_CMAF_SEGMENTS];
+  if (*slot)
+    gss_cmaf_segment_free (*slot);
+
+  track->current = g_malloc0 (sizeof (GssCmafSegment));
+  track->current->index = track->n_segments;
+  track->current->timestamp = timestamp;
+  track->current->chunks = g_array_new (FALSE, FALSE, sizeof (GssCmafChunk));
+  *slot = track->current;
+  track->n_segments++;
+}
+
+/**
+ * gss_cmaf_track_push_sample:
+ * @track: a #GssCmafTrack
+ * @data: sample data, with length-prefixed NAL units for H.264
+ * @size: size of @data
+ * @dts: decode time
+ * @pts: presentation time
+ * @sync: whether the sample is a sync sample
+ *
+ * Adds a sample to @track.  Samples before the first sync sample are
+ * dropped.
+ */
+void
+gss_cmaf_track_push_sample (GssCmafTrack * track, const guint8 * data,
+    gsize size, guint64 dts, guint64 pts, gboolean sync)
+{
+  GssBoxTrunSample sample;
+  guint64 duration = 0;
+
+  g_return_if_fail (track != NULL);
+  g_return_if_fail (data != NULL || size == 0);
+
+  if (track->finished)
+    return;
+
+  if (track->samples->len > 0) {
+    GssBoxTrunSample *last = &g_array_index (track->samples,
+        GssBoxTrunSample, track->samples->len - 1);
+
+    duration = (dts > track->last_timestamp) ?
+        dts - track->last_timestamp : 0;
+    last->duration = duration;
+  }
+
+  if (track->current == NULL) {
+    if (!sync)
+      return;
+    if (track->n_segments == 0) {
+      track->start_time = g_get_real_time ();
+      track->start_timestamp = dts;
+    }
+    gss_cmaf_track_start_segment (track, dts);
+  } else if (sync &&
+      dts >= track->current->timestamp + track->segment_duration) {
+    gss_cmaf_track_finish_segment (track);
+    gss_cmaf_track_start_segment (track, dts);
+  } else if (track->samples->len > 0 &&
+      dts + duration > track->chunk_timestamp + track->chunk_duration) {
+    /* assuming this sample is as long as the last one, it would not fit
+     * into the chunk; parts must not exceed the part target duration */
+    gss_cmaf_track_flush_chunk (track);
+  }
+
+  if (track->samples->len == 0)
+    track->chunk_timestamp = dts;
+
+  sample.duration = 0;
+  sample.size = size;
+  sample.flags = sync ? GSS_CMAF_SAMPLE_FLAGS_SYNC :
+      GSS_CMAF_SAMPLE_FLAGS_NON_SYNC;
+  sample.composition_time_offset = (gint32) (pts - dts);
+  g_array_append_val (track->samples, sample);
+  g_byte_array_append (track->data, data, size);
+  track->last_timestamp = dts;
+}
+
+/**
+ * gss_cmaf_track_finish:
+ * @track: a #GssCmafTrack
+ *
+ * Writes the pending samples and completes the current segment, at the
+ * end of the stream.  The last sample gets the duration of the one
+ * before it.
+ */
+void
+gss_cmaf_track_finish (GssCmafTrack * track)
+{
+  g_return_if_fail (track != NULL);
+
+  if (track->finished)
+    return;
+  track->finished = TRUE;
+
+  if (track->current == NULL) {
+    /* waiters still have to learn that nothing more is coming */
+    if (track->notify)
+      track->notify (track, track->notify_priv);
+    return;
+  }
+
+  if (track->samples->len > 1) {
+    GssBoxTrunSample *samples = (GssBoxTrunSample *) track->samples->data;
+    int n = track->samples->len;
+
+    samples[n - 1].duration = samples[n - 2].duration;
+  }
+  gss_cmaf_track_finish_segment (track);
+}
+
+GssCmafSegment *
+gss_cmaf_track_get_segment (GssCmafTrack * track, int index)
+{
+  g_return_val_if_fail (track != NULL, NULL);
+
+  if (index < gss_cmaf_track_get_first_segment (track) ||
+      index >= track->n_segments)
+    return NULL;
+
+  return track->segments[index % GSS_CMAF_SEGMENTS];
+}
+
+int
+gss_cmaf_track_get_first_segment (GssCmafTrack * track)
+{
+  return MAX (0, track->n_segments - GSS_CMAF_SEGMENTS);
+}
+
+/**
+ * gss_cmaf_track_has_part:
+ * @track: a #GssCmafTrack
+ * @index: segment index
+ * @part: chunk index in the segment, or -1 for the complete segment
+ *
+ * Returns: TRUE if the part is available or will never become
+ * available, i.e., if a request blocking on it can be answered.
+ */
+gboolean
+gss_cmaf_track_has_part (GssCmafTrack * track, int index, int part)
+{
+  GssCmafSegment *segment;
+
+  g_return_val_if_fail (track != NULL, TRUE);
+
+  if (track->finished || index < gss_cmaf_track_get_first_segment (track))
+    return TRUE;
+
+  segment = gss_cmaf_track_get_segment (track, index);
+  if (segment == NULL)
+    return FALSE;
+
+  return segment->complete || (part >= 0 && part < segment->chunks->len);
+}
+
+static const char *
+gss_cmaf_format_seconds (char *buf, guint64 duration)
+{
+  return g_ascii_formatd (buf, G_ASCII_DTOSTR_BUF_SIZE, "%.3f",
+      (double) duration / GSS_CMAF_TIMESCALE);
+}
+
+/**
+ * gss_cmaf_track_append_hls_playlist:
+ * @track: a #GssCmafTrack
+ * @s: string to append to
+ * @prefix: prefix of the URIs of the init segment, segments and parts
+ *
+ * Appends an LL-HLS media playlist.  The parts of the last few segments
+ * are listed, followed by a preload hint for the next part.  Clients may
+ * block on the playlist until a part is available, see
+ * gss_cmaf_track_has_part().
+ */
+void
+gss_cmaf_track_append_hls_playlist (GssCmafTrack * track, GString * s,
+    const char *prefix)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+  guint64 max_duration;
+  int first;
+  int i;
+  guint j;
+
+  g_return_if_fail (track != NULL);
+  g_return_if_fail (s != NULL);
+
+  first = gss_cmaf_track_get_first_segment (track);
+  max_duration = track->segment_duration;
+  for (i = first; i < track->n_segments; i++) {
+    max_duration = MAX (max_duration,
+        gss_cmaf_track_get_segment (track, i)->duration);
+  }
+
+  GSS_A ("#EXTM3U\n");
+  GSS_A ("#EXT-X-VERSION:9\n");
+  GSS_P ("#EXT-X-TARGETDURATION:%d\n",
+      (int) ((max_duration + GSS_CMAF_TIMESCALE - 1) / GSS_CMAF_TIMESCALE));
+  GSS_P ("#EXT-X-PART-INF:PART-TARGET=%s\n",
+      gss_cmaf_format_seconds (buf, track->chunk_duration));
+  GSS_P ("#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%s\n",
+      gss_cmaf_format_seconds (buf, 3 * track->chunk_duration));
+  GSS_P ("#EXT-X-MEDIA-SEQUENCE:%d\n", first);
+  GSS_P ("#EXT-X-MAP:URI=\"%sinit.mp4\"\n", prefix);
+
+  for (i = first; i < track->n_segments; i++) {
+    GssCmafSegment *segment = gss_cmaf_track_get_segment (track, i);
+
+    if (i >= track->n_segments - GSS_CMAF_HLS_PART_SEGMENTS) {
+      for (j = 0; j < segment->chunks->len; j++) {
+        GssCmafChunk *chunk = &g_array_index (segment->chunks,
+            GssCmafChunk, j);
+
+        GSS_P ("#EXT-X-PART:DURATION=%s,URI=\"%s%d.%d.m4s\"%s\n",
+            gss_cmaf_format_seconds (buf, chunk->duration), prefix, i, j,
+            chunk->independent ? ",INDEPENDENT=YES" : "");
+      }
+    }
+    if (segment->complete) {
+      GSS_P ("#EXTINF:%s,\n", gss_cmaf_format_seconds (buf,
+              segment->duration));
+      GSS_P ("%s%d.m4s\n", prefix, i);
+    }
+  }
+
+  if (track->finished) {
+    GSS_A ("#EXT-X-ENDLIST\n");
+  } else if (track->current) {
+    GSS_P ("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s%d.%d.m4s\"\n", prefix,
+        track->current->index, track->current->chunks->len);
+  } else {
+    GSS_P ("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s%d.0.m4s\"\n", prefix,
+        track->n_segments);
+  }
+}
+
+/**
+ * gss_cmaf_track_append_dash_segment_template:
+ * @track: a #GssCmafTrack
+ * @s: string to append to
+ * @prefix: prefix of the URLs of the init segment and segments
+ *
+ * Appends a SegmentTemplate element for a low-latency DASH
+ * representation.  Segments are available as soon as their first chunk
+ * is, so availabilityTimeOffset is the segment duration less one chunk.
+ * The segment in progress is listed with the nominal segment duration.
+ */
+void
+gss_cmaf_track_append_dash_segment_template (GssCmafTrack * track,
+    GString * s, const char *prefix)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+  int first;
+  int i;
+
+  g_return_if_fail (track != NULL);
+  g_return_if_fail (s != NULL);
+
+  first = gss_cmaf_track_get_first_segment (track);
+
+  GSS_P ("<SegmentTemplate timescale=\"%d\" startNumber=\"%d\" "
+      "availabilityTimeOffset=\"%s\" availabilityTimeComplete=\"false\" "
+      "initialization=\"%sinit.mp4\" media=\"%s$Number$.m4s\">\n",
+      GSS_CMAF_TIMESCALE, first, gss_cmaf_format_seconds (buf,
+          track->segment_duration - track->chunk_duration), prefix, prefix);
+  GSS_A ("<SegmentTimeline>\n");
+  for (i = first; i < track->n_segments; i++) {
+    GssCmafSegment *segment = gss_cmaf_track_get_segment (track, i);
+
+    GSS_P ("<S t=\"%" G_GUINT64_FORMAT "\" d=\"%" G_GUINT64_FORMAT "\"/>\n",
+        segment->timestamp, segment->complete ? segment->duration :
+        track->segment_duration);
+  }
+  GSS_A ("</SegmentTimeline>\n");
+  GSS_A ("</SegmentTemplate>\n");
+}
@@ -0,0 +1,117 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_CMAF_H
+#define _GSS_CMAF_H
+
+#include "gss-isom.h"
+
+G_BEGIN_DECLS
+
+/* all times are in units of 100 ns, as for the VOD fragments */
+#define GSS_CMAF_TIMESCALE 10000000
+
+/* segments kept per track */
+#define GSS_CMAF_SEGMENTS 10
+
+typedef struct _GssCmafChunk GssCmafChunk;
+typedef struct _GssCmafSegment GssCmafSegment;
+
+struct _GssCmafChunk {
+  /* moof and mdat */
+  SoupBuffer *buffer;
+  guint64 duration;
+  /* starts with a sync sample */
+  gboolean independent;
+};
+
+struct _GssCmafSegment {
+  int index;
+  guint64 timestamp;
+  /* sum of the durations of the chunks so far */
+  guint64 duration;
+  /* array of GssCmafChunk */
+  GArray *chunks;
+  /* no more chunks will be added */
+  gboolean complete;
+};
+
+struct _GssCmafTrack {
+  gboolean is_video;
+  /* RFC 6381 codec string */
+  char *codec;
+  int width;
+  int height;
+
+  guint64 segment_duration;
+  guint64 chunk_duration;
+
+  /* ftyp and moov */
+  SoupBuffer *init_segment;
+
+  /* wall clock time (in microseconds) and decode time of the first
+   * sample */
+  gint64 start_time;
+  guint64 start_timestamp;
+
+  /* index of the next segment that will be started */
+  int n_segments;
+
+  /* called after a chunk was added or a segment was completed */
+  void (*notify) (GssCmafTrack *track, gpointer priv);
+  gpointer notify_priv;
+
+  /*< private >*/
+  GssCmafSegment *segments[GSS_CMAF_SEGMENTS];
+  GssCmafSegment *current;
+  GArray *samples;
+  GByteArray *data;
+  guint64 chunk_timestamp;
+  guint64 last_timestamp;
+  guint32 sequence_number;
+  gboolean finished;
+};
+
+
+GssCmafTrack * gss_cmaf_track_new_video (const guint8 *avcc, gsize avcc_len,
+    int width, int height);
+GssCmafTrack * gss_cmaf_track_new_audio (const guint8 *audio_specific_config,
+    gsize audio_specific_config_len, int rate, int channels);
+void gss_cmaf_track_free (GssCmafTrack *track);
+void gss_cmaf_track_set_durations (GssCmafTrack *track,
+    guint64 segment_duration, guint64 chunk_duration);
+void gss_cmaf_track_push_sample (GssCmafTrack *track, const guint8 *data,
+    gsize size, guint64 dts, guint64 pts, gboolean sync);
+void gss_cmaf_track_finish (GssCmafTrack *track);
+
+GssCmafSegment * gss_cmaf_track_get_segment (GssCmafTrack *track, int index);
+int gss_cmaf_track_get_first_segment (GssCmafTrack *track);
+gboolean gss_cmaf_track_has_part (GssCmafTrack *track, int index, int part);
+
+void gss_cmaf_track_append_hls_playlist (GssCmafTrack *track, GString *s,
+    const char *prefix);
+void gss_cmaf_track_append_dash_segment_template (GssCmafTrack *track,
+    GString *s, const char *prefix);
+
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,266 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+
+#include "gss-compress.h"
+#include "gss-server.h"
+#include "gss-log.h"
+
+#include <string.h>
+
+/**
+ * SECTION:gss-compress
+ * @short_description: gzip content encoding
+ *
+ * Helpers for sending text responses (HTML, manifests, playlists) with
+ * gzip content encoding to clients that accept it.  Bodies that are
+ * generated per request are compressed when they are sent.  Bodies that
+ * are kept around (static resources, pre-rendered manifests, HLS
+ * playlists) keep their compressed form next to the uncompressed one,
+ * so it is only computed once.  A compressed body gets the ETag of the
+ * uncompressed body with "-gzip" appended.
+ */
+
+#define GSS_COMPRESS_ETAG_SUFFIX "-gzip"
+
+static const char *const text_content_types[] = {
+  "application/javascript",
+  "application/json",
+  "application/xml",
+  "application/dash+xml",
+  "application/vnd.ms-sstr+xml",
+  "application/vnd.apple.mpegurl",
+  "application/x-mpegurl",
+  "audio/mpegurl",
+  "audio/x-mpegurl",
+  "video/x-mpegurl"
+};
+
+/**
+ * gss_compress_content_type_is_text:
+ * @content_type: a MIME type, possibly with parameters, or %NULL
+ *
+ * Returns: %TRUE if bodies of @content_type are text that compresses well
+ */
+gboolean
+gss_compress_content_type_is_text (const char *content_type)
+{
+  guint i;
+
+  if (content_type == NULL)
+    return FALSE;
+
+  if (g_ascii_strncasecmp (content_type, "text/", 5) == 0)
+    return TRUE;
+
+  for (i = 0; i < G_N_ELEMENTS (text_content_types); i++) {
+    int len = strlen (text_content_types[i]);
+
+    if (g_ascii_strncasecmp (content_type, text_content_types[i], len) == 0 &&
+        (content_type[len] == '\0' || content_type[len] == ';')) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/**
+ * gss_compress_accept_gzip:
+ * @t: a #GssTransaction
+ *
+ * Checks whether the response to @t may be sent with gzip content
+ * encoding.  Since the response then depends on Accept-Encoding, this
+ * also adds Accept-Encoding to the Vary response header.
+ *
+ * Returns: %TRUE if compression is enabled and the client accepts gzip
+ */
+gboolean
+gss_compress_accept_gzip (GssTransaction * t)
+{
+  const char *accept;
+  GSList *codings;
+  GSList *g;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (t != NULL, FALSE);
+
+  if (!t->server->enable_compression)
+    return FALSE;
+
+  soup_message_headers_append (t->msg->response_headers, "Vary",
+      "Accept-Encoding");
+
+  accept = soup_message_headers_get_list (t->msg->request_headers,
+      "Accept-Encoding");
+  if (accept == NULL)
+    return FALSE;
+
+  /* only returns codings with q > 0 */
+  codings = soup_header_parse_quality_list (accept, NULL);
+  for (g = codings; g; g = g_slist_next (g)) {
+    if (g_ascii_strcasecmp (g->data, "gzip") == 0 ||
+        g_ascii_strcasecmp (g->data, "x-gzip") == 0) {
+      ret = TRUE;
+      break;
+    }
+  }
+  soup_header_free_list (codings);
+
+  return ret;
+}
+
+void
+gss_compress_set_gzip_headers (GssTransaction * t)
+{
+  g_return_if_fail (t != NULL);
+
+  soup_message_headers_replace (t->msg->response_headers, "Content-Encoding",
+      "gzip");
+}
+
+/**
+ * gss_compress_gzip:
+ * @data: data to compress
+ * @size: size of @data
+ *
+ * Compresses @data in gzip format.
+ *
+ * Returns: a new buffer, or %NULL if compression failed or would not
+ *   make the data smaller
+ */
+SoupBuffer *
+gss_compress_gzip (const char *data, gsize size)
+{
+  GConverter *compressor;
+  GConverterResult result;
+  GError *error = NULL;
+  guint8 *out;
+  gsize out_size;
+  gsize n_read = 0;
+  gsize n_written = 0;
+
+  g_return_val_if_fail (data != NULL || size == 0, NULL);
+
+  if (size < GSS_COMPRESS_MIN_SIZE)
+    return NULL;
+
+  compressor = G_CONVERTER (g_zlib_compressor_new
+      (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+
+  /* anything larger than the input is useless */
+  out_size = size;
+  out = g_malloc (out_size);
+  do {
+    gsize bytes_read;
+    gsize bytes_written;
+
+    result = g_converter_convert (compressor, data + n_read, size - n_read,
+        out + n_written, out_size - n_written, G_CONVERTER_INPUT_AT_END,
+        &bytes_read, &bytes_written, &error);
+    n_read += bytes_read;
+    n_written += bytes_written;
+  } while (result == G_CONVERTER_CONVERTED);
+  g_object_unref (compressor);
+
+  if (result != G_CONVERTER_FINISHED) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE)) {
+      GST_WARNING ("compression failed: %s",
+          error ? error->message : "unknown error");
+    }
+    g_clear_error (&error);
+    g_free (out);
+    return NULL;
+  }
+
+  return soup_buffer_new (SOUP_MEMORY_TAKE, out, n_written);
+}
+
+char *
+gss_compress_get_gzip_etag (const char *etag)
+{
+  g_return_val_if_fail (etag != NULL, NULL);
+
+  return g_strconcat (etag, GSS_COMPRESS_ETAG_SUFFIX, NULL);
+}
+
+/**
+ * gss_compress_etag_matches:
+ * @if_none_match: value of an If-None-Match request header
+ * @etag: ETag of the uncompressed body
+ *
+ * Returns: %TRUE if @if_none_match refers to either the uncompressed or
+ *   the compressed form of the body with @etag
+ */
+gboolean
+gss_compress_etag_matches (const char *if_none_match, const char *etag)
+{
+  int len;
+
+  g_return_val_if_fail (if_none_match != NULL, FALSE);
+  g_return_val_if_fail (etag != NULL, FALSE);
+
+  len = strlen (etag);
+  if (strncmp (if_none_match, etag, len) != 0)
+    return FALSE;
+
+  return (if_none_match[len] == '\0' ||
+      strcmp (if_none_match + len, GSS_COMPRESS_ETAG_SUFFIX) == 0);
+}
+
+/**
+ * gss_compress_append_body:
+ * @t: a #GssTransaction
+ * @content: (transfer full): response body
+ * @size: size of @content
+ *
+ * Appends @content to the response body, compressed if the response
+ * content type is text and the client accepts gzip.
+ */
+void
+gss_compress_append_body (GssTransaction * t, char *content, gsize size)
+{
+  const char *content_type;
+
+  g_return_if_fail (t != NULL);
+
+  content_type = soup_message_headers_get_content_type
+      (t->msg->response_headers, NULL);
+  if (size >= GSS_COMPRESS_MIN_SIZE &&
+      gss_compress_content_type_is_text (content_type) &&
+      gss_compress_accept_gzip (t)) {
+    SoupBuffer *buffer;
+
+    buffer = gss_compress_gzip (content, size);
+    if (buffer) {
+      gss_compress_set_gzip_headers (t);
+      soup_message_body_append_buffer (t->msg->response_body, buffer);
+      soup_buffer_free (buffer);
+      g_free (content);
+      return;
+    }
+  }
+
+  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_TAKE,
+      content, size);
+}
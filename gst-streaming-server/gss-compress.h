@@ -0,0 +1,46 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_COMPRESS_H
+#define _GSS_COMPRESS_H
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* bodies smaller than this are not worth compressing */
+#define GSS_COMPRESS_MIN_SIZE 256
+
+gboolean gss_compress_content_type_is_text (const char *content_type);
+gboolean gss_compress_accept_gzip (GssTransaction *t);
+void gss_compress_set_gzip_headers (GssTransaction *t);
+SoupBuffer *gss_compress_gzip (const char *data, gsize size);
+char *gss_compress_get_gzip_etag (const char *etag);
+gboolean gss_compress_etag_matches (const char *if_none_match,
+    const char *etag);
+void gss_compress_append_body (GssTransaction *t, char *content, gsize size);
+
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,418 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include <gst/gst.h>
+
+#include "gss-fd-cache.h"
+#include "gss-log.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/**
+ * SECTION:gss-fd-cache
+ * @short_description: LRU cache of open file descriptors
+ *
+ * Keeps recently used files open so that fragment assembly does not
+ * need an open()/close() pair per request.  The cache is shared by the
+ * async worker threads and is protected by a mutex.  Entries are
+ * reference counted: a descriptor that is evicted or invalidated while
+ * a reader still holds it is closed only when the last reference is
+ * released.
+ *
+ * An entry can also be mapped into memory with gss_fd_cache_entry_map(),
+ * so that file contents can be handed to libsoup without copying.  The
+ * mapping lives as long as the entry.
+ */
+
+struct _GssFdCache
+{
+  GMutex lock;
+  GHashTable *entries;
+  /* most recently used at head */
+  GQueue lru;
+  int max_fds;
+
+  guint64 hits;
+  guint64 misses;
+};
+
+
+static void
+gss_fd_cache_entry_free (GssFdCacheEntry * entry)
+{
+  if (entry->map_data) {
+    munmap (entry->map_data, entry->map_size);
+  }
+  close (entry->fd);
+  g_free (entry->filename);
+  g_free (entry);
+}
+
+/* called with lock held.  Returns TRUE if the caller must free the
+ * entry after dropping the lock. */
+static gboolean
+gss_fd_cache_remove_entry (GssFdCache * cache, GssFdCacheEntry * entry)
+{
+  g_hash_table_remove (cache->entries, entry->filename);
+  g_queue_delete_link (&cache->lru, entry->lru_link);
+  entry->lru_link = NULL;
+  entry->stale = TRUE;
+
+  return (entry->refcount == 0);
+}
+
+/* called with lock held.  Evicted entries that are no longer in use are
+ * prepended to @dead. */
+static GList *
+gss_fd_cache_trim (GssFdCache * cache, GList * dead)
+{
+  while ((int) g_queue_get_length (&cache->lru) > cache->max_fds) {
+    GssFdCacheEntry *entry = g_queue_peek_tail (&cache->lru);
+
+    if (gss_fd_cache_remove_entry (cache, entry)) {
+      dead = g_list_prepend (dead, entry);
+    }
+  }
+  return dead;
+}
+
+GssFdCache *
+gss_fd_cache_new (int max_fds)
+{
+  GssFdCache *cache;
+
+  g_return_val_if_fail (max_fds >= 0, NULL);
+
+  cache = g_new0 (GssFdCache, 1);
+  g_mutex_init (&cache->lock);
+  cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&cache->lru);
+  cache->max_fds = max_fds;
+
+  return cache;
+}
+
+void
+gss_fd_cache_free (GssFdCache * cache)
+{
+  GssFdCacheEntry *entry;
+
+  g_return_if_fail (cache != NULL);
+
+  while ((entry = g_queue_pop_head (&cache->lru))) {
+    if (entry->refcount > 0) {
+      GST_WARNING ("freeing fd cache while \"%s\" is still in use",
+          entry->filename);
+    }
+    gss_fd_cache_entry_free (entry);
+  }
+  g_hash_table_unref (cache->entries);
+  g_mutex_clear (&cache->lock);
+  g_free (cache);
+}
+
+void
+gss_fd_cache_set_max_fds (GssFdCache * cache, int max_fds)
+{
+  GList *dead;
+
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (max_fds >= 0);
+
+  g_mutex_lock (&cache->lock);
+  cache->max_fds = max_fds;
+  dead = gss_fd_cache_trim (cache, NULL);
+  g_mutex_unlock (&cache->lock);
+
+  g_list_free_full (dead, (GDestroyNotify) gss_fd_cache_entry_free);
+}
+
+int
+gss_fd_cache_get_max_fds (GssFdCache * cache)
+{
+  g_return_val_if_fail (cache != NULL, 0);
+
+  return cache->max_fds;
+}
+
+/**
+ * gss_fd_cache_open:
+ * @cache: a #GssFdCache
+ * @filename: file to open read-only
+ * @error: location for a #GError, or %NULL
+ *
+ * Looks up @filename in the cache, opening it if necessary.  The
+ * returned entry must be released with gss_fd_cache_release().
+ *
+ * Returns: a referenced cache entry, or %NULL if the file could not
+ *   be opened
+ */
+GssFdCacheEntry *
+gss_fd_cache_open (GssFdCache * cache, const char *filename, GError ** error)
+{
+  GssFdCacheEntry *entry;
+  GList *dead;
+  int fd;
+
+  g_return_val_if_fail (cache != NULL, NULL);
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  g_mutex_lock (&cache->lock);
+  entry = g_hash_table_lookup (cache->entries, filename);
+  if (entry) {
+    entry->refcount++;
+    g_queue_unlink (&cache->lru, entry->lru_link);
+    g_queue_push_head_link (&cache->lru, entry->lru_link);
+    cache->hits++;
+    g_mutex_unlock (&cache->lock);
+    return entry;
+  }
+  cache->misses++;
+  g_mutex_unlock (&cache->lock);
+
+  /* don't hold the lock across a (possibly slow) path lookup */
+  fd = open (filename, O_RDONLY);
+  if (fd < 0) {
+    GST_WARNING ("failed to open \"%s\", error=\"%s\"", filename,
+        g_strerror (errno));
+    if (error) {
+      *error = g_error_new (_gss_error_quark, GSS_ERROR_FILE_OPEN,
+          "failed to open file");
+    }
+    return NULL;
+  }
+
+  g_mutex_lock (&cache->lock);
+  entry = g_hash_table_lookup (cache->entries, filename);
+  if (entry) {
+    /* another thread opened it in the meantime */
+    entry->refcount++;
+    g_mutex_unlock (&cache->lock);
+    close (fd);
+    return entry;
+  }
+
+  entry = g_new0 (GssFdCacheEntry, 1);
+  entry->cache = cache;
+  entry->filename = g_strdup (filename);
+  entry->fd = fd;
+  entry->refcount = 1;
+  g_queue_push_head (&cache->lru, entry);
+  entry->lru_link = g_queue_peek_head_link (&cache->lru);
+  g_hash_table_insert (cache->entries, entry->filename, entry);
+
+  dead = gss_fd_cache_trim (cache, NULL);
+  g_mutex_unlock (&cache->lock);
+
+  g_list_free_full (dead, (GDestroyNotify) gss_fd_cache_entry_free);
+
+  return entry;
+}
+
+void
+gss_fd_cache_release (GssFdCache * cache, GssFdCacheEntry * entry)
+{
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (entry != NULL);
+  g_return_if_fail (entry->cache == cache);
+
+  gss_fd_cache_entry_unref (entry);
+}
+
+GssFdCacheEntry *
+gss_fd_cache_entry_ref (GssFdCacheEntry * entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  g_mutex_lock (&entry->cache->lock);
+  entry->refcount++;
+  g_mutex_unlock (&entry->cache->lock);
+
+  return entry;
+}
+
+void
+gss_fd_cache_entry_unref (GssFdCacheEntry * entry)
+{
+  GssFdCache *cache;
+  gboolean free_entry;
+
+  g_return_if_fail (entry != NULL);
+
+  cache = entry->cache;
+  g_mutex_lock (&cache->lock);
+  entry->refcount--;
+  free_entry = (entry->refcount == 0 && entry->stale);
+  g_mutex_unlock (&cache->lock);
+
+  if (free_entry) {
+    gss_fd_cache_entry_free (entry);
+  }
+}
+
+/**
+ * gss_fd_cache_entry_map:
+ * @entry: a referenced #GssFdCacheEntry
+ * @data: (out): location for the start of the mapping
+ * @size: (out): location for the size of the mapping
+ *
+ * Maps the whole file read-only, if it is not already mapped.  The
+ * mapping stays valid as long as a reference to @entry is held.  Note
+ * that truncating a mapped file causes SIGBUS on access, so files that
+ * are served this way must be replaced, not rewritten in place.
+ *
+ * Returns: %TRUE if the file is mapped
+ */
+gboolean
+gss_fd_cache_entry_map (GssFdCacheEntry * entry, const guint8 ** data,
+    gsize * size)
+{
+  GssFdCache *cache;
+  gboolean ret = TRUE;
+
+  g_return_val_if_fail (entry != NULL, FALSE);
+  g_return_val_if_fail (data != NULL, FALSE);
+  g_return_val_if_fail (size != NULL, FALSE);
+
+  cache = entry->cache;
+  g_mutex_lock (&cache->lock);
+  if (entry->map_data == NULL) {
+    struct stat st;
+    void *map;
+
+    if (fstat (entry->fd, &st) < 0 || st.st_size == 0) {
+      ret = FALSE;
+    } else {
+      map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, entry->fd, 0);
+      if (map == MAP_FAILED) {
+        GST_WARNING ("failed to map \"%s\", error=\"%s\"", entry->filename,
+            g_strerror (errno));
+        ret = FALSE;
+      } else {
+        entry->map_data = map;
+        entry->map_size = st.st_size;
+      }
+    }
+  }
+  *data = entry->map_data;
+  *size = entry->map_size;
+  g_mutex_unlock (&cache->lock);
+
+  return ret;
+}
+
+/**
+ * gss_fd_cache_entry_fault_in:
+ * @entry: a referenced, mapped #GssFdCacheEntry
+ * @offset: offset into the file
+ * @size: number of bytes
+ *
+ * Makes sure the given range of the mapping is resident, so that
+ * whoever reads it later, e.g., libsoup writing it to a socket from
+ * the main loop, does not block on disk I/O.  The read-ahead for the
+ * whole range is started at once, then each page is touched.  This
+ * blocks, so it should be called from a worker thread.
+ */
+void
+gss_fd_cache_entry_fault_in (GssFdCacheEntry * entry, guint64 offset,
+    guint64 size)
+{
+  static gsize page_size;
+  const volatile guint8 *p;
+  guint64 start;
+  guint64 end;
+  guint64 pos;
+
+  g_return_if_fail (entry != NULL);
+  g_return_if_fail (entry->map_data != NULL);
+
+  if (page_size == 0) {
+    page_size = sysconf (_SC_PAGESIZE);
+  }
+
+  end = MIN (offset + size, entry->map_size);
+  if (offset >= end)
+    return;
+  start = offset - (offset % page_size);
+
+  if (madvise (entry->map_data + start, end - start, MADV_WILLNEED) < 0) {
+    GST_DEBUG ("madvise failed on \"%s\", error=\"%s\"", entry->filename,
+        g_strerror (errno));
+  }
+
+  p = entry->map_data;
+  for (pos = start; pos < end; pos += page_size) {
+    (void) p[pos];
+  }
+}
+
+/**
+ * gss_fd_cache_invalidate:
+ * @cache: a #GssFdCache
+ * @filename: file name
+ *
+ * Drops the cached descriptor for @filename, if any, so that the next
+ * lookup reopens the file.  Readers holding the old entry keep a valid
+ * descriptor until they release it.
+ */
+void
+gss_fd_cache_invalidate (GssFdCache * cache, const char *filename)
+{
+  GssFdCacheEntry *entry;
+  gboolean free_entry = FALSE;
+
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (filename != NULL);
+
+  g_mutex_lock (&cache->lock);
+  entry = g_hash_table_lookup (cache->entries, filename);
+  if (entry) {
+    free_entry = gss_fd_cache_remove_entry (cache, entry);
+  }
+  g_mutex_unlock (&cache->lock);
+
+  if (free_entry) {
+    gss_fd_cache_entry_free (entry);
+  }
+}
+
+void
+gss_fd_cache_get_stats (GssFdCache * cache, guint64 * hits, guint64 * misses,
+    int *n_open)
+{
+  g_return_if_fail (cache != NULL);
+
+  g_mutex_lock (&cache->lock);
+  if (hits)
+    *hits = cache->hits;
+  if (misses)
+    *misses = cache->misses;
+  if (n_open)
+    *n_open = g_queue_get_length (&cache->lru);
+  g_mutex_unlock (&cache->lock);
+}
@@ -0,0 +1,66 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_FD_CACHE_H
+#define _GSS_FD_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GssFdCache GssFdCache;
+typedef struct _GssFdCacheEntry GssFdCacheEntry;
+
+struct _GssFdCacheEntry {
+  char *filename;
+  int fd;
+
+  /*< private >*/
+  GssFdCache *cache;
+  int refcount;
+  gboolean stale;
+  GList *lru_link;
+  guint8 *map_data;
+  gsize map_size;
+};
+
+
+GssFdCache *gss_fd_cache_new (int max_fds);
+void gss_fd_cache_free (GssFdCache *cache);
+void gss_fd_cache_set_max_fds (GssFdCache *cache, int max_fds);
+int gss_fd_cache_get_max_fds (GssFdCache *cache);
+GssFdCacheEntry *gss_fd_cache_open (GssFdCache *cache, const char *filename,
+    GError **error);
+void gss_fd_cache_release (GssFdCache *cache, GssFdCacheEntry *entry);
+GssFdCacheEntry *gss_fd_cache_entry_ref (GssFdCacheEntry *entry);
+void gss_fd_cache_entry_unref (GssFdCacheEntry *entry);
+gboolean gss_fd_cache_entry_map (GssFdCacheEntry *entry, const guint8 **data,
+    gsize *size);
+void gss_fd_cache_entry_fault_in (GssFdCacheEntry *entry, guint64 offset,
+    guint64 size);
+void gss_fd_cache_invalidate (GssFdCache *cache, const char *filename);
+void gss_fd_cache_get_stats (GssFdCache *cache, guint64 *hits,
+    guint64 *misses, int *n_open);
+
+
+G_END_DECLS
+
+#endif
+
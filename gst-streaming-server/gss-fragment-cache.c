@@ -0,0 +1,318 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include <gst/gst.h>
+
+#include "gss-fragment-cache.h"
+#include "gss-log.h"
+
+#include <string.h>
+
+/**
+ * SECTION:gss-fragment-cache
+ * @short_description: Byte-bounded cache of assembled fragments
+ *
+ * Holds fully assembled (and, for DRM content, encrypted) media
+ * fragments so that popular fragments are not read and encrypted again
+ * for every request.  Fragments are stored as #SoupBuffer, and lookups
+ * return a new reference that can be appended to a message body without
+ * copying.
+ *
+ * A fragment is only admitted after it has missed
+ * %GSS_FRAGMENT_CACHE_ADMIT_COUNT times, so that a single pass through
+ * a long tail of rarely watched content does not flush the popular
+ * fragments.  Admitted fragments are evicted in LRU order once the
+ * total size exceeds the configured budget.
+ *
+ * The cache is shared by the async worker threads and is protected by
+ * a mutex.
+ */
+
+/* number of misses before a fragment is admitted */
+#define GSS_FRAGMENT_CACHE_ADMIT_COUNT 2
+/* miss counts are forgotten once this many distinct keys are tracked */
+#define GSS_FRAGMENT_CACHE_MAX_CANDIDATES 65536
+
+typedef struct _GssFragmentCacheEntry GssFragmentCacheEntry;
+struct _GssFragmentCacheEntry
+{
+  char *key;
+  SoupBuffer *buffer;
+  GList *lru_link;
+};
+
+struct _GssFragmentCache
+{
+  GMutex lock;
+  GHashTable *entries;
+  /* key -> number of misses, for keys not yet admitted */
+  GHashTable *candidates;
+  /* most recently used at head */
+  GQueue lru;
+  gsize size;
+  gsize max_size;
+
+  guint64 hits;
+  guint64 misses;
+  guint64 bytes_saved;
+};
+
+
+static void
+gss_fragment_cache_entry_free (GssFragmentCacheEntry * entry)
+{
+  soup_buffer_free (entry->buffer);
+  g_free (entry->key);
+  g_free (entry);
+}
+
+/* called with lock held */
+static void
+gss_fragment_cache_remove_entry (GssFragmentCache * cache,
+    GssFragmentCacheEntry * entry)
+{
+  g_hash_table_remove (cache->entries, entry->key);
+  g_queue_delete_link (&cache->lru, entry->lru_link);
+  entry->lru_link = NULL;
+  cache->size -= entry->buffer->length;
+}
+
+/* called with lock held.  Evicted entries are prepended to @dead, to be
+ * freed after dropping the lock. */
+static GList *
+gss_fragment_cache_trim (GssFragmentCache * cache, GList * dead)
+{
+  while (cache->size > cache->max_size) {
+    GssFragmentCacheEntry *entry = g_queue_peek_tail (&cache->lru);
+
+    gss_fragment_cache_remove_entry (cache, entry);
+    dead = g_list_prepend (dead, entry);
+  }
+  return dead;
+}
+
+GssFragmentCache *
+gss_fragment_cache_new (gsize max_size)
+{
+  GssFragmentCache *cache;
+
+  cache = g_new0 (GssFragmentCache, 1);
+  g_mutex_init (&cache->lock);
+  cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  cache->candidates = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  g_queue_init (&cache->lru);
+  cache->max_size = max_size;
+
+  return cache;
+}
+
+void
+gss_fragment_cache_free (GssFragmentCache * cache)
+{
+  GssFragmentCacheEntry *entry;
+
+  g_return_if_fail (cache != NULL);
+
+  while ((entry = g_queue_pop_head (&cache->lru))) {
+    gss_fragment_cache_entry_free (entry);
+  }
+  g_hash_table_unref (cache->entries);
+  g_hash_table_unref (cache->candidates);
+  g_mutex_clear (&cache->lock);
+  g_free (cache);
+}
+
+void
+gss_fragment_cache_set_max_size (GssFragmentCache * cache, gsize max_size)
+{
+  GList *dead;
+
+  g_return_if_fail (cache != NULL);
+
+  g_mutex_lock (&cache->lock);
+  cache->max_size = max_size;
+  dead = gss_fragment_cache_trim (cache, NULL);
+  g_mutex_unlock (&cache->lock);
+
+  g_list_free_full (dead, (GDestroyNotify) gss_fragment_cache_entry_free);
+}
+
+gsize
+gss_fragment_cache_get_max_size (GssFragmentCache * cache)
+{
+  g_return_val_if_fail (cache != NULL, 0);
+
+  return cache->max_size;
+}
+
+/**
+ * gss_fragment_cache_lookup:
+ * @cache: a #GssFragmentCache
+ * @key: fragment key
+ *
+ * Looks up the fragment stored under @key.  A miss counts towards
+ * admitting @key on the next gss_fragment_cache_insert().
+ *
+ * Returns: a new reference to the cached buffer, to be freed with
+ *   soup_buffer_free(), or %NULL
+ */
+SoupBuffer *
+gss_fragment_cache_lookup (GssFragmentCache * cache, const char *key)
+{
+  GssFragmentCacheEntry *entry;
+  SoupBuffer *buffer = NULL;
+
+  g_return_val_if_fail (cache != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  g_mutex_lock (&cache->lock);
+  entry = g_hash_table_lookup (cache->entries, key);
+  if (entry) {
+    g_queue_unlink (&cache->lru, entry->lru_link);
+    g_queue_push_head_link (&cache->lru, entry->lru_link);
+    buffer = soup_buffer_copy (entry->buffer);
+    cache->hits++;
+    cache->bytes_saved += buffer->length;
+  } else if (cache->max_size > 0) {
+    int count;
+
+    if (g_hash_table_size (cache->candidates) >=
+        GSS_FRAGMENT_CACHE_MAX_CANDIDATES) {
+      g_hash_table_remove_all (cache->candidates);
+    }
+    count = GPOINTER_TO_INT (g_hash_table_lookup (cache->candidates, key));
+    g_hash_table_replace (cache->candidates, g_strdup (key),
+        GINT_TO_POINTER (count + 1));
+    cache->misses++;
+  } else {
+    cache->misses++;
+  }
+  g_mutex_unlock (&cache->lock);
+
+  return buffer;
+}
+
+/**
+ * gss_fragment_cache_insert:
+ * @cache: a #GssFragmentCache
+ * @key: fragment key
+ * @buffer: assembled fragment
+ *
+ * Offers @buffer to the cache.  The cache takes its own reference to
+ * @buffer if @key has missed often enough to be admitted and the buffer
+ * fits in the budget; otherwise this does nothing.  @buffer must not
+ * use %SOUP_MEMORY_TEMPORARY, and its contents must not be changed
+ * afterwards.
+ */
+void
+gss_fragment_cache_insert (GssFragmentCache * cache, const char *key,
+    SoupBuffer * buffer)
+{
+  GssFragmentCacheEntry *entry;
+  GList *dead;
+  int count;
+
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (buffer != NULL);
+
+  g_mutex_lock (&cache->lock);
+  if (buffer->length > cache->max_size ||
+      g_hash_table_lookup (cache->entries, key)) {
+    g_mutex_unlock (&cache->lock);
+    return;
+  }
+  count = GPOINTER_TO_INT (g_hash_table_lookup (cache->candidates, key));
+  if (count < GSS_FRAGMENT_CACHE_ADMIT_COUNT) {
+    g_mutex_unlock (&cache->lock);
+    return;
+  }
+  g_hash_table_remove (cache->candidates, key);
+
+  entry = g_new0 (GssFragmentCacheEntry, 1);
+  entry->key = g_strdup (key);
+  entry->buffer = soup_buffer_copy (buffer);
+  g_queue_push_head (&cache->lru, entry);
+  entry->lru_link = g_queue_peek_head_link (&cache->lru);
+  g_hash_table_insert (cache->entries, entry->key, entry);
+  cache->size += buffer->length;
+
+  dead = gss_fragment_cache_trim (cache, NULL);
+  g_mutex_unlock (&cache->lock);
+
+  g_list_free_full (dead, (GDestroyNotify) gss_fragment_cache_entry_free);
+}
+
+/**
+ * gss_fragment_cache_invalidate_prefix:
+ * @cache: a #GssFragmentCache
+ * @prefix: key prefix
+ *
+ * Drops all cached fragments whose key starts with @prefix.  Buffers
+ * that are still being sent stay valid until libsoup releases them.
+ */
+void
+gss_fragment_cache_invalidate_prefix (GssFragmentCache * cache,
+    const char *prefix)
+{
+  GList *dead = NULL;
+  GList *g;
+  GList *next;
+
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (prefix != NULL);
+
+  g_mutex_lock (&cache->lock);
+  for (g = cache->lru.head; g; g = next) {
+    GssFragmentCacheEntry *entry = g->data;
+
+    next = g->next;
+    if (g_str_has_prefix (entry->key, prefix)) {
+      gss_fragment_cache_remove_entry (cache, entry);
+      dead = g_list_prepend (dead, entry);
+    }
+  }
+  g_mutex_unlock (&cache->lock);
+
+  g_list_free_full (dead, (GDestroyNotify) gss_fragment_cache_entry_free);
+}
+
+void
+gss_fragment_cache_get_stats (GssFragmentCache * cache, guint64 * hits,
+    guint64 * misses, guint64 * bytes_saved, gsize * size, int *n_entries)
+{
+  g_return_if_fail (cache != NULL);
+
+  g_mutex_lock (&cache->lock);
+  if (hits)
+    *hits = cache->hits;
+  if (misses)
+    *misses = cache->misses;
+  if (bytes_saved)
+    *bytes_saved = cache->bytes_saved;
+  if (size)
+    *size = cache->size;
+  if (n_entries)
+    *n_entries = g_queue_get_length (&cache->lru);
+  g_mutex_unlock (&cache->lock);
+}
@@ -0,0 +1,50 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_FRAGMENT_CACHE_H
+#define _GSS_FRAGMENT_CACHE_H
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GssFragmentCache GssFragmentCache;
+
+
+GssFragmentCache *gss_fragment_cache_new (gsize max_size);
+void gss_fragment_cache_free (GssFragmentCache *cache);
+void gss_fragment_cache_set_max_size (GssFragmentCache *cache,
+    gsize max_size);
+gsize gss_fragment_cache_get_max_size (GssFragmentCache *cache);
+SoupBuffer *gss_fragment_cache_lookup (GssFragmentCache *cache,
+    const char *key);
+void gss_fragment_cache_insert (GssFragmentCache *cache, const char *key,
+    SoupBuffer *buffer);
+void gss_fragment_cache_invalidate_prefix (GssFragmentCache *cache,
+    const char *prefix);
+void gss_fragment_cache_get_stats (GssFragmentCache *cache, guint64 *hits,
+    guint64 *misses, guint64 *bytes_saved, gsize *size, int *n_entries);
+
+
+G_END_DECLS
+
+#endif
+
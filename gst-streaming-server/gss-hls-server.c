@@ -23,6 +23,11 @@
 
 #include "gss-server.h"
 #include "gss-utils.h"
+#include "gss-compress.h"
+#include "gss-tsparse.h"
+#include "gss-log.h"
+
+#include <string.h>
 
 
 
@@ -36,7 +41,8 @@ static void gss_hls_handle_m3u8 (GssTransaction * t);
 static void gss_hls_handle_stream_m3u8 (GssTransaction * t);
 static void gss_hls_handle_ts_chunk (GssTransaction * t);
 
-void gss_program_add_hls_chunk (GssStream * stream, SoupBuffer * buf);
+void gss_program_add_hls_chunk (GssStream * stream, GPtrArray * buffers,
+    guint64 duration, gboolean discontinuity);
 
 #if GST_CHECK_VERSION(1,0,0)
 static GstPadProbeReturn sink_probe_callback (GstPad * pad,
@@ -59,7 +65,12 @@ gss_stream_add_hls (GssStream * stream)
 
   if (!program->enable_hls) {
 
-    program->hls.target_duration = 4;
+    /* Segments end at the first key frame after the segment duration,
+     * so they are usually longer.  The target duration is fixed for the
+     * lifetime of the playlist, so it leaves room for that. */
+    program->hls.target_duration =
+        (GSS_OBJECT_SERVER (program)->hls_segment_duration * 3 / 2 +
+        999) / 1000;
 
     program->enable_hls = TRUE;
 
@@ -115,7 +126,13 @@ gss_stream_add_hls (GssStream * stream)
   stream->codecs = g_strdup_printf ("avc1.%04X%02X, mp4a.40.2", profile, level);
   stream->is_hls = TRUE;
 
-  stream->adapter = gst_adapter_new ();
+  if (stream->adapter) {
+    gst_adapter_clear (stream->adapter);
+  } else {
+    stream->adapter = gst_adapter_new ();
+  }
+  /* a new source starts a new timeline */
+  gss_tsparse_segmenter_reset (&stream->hls.segmenter, (stream->n_chunks > 0));
 
   s = g_strdup_printf ("/%s-%dx%d-%dkbps%s.m3u8", GSS_OBJECT_NAME (program),
       stream->width, stream->height, stream->bitrate / 1000,
@@ -128,30 +145,148 @@ gss_stream_add_hls (GssStream * stream)
 }
 
 
+/* Segments are cut by #GssTsSegmenter, with timestamps in units of the
+ * 90 kHz MPEG clock.  A timestamp more than GSS_HLS_MAX_JUMP target
+ * durations ahead starts a new timeline, and one up to a target duration
+ * back is a reordered frame. */
+#define GSS_HLS_CLOCK_RATE 90000
+#define GSS_HLS_MAX_JUMP 3
+
 typedef struct _ChunkCallback ChunkCallback;
 struct _ChunkCallback
 {
   GssStream *stream;
-  guint8 *data;
-  int n;
+  /* GstBuffers of the segment, taken from the adapter without copying */
+  GList *buffers;
+  guint64 duration;
+  gboolean discontinuity;
 };
 
+#if GST_CHECK_VERSION(1,0,0)
+typedef struct _GssHLSMapping GssHLSMapping;
+struct _GssHLSMapping
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+};
+
+static void
+gss_hls_mapping_free (gpointer data)
+{
+  GssHLSMapping *mapping = data;
+
+  gst_buffer_unmap (mapping->buffer, &mapping->map);
+  gst_buffer_unref (mapping->buffer);
+  g_free (mapping);
+}
+#endif
+
+/* Wraps the memory of @buffer, taking ownership of it.  The buffer
+ * stays mapped as long as the SoupBuffer is alive. */
+static SoupBuffer *
+gss_hls_soup_buffer_new (GstBuffer * buffer)
+{
+#if GST_CHECK_VERSION(1,0,0)
+  GssHLSMapping *mapping;
+
+  mapping = g_malloc (sizeof (GssHLSMapping));
+  if (!gst_buffer_map (buffer, &mapping->map, GST_MAP_READ)) {
+    GST_ERROR ("failed map");
+    gst_buffer_unref (buffer);
+    g_free (mapping);
+    return NULL;
+  }
+  mapping->buffer = buffer;
+
+  return soup_buffer_new_with_owner (mapping->map.data, mapping->map.size,
+      mapping, gss_hls_mapping_free);
+#else
+  return soup_buffer_new_with_owner (GST_BUFFER_DATA (buffer),
+      GST_BUFFER_SIZE (buffer), buffer, (GDestroyNotify) gst_buffer_unref);
+#endif
+}
+
 static gboolean
 gss_program_add_hls_chunk_callback (gpointer data)
 {
   ChunkCallback *chunk_callback = (ChunkCallback *) data;
-  SoupBuffer *buffer;
+  GPtrArray *buffers;
+  GList *g;
 
-  buffer =
-      soup_buffer_new (SOUP_MEMORY_TAKE, chunk_callback->data,
-      chunk_callback->n);
-  gss_program_add_hls_chunk (chunk_callback->stream, buffer);
+  buffers = g_ptr_array_new_with_free_func ((GDestroyNotify) soup_buffer_free);
+  for (g = chunk_callback->buffers; g; g = g_list_next (g)) {
+    SoupBuffer *buffer = gss_hls_soup_buffer_new (GST_BUFFER (g->data));
+
+    if (buffer)
+      g_ptr_array_add (buffers, buffer);
+  }
+  g_list_free (chunk_callback->buffers);
+
+  gss_program_add_hls_chunk (chunk_callback->stream, buffers,
+      chunk_callback->duration, chunk_callback->discontinuity);
 
   g_free (chunk_callback);
 
   return FALSE;
 }
 
+/* Called in the streaming thread for each buffer of MPEG-TS packets.
+ * @data and @size are the contents of @buffer. */
+static void
+gss_hls_push_buffer (GssStream * stream, GstBuffer * buffer,
+    const guint8 * data, gsize size)
+{
+  GssServer *server = GSS_OBJECT_SERVER (stream->program);
+  GssTsSegmenter *segmenter = &stream->hls.segmenter;
+  gssize base;
+  gsize offset;
+
+  segmenter->target = (guint64) server->hls_segment_duration *
+      GSS_HLS_CLOCK_RATE / 1000;
+  segmenter->max_reorder = (guint64) stream->program->hls.target_duration *
+      GSS_HLS_CLOCK_RATE;
+  segmenter->max_jump = segmenter->max_reorder * GSS_HLS_MAX_JUMP;
+
+  gst_adapter_push (stream->adapter, gst_buffer_ref (buffer));
+  /* position of @data in the adapter */
+  base = gst_adapter_available (stream->adapter) - size;
+
+  for (offset = 0; offset + GSS_TSPARSE_PACKET_SIZE <= size;
+      offset += GSS_TSPARSE_PACKET_SIZE) {
+    GssTsPacketInfo info;
+    guint64 duration;
+    gboolean discontinuity;
+    ChunkCallback *chunk_callback;
+
+    if (!gss_tsparse_packet (data + offset, &info))
+      continue;
+
+    switch (gss_tsparse_segmenter_push (segmenter, &info, &duration,
+            &discontinuity)) {
+      case GSS_TSPARSE_SEGMENT_START:
+        gst_adapter_flush (stream->adapter, base + offset);
+        base = -(gssize) offset;
+        break;
+      case GSS_TSPARSE_SEGMENT_CUT:
+        if (segmenter->discontinuity) {
+          GST_WARNING ("timestamp jump after segment %d, starting a new "
+              "timeline", stream->n_chunks);
+        }
+        chunk_callback = g_malloc0 (sizeof (ChunkCallback));
+        chunk_callback->buffers = gst_adapter_take_list (stream->adapter,
+            base + offset);
+        chunk_callback->duration = duration;
+        chunk_callback->discontinuity = discontinuity;
+        chunk_callback->stream = stream;
+        base = -(gssize) offset;
+        g_idle_add (gss_program_add_hls_chunk_callback, chunk_callback);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
 #if GST_CHECK_VERSION(1,0,0)
 static GstPadProbeReturn
 sink_probe_callback (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
@@ -161,36 +296,13 @@ sink_probe_callback (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
   if (info->type == GST_PAD_PROBE_TYPE_BUFFER) {
     GstBuffer *buffer = GST_BUFFER (info->data);
     GstMapInfo mapinfo;
-    guint8 *data;
-    gboolean ret;
 
-    ret = gst_buffer_map (buffer, &mapinfo, GST_MAP_READ);
-    if (!ret) {
+    if (!gst_buffer_map (buffer, &mapinfo, GST_MAP_READ)) {
       GST_ERROR ("failed map");
+      return GST_PAD_PROBE_OK;
     }
-    data = mapinfo.data;
-
-    if (((data[3] >> 4) & 2) && ((data[5] >> 6) & 1)) {
-      int n;
-
-      n = gst_adapter_available (stream->adapter);
-      if (n < 188 * 100) {
-        /* skipped (too early) */
-      } else {
-        ChunkCallback *chunk_callback;
-
-        chunk_callback = g_malloc0 (sizeof (ChunkCallback));
-        chunk_callback->data = gst_adapter_take (stream->adapter, n);
-        chunk_callback->n = n;
-        chunk_callback->stream = stream;
-
-        g_idle_add (gss_program_add_hls_chunk_callback, chunk_callback);
-      }
-    }
-
+    gss_hls_push_buffer (stream, buffer, mapinfo.data, mapinfo.size);
     gst_buffer_unmap (buffer, &mapinfo);
-
-    gst_adapter_push (stream->adapter, gst_buffer_ref (buffer));
   }
 
   return GST_PAD_PROBE_OK;
@@ -203,27 +315,9 @@ sink_data_probe_callback (GstPad * pad, GstMiniObject * mo, gpointer user_data)
 
   if (GST_IS_BUFFER (mo)) {
     GstBuffer *buffer = GST_BUFFER (mo);
-    guint8 *data = GST_BUFFER_DATA (buffer);
-
-    if (((data[3] >> 4) & 2) && ((data[5] >> 6) & 1)) {
-      int n;
-
-      n = gst_adapter_available (stream->adapter);
-      if (n < 188 * 100) {
-        /* skipped (too early) */
-      } else {
-        ChunkCallback *chunk_callback;
-
-        chunk_callback = g_malloc0 (sizeof (ChunkCallback));
-        chunk_callback->data = gst_adapter_take (stream->adapter, n);
-        chunk_callback->n = n;
-        chunk_callback->stream = stream;
-
-        g_idle_add (gss_program_add_hls_chunk_callback, chunk_callback);
-      }
-    }
 
-    gst_adapter_push (stream->adapter, gst_buffer_ref (buffer));
+    gss_hls_push_buffer (stream, buffer, GST_BUFFER_DATA (buffer),
+        GST_BUFFER_SIZE (buffer));
   } else {
     /* got event */
   }
@@ -233,25 +327,41 @@ sink_data_probe_callback (GstPad * pad, GstMiniObject * mo, gpointer user_data)
 #endif
 
 void
-gss_program_add_hls_chunk (GssStream * stream, SoupBuffer * buf)
+gss_program_add_hls_chunk (GssStream * stream, GPtrArray * buffers,
+    guint64 duration, gboolean discontinuity)
 {
+  GssProgram *program = stream->program;
   GssHLSSegment *segment;
+  int rounded;
 
   segment = &stream->chunks[stream->n_chunks % GSS_STREAM_HLS_CHUNKS];
 
-  if (segment->buffer) {
+  if (segment->buffers) {
     gss_server_remove_resource (GSS_OBJECT_SERVER (stream->program),
         segment->location);
     g_free (segment->location);
-    soup_buffer_free (segment->buffer);
+    g_ptr_array_free (segment->buffers, TRUE);
   }
   segment->index = stream->n_chunks;
-  segment->buffer = buf;
+  segment->buffers = buffers;
   segment->location = g_strdup_printf ("/%s-%dx%d-%dkbps%s-%05d.ts",
       GSS_OBJECT_NAME (stream->program), stream->width, stream->height,
       stream->bitrate / 1000, gss_stream_type_get_mod (stream->type),
       stream->n_chunks);
-  segment->duration = stream->program->hls.target_duration;
+  segment->duration = duration;
+  segment->discontinuity = discontinuity;
+  if (discontinuity)
+    stream->hls.discontinuity_sequence++;
+  segment->discontinuity_sequence = stream->hls.discontinuity_sequence;
+
+  /* EXTINF durations rounded to the nearest integer must not exceed the
+   * target duration, which clients don't expect to change.  The key
+   * frame interval of the source is too long. */
+  rounded = (duration + GSS_HLS_CLOCK_RATE / 2) / GSS_HLS_CLOCK_RATE;
+  if (rounded > program->hls.target_duration) {
+    GST_WARNING ("segment of %d s exceeds target duration of %d s", rounded,
+        program->hls.target_duration);
+  }
 
   stream->hls.need_index_update = TRUE;
 
@@ -282,6 +392,16 @@ gss_hls_update_index (GssStream * stream)
   g_string_append_printf (s, "#EXT-X-TARGETDURATION:%d\n",
       program->hls.target_duration);
   g_string_append_printf (s, "#EXT-X-MEDIA-SEQUENCE:%d\n", seq_num);
+  if (seq_num < stream->n_chunks) {
+    GssHLSSegment *first = &stream->chunks[seq_num % GSS_STREAM_HLS_CHUNKS];
+    int dsn;
+
+    /* discontinuities before the first segment */
+    dsn = first->discontinuity_sequence - (first->discontinuity ? 1 : 0);
+    if (dsn > 0) {
+      g_string_append_printf (s, "#EXT-X-DISCONTINUITY-SEQUENCE:%d\n", dsn);
+    }
+  }
   if (program->hls.is_encrypted) {
     g_string_append_printf (s, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s\"",
         program->hls.key_uri);
@@ -300,16 +420,21 @@ gss_hls_update_index (GssStream * stream)
     g_string_append (s, "#EXT-X-PROGRAM-DATE-TIME:YYYY-MM-DDThh:mm:ssZ\n");
   }
   g_string_append (s, "#EXT-X-ALLOW-CACHE:NO\n");
-  g_string_append (s, "#EXT-X-VERSION:1\n");
+  g_string_append (s, "#EXT-X-VERSION:3\n");
 
   for (i = seq_num; i < stream->n_chunks; i++) {
     GssHLSSegment *segment = &stream->chunks[i % GSS_STREAM_HLS_CHUNKS];
+    char duration[G_ASCII_DTOSTR_BUF_SIZE];
 
+    g_ascii_formatd (duration, sizeof (duration), "%.3f",
+        (double) segment->duration / GSS_HLS_CLOCK_RATE);
+    if (segment->discontinuity) {
+      g_string_append (s, "#EXT-X-DISCONTINUITY\n");
+    }
     g_string_append_printf (s,
-        "#EXTINF:%d,\n"
+        "#EXTINF:%s,\n"
         "%s%s\n",
-        segment->duration, GSS_OBJECT_SERVER (program)->base_url,
-        segment->location);
+        duration, GSS_OBJECT_SERVER (program)->base_url, segment->location);
   }
 
   if (stream->hls.at_eos) {
@@ -319,6 +444,11 @@ gss_hls_update_index (GssStream * stream)
   if (stream->hls.index_buffer) {
     soup_buffer_free (stream->hls.index_buffer);
   }
+  if (stream->hls.index_gzip_buffer) {
+    soup_buffer_free (stream->hls.index_gzip_buffer);
+    stream->hls.index_gzip_buffer = NULL;
+  }
+  stream->hls.index_gzip_done = FALSE;
   stream->hls.index_buffer = soup_buffer_new (SOUP_MEMORY_TAKE, s->str, s->len);
   g_string_free (s, FALSE);
 
@@ -356,12 +486,40 @@ gss_hls_update_variant (GssProgram * program)
   if (program->hls.variant_buffer) {
     soup_buffer_free (program->hls.variant_buffer);
   }
+  if (program->hls.variant_gzip_buffer) {
+    soup_buffer_free (program->hls.variant_gzip_buffer);
+    program->hls.variant_gzip_buffer = NULL;
+  }
+  program->hls.variant_gzip_done = FALSE;
   program->hls.variant_buffer =
       soup_buffer_new (SOUP_MEMORY_TAKE, s->str, s->len);
   g_string_free (s, FALSE);
 
 }
 
+/* Appends the playlist in @buffer, or its compressed form if the client
+ * accepts gzip.  The compressed form is kept in @gzip_buffer until the
+ * playlist changes.  @gzip_done records that compression was tried, so
+ * that playlists that are not worth compressing are not tried again. */
+static void
+gss_hls_append_playlist (GssTransaction * t, SoupBuffer * buffer,
+    SoupBuffer ** gzip_buffer, gboolean * gzip_done)
+{
+  if (gss_compress_accept_gzip (t)) {
+    if (!*gzip_done) {
+      *gzip_buffer = gss_compress_gzip (buffer->data, buffer->length);
+      *gzip_done = TRUE;
+    }
+    if (*gzip_buffer) {
+      gss_compress_set_gzip_headers (t);
+      soup_message_body_append_buffer (t->msg->response_body, *gzip_buffer);
+      return;
+    }
+  }
+
+  soup_message_body_append_buffer (t->msg->response_body, buffer);
+}
+
 static void
 gss_hls_handle_m3u8 (GssTransaction * t)
 {
@@ -372,8 +530,8 @@ gss_hls_handle_m3u8 (GssTransaction * t)
   soup_message_set_status (t->msg, SOUP_STATUS_OK);
   soup_message_headers_replace (t->msg->response_headers,
       "Cache-Control", "no-store");
-  soup_message_body_append_buffer (t->msg->response_body,
-      program->hls.variant_buffer);
+  gss_hls_append_playlist (t, program->hls.variant_buffer,
+      &program->hls.variant_gzip_buffer, &program->hls.variant_gzip_done);
 }
 
 static void
@@ -388,21 +546,25 @@ gss_hls_handle_stream_m3u8 (GssTransaction * t)
   soup_message_set_status (t->msg, SOUP_STATUS_OK);
   soup_message_headers_replace (t->msg->response_headers,
       "Cache-Control", "no-store");
-  soup_message_body_append_buffer (t->msg->response_body,
-      stream->hls.index_buffer);
+  gss_hls_append_playlist (t, stream->hls.index_buffer,
+      &stream->hls.index_gzip_buffer, &stream->hls.index_gzip_done);
 }
 
 static void
 gss_hls_handle_ts_chunk (GssTransaction * t)
 {
   GssHLSSegment *segment = (GssHLSSegment *) t->resource->priv;
+  guint i;
 
   soup_message_set_status (t->msg, SOUP_STATUS_OK);
 
   soup_message_headers_replace (t->msg->response_headers,
       "Cache-Control", "no-store");
 
-  soup_message_body_append_buffer (t->msg->response_body, segment->buffer);
+  for (i = 0; i < segment->buffers->len; i++) {
+    soup_message_body_append_buffer (t->msg->response_body,
+        g_ptr_array_index (segment->buffers, i));
+  }
 }
 
 void
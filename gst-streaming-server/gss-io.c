@@ -0,0 +1,99 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include <gst/gst.h>
+
+#include "gss-io.h"
+#include "gss-log.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * SECTION:gss-io
+ * @short_description: File reads
+ *
+ * Helpers for reading from files shared by the async worker threads.
+ * Reads are positioned, so the file offset of a descriptor is never
+ * used, and scatter/gather, so that runs of chunks, such as the samples
+ * of one media fragment, can be read with a single system call.
+ */
+
+/* Advances @iov and @n_iov past the first @n bytes. */
+static void
+gss_io_iov_skip (struct iovec **iov, int *n_iov, gsize n)
+{
+  while (*n_iov > 0 && n >= (*iov)[0].iov_len) {
+    n -= (*iov)[0].iov_len;
+    (*iov)++;
+    (*n_iov)--;
+  }
+  if (*n_iov > 0) {
+    (*iov)[0].iov_base = (guint8 *) (*iov)[0].iov_base + n;
+    (*iov)[0].iov_len -= n;
+  }
+}
+
+/**
+ * gss_io_preadv:
+ * @fd: file descriptor to read from
+ * @iov: (inout): buffers to fill.  The array is modified.
+ * @n_iov: number of entries in @iov
+ * @offset: file offset
+ * @error: location for a #GError, or %NULL
+ *
+ * Fills all of @iov from @fd, starting at @offset, retrying after short
+ * reads.  Reaching the end of the file is an error.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+gss_io_preadv (int fd, struct iovec *iov, int n_iov, off_t offset,
+    GError ** error)
+{
+  ssize_t n;
+
+  while (n_iov > 0) {
+    n = preadv (fd, iov, n_iov, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      GST_WARNING ("failed to read %" G_GSIZE_FORMAT " bytes at %"
+          G_GUINT64_FORMAT " error=\"%s\"", iov[0].iov_len,
+          (guint64) offset, (n < 0) ? g_strerror (errno) : "short read");
+      if (error) {
+        *error = g_error_new (_gss_error_quark, GSS_ERROR_FILE_READ,
+            "failed to read from file");
+      }
+      return FALSE;
+    }
+
+    /* skip over whatever was completely filled and retry the rest */
+    offset += n;
+    gss_io_iov_skip (&iov, &n_iov, n);
+  }
+
+  return TRUE;
+}
@@ -34,6 +34,7 @@
 #include "gss-isom.h"
 #include "gss-isom-boxes.h"
 #include "gss-playready.h"
+#include "gss-log.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -41,6 +42,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
 #include <openssl/aes.h>
 
 /**
@@ -128,6 +131,8 @@ static void gss_isom_parser_fragmentize_track_audio (GssIsomTrack * audio_track,
     GssIsomTrack * video_track, gboolean is_dash);
 
 static guint64 gss_isom_moof_get_duration (GssIsomFragment * fragment);
+static void gss_isom_parser_fragmentize_finish (GssIsomParser * file,
+    GssIsomTrack * video_track, GssIsomTrack * audio_track);
 
 
 #define CHECK_END(br) do { \
@@ -154,7 +159,8 @@ gss_isom_parser_new (void)
 void
 gss_isom_parser_free (GssIsomParser * parser)
 {
-  gss_isom_movie_free (parser->movie);
+  if (parser->movie)
+    gss_isom_movie_free (parser->movie);
 
   g_free (parser->filename);
   g_free (parser->data);
@@ -170,19 +176,234 @@ gss_isom_track_get_fragment (GssIsomTrack * track, int index)
   return track->fragments[index];
 }
 
-GssIsomFragment *
-gss_isom_track_get_fragment_by_timestamp (GssIsomTrack * track,
+/**
+ * gss_isom_track_build_fragment_index:
+ * @track: a #GssIsomTrack
+ *
+ * Builds the arrays of fragment timestamps and offsets used by the
+ * bisecting lookup functions.  Must be called again whenever fragment
+ * timestamps or offsets change.  Fragments are expected to be in
+ * presentation and file order, which is how they are created.
+ */
+void
+gss_isom_track_build_fragment_index (GssIsomTrack * track)
+{
+  int i;
+
+  g_return_if_fail (track != NULL);
+
+  g_free (track->fragment_timestamps);
+  g_free (track->fragment_offsets);
+  track->fragment_timestamps = g_malloc (sizeof (guint64) *
+      MAX (track->n_fragments, 1));
+  track->fragment_offsets = g_malloc (sizeof (guint64) *
+      MAX (track->n_fragments, 1));
+  for (i = 0; i < track->n_fragments; i++) {
+    track->fragment_timestamps[i] = track->fragments[i]->timestamp;
+    track->fragment_offsets[i] = track->fragments[i]->offset;
+    if (i > 0 && (track->fragment_timestamps[i] <
+            track->fragment_timestamps[i - 1] ||
+            track->fragment_offsets[i] < track->fragment_offsets[i - 1])) {
+      GST_WARNING ("fragments of track %d out of order, using linear search",
+          track->tkhd.track_id);
+      g_free (track->fragment_timestamps);
+      g_free (track->fragment_offsets);
+      track->fragment_timestamps = NULL;
+      track->fragment_offsets = NULL;
+      return;
+    }
+  }
+}
+
+static gsize
+gss_isom_fragment_get_memory_size (GssIsomFragment * fragment)
+{
+  gsize size;
+
+  size = sizeof (GssIsomFragment);
+  size += fragment->moof_size;
+  size += fragment->mdat_header_size;
+  if (fragment->sglist) {
+    size += sizeof (GssSGList);
+    size += fragment->sglist->n_chunks * sizeof (GssSGChunk);
+  }
+  size += fragment->trun.sample_count * sizeof (GssBoxTrunSample);
+  if (fragment->sdtp.sample_flags) {
+    size += fragment->trun.sample_count;
+  }
+  size += fragment->sample_encryption.sample_count *
+      sizeof (GssBoxUUIDSampleEncryptionSample);
+  if (fragment->saiz.sizes) {
+    size += fragment->saiz.sample_count;
+  }
+
+  return size;
+}
+
+/**
+ * gss_isom_track_get_memory_size:
+ * @track: a #GssIsomTrack
+ *
+ * Returns: an estimate of the heap memory held by @track, including its
+ *   fragments and serialized headers
+ */
+gsize
+gss_isom_track_get_memory_size (GssIsomTrack * track)
+{
+  gsize size;
+  int i;
+
+  g_return_val_if_fail (track != NULL, 0);
+
+  size = sizeof (GssIsomTrack);
+  size += track->n_fragments_alloc * sizeof (GssIsomFragment *);
+  for (i = 0; i < track->n_fragments; i++) {
+    size += gss_isom_fragment_get_memory_size (track->fragments[i]);
+  }
+  if (track->fragment_timestamps) {
+    size += track->n_fragments * 2 * sizeof (guint64);
+  }
+  size += track->stsz.sample_count * sizeof (guint32);
+  size += track->stco.entry_count * sizeof (guint64);
+  size += track->stss.entry_count * sizeof (guint32);
+  size += track->stts.entry_count * sizeof (GssBoxSttsEntry);
+  size += track->ctts.entry_count * sizeof (GssBoxCttsEntry);
+  size += track->stsc.entry_count * sizeof (GssBoxStscEntry);
+  size += track->ccff_header_size;
+  size += track->dash_header_and_sidx_size;
+  size += track->esds.codec_data_len;
+  size += track->esds_store.size;
+
+  return size;
+}
+
+/**
+ * gss_isom_parser_get_memory_size:
+ * @parser: a #GssIsomParser
+ *
+ * Returns: an estimate of the heap memory held by @parser once the file
+ *   has been parsed.  The file itself is only mapped or read while
+ *   parsing, so it is not included.
+ */
+gsize
+gss_isom_parser_get_memory_size (GssIsomParser * parser)
+{
+  GssIsomMovie *movie;
+  gsize size;
+  int i;
+
+  g_return_val_if_fail (parser != NULL, 0);
+
+  movie = parser->movie;
+  size = sizeof (GssIsomParser);
+  if (parser->filename) {
+    size += strlen (parser->filename) + 1;
+  }
+  size += parser->pdin.size + parser->bloc.size;
+  if (movie) {
+    size += sizeof (GssIsomMovie);
+    size += movie->n_tracks * sizeof (GssIsomTrack *);
+    size += movie->meta.size + movie->hdlr.size + movie->ilst.size +
+        movie->xtra.size + movie->iods.size + movie->mvex.size +
+        movie->ainf.size;
+    for (i = 0; i < movie->n_tracks; i++) {
+      size += gss_isom_track_get_memory_size (movie->tracks[i]);
+    }
+  }
+
+  return size;
+}
+
+/* Returns the index of the last entry in @values (sorted ascending) that
+ * is less than or equal to @value, or -1 if there is none. */
+static int
+bisect_uint64 (const guint64 * values, int n_values, guint64 value)
+{
+  int lo = 0;
+  int hi = n_values;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (values[mid] <= value) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo - 1;
+}
+
+/**
+ * gss_isom_track_find_fragment_by_timestamp:
+ * @track: a #GssIsomTrack
+ * @timestamp: a timestamp in fragment units
+ *
+ * Returns: the index of the fragment starting exactly at @timestamp,
+ *   or -1
+ */
+int
+gss_isom_track_find_fragment_by_timestamp (GssIsomTrack * track,
     guint64 timestamp)
 {
   int i;
 
+  g_return_val_if_fail (track != NULL, -1);
+
+  if (track->fragment_timestamps) {
+    i = bisect_uint64 (track->fragment_timestamps, track->n_fragments,
+        timestamp);
+    if (i >= 0 && track->fragment_timestamps[i] == timestamp)
+      return i;
+    return -1;
+  }
+
   for (i = 0; i < track->n_fragments; i++) {
     if (track->fragments[i]->timestamp == timestamp) {
-      return track->fragments[i];
+      return i;
     }
   }
+  return -1;
+}
 
-  return NULL;
+/**
+ * gss_isom_track_find_fragment_by_offset:
+ * @track: a #GssIsomTrack
+ * @offset: a byte offset relative to the first fragment
+ *
+ * Returns: the index of the fragment that contains @offset, i.e., the
+ *   last fragment starting at or before @offset, or 0 if @offset is
+ *   before the first fragment
+ */
+int
+gss_isom_track_find_fragment_by_offset (GssIsomTrack * track, guint64 offset)
+{
+  int i;
+
+  g_return_val_if_fail (track != NULL, 0);
+
+  if (track->fragment_offsets) {
+    i = bisect_uint64 (track->fragment_offsets, track->n_fragments, offset);
+    return MAX (i, 0);
+  }
+
+  for (i = 0; i < track->n_fragments - 1; i++) {
+    if (track->fragments[i + 1]->offset > offset)
+      break;
+  }
+  return MAX (i, 0);
+}
+
+GssIsomFragment *
+gss_isom_track_get_fragment_by_timestamp (GssIsomTrack * track,
+    guint64 timestamp)
+{
+  int i;
+
+  i = gss_isom_track_find_fragment_by_timestamp (track, timestamp);
+  if (i < 0)
+    return NULL;
+
+  return track->fragments[i];
 }
 
 gboolean
@@ -229,6 +450,82 @@ gss_isom_parser_load_chunk (GssIsomParser * parser, guint64 offset,
   file_read (parser, parser->data, parser->data_offset, parser->data_size);
 }
 
+/* Returns a pointer to @size bytes of the file at @offset.  If the file
+ * is mapped, boxes are parsed in place.  Otherwise the data is read into
+ * parser->data, which is only valid until the next call. */
+static const guint8 *
+gss_isom_parser_peek (GssIsomParser * parser, guint64 offset, guint64 size)
+{
+  if (size < 8 || offset + size > parser->file_size) {
+    GST_ERROR ("box at offset %" G_GUINT64_FORMAT " with size %"
+        G_GUINT64_FORMAT " extends past end of file", offset, size);
+    parser->error = TRUE;
+    return NULL;
+  }
+
+  if (parser->map_data) {
+    return parser->map_data + offset;
+  }
+
+  gss_isom_parser_load_chunk (parser, offset, size);
+  if (parser->error)
+    return NULL;
+  return parser->data;
+}
+
+static void
+gss_isom_parser_map (GssIsomParser * parser)
+{
+  void *map;
+
+  if (parser->file_size == 0)
+    return;
+
+  map = mmap (NULL, parser->file_size, PROT_READ, MAP_PRIVATE, parser->fd, 0);
+  if (map == MAP_FAILED) {
+    GST_DEBUG ("mmap of %s failed (%s), reading instead", parser->filename,
+        strerror (errno));
+    return;
+  }
+  parser->map_data = map;
+}
+
+static void
+gss_isom_parser_close (GssIsomParser * parser)
+{
+  if (parser->map_data) {
+    munmap (parser->map_data, parser->file_size);
+    parser->map_data = NULL;
+  }
+  g_free (parser->data);
+  parser->data = NULL;
+  parser->data_size = 0;
+  close (parser->fd);
+  parser->fd = -1;
+}
+
+static void
+gss_isom_parser_read_moov (GssIsomParser * parser, guint64 offset,
+    guint64 size)
+{
+  GstByteReader br;
+  const guint8 *data;
+  GssIsomMovie *movie;
+
+  parser->moov_offset = offset;
+  parser->moov_size = size;
+
+  data = gss_isom_parser_peek (parser, offset, size);
+  if (data == NULL)
+    return;
+  gst_byte_reader_init (&br, data + 8, size - 8);
+
+  movie = gss_isom_movie_new ();
+  gss_isom_parse_moov (parser, movie, &br);
+
+  parser->movie = movie;
+}
+
 gboolean
 gss_isom_parser_parse_file (GssIsomParser * parser, const char *filename)
 {
@@ -253,16 +550,26 @@ gss_isom_parser_parse_file (GssIsomParser * parser, const char *filename)
     parser->file_size = sb.st_size;
   }
 
+  gss_isom_parser_map (parser);
+
   parser->offset = 0;
   while (!parser->error && parser->offset < parser->file_size) {
     guint8 buffer[16];
+    const guint8 *header;
+    guint64 header_size;
     guint64 size = 0;
     guint32 size32 = 0;
     guint32 atom = 0;
     GstByteReader br;
 
-    file_read (parser, buffer, parser->offset, 16);
-    gst_byte_reader_init (&br, buffer, 16);
+    header_size = MIN (16, parser->file_size - parser->offset);
+    if (parser->map_data) {
+      header = parser->map_data + parser->offset;
+    } else {
+      file_read (parser, buffer, parser->offset, header_size);
+      header = buffer;
+    }
+    gst_byte_reader_init (&br, header, header_size);
 
     gst_byte_reader_get_uint32_be (&br, &size32);
     gst_byte_reader_get_uint32_le (&br, &atom);
@@ -273,18 +580,27 @@ gss_isom_parser_parse_file (GssIsomParser * parser, const char *filename)
     } else {
       size = size32;
     }
+    if (size < 8) {
+      GST_ERROR ("bad box size %" G_GUINT64_FORMAT " at offset %"
+          G_GUINT64_FORMAT, size, parser->offset);
+      parser->error = TRUE;
+      break;
+    }
 
     if (atom == GST_MAKE_FOURCC ('f', 't', 'y', 'p')) {
-      gss_isom_parser_load_chunk (parser, parser->offset, size);
-
+      parser->ftyp_offset = parser->offset;
+      parser->ftyp_size = size;
       gss_isom_parse_ftyp (parser, parser->offset, size);
     } else if (atom == GST_MAKE_FOURCC ('m', 'o', 'o', 'f')) {
       GstByteReader br;
+      const guint8 *data;
       GssIsomFragment *fragment;
       GssIsomTrack *track;
 
-      gss_isom_parser_load_chunk (parser, parser->offset, size);
-      gst_byte_reader_init (&br, parser->data + 8, size - 8);
+      data = gss_isom_parser_peek (parser, parser->offset, size);
+      if (data == NULL)
+        break;
+      gst_byte_reader_init (&br, data + 8, size - 8);
 
       fragment = gss_isom_fragment_new ();
       gss_isom_parse_moof (parser, fragment, &br);
@@ -313,8 +629,7 @@ gss_isom_parser_parse_file (GssIsomParser * parser, const char *filename)
       if (parser->is_isml && parser->current_fragment == NULL) {
         GST_ERROR ("mdat with no moof, broken file");
         parser->error = TRUE;
-        close (parser->fd);
-        parser->fd = -1;
+        gss_isom_parser_close (parser);
         return FALSE;
       }
 
@@ -328,19 +643,7 @@ gss_isom_parser_parse_file (GssIsomParser * parser, const char *filename)
     } else if (atom == GST_MAKE_FOURCC ('m', 'f', 'r', 'a')) {
       gss_isom_parse_mfra (parser, parser->offset, size);
     } else if (atom == GST_MAKE_FOURCC ('m', 'o', 'o', 'v')) {
-      GstByteReader br;
-      guint8 *data;
-      GssIsomMovie *movie;
-
-      data = g_malloc (size);
-      file_read (parser, data, parser->offset, size);
-      gst_byte_reader_init (&br, data + 8, size - 8);
-
-      movie = gss_isom_movie_new ();
-      gss_isom_parse_moov (parser, movie, &br);
-
-      parser->movie = movie;
-      g_free (data);
+      gss_isom_parser_read_moov (parser, parser->offset, size);
     } else if (atom == GST_MAKE_FOURCC ('u', 'u', 'i', 'd')) {
       guint8 uuid[16];
 
@@ -388,15 +691,13 @@ gss_isom_parser_parse_file (GssIsomParser * parser, const char *filename)
 
   if (parser->error) {
     GST_ERROR ("file error");
-    close (parser->fd);
-    parser->fd = -1;
+    gss_isom_parser_close (parser);
     return FALSE;
   }
 
   gss_isom_parser_fixup (parser);
 
-  close (parser->fd);
-  parser->fd = -1;
+  gss_isom_parser_close (parser);
   return TRUE;
 }
 
@@ -453,6 +754,8 @@ gss_isom_track_free (GssIsomTrack * track)
   g_free (track->esds_store.data);
   g_free (track->ccff_header_data);
   g_free (track->dash_header_data);
+  g_free (track->fragment_timestamps);
+  g_free (track->fragment_offsets);
   g_free (track);
 }
 
@@ -555,14 +858,12 @@ static void
 gss_isom_parse_ftyp (GssIsomParser * file, guint64 offset, guint64 size)
 {
   GstByteReader br;
-  guint8 *data;
+  const guint8 *data;
   guint32 atom = 0;
   guint32 tmp = 0;
-  gboolean ret;
 
-  data = g_malloc (size);
-  ret = file_read (file, data, file->offset, size);
-  if (!ret) {
+  data = gss_isom_parser_peek (file, offset, size);
+  if (data == NULL) {
     return;
   }
 
@@ -610,7 +911,6 @@ gss_isom_parse_ftyp (GssIsomParser * file, guint64 offset, guint64 size)
           GST_FOURCC_ARGS (atom));
     }
   }
-  g_free (data);
 }
 
 static void
@@ -3476,6 +3776,42 @@ gss_isom_movie_serialize_track_ccff (GssIsomMovie * movie, GssIsomTrack * track,
   *data = gst_byte_writer_free_and_get_data (bw);
 }
 
+/* CMAF header (ISO/IEC 23000-19) for a single track that is being
+ * fragmented live.  Unlike the other headers, there is no mehd, since
+ * the duration of the movie isn't known. */
+void
+gss_isom_movie_serialize_track_cmaf (GssIsomMovie * movie,
+    GssIsomTrack * track, guint8 ** data, gsize * size)
+{
+  GstByteWriter *bw;
+  int offset;
+  int offset_moov;
+  int offset_mvex;
+
+  bw = gst_byte_writer_new ();
+
+  offset = BOX_INIT (bw, GST_MAKE_FOURCC ('f', 't', 'y', 'p'));
+  gst_byte_writer_put_uint32_le (bw, GST_MAKE_FOURCC ('c', 'm', 'f', 'c'));
+  gst_byte_writer_put_uint32_be (bw, 0x00000000);
+  gst_byte_writer_put_uint32_le (bw, GST_MAKE_FOURCC ('c', 'm', 'f', 'c'));
+  gst_byte_writer_put_uint32_le (bw, GST_MAKE_FOURCC ('i', 's', 'o', '6'));
+  BOX_FINISH (bw, offset);
+
+  offset_moov = BOX_INIT (bw, GST_MAKE_FOURCC ('m', 'o', 'o', 'v'));
+
+  gss_isom_mvhd_serialize (&movie->mvhd, bw);
+  gss_isom_track_serialize (track, bw);
+
+  offset_mvex = BOX_INIT (bw, GST_MAKE_FOURCC ('m', 'v', 'e', 'x'));
+  gss_isom_trex_serialize (&track->trex, bw);
+  BOX_FINISH (bw, offset_mvex);
+
+  BOX_FINISH (bw, offset_moov);
+
+  *size = bw->parent.byte;
+  *data = gst_byte_writer_free_and_get_data (bw);
+}
+
 void
 gss_isom_movie_serialize_track_dash (GssIsomMovie * movie, GssIsomTrack * track,
     guint8 ** data, gsize * header_size, gsize * size)
@@ -3600,7 +3936,6 @@ gss_isom_parser_fragmentize (GssIsomParser * file, gboolean is_dash)
 {
   GssIsomTrack *video_track;
   GssIsomTrack *audio_track;
-  int n_fragments;
 
   video_track = gss_isom_movie_get_video_track (file->movie);
   if (video_track == NULL) {
@@ -3632,19 +3967,31 @@ gss_isom_parser_fragmentize (GssIsomParser * file, gboolean is_dash)
 
   gss_isom_parser_fragmentize_track_audio (audio_track, video_track, is_dash);
 
+  gss_isom_parser_fragmentize_finish (file, video_track, audio_track);
+}
+
+/* Movie and track header fixups once both tracks have been split into
+ * fragments.  Also used when the fragments come from an index. */
+static void
+gss_isom_parser_fragmentize_finish (GssIsomParser * file,
+    GssIsomTrack * video_track, GssIsomTrack * audio_track)
+{
+  int n_fragments;
+
   file->movie->mvhd.timescale = 10000000;
   fixup_track (video_track, TRUE);
   fixup_track (audio_track, FALSE);
 
   file->movie->mehd.version = 1;
-  /* FIXME */
-  n_fragments = video_track->stss.entry_count;
+  n_fragments = video_track->n_fragments;
   file->movie->mehd.fragment_duration =
       video_track->fragments[n_fragments - 1]->timestamp +
       video_track->fragments[n_fragments - 1]->duration;
   file->movie->mvhd.duration =
       video_track->fragments[n_fragments - 1]->timestamp +
       video_track->fragments[n_fragments - 1]->duration;
+
+  file->fragmentized = TRUE;
 }
 
 
@@ -3693,6 +4040,8 @@ gss_isom_parser_fragmentize_track_audio (GssIsomTrack * audio_track,
     if (is_dash) {
       audio_fragment->tfdt.present = TRUE;
     }
+    /* 10 MHz timestamps overflow 32 bits after 7 minutes */
+    audio_fragment->tfdt.version = 1;
     audio_fragment->tfhd.track_id = audio_track->tkhd.track_id;
     audio_fragment->tfhd.flags = 0;
     audio_fragment->tfhd.default_sample_duration = 0;
@@ -3736,6 +4085,8 @@ gss_isom_parser_fragmentize_track_audio (GssIsomTrack * audio_track,
 
       gss_isom_sample_iter_iterate (&audio_iter);
     }
+    /* consecutive samples are usually stored contiguously */
+    gss_sglist_coalesce (audio_fragment->sglist);
     audio_fragment->trun.samples = samples;
     audio_fragment->trun.version = 1;
     /* FIXME not all strictly necessary, should be handled in serializer */
@@ -3842,6 +4193,7 @@ gss_isom_parser_fragmentize_track_video (GssIsomTrack * video_track,
 
       gss_isom_sample_iter_iterate (&video_iter);
     }
+    gss_sglist_coalesce (video_fragment->sglist);
     video_fragment->trun.samples = samples;
     /* FIXME not all strictly necessary, should be handled in serializer */
     video_fragment->trun.flags =
@@ -4091,3 +4443,524 @@ gss_isom_track_convert_h264_codec_data (GssIsomTrack * track)
   track->esds.codec_data_len = 4 + len1 + 4 + len2;
   g_free (codec_data);
 }
+
+
+/* Fragment index
+ *
+ * Parsing every moof of a fragmented file, or splitting a progressive
+ * file into fragments, takes far longer than parsing the moov.  The
+ * index stores the resulting fragment tables and scatter/gather lists
+ * in a sidecar file next to the source file, so that loading only needs
+ * to parse the ftyp and moov boxes.  The index is only used if the size
+ * and modification time of the source file match. */
+
+#define GSS_ISOM_INDEX_MAGIC "GSSINDEX"
+#define GSS_ISOM_INDEX_VERSION 1
+
+#define GSS_ISOM_INDEX_FLAG_FRAGMENTIZED (1<<0)
+
+char *
+gss_isom_parser_get_index_filename (const char *filename)
+{
+  return g_strdup_printf ("%s.gssidx", filename);
+}
+
+static void
+gss_isom_index_write_fragment (GstByteWriter * bw, GssIsomFragment * fragment)
+{
+  int i;
+  int j;
+
+  gst_byte_writer_put_uint64_be (bw, fragment->offset);
+  gst_byte_writer_put_uint64_be (bw, fragment->moof_size);
+  gst_byte_writer_put_uint32_be (bw, fragment->mdat_size);
+  gst_byte_writer_put_uint64_be (bw, fragment->timestamp);
+  gst_byte_writer_put_uint64_be (bw, fragment->duration);
+
+  gst_byte_writer_put_uint8 (bw, fragment->mfhd.version);
+  gst_byte_writer_put_uint32_be (bw, fragment->mfhd.flags);
+  gst_byte_writer_put_uint32_be (bw, fragment->mfhd.sequence_number);
+
+  gst_byte_writer_put_uint8 (bw, fragment->tfhd.version);
+  gst_byte_writer_put_uint32_be (bw, fragment->tfhd.flags);
+  gst_byte_writer_put_uint32_be (bw, fragment->tfhd.track_id);
+  gst_byte_writer_put_uint32_be (bw, fragment->tfhd.default_sample_duration);
+  gst_byte_writer_put_uint32_be (bw, fragment->tfhd.default_sample_size);
+  gst_byte_writer_put_uint32_be (bw, fragment->tfhd.default_sample_flags);
+
+  gst_byte_writer_put_uint8 (bw, fragment->trun.version);
+  gst_byte_writer_put_uint32_be (bw, fragment->trun.flags);
+  gst_byte_writer_put_uint32_be (bw, fragment->trun.sample_count);
+  gst_byte_writer_put_uint32_be (bw, fragment->trun.data_offset);
+  gst_byte_writer_put_uint32_be (bw, fragment->trun.first_sample_flags);
+  for (i = 0; i < fragment->trun.sample_count; i++) {
+    GssBoxTrunSample *sample = &fragment->trun.samples[i];
+
+    gst_byte_writer_put_uint32_be (bw, sample->duration);
+    gst_byte_writer_put_uint32_be (bw, sample->size);
+    gst_byte_writer_put_uint32_be (bw, sample->flags);
+    gst_byte_writer_put_uint32_be (bw, sample->composition_time_offset);
+  }
+
+  gst_byte_writer_put_uint8 (bw, fragment->sdtp.present);
+  gst_byte_writer_put_uint8 (bw, fragment->sdtp.version);
+  gst_byte_writer_put_uint32_be (bw, fragment->sdtp.flags);
+  if (fragment->sdtp.present) {
+    gst_byte_writer_put_data (bw, fragment->sdtp.sample_flags,
+        fragment->trun.sample_count);
+  }
+
+  gst_byte_writer_put_uint8 (bw, fragment->tfdt.present);
+  gst_byte_writer_put_uint8 (bw, fragment->tfdt.version);
+  gst_byte_writer_put_uint32_be (bw, fragment->tfdt.flags);
+  gst_byte_writer_put_uint64_be (bw, fragment->tfdt.start_time);
+
+  gst_byte_writer_put_uint8 (bw, fragment->avcn.version);
+  gst_byte_writer_put_uint32_be (bw, fragment->avcn.flags);
+  gst_byte_writer_put_uint8 (bw, fragment->trik.version);
+  gst_byte_writer_put_uint32_be (bw, fragment->trik.flags);
+
+  gst_byte_writer_put_uint8 (bw, fragment->sample_encryption.present);
+  if (fragment->sample_encryption.present) {
+    GssBoxUUIDSampleEncryption *se = &fragment->sample_encryption;
+
+    gst_byte_writer_put_uint8 (bw, se->version);
+    gst_byte_writer_put_uint32_be (bw, se->flags);
+    gst_byte_writer_put_uint32_be (bw, se->algorithm_id);
+    gst_byte_writer_put_uint8 (bw, se->iv_size);
+    gst_byte_writer_put_data (bw, se->kid, 16);
+    gst_byte_writer_put_uint32_be (bw, se->sample_count);
+    for (i = 0; i < se->sample_count; i++) {
+      gst_byte_writer_put_uint64_be (bw, se->samples[i].iv);
+      gst_byte_writer_put_uint16_be (bw, se->samples[i].num_entries);
+      for (j = 0; j < se->samples[i].num_entries; j++) {
+        gst_byte_writer_put_uint16_be (bw,
+            se->samples[i].entries[j].bytes_of_clear_data);
+        gst_byte_writer_put_uint32_be (bw,
+            se->samples[i].entries[j].bytes_of_encrypted_data);
+      }
+    }
+  }
+
+  if (fragment->sglist) {
+    gst_byte_writer_put_uint32_be (bw, fragment->sglist->n_chunks);
+    for (i = 0; i < fragment->sglist->n_chunks; i++) {
+      gst_byte_writer_put_uint64_be (bw, fragment->sglist->chunks[i].offset);
+      gst_byte_writer_put_uint64_be (bw, fragment->sglist->chunks[i].size);
+    }
+  } else {
+    gst_byte_writer_put_uint32_be (bw, 0);
+  }
+}
+
+/**
+ * gss_isom_parser_save_index:
+ * @parser: a parser that has parsed, and if necessary fragmentized, a file
+ * @error: return location for a #GError
+ *
+ * Writes the fragment index for the parsed file next to it.  See
+ * gss_isom_parser_load_index().
+ *
+ * Returns: TRUE if the index was written
+ */
+gboolean
+gss_isom_parser_save_index (GssIsomParser * parser, GError ** error)
+{
+  GstByteWriter *bw;
+  struct stat sb;
+  char *index_filename;
+  guint8 *data;
+  gsize size;
+  gboolean ret;
+  int i;
+  int j;
+
+  g_return_val_if_fail (parser != NULL, FALSE);
+  g_return_val_if_fail (parser->movie != NULL, FALSE);
+
+  if (stat (parser->filename, &sb) < 0) {
+    g_set_error (error, _gss_error_quark, GSS_ERROR_FILE_OPEN,
+        "stat of %s failed: %s", parser->filename, strerror (errno));
+    return FALSE;
+  }
+
+  bw = gst_byte_writer_new ();
+  gst_byte_writer_put_data (bw, (const guint8 *) GSS_ISOM_INDEX_MAGIC, 8);
+  gst_byte_writer_put_uint32_be (bw, GSS_ISOM_INDEX_VERSION);
+  gst_byte_writer_put_uint64_be (bw, sb.st_size);
+  gst_byte_writer_put_uint64_be (bw, sb.st_mtime);
+  gst_byte_writer_put_uint32_be (bw,
+      parser->fragmentized ? GSS_ISOM_INDEX_FLAG_FRAGMENTIZED : 0);
+  gst_byte_writer_put_uint64_be (bw, parser->ftyp_offset);
+  gst_byte_writer_put_uint64_be (bw, parser->ftyp_size);
+  gst_byte_writer_put_uint64_be (bw, parser->moov_offset);
+  gst_byte_writer_put_uint64_be (bw, parser->moov_size);
+
+  gst_byte_writer_put_uint32_be (bw, parser->movie->n_tracks);
+  for (i = 0; i < parser->movie->n_tracks; i++) {
+    GssIsomTrack *track = parser->movie->tracks[i];
+
+    gst_byte_writer_put_uint32_be (bw, track->tkhd.track_id);
+    gst_byte_writer_put_uint32_be (bw, track->trex.track_id);
+    gst_byte_writer_put_uint32_be (bw,
+        track->trex.default_sample_description_index);
+    gst_byte_writer_put_uint32_be (bw, track->n_fragments);
+    for (j = 0; j < track->n_fragments; j++) {
+      gss_isom_index_write_fragment (bw, track->fragments[j]);
+    }
+  }
+
+  size = gst_byte_writer_get_size (bw);
+  data = gst_byte_writer_free_and_get_data (bw);
+
+  index_filename = gss_isom_parser_get_index_filename (parser->filename);
+  ret = g_file_set_contents (index_filename, (gchar *) data, size, error);
+  g_free (index_filename);
+  g_free (data);
+
+  return ret;
+}
+
+static gboolean
+gss_isom_index_read_fragment (GstByteReader * br, GssIsomFragment * fragment)
+{
+  guint32 mdat_size = 0;
+  guint32 n_chunks = 0;
+  guint8 present = 0;
+  const guint8 *data;
+  int i;
+  int j;
+
+  if (!(gst_byte_reader_get_uint64_be (br, &fragment->offset) &&
+          gst_byte_reader_get_uint64_be (br, &fragment->moof_size) &&
+          gst_byte_reader_get_uint32_be (br, &mdat_size) &&
+          gst_byte_reader_get_uint64_be (br, &fragment->timestamp) &&
+          gst_byte_reader_get_uint64_be (br, &fragment->duration))) {
+    return FALSE;
+  }
+  fragment->mdat_size = mdat_size;
+
+  if (!(gst_byte_reader_get_uint8 (br, &fragment->mfhd.version) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->mfhd.flags) &&
+          gst_byte_reader_get_uint32_be (br,
+              &fragment->mfhd.sequence_number))) {
+    return FALSE;
+  }
+
+  if (!(gst_byte_reader_get_uint8 (br, &fragment->tfhd.version) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->tfhd.flags) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->tfhd.track_id) &&
+          gst_byte_reader_get_uint32_be (br,
+              &fragment->tfhd.default_sample_duration) &&
+          gst_byte_reader_get_uint32_be (br,
+              &fragment->tfhd.default_sample_size) &&
+          gst_byte_reader_get_uint32_be (br,
+              &fragment->tfhd.default_sample_flags))) {
+    return FALSE;
+  }
+
+  if (!(gst_byte_reader_get_uint8 (br, &fragment->trun.version) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->trun.flags) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->trun.sample_count) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->trun.data_offset) &&
+          gst_byte_reader_get_uint32_be (br,
+              &fragment->trun.first_sample_flags))) {
+    return FALSE;
+  }
+  if (gst_byte_reader_get_remaining (br) / 16 < fragment->trun.sample_count) {
+    fragment->trun.sample_count = 0;
+    return FALSE;
+  }
+  fragment->trun.samples = g_malloc (sizeof (GssBoxTrunSample) *
+      fragment->trun.sample_count);
+  for (i = 0; i < fragment->trun.sample_count; i++) {
+    GssBoxTrunSample *sample = &fragment->trun.samples[i];
+
+    sample->duration = gst_byte_reader_get_uint32_be_unchecked (br);
+    sample->size = gst_byte_reader_get_uint32_be_unchecked (br);
+    sample->flags = gst_byte_reader_get_uint32_be_unchecked (br);
+    sample->composition_time_offset =
+        gst_byte_reader_get_uint32_be_unchecked (br);
+  }
+
+  if (!(gst_byte_reader_get_uint8 (br, &present) &&
+          gst_byte_reader_get_uint8 (br, &fragment->sdtp.version) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->sdtp.flags))) {
+    return FALSE;
+  }
+  fragment->sdtp.present = present;
+  if (present) {
+    if (!gst_byte_reader_dup_data (br, fragment->trun.sample_count,
+            &fragment->sdtp.sample_flags)) {
+      return FALSE;
+    }
+  }
+
+  if (!(gst_byte_reader_get_uint8 (br, &present) &&
+          gst_byte_reader_get_uint8 (br, &fragment->tfdt.version) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->tfdt.flags) &&
+          gst_byte_reader_get_uint64_be (br, &fragment->tfdt.start_time))) {
+    return FALSE;
+  }
+  fragment->tfdt.present = present;
+
+  if (!(gst_byte_reader_get_uint8 (br, &fragment->avcn.version) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->avcn.flags) &&
+          gst_byte_reader_get_uint8 (br, &fragment->trik.version) &&
+          gst_byte_reader_get_uint32_be (br, &fragment->trik.flags))) {
+    return FALSE;
+  }
+
+  if (!gst_byte_reader_get_uint8 (br, &present))
+    return FALSE;
+  if (present) {
+    GssBoxUUIDSampleEncryption *se = &fragment->sample_encryption;
+    guint32 sample_count = 0;
+
+    se->present = TRUE;
+    if (!(gst_byte_reader_get_uint8 (br, &se->version) &&
+            gst_byte_reader_get_uint32_be (br, &se->flags) &&
+            gst_byte_reader_get_uint32_be (br, &se->algorithm_id) &&
+            gst_byte_reader_get_uint8 (br, &se->iv_size) &&
+            gst_byte_reader_get_data (br, 16, &data) &&
+            gst_byte_reader_get_uint32_be (br, &sample_count))) {
+      return FALSE;
+    }
+    memcpy (se->kid, data, 16);
+    if (gst_byte_reader_get_remaining (br) / 10 < sample_count) {
+      return FALSE;
+    }
+    se->samples = g_malloc0 (sizeof (GssBoxUUIDSampleEncryptionSample) *
+        sample_count);
+    se->sample_count = sample_count;
+    for (i = 0; i < se->sample_count; i++) {
+      GssBoxUUIDSampleEncryptionSample *sample = &se->samples[i];
+
+      if (!(gst_byte_reader_get_uint64_be (br, &sample->iv) &&
+              gst_byte_reader_get_uint16_be (br, &sample->num_entries))) {
+        return FALSE;
+      }
+      if (gst_byte_reader_get_remaining (br) / 6 < sample->num_entries) {
+        return FALSE;
+      }
+      sample->entries = g_malloc (sizeof (GssBoxUUIDSampleEncryptionSampleEntry)
+          * sample->num_entries);
+      for (j = 0; j < sample->num_entries; j++) {
+        sample->entries[j].bytes_of_clear_data =
+            gst_byte_reader_get_uint16_be_unchecked (br);
+        sample->entries[j].bytes_of_encrypted_data =
+            gst_byte_reader_get_uint32_be_unchecked (br);
+      }
+    }
+  }
+
+  if (!gst_byte_reader_get_uint32_be (br, &n_chunks))
+    return FALSE;
+  if (n_chunks > 0) {
+    if (gst_byte_reader_get_remaining (br) / 16 < n_chunks) {
+      return FALSE;
+    }
+    fragment->sglist = gss_sglist_new (n_chunks);
+    for (i = 0; i < n_chunks; i++) {
+      fragment->sglist->chunks[i].offset =
+          gst_byte_reader_get_uint64_be_unchecked (br);
+      fragment->sglist->chunks[i].size =
+          gst_byte_reader_get_uint64_be_unchecked (br);
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gss_isom_index_read_tracks (GssIsomParser * parser, GstByteReader * br)
+{
+  guint32 n_tracks = 0;
+  int i;
+  int j;
+
+  if (!gst_byte_reader_get_uint32_be (br, &n_tracks))
+    return FALSE;
+  if (n_tracks != parser->movie->n_tracks) {
+    GST_WARNING ("index has %d tracks, file has %d", n_tracks,
+        parser->movie->n_tracks);
+    return FALSE;
+  }
+
+  for (i = 0; i < n_tracks; i++) {
+    GssIsomTrack *track = parser->movie->tracks[i];
+    guint32 n_fragments = 0;
+
+    if (!(gst_byte_reader_get_uint32_be (br, &track->tkhd.track_id) &&
+            gst_byte_reader_get_uint32_be (br, &track->trex.track_id) &&
+            gst_byte_reader_get_uint32_be (br,
+                &track->trex.default_sample_description_index) &&
+            gst_byte_reader_get_uint32_be (br, &n_fragments))) {
+      return FALSE;
+    }
+    if (track->n_fragments > 0) {
+      GST_WARNING ("track %d already has fragments", track->tkhd.track_id);
+      return FALSE;
+    }
+    if (gst_byte_reader_get_remaining (br) < n_fragments) {
+      return FALSE;
+    }
+
+    track->fragments = g_malloc0 (sizeof (GssIsomFragment *) * n_fragments);
+    track->n_fragments_alloc = n_fragments;
+    for (j = 0; j < n_fragments; j++) {
+      GssIsomFragment *fragment;
+
+      fragment = gss_isom_fragment_new ();
+      if (!gss_isom_index_read_fragment (br, fragment)) {
+        gss_isom_fragment_free (fragment);
+        return FALSE;
+      }
+      fragment->index = j;
+      track->fragments[j] = fragment;
+      track->n_fragments++;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+ * gss_isom_parser_load_index:
+ * @parser: a new parser
+ * @filename: the file to load
+ * @is_dash: whether fragments split from a progressive file get a
+ *   tfdt, as for gss_isom_parser_fragmentize()
+ *
+ * Loads @filename using the fragment index written by
+ * gss_isom_parser_save_index(), parsing only the ftyp and moov boxes of
+ * the file itself.  The result is the same as parsing the file with
+ * gss_isom_parser_parse_file() and fragmentizing it if necessary.
+ *
+ * If the index is missing, out of date or damaged, FALSE is returned
+ * and @parser must be freed; the caller should then parse the file
+ * normally with a new parser.
+ *
+ * Returns: TRUE if the file was loaded from the index
+ */
+gboolean
+gss_isom_parser_load_index (GssIsomParser * parser, const char *filename,
+    gboolean is_dash)
+{
+  GMappedFile *mapped_file;
+  GstByteReader br;
+  char *index_filename;
+  const guint8 *magic = NULL;
+  guint32 version = 0;
+  guint64 file_size = 0;
+  guint64 mtime = 0;
+  guint32 flags = 0;
+  struct stat sb;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (parser != NULL, FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  parser->fd = -1;
+  index_filename = gss_isom_parser_get_index_filename (filename);
+  mapped_file = g_mapped_file_new (index_filename, FALSE, NULL);
+  if (mapped_file == NULL) {
+    GST_DEBUG ("no index for %s", filename);
+    g_free (index_filename);
+    return FALSE;
+  }
+
+  gst_byte_reader_init (&br,
+      (const guint8 *) g_mapped_file_get_contents (mapped_file),
+      g_mapped_file_get_length (mapped_file));
+
+  if (!(gst_byte_reader_get_data (&br, 8, &magic) &&
+          memcmp (magic, GSS_ISOM_INDEX_MAGIC, 8) == 0 &&
+          gst_byte_reader_get_uint32_be (&br, &version) &&
+          version == GSS_ISOM_INDEX_VERSION &&
+          gst_byte_reader_get_uint64_be (&br, &file_size) &&
+          gst_byte_reader_get_uint64_be (&br, &mtime) &&
+          gst_byte_reader_get_uint32_be (&br, &flags) &&
+          gst_byte_reader_get_uint64_be (&br, &parser->ftyp_offset) &&
+          gst_byte_reader_get_uint64_be (&br, &parser->ftyp_size) &&
+          gst_byte_reader_get_uint64_be (&br, &parser->moov_offset) &&
+          gst_byte_reader_get_uint64_be (&br, &parser->moov_size))) {
+    GST_WARNING ("bad header in %s", index_filename);
+    goto out;
+  }
+
+  parser->filename = g_strdup (filename);
+  parser->fd = open (filename, O_RDONLY);
+  if (parser->fd < 0) {
+    GST_ERROR ("cannot open %s", filename);
+    goto out;
+  }
+  if (fstat (parser->fd, &sb) < 0) {
+    GST_ERROR ("stat failed");
+    goto out;
+  }
+  parser->file_size = sb.st_size;
+  if (file_size != sb.st_size || mtime != sb.st_mtime) {
+    GST_DEBUG ("index %s is out of date", index_filename);
+    goto out;
+  }
+
+  if (parser->moov_size < 8 ||
+      parser->moov_offset + parser->moov_size > parser->file_size) {
+    GST_WARNING ("bad moov location in %s", index_filename);
+    goto out;
+  }
+  if (parser->ftyp_size >= 8) {
+    parser->offset = parser->ftyp_offset;
+    gss_isom_parse_ftyp (parser, parser->ftyp_offset, parser->ftyp_size);
+  }
+  gss_isom_parser_read_moov (parser, parser->moov_offset, parser->moov_size);
+  if (parser->error || parser->movie == NULL) {
+    goto out;
+  }
+
+  if (!gss_isom_index_read_tracks (parser, &br)) {
+    GST_WARNING ("damaged index %s", index_filename);
+    goto out;
+  }
+
+  if (flags & GSS_ISOM_INDEX_FLAG_FRAGMENTIZED) {
+    GssIsomTrack *video_track;
+    GssIsomTrack *audio_track;
+    int i;
+    int j;
+
+    video_track = gss_isom_movie_get_video_track (parser->movie);
+    audio_track = gss_isom_movie_get_audio_track (parser->movie);
+    if (video_track == NULL || audio_track == NULL ||
+        video_track->n_fragments == 0) {
+      GST_WARNING ("index %s does not match tracks", index_filename);
+      goto out;
+    }
+
+    for (i = 0; i < parser->movie->n_tracks; i++) {
+      GssIsomTrack *track = parser->movie->tracks[i];
+
+      for (j = 0; j < track->n_fragments; j++) {
+        track->fragments[j]->tfdt.present = is_dash;
+        /* older indexes have 32-bit audio tfdts */
+        track->fragments[j]->tfdt.version = 1;
+      }
+    }
+
+    video_track->filename = parser->filename;
+    audio_track->filename = parser->filename;
+    gss_isom_parser_fragmentize_finish (parser, video_track, audio_track);
+  }
+
+  GST_DEBUG ("loaded %s from index", filename);
+  ret = TRUE;
+
+out:
+  if (parser->fd >= 0) {
+    gss_isom_parser_close (parser);
+  }
+  g_mapped_file_unref (mapped_file);
+  g_free (index_filename);
+  return ret;
+}
@@ -150,6 +150,11 @@ struct _GssIsomTrack
   int n_fragments;
   int n_fragments_alloc;
 
+  /* sorted copies of fragment timestamps and offsets for bisection,
+   * built by gss_isom_track_build_fragment_index() */
+  guint64 *fragment_timestamps;
+  guint64 *fragment_offsets;
+
   guint8 *ccff_header_data;
   gsize ccff_header_size;
 
@@ -185,8 +190,18 @@ struct _GssIsomParser
   guint64 data_offset;
   guint64 data_size;
 
+  /* whole file, while parsing */
+  guint8 *map_data;
+
   GssBoxStore pdin;
   GssBoxStore bloc;
+
+  /* location of the top-level boxes, recorded in the fragment index */
+  guint64 ftyp_offset;
+  guint64 ftyp_size;
+  guint64 moov_offset;
+  guint64 moov_size;
+  gboolean fragmentized;
 };
 
 struct _GssIsomSampleIterator
@@ -222,6 +237,13 @@ guint64 gss_isom_movie_get_duration (GssIsomMovie *movie);
 GssIsomFragment * gss_isom_track_get_fragment (GssIsomTrack * track, int index);
 GssIsomFragment * gss_isom_track_get_fragment_by_timestamp (GssIsomTrack *track,
     guint64 timestamp);
+void gss_isom_track_build_fragment_index (GssIsomTrack *track);
+gsize gss_isom_track_get_memory_size (GssIsomTrack *track);
+gsize gss_isom_parser_get_memory_size (GssIsomParser *parser);
+int gss_isom_track_find_fragment_by_timestamp (GssIsomTrack *track,
+    guint64 timestamp);
+int gss_isom_track_find_fragment_by_offset (GssIsomTrack *track,
+    guint64 offset);
 gboolean gss_isom_track_is_video (GssIsomTrack *track);
 
 void gss_isom_fragment_set_sample_encryption (GssIsomFragment *fragment,
@@ -232,6 +254,8 @@ void gss_isom_movie_serialize_track_ccff (GssIsomMovie * movie, GssIsomTrack *tr
     guint8 ** data, gsize *size);
 void gss_isom_movie_serialize_track_dash (GssIsomMovie * movie, GssIsomTrack *track,
     guint8 ** data, gsize *header_size, gsize *size);
+void gss_isom_movie_serialize_track_cmaf (GssIsomMovie * movie,
+    GssIsomTrack *track, guint8 ** data, gsize *size);
 void gss_isom_movie_serialize (GssIsomMovie * movie, guint8 ** data,
     int *size);
 void gss_isom_track_serialize_dash (GssIsomTrack *track, guint8 ** data, int *size);
@@ -241,6 +265,7 @@ void gss_isom_encrypt_samples (GssIsomFragment * fragment, guint8 * mdat_data,
 int gss_isom_fragment_get_n_samples (GssIsomFragment *fragment);
 
 GssIsomMovie *gss_isom_movie_new (void);
+GssIsomTrack *gss_isom_track_new (void);
 void gss_isom_movie_free (GssIsomMovie * movie);
 GssIsomTrack * gss_isom_movie_get_video_track (GssIsomMovie * movie);
 GssIsomTrack * gss_isom_movie_get_audio_track (GssIsomMovie * movie);
@@ -250,6 +275,10 @@ GssIsomFragment *gss_isom_fragment_new (void);
 void gss_isom_fragment_free (GssIsomFragment * fragment);
 
 void gss_isom_parser_fragmentize (GssIsomParser *file, gboolean is_dash);
+char * gss_isom_parser_get_index_filename (const char *filename);
+gboolean gss_isom_parser_save_index (GssIsomParser *parser, GError **error);
+gboolean gss_isom_parser_load_index (GssIsomParser *parser,
+    const char *filename, gboolean is_dash);
 #if 0
 void gss_isom_track_prepare_streaming (GssIsomMovie *movie, GssIsomTrack *track,
     const GssBoxPssh *pssh);
@@ -27,7 +27,8 @@ G_BEGIN_DECLS
 
 typedef enum {
   GSS_ERROR_FILE_SEEK,
-  GSS_ERROR_FILE_READ
+  GSS_ERROR_FILE_READ,
+  GSS_ERROR_FILE_OPEN
 } GssErrorEnum;
 
 extern GQuark _gss_error_quark;
@@ -30,6 +30,19 @@
  *
  */
 
+/* Latency histograms have power-of-two buckets, the first one ending at
+ * 64 us, the last one catching everything above about 1 s. */
+#define GSS_LATENCY_HISTOGRAM_FIRST_SHIFT 6
+#define GSS_LATENCY_HISTOGRAM_N_BUCKETS 16
+
+struct _GssLatencyHistogram
+{
+  GMutex lock;
+  guint64 counts[GSS_LATENCY_HISTOGRAM_N_BUCKETS];
+  guint64 count;
+  gint64 total;
+};
+
 
 GssMetrics *
 gss_metrics_new (void)
@@ -64,3 +77,176 @@ gss_metrics_remove_client (GssMetrics * metrics, int bitrate)
   metrics->n_clients--;
   metrics->bitrate -= bitrate;
 }
+
+GssLatencyHistogram *
+gss_latency_histogram_new (void)
+{
+  GssLatencyHistogram *histogram;
+
+  histogram = g_new0 (GssLatencyHistogram, 1);
+  g_mutex_init (&histogram->lock);
+
+  return histogram;
+}
+
+void
+gss_latency_histogram_free (GssLatencyHistogram * histogram)
+{
+  g_return_if_fail (histogram != NULL);
+
+  g_mutex_clear (&histogram->lock);
+  g_free (histogram);
+}
+
+/* upper bound of bucket @i, or -1 for the last bucket */
+static gint64
+gss_latency_histogram_bucket_limit (int i)
+{
+  if (i == GSS_LATENCY_HISTOGRAM_N_BUCKETS - 1)
+    return -1;
+  return G_GINT64_CONSTANT (1) << (GSS_LATENCY_HISTOGRAM_FIRST_SHIFT + i);
+}
+
+/**
+ * gss_latency_histogram_add:
+ * @histogram: a #GssLatencyHistogram
+ * @usec: a latency, in microseconds
+ *
+ * Counts one operation that took @usec.  May be called from any thread.
+ */
+void
+gss_latency_histogram_add (GssLatencyHistogram * histogram, gint64 usec)
+{
+  int i;
+
+  g_return_if_fail (histogram != NULL);
+
+  for (i = 0; i < GSS_LATENCY_HISTOGRAM_N_BUCKETS - 1; i++) {
+    if (usec < gss_latency_histogram_bucket_limit (i))
+      break;
+  }
+
+  g_mutex_lock (&histogram->lock);
+  histogram->counts[i]++;
+  histogram->count++;
+  histogram->total += MAX (usec, 0);
+  g_mutex_unlock (&histogram->lock);
+}
+
+guint64
+gss_latency_histogram_get_count (GssLatencyHistogram * histogram)
+{
+  guint64 count;
+
+  g_return_val_if_fail (histogram != NULL, 0);
+
+  g_mutex_lock (&histogram->lock);
+  count = histogram->count;
+  g_mutex_unlock (&histogram->lock);
+
+  return count;
+}
+
+/* called with lock held */
+static gint64
+gss_latency_histogram_get_percentile_unlocked (GssLatencyHistogram *
+    histogram, double fraction)
+{
+  guint64 sum = 0;
+  int i;
+
+  if (histogram->count == 0)
+    return 0;
+
+  for (i = 0; i < GSS_LATENCY_HISTOGRAM_N_BUCKETS - 1; i++) {
+    sum += histogram->counts[i];
+    if (sum >= fraction * histogram->count)
+      break;
+  }
+  return gss_latency_histogram_bucket_limit (i);
+}
+
+/**
+ * gss_latency_histogram_get_percentile:
+ * @histogram: a #GssLatencyHistogram
+ * @fraction: between 0 and 1, e.g. 0.99
+ *
+ * Returns: the upper bound, in microseconds, of the bucket that contains
+ *   the given fraction of operations, -1 if that is the last (unbounded)
+ *   bucket, or 0 if nothing has been counted
+ */
+gint64
+gss_latency_histogram_get_percentile (GssLatencyHistogram * histogram,
+    double fraction)
+{
+  gint64 usec;
+
+  g_return_val_if_fail (histogram != NULL, 0);
+
+  g_mutex_lock (&histogram->lock);
+  usec = gss_latency_histogram_get_percentile_unlocked (histogram, fraction);
+  g_mutex_unlock (&histogram->lock);
+
+  return usec;
+}
+
+/**
+ * gss_latency_histogram_to_string:
+ * @histogram: a #GssLatencyHistogram
+ *
+ * Formats @histogram for display, as the number of operations, their
+ * mean latency, and the count of each non-empty bucket, e.g.
+ * "n=12 mean=180us p50<256us p99<1024us <128us:3 <256us:8 <1024us:1".
+ *
+ * Returns: a newly allocated string
+ */
+char *
+gss_latency_histogram_to_string (GssLatencyHistogram * histogram)
+{
+  GString *s;
+  int i;
+
+  g_return_val_if_fail (histogram != NULL, NULL);
+
+  s = g_string_new ("");
+  g_mutex_lock (&histogram->lock);
+  g_string_append_printf (s, "n=%" G_GUINT64_FORMAT, histogram->count);
+  if (histogram->count > 0) {
+    const double fractions[] = { 0.5, 0.99 };
+    guint j;
+
+    g_string_append_printf (s, " mean=%" G_GINT64_FORMAT "us",
+        histogram->total / (gint64) histogram->count);
+    for (j = 0; j < G_N_ELEMENTS (fractions); j++) {
+      gint64 usec;
+
+      usec = gss_latency_histogram_get_percentile_unlocked (histogram,
+          fractions[j]);
+      if (usec < 0) {
+        g_string_append_printf (s, " p%d>=%" G_GINT64_FORMAT "us",
+            (int) (fractions[j] * 100),
+            gss_latency_histogram_bucket_limit (GSS_LATENCY_HISTOGRAM_N_BUCKETS
+                - 2));
+      } else {
+        g_string_append_printf (s, " p%d<%" G_GINT64_FORMAT "us",
+            (int) (fractions[j] * 100), usec);
+      }
+    }
+  }
+  for (i = 0; i < GSS_LATENCY_HISTOGRAM_N_BUCKETS; i++) {
+    gint64 limit = gss_latency_histogram_bucket_limit (i);
+
+    if (histogram->counts[i] == 0)
+      continue;
+    if (limit < 0) {
+      g_string_append_printf (s, " >=%" G_GINT64_FORMAT "us:%" G_GUINT64_FORMAT,
+          gss_latency_histogram_bucket_limit (i - 1), histogram->counts[i]);
+    } else {
+      g_string_append_printf (s, " <%" G_GINT64_FORMAT "us:%" G_GUINT64_FORMAT,
+          limit, histogram->counts[i]);
+    }
+  }
+  g_mutex_unlock (&histogram->lock);
+
+  return g_string_free (s, FALSE);
+}
@@ -39,6 +39,15 @@ void gss_metrics_free (GssMetrics * metrics);
 void gss_metrics_add_client (GssMetrics * metrics, int bitrate);
 void gss_metrics_remove_client (GssMetrics * metrics, int bitrate);
 
+GssLatencyHistogram * gss_latency_histogram_new (void);
+void gss_latency_histogram_free (GssLatencyHistogram * histogram);
+void gss_latency_histogram_add (GssLatencyHistogram * histogram,
+    gint64 usec);
+guint64 gss_latency_histogram_get_count (GssLatencyHistogram * histogram);
+gint64 gss_latency_histogram_get_percentile (GssLatencyHistogram * histogram,
+    double fraction);
+char * gss_latency_histogram_to_string (GssLatencyHistogram * histogram);
+
 G_END_DECLS
 
 #endif
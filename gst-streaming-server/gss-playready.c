@@ -50,7 +50,8 @@ enum
 {
   PROP_LICENSE_URL = 1,
   PROP_KEY_SEED,
-  PROP_ALLOW_CLEAR
+  PROP_ALLOW_CLEAR,
+  PROP_PARALLEL_ENCRYPT_SIZE
 };
 
 #define DEFAULT_LICENSE_URL "http://playready.directtaps.net/pr/svc/rightsmanager.asmx"
@@ -60,6 +61,7 @@ enum
  * key seed.  */
 #define DEFAULT_KEY_SEED "5D5068BEC9B384FF6044867159F16D6B755544FCD5116989B1ACC4278E88"
 #define DEFAULT_ALLOW_CLEAR FALSE
+#define DEFAULT_PARALLEL_ENCRYPT_SIZE 1024
 
 
 static void gss_playready_finalize (GObject * object);
@@ -83,6 +85,7 @@ gss_playready_init (GssPlayready * playready)
   playready->license_url = g_strdup (DEFAULT_LICENSE_URL);
   gss_playready_set_key_seed_hex (playready, DEFAULT_KEY_SEED);
   playready->allow_clear = DEFAULT_ALLOW_CLEAR;
+  playready->parallel_encrypt_size = DEFAULT_PARALLEL_ENCRYPT_SIZE;
 }
 
 static void
@@ -109,6 +112,13 @@ gss_playready_class_init (GssPlayreadyClass * playready_class)
           "Allow clear streaming in addition to encrypted streaming.",
           DEFAULT_ALLOW_CLEAR,
           (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (playready_class),
+      PROP_PARALLEL_ENCRYPT_SIZE, g_param_spec_int ("parallel-encrypt-size",
+          "Parallel Encrypt Size",
+          "Fragments larger than this size (in kB) are encrypted using "
+          "several threads.  0 disables.", 0, G_MAXINT / 1024,
+          DEFAULT_PARALLEL_ENCRYPT_SIZE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 
   parent_class = g_type_class_peek_parent (playready_class);
 }
@@ -142,6 +152,9 @@ gss_playready_set_property (GObject * object, guint prop_id,
     case PROP_ALLOW_CLEAR:
       playready->allow_clear = g_value_get_boolean (value);
       break;
+    case PROP_PARALLEL_ENCRYPT_SIZE:
+      playready->parallel_encrypt_size = g_value_get_int (value);
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -166,6 +179,9 @@ gss_playready_get_property (GObject * object, guint prop_id,
     case PROP_ALLOW_CLEAR:
       g_value_set_boolean (value, playready->allow_clear);
       break;
+    case PROP_PARALLEL_ENCRYPT_SIZE:
+      g_value_set_int (value, playready->parallel_encrypt_size);
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -515,97 +531,302 @@ gss_playready_generate_checksum (guint8 * key_id, guint8 * content_key)
   return g_base64_encode (dest, 8);
 }
 
+/* The expanded AES key for a content key.  Each call to
+ * gss_playready_encrypt_samples() only resets the counter block for
+ * each sample, so the key schedule is computed once per stream. */
+struct _GssPlayreadyCipher
+{
 #if OPENSSL_VERSION_NUMBER >= 0x100010fL
+  EVP_CIPHER_CTX *ctx;
+#else
+  AES_KEY key;
+#endif
+
+  /* fragments with at least this many bytes are encrypted in parallel,
+   * 0 to disable */
+  gsize parallel_threshold;
+};
+
+/* A range of samples of a fragment, encrypted by one thread */
+typedef struct _GssPlayreadyEncryptJob GssPlayreadyEncryptJob;
+struct _GssPlayreadyEncryptJob
+{
+  GssIsomFragment *fragment;
+  guint8 *mdat_data;
+  GssPlayreadyCipher *cipher;
+  int first_sample;
+  int end_sample;
+  guint64 sample_offset;
+
+  GMutex *lock;
+  GCond *cond;
+  int *n_pending;
+};
+
+#define GSS_PLAYREADY_MAX_ENCRYPT_JOBS 8
+
+GssPlayreadyCipher *
+gss_playready_cipher_new (const guint8 * content_key)
+{
+  GssPlayreadyCipher *cipher;
+
+  g_return_val_if_fail (content_key != NULL, NULL);
+
+  cipher = g_malloc0 (sizeof (GssPlayreadyCipher));
+#if OPENSSL_VERSION_NUMBER >= 0x100010fL
+  cipher->ctx = EVP_CIPHER_CTX_new ();
+  EVP_EncryptInit_ex (cipher->ctx, EVP_aes_128_ctr (), NULL, content_key,
+      NULL);
+#else
+  AES_set_encrypt_key (content_key, 16 * 8, &cipher->key);
+#endif
+
+  return cipher;
+}
+
 void
-gss_playready_encrypt_samples (GssIsomFragment * fragment, guint8 * mdat_data,
-    guint8 * content_key)
+gss_playready_cipher_free (GssPlayreadyCipher * cipher)
+{
+  g_return_if_fail (cipher != NULL);
+
+#if OPENSSL_VERSION_NUMBER >= 0x100010fL
+  EVP_CIPHER_CTX_free (cipher->ctx);
+#endif
+  g_free (cipher);
+}
+
+/**
+ * gss_playready_cipher_set_parallel_threshold:
+ * @cipher: a #GssPlayreadyCipher
+ * @threshold: size in bytes
+ *
+ * Fragments with an mdat of at least @threshold bytes are split into
+ * ranges of samples that are encrypted on several threads.  Smaller
+ * fragments, or all fragments if @threshold is 0, are encrypted by the
+ * calling thread.
+ */
+void
+gss_playready_cipher_set_parallel_threshold (GssPlayreadyCipher * cipher,
+    gsize threshold)
+{
+  g_return_if_fail (cipher != NULL);
+
+  cipher->parallel_threshold = threshold;
+}
+
+/* Copies the encrypted ranges of a sample with subsamples into @dest,
+ * or back from @src, so that the cipher sees one contiguous run.  CTR
+ * keystream continues across subsamples, so this gives the same
+ * result as encrypting each range in turn. */
+static gsize
+gather_subsamples (GssBoxUUIDSampleEncryptionSample * sample,
+    guint8 * sample_data, guint8 * dest)
+{
+  gsize offset = 0;
+  gsize n = 0;
+  int j;
+
+  for (j = 0; j < sample->num_entries; j++) {
+    offset += sample->entries[j].bytes_of_clear_data;
+    memcpy (dest + n, sample_data + offset,
+        sample->entries[j].bytes_of_encrypted_data);
+    offset += sample->entries[j].bytes_of_encrypted_data;
+    n += sample->entries[j].bytes_of_encrypted_data;
+  }
+  return n;
+}
+
+static void
+scatter_subsamples (GssBoxUUIDSampleEncryptionSample * sample,
+    guint8 * sample_data, const guint8 * src)
+{
+  gsize offset = 0;
+  gsize n = 0;
+  int j;
+
+  for (j = 0; j < sample->num_entries; j++) {
+    offset += sample->entries[j].bytes_of_clear_data;
+    memcpy (sample_data + offset, src + n,
+        sample->entries[j].bytes_of_encrypted_data);
+    offset += sample->entries[j].bytes_of_encrypted_data;
+    n += sample->entries[j].bytes_of_encrypted_data;
+  }
+}
+
+/* Encrypts samples [first_sample, end_sample), the first of which
+ * starts at sample_offset in mdat_data. */
+static void
+encrypt_sample_range (GssIsomFragment * fragment, guint8 * mdat_data,
+    GssPlayreadyCipher * cipher, int first_sample, int end_sample,
+    guint64 sample_offset)
 {
   GssBoxTrun *trun = &fragment->trun;
   GssBoxUUIDSampleEncryption *se = &fragment->sample_encryption;
-  guint64 sample_offset;
+  guint8 *scratch = NULL;
+  gsize scratch_size = 0;
   int i;
-  int bytes = 0;
+#if OPENSSL_VERSION_NUMBER >= 0x100010fL
   EVP_CIPHER_CTX *ctx;
 
-  sample_offset = 8;
-
   ctx = EVP_CIPHER_CTX_new ();
-  for (i = 0; i < trun->sample_count; i++) {
+  EVP_CIPHER_CTX_copy (ctx, cipher->ctx);
+#endif
+
+  for (i = first_sample; i < end_sample; i++) {
+    GssBoxUUIDSampleEncryptionSample *sample = &se->samples[i];
+    guint8 *data;
+    gsize size;
     unsigned char raw_iv[16];
+#if OPENSSL_VERSION_NUMBER >= 0x100010fL
     int len;
+#else
+    unsigned char ecount_buf[16] = { 0 };
+    unsigned int num = 0;
+#endif
 
     memset (raw_iv, 0, 16);
-    GST_WRITE_UINT64_BE (raw_iv, se->samples[i].iv);
-
-    EVP_EncryptInit_ex (ctx, EVP_aes_128_ctr (), NULL, content_key, raw_iv);
-
-    if (se->samples[i].num_entries == 0) {
-      EVP_EncryptUpdate (ctx,
-          mdat_data + sample_offset, &len,
-          mdat_data + sample_offset, trun->samples[i].size);
-      bytes += trun->samples[i].size;
+    GST_WRITE_UINT64_BE (raw_iv, sample->iv);
+
+    if (sample->num_entries == 0) {
+      data = mdat_data + sample_offset;
+      size = trun->samples[i].size;
+    } else if (sample->num_entries == 1) {
+      data = mdat_data + sample_offset + sample->entries[0].bytes_of_clear_data;
+      size = sample->entries[0].bytes_of_encrypted_data;
     } else {
-      guint64 offset;
-      int j;
-      offset = sample_offset;
-      for (j = 0; j < se->samples[i].num_entries; j++) {
-        offset += se->samples[i].entries[j].bytes_of_clear_data;
-        EVP_EncryptUpdate (ctx,
-            mdat_data + offset, &len,
-            mdat_data + offset,
-            se->samples[i].entries[j].bytes_of_encrypted_data);
-        offset += se->samples[i].entries[j].bytes_of_encrypted_data;
-        bytes += se->samples[i].entries[j].bytes_of_encrypted_data;
+      if (scratch_size < trun->samples[i].size) {
+        scratch_size = trun->samples[i].size;
+        scratch = g_realloc (scratch, scratch_size);
       }
+      data = scratch;
+      size = gather_subsamples (sample, mdat_data + sample_offset, scratch);
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x100010fL
+    /* only resets the counter block, the key schedule is kept */
+    EVP_EncryptInit_ex (ctx, NULL, NULL, NULL, raw_iv);
+    EVP_EncryptUpdate (ctx, data, &len, data, size);
+#else
+    AES_ctr128_encrypt (data, data, size, &cipher->key, raw_iv, ecount_buf,
+        &num);
+#endif
+
+    if (data == scratch) {
+      scatter_subsamples (sample, mdat_data + sample_offset, scratch);
     }
     sample_offset += trun->samples[i].size;
   }
+
+#if OPENSSL_VERSION_NUMBER >= 0x100010fL
   EVP_CIPHER_CTX_free (ctx);
+#endif
+  g_free (scratch);
 }
-#else
+
+static void
+gss_playready_encrypt_job (gpointer data, gpointer user_data)
+{
+  GssPlayreadyEncryptJob *job = data;
+
+  encrypt_sample_range (job->fragment, job->mdat_data, job->cipher,
+      job->first_sample, job->end_sample, job->sample_offset);
+
+  g_mutex_lock (job->lock);
+  (*job->n_pending)--;
+  if (*job->n_pending == 0)
+    g_cond_signal (job->cond);
+  g_mutex_unlock (job->lock);
+}
+
+static GThreadPool *
+gss_playready_get_encrypt_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool)) {
+    GThreadPool *p;
+
+    p = g_thread_pool_new (gss_playready_encrypt_job, NULL,
+        MIN (g_get_num_processors (), GSS_PLAYREADY_MAX_ENCRYPT_JOBS), FALSE,
+        NULL);
+    g_once_init_leave (&pool, (gsize) p);
+  }
+  return (GThreadPool *) pool;
+}
+
 void
 gss_playready_encrypt_samples (GssIsomFragment * fragment, guint8 * mdat_data,
-    guint8 * content_key)
+    GssPlayreadyCipher * cipher)
 {
+  GssPlayreadyEncryptJob jobs[GSS_PLAYREADY_MAX_ENCRYPT_JOBS];
   GssBoxTrun *trun = &fragment->trun;
-  GssBoxUUIDSampleEncryption *se = &fragment->sample_encryption;
+  GThreadPool *pool;
+  GMutex lock;
+  GCond cond;
+  int n_pending;
+  int n_jobs;
   guint64 sample_offset;
+  guint64 total;
+  guint64 sum;
   int i;
+  int j;
 
-  sample_offset = 8;
-
-  for (i = 0; i < trun->sample_count; i++) {
-    unsigned char raw_iv[16];
-    unsigned char ecount_buf[16] = { 0 };
-    unsigned int num = 0;
-    AES_KEY key;
-
-    memset (raw_iv, 0, 16);
-    GST_WRITE_UINT64_BE (raw_iv, se->samples[i].iv);
+  g_return_if_fail (cipher != NULL);
 
-    AES_set_encrypt_key (content_key, 16 * 8, &key);
+  n_jobs = MIN (g_get_num_processors (), GSS_PLAYREADY_MAX_ENCRYPT_JOBS);
+  n_jobs = MIN (n_jobs, trun->sample_count);
+  if (cipher->parallel_threshold == 0 ||
+      (gsize) fragment->mdat_size < cipher->parallel_threshold || n_jobs < 2) {
+    encrypt_sample_range (fragment, mdat_data, cipher, 0, trun->sample_count,
+        8);
+    return;
+  }
 
-    if (se->samples[i].num_entries == 0) {
-      AES_ctr128_encrypt (mdat_data + sample_offset,
-          mdat_data + sample_offset, trun->samples[i].size,
-          &key, raw_iv, ecount_buf, &num);
+  /* split into ranges of samples with roughly equal numbers of bytes */
+  total = fragment->mdat_size - 8;
+  sample_offset = 8;
+  sum = 0;
+  i = 0;
+  for (j = 0; j < n_jobs; j++) {
+    jobs[j].fragment = fragment;
+    jobs[j].mdat_data = mdat_data;
+    jobs[j].cipher = cipher;
+    jobs[j].first_sample = i;
+    jobs[j].sample_offset = sample_offset;
+    jobs[j].lock = &lock;
+    jobs[j].cond = &cond;
+    jobs[j].n_pending = &n_pending;
+    if (j == n_jobs - 1) {
+      i = trun->sample_count;
     } else {
-      guint64 offset;
-      int j;
-      offset = sample_offset;
-      for (j = 0; j < se->samples[i].num_entries; j++) {
-        offset += se->samples[i].entries[j].bytes_of_clear_data;
-        AES_ctr128_encrypt (mdat_data + offset,
-            mdat_data + offset,
-            se->samples[i].entries[j].bytes_of_encrypted_data,
-            &key, raw_iv, ecount_buf, &num);
-        offset += se->samples[i].entries[j].bytes_of_encrypted_data;
+      while (i < trun->sample_count && sum < total * (j + 1) / n_jobs) {
+        sum += trun->samples[i].size;
+        sample_offset += trun->samples[i].size;
+        i++;
       }
     }
-    sample_offset += trun->samples[i].size;
+    jobs[j].end_sample = i;
   }
+
+  g_mutex_init (&lock);
+  g_cond_init (&cond);
+  n_pending = n_jobs - 1;
+
+  pool = gss_playready_get_encrypt_pool ();
+  for (j = 1; j < n_jobs; j++) {
+    g_thread_pool_push (pool, &jobs[j], NULL);
+  }
+  encrypt_sample_range (fragment, mdat_data, cipher, jobs[0].first_sample,
+      jobs[0].end_sample, jobs[0].sample_offset);
+
+  g_mutex_lock (&lock);
+  while (n_pending > 0)
+    g_cond_wait (&cond, &lock);
+  g_mutex_unlock (&lock);
+
+  g_mutex_clear (&lock);
+  g_cond_clear (&cond);
 }
-#endif
 
 const char *
 gss_playready_get_uri (GssDrmType drm_type)
@@ -46,6 +46,7 @@ struct _GssPlayready {
   char *license_url;
   guint8 key_seed[30];
   gboolean allow_clear;
+  int parallel_encrypt_size;
 
 };
 
@@ -68,8 +69,12 @@ gsize gss_playready_get_protection_header (GssAdaptive * adaptive,
     const char *la_url, const char *auth_token, guchar **p_content);
 char * gss_playready_get_protection_header_base64 (GssAdaptive *adaptive,
     const char *la_url, const char *auth_token);
+GssPlayreadyCipher *gss_playready_cipher_new (const guint8 *content_key);
+void gss_playready_cipher_free (GssPlayreadyCipher *cipher);
+void gss_playready_cipher_set_parallel_threshold (GssPlayreadyCipher *cipher,
+    gsize threshold);
 void gss_playready_encrypt_samples (GssIsomFragment * fragment,
-    guint8 * mdat_data, guint8 * content_key);
+    guint8 * mdat_data, GssPlayreadyCipher *cipher);
 void gss_playready_setup_iv (GssPlayready *playready, GssAdaptive * adaptive,
     GssAdaptiveLevel * level, GssIsomFragment * fragment);
 
@@ -159,6 +159,9 @@ gss_program_finalize (GObject * object)
   if (program->hls.variant_buffer) {
     soup_buffer_free (program->hls.variant_buffer);
   }
+  if (program->hls.variant_gzip_buffer) {
+    soup_buffer_free (program->hls.variant_gzip_buffer);
+  }
 
   gss_metrics_free (program->metrics);
   g_free (program->follow_uri);
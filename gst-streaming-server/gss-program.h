@@ -89,6 +89,8 @@ struct _GssProgram {
   int n_hls_chunks;
   struct {
     SoupBuffer *variant_buffer; /* contents of current variant file */
+    SoupBuffer *variant_gzip_buffer; /* variant_buffer compressed, or NULL */
+    gboolean variant_gzip_done; /* variant_buffer was compressed, or too small */
 
     int target_duration; /* max length of a chunk (in seconds) */
     gboolean is_encrypted;
@@ -23,6 +23,7 @@
 #include "gss-server.h"
 #include "gss-html.h"
 #include "gss-resource.h"
+#include "gss-compress.h"
 #include "gss-soup.h"
 #include "gss-utils.h"
 
@@ -74,6 +75,11 @@ struct _GssStaticResource
   const char *contents;
   char *malloc_contents;
   gsize size;
+
+  /* compressed on first use */
+  gboolean gzip_done;
+  SoupBuffer *gzip_buffer;
+  char *gzip_etag;
 };
 
 void
@@ -83,13 +89,32 @@ gss_resource_file (GssTransaction * t)
 
   soup_message_headers_replace (t->msg->response_headers, "Keep-Alive",
       "timeout=5, max=100");
-  soup_message_headers_append (t->msg->response_headers, "Etag",
-      sr->resource.etag);
   soup_message_headers_append (t->msg->response_headers, "Cache-Control",
       "max-age=86400");
 
   soup_message_set_status (t->msg, SOUP_STATUS_OK);
 
+  if (gss_compress_content_type_is_text (sr->resource.content_type) &&
+      gss_compress_accept_gzip (t)) {
+    if (!sr->gzip_done) {
+      sr->gzip_buffer = gss_compress_gzip (sr->contents, sr->size);
+      if (sr->gzip_buffer) {
+        sr->gzip_etag = gss_compress_get_gzip_etag (sr->resource.etag);
+      }
+      sr->gzip_done = TRUE;
+    }
+    if (sr->gzip_buffer) {
+      soup_message_headers_append (t->msg->response_headers, "Etag",
+          sr->gzip_etag);
+      gss_compress_set_gzip_headers (t);
+      soup_message_body_append_buffer (t->msg->response_body,
+          sr->gzip_buffer);
+      return;
+    }
+  }
+
+  soup_message_headers_append (t->msg->response_headers, "Etag",
+      sr->resource.etag);
   soup_message_set_response (t->msg, sr->resource.content_type,
       SOUP_MEMORY_STATIC, sr->contents, sr->size);
 }
@@ -98,6 +123,9 @@ static void
 gss_static_resource_destroy (GssStaticResource * sr)
 {
   g_free (sr->malloc_contents);
+  if (sr->gzip_buffer)
+    soup_buffer_free (sr->gzip_buffer);
+  g_free (sr->gzip_etag);
 }
 
 static void
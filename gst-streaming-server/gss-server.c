@@ -25,6 +25,7 @@
 #include "gss-html.h"
 #include "gss-session.h"
 #include "gss-soup.h"
+#include "gss-compress.h"
 #ifdef ENABLE_RTSP
 #include "gss-rtsp.h"
 #endif
@@ -66,7 +67,28 @@ enum
   PROP_ENABLE_RTMP,
   PROP_ENABLE_VOD,
   PROP_ARCHIVE_DIR,
-  PROP_CAS_SERVER
+  PROP_CAS_SERVER,
+  PROP_ASYNC_THREADS,
+  PROP_ASYNC_QUEUE_DEPTH,
+  PROP_ASYNC_BUSY_TIME,
+  PROP_FD_CACHE_SIZE,
+  PROP_FD_CACHE_HITS,
+  PROP_FD_CACHE_MISSES,
+  PROP_ENABLE_ZERO_COPY,
+  PROP_FRAGMENT_CACHE_SIZE,
+  PROP_FRAGMENT_CACHE_USED,
+  PROP_FRAGMENT_CACHE_HITS,
+  PROP_FRAGMENT_CACHE_MISSES,
+  PROP_FRAGMENT_CACHE_HIT_RATIO,
+  PROP_FRAGMENT_CACHE_BYTES_SAVED,
+  PROP_ENABLE_COMPRESSION,
+  PROP_IO_LATENCY,
+  PROP_ENCRYPT_LATENCY,
+  PROP_RANGE_WINDOW_SIZE,
+  PROP_ENABLE_CMAF,
+  PROP_CMAF_SEGMENT_DURATION,
+  PROP_CMAF_CHUNK_DURATION,
+  PROP_HLS_SEGMENT_DURATION
 };
 
 #define DEFAULT_ENABLE_PUBLIC_INTERFACE TRUE
@@ -87,6 +109,19 @@ enum
 #define DEFAULT_ENABLE_RTSP FALSE
 #define DEFAULT_ENABLE_RTMP FALSE
 #define DEFAULT_ENABLE_VOD FALSE
+#define DEFAULT_ASYNC_THREADS 0
+#define DEFAULT_FD_CACHE_SIZE 256
+#define DEFAULT_ENABLE_ZERO_COPY TRUE
+#define DEFAULT_ENABLE_COMPRESSION TRUE
+/* in kB */
+#define DEFAULT_RANGE_WINDOW_SIZE 4096
+#define DEFAULT_ENABLE_CMAF FALSE
+/* in ms */
+#define DEFAULT_CMAF_SEGMENT_DURATION 2000
+#define DEFAULT_CMAF_CHUNK_DURATION 500
+#define DEFAULT_HLS_SEGMENT_DURATION 4000
+/* in MB */
+#define DEFAULT_FRAGMENT_CACHE_SIZE 256
 #ifdef USE_LOCAL
 #define DEFAULT_ARCHIVE_DIR "."
 #else
@@ -261,6 +296,11 @@ gss_server_init (GssServer * server)
   char *s;
 
   server->metrics = gss_metrics_new ();
+  server->fd_cache = gss_fd_cache_new (DEFAULT_FD_CACHE_SIZE);
+  server->fragment_cache =
+      gss_fragment_cache_new ((gsize) DEFAULT_FRAGMENT_CACHE_SIZE << 20);
+  server->io_latency = gss_latency_histogram_new ();
+  server->encrypt_latency = gss_latency_histogram_new ();
 
   server->resources = g_hash_table_new_full (g_str_hash, g_str_equal,
       NULL, (GDestroyNotify) gss_resource_free);
@@ -290,6 +330,14 @@ gss_server_init (GssServer * server)
   server->enable_rtsp = DEFAULT_ENABLE_RTSP;
   server->enable_rtmp = DEFAULT_ENABLE_RTMP;
   server->enable_vod = DEFAULT_ENABLE_VOD;
+  server->async_threads = DEFAULT_ASYNC_THREADS;
+  server->enable_zero_copy = DEFAULT_ENABLE_ZERO_COPY;
+  server->enable_compression = DEFAULT_ENABLE_COMPRESSION;
+  server->range_window_size = DEFAULT_RANGE_WINDOW_SIZE;
+  server->enable_cmaf = DEFAULT_ENABLE_CMAF;
+  server->cmaf_segment_duration = DEFAULT_CMAF_SEGMENT_DURATION;
+  server->cmaf_chunk_duration = DEFAULT_CMAF_CHUNK_DURATION;
+  server->hls_segment_duration = DEFAULT_HLS_SEGMENT_DURATION;
 
   server->enable_flowplayer = FALSE;
   server->enable_persona = FALSE;
@@ -332,6 +380,10 @@ gss_server_finalize (GObject * object)
   }
   g_free (server->prefix_resources);
   gss_metrics_free (server->metrics);
+  gss_fd_cache_free (server->fd_cache);
+  gss_fragment_cache_free (server->fragment_cache);
+  gss_latency_histogram_free (server->io_latency);
+  gss_latency_histogram_free (server->encrypt_latency);
   g_free (server->base_url);
   g_free (server->base_url_https);
   g_free (server->server_hostname);
@@ -463,6 +515,126 @@ gss_server_class_init (GssServerClass * server_class)
       g_param_spec_boolean ("enable-vod", "Enable VOD",
           "Enable VOD", DEFAULT_ENABLE_VOD,
           (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ASYNC_THREADS, g_param_spec_int ("async-threads",
+          "Async Worker Threads",
+          "Number of threads used for fragment assembly and encryption "
+          "(0 means one per online CPU)", 0,
+          GSS_TRANSACTION_MAX_ASYNC_THREADS, DEFAULT_ASYNC_THREADS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ASYNC_QUEUE_DEPTH, g_param_spec_int ("async-queue-depth",
+          "Async Queue Depth",
+          "Number of transactions waiting for a worker thread", 0, G_MAXINT,
+          0, (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ASYNC_BUSY_TIME, g_param_spec_string ("async-busy-time",
+          "Async Busy Time",
+          "Time each worker thread has spent processing (in seconds)", "",
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FD_CACHE_SIZE, g_param_spec_int ("fd-cache-size",
+          "File Descriptor Cache Size",
+          "Maximum number of media files kept open (0 disables the cache)",
+          0, 65536, DEFAULT_FD_CACHE_SIZE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FD_CACHE_HITS, g_param_spec_uint64 ("fd-cache-hits",
+          "File Descriptor Cache Hits", "File Descriptor Cache Hits",
+          0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FD_CACHE_MISSES, g_param_spec_uint64 ("fd-cache-misses",
+          "File Descriptor Cache Misses", "File Descriptor Cache Misses",
+          0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ENABLE_ZERO_COPY, g_param_spec_boolean ("enable-zero-copy",
+          "Enable Zero-Copy VOD",
+          "Serve unencrypted media data directly from memory-mapped files",
+          DEFAULT_ENABLE_ZERO_COPY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FRAGMENT_CACHE_SIZE, g_param_spec_int ("fragment-cache-size",
+          "Fragment Cache Size",
+          "Memory used to cache encrypted media fragments (in MB, 0 disables the cache)",
+          0, 1024 * 1024, DEFAULT_FRAGMENT_CACHE_SIZE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FRAGMENT_CACHE_USED, g_param_spec_uint64 ("fragment-cache-used",
+          "Fragment Cache Used",
+          "Memory used by cached fragments (in bytes)",
+          0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FRAGMENT_CACHE_HITS, g_param_spec_uint64 ("fragment-cache-hits",
+          "Fragment Cache Hits", "Fragment Cache Hits",
+          0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FRAGMENT_CACHE_MISSES, g_param_spec_uint64 ("fragment-cache-misses",
+          "Fragment Cache Misses", "Fragment Cache Misses",
+          0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FRAGMENT_CACHE_HIT_RATIO,
+      g_param_spec_double ("fragment-cache-hit-ratio",
+          "Fragment Cache Hit Ratio",
+          "Fraction of fragment requests served from the cache",
+          0.0, 1.0, 0.0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_FRAGMENT_CACHE_BYTES_SAVED,
+      g_param_spec_uint64 ("fragment-cache-bytes-saved",
+          "Fragment Cache Bytes Saved",
+          "Bytes served from the cache instead of being read and encrypted again",
+          0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ENABLE_COMPRESSION, g_param_spec_boolean ("enable-compression",
+          "Enable Compression",
+          "Send text responses (web pages, manifests, playlists) gzip compressed to clients that accept it",
+          DEFAULT_ENABLE_COMPRESSION,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_IO_LATENCY, g_param_spec_string ("io-latency", "I/O Latency",
+          "Histogram of the time taken to read VOD fragments from disk", NULL,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ENCRYPT_LATENCY, g_param_spec_string ("encrypt-latency",
+          "Encryption Latency",
+          "Histogram of the time taken to encrypt VOD fragments", NULL,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_RANGE_WINDOW_SIZE, g_param_spec_int ("range-window-size",
+          "Range Window Size",
+          "Memory used per request to buffer larger DASH byte range responses while they are sent (in kB)",
+          64, 1024 * 1024, DEFAULT_RANGE_WINDOW_SIZE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ENABLE_CMAF, g_param_spec_boolean ("enable-cmaf",
+          "Enable CMAF",
+          "Serve live MPEG-TS programs as low-latency chunked CMAF (LL-HLS and DASH)",
+          DEFAULT_ENABLE_CMAF,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_CMAF_SEGMENT_DURATION, g_param_spec_int ("cmaf-segment-duration",
+          "CMAF Segment Duration",
+          "Minimum duration of live CMAF segments (in ms)",
+          100, 60000, DEFAULT_CMAF_SEGMENT_DURATION,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_CMAF_CHUNK_DURATION, g_param_spec_int ("cmaf-chunk-duration",
+          "CMAF Chunk Duration",
+          "Duration of the chunks of live CMAF segments (in ms)",
+          20, 60000, DEFAULT_CMAF_CHUNK_DURATION,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_HLS_SEGMENT_DURATION, g_param_spec_int ("hls-segment-duration",
+          "HLS Segment Duration",
+          "Minimum duration of live HLS segments, which end at the next key frame (in ms)",
+          500, 60000, DEFAULT_HLS_SEGMENT_DURATION,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 #ifdef ENABLE_CAS
   g_object_class_install_property (G_OBJECT_CLASS (server_class),
       PROP_CAS_SERVER, g_param_spec_string ("cas-server", "CAS Server",
@@ -556,6 +728,38 @@ gss_server_set_property (GObject * object, guint prop_id,
       g_free (server->cas_server);
       server->cas_server = g_value_dup_string (value);
       break;
+    case PROP_ASYNC_THREADS:
+      server->async_threads = g_value_get_int (value);
+      gss_transaction_set_async_threads (server->async_threads);
+      break;
+    case PROP_FD_CACHE_SIZE:
+      gss_fd_cache_set_max_fds (server->fd_cache, g_value_get_int (value));
+      break;
+    case PROP_ENABLE_ZERO_COPY:
+      server->enable_zero_copy = g_value_get_boolean (value);
+      break;
+    case PROP_ENABLE_COMPRESSION:
+      server->enable_compression = g_value_get_boolean (value);
+      break;
+    case PROP_RANGE_WINDOW_SIZE:
+      server->range_window_size = g_value_get_int (value);
+      break;
+    case PROP_ENABLE_CMAF:
+      server->enable_cmaf = g_value_get_boolean (value);
+      break;
+    case PROP_CMAF_SEGMENT_DURATION:
+      server->cmaf_segment_duration = g_value_get_int (value);
+      break;
+    case PROP_CMAF_CHUNK_DURATION:
+      server->cmaf_chunk_duration = g_value_get_int (value);
+      break;
+    case PROP_HLS_SEGMENT_DURATION:
+      server->hls_segment_duration = g_value_get_int (value);
+      break;
+    case PROP_FRAGMENT_CACHE_SIZE:
+      gss_fragment_cache_set_max_size (server->fragment_cache,
+          (gsize) g_value_get_int (value) << 20);
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -625,6 +829,124 @@ gss_server_get_property (GObject * object, guint prop_id,
     case PROP_CAS_SERVER:
       g_value_set_string (value, server->cas_server);
       break;
+    case PROP_ASYNC_THREADS:
+      g_value_set_int (value, server->async_threads);
+      break;
+    case PROP_ASYNC_QUEUE_DEPTH:
+      g_value_set_int (value, gss_transaction_get_async_queue_depth ());
+      break;
+    case PROP_ASYNC_BUSY_TIME:
+    {
+      GString *str = g_string_new ("");
+      int i;
+
+      for (i = 0; i < gss_transaction_get_async_threads (); i++) {
+        gint64 busy_time = gss_transaction_get_async_busy_time (i, NULL);
+        g_string_append_printf (str, "%s%.3f", (i > 0) ? " " : "",
+            busy_time / (double) G_USEC_PER_SEC);
+      }
+      g_value_take_string (value, g_string_free (str, FALSE));
+    }
+      break;
+    case PROP_FD_CACHE_SIZE:
+      g_value_set_int (value, gss_fd_cache_get_max_fds (server->fd_cache));
+      break;
+    case PROP_FD_CACHE_HITS:
+    {
+      guint64 hits;
+
+      gss_fd_cache_get_stats (server->fd_cache, &hits, NULL, NULL);
+      g_value_set_uint64 (value, hits);
+    }
+      break;
+    case PROP_FD_CACHE_MISSES:
+    {
+      guint64 misses;
+
+      gss_fd_cache_get_stats (server->fd_cache, NULL, &misses, NULL);
+      g_value_set_uint64 (value, misses);
+    }
+      break;
+    case PROP_ENABLE_ZERO_COPY:
+      g_value_set_boolean (value, server->enable_zero_copy);
+      break;
+    case PROP_ENABLE_COMPRESSION:
+      g_value_set_boolean (value, server->enable_compression);
+      break;
+    case PROP_IO_LATENCY:
+      g_value_take_string (value,
+          gss_latency_histogram_to_string (server->io_latency));
+      break;
+    case PROP_ENCRYPT_LATENCY:
+      g_value_take_string (value,
+          gss_latency_histogram_to_string (server->encrypt_latency));
+      break;
+    case PROP_RANGE_WINDOW_SIZE:
+      g_value_set_int (value, server->range_window_size);
+      break;
+    case PROP_ENABLE_CMAF:
+      g_value_set_boolean (value, server->enable_cmaf);
+      break;
+    case PROP_CMAF_SEGMENT_DURATION:
+      g_value_set_int (value, server->cmaf_segment_duration);
+      break;
+    case PROP_CMAF_CHUNK_DURATION:
+      g_value_set_int (value, server->cmaf_chunk_duration);
+      break;
+    case PROP_HLS_SEGMENT_DURATION:
+      g_value_set_int (value, server->hls_segment_duration);
+      break;
+    case PROP_FRAGMENT_CACHE_SIZE:
+      g_value_set_int (value,
+          gss_fragment_cache_get_max_size (server->fragment_cache) >> 20);
+      break;
+    case PROP_FRAGMENT_CACHE_USED:
+    {
+      gsize size;
+
+      gss_fragment_cache_get_stats (server->fragment_cache, NULL, NULL, NULL,
+          &size, NULL);
+      g_value_set_uint64 (value, size);
+    }
+      break;
+    case PROP_FRAGMENT_CACHE_HITS:
+    {
+      guint64 hits;
+
+      gss_fragment_cache_get_stats (server->fragment_cache, &hits, NULL, NULL,
+          NULL, NULL);
+      g_value_set_uint64 (value, hits);
+    }
+      break;
+    case PROP_FRAGMENT_CACHE_MISSES:
+    {
+      guint64 misses;
+
+      gss_fragment_cache_get_stats (server->fragment_cache, NULL, &misses,
+          NULL, NULL, NULL);
+      g_value_set_uint64 (value, misses);
+    }
+      break;
+    case PROP_FRAGMENT_CACHE_HIT_RATIO:
+    {
+      guint64 hits;
+      guint64 misses;
+
+      gss_fragment_cache_get_stats (server->fragment_cache, &hits, &misses,
+          NULL, NULL, NULL);
+      g_value_set_double (value,
+          (hits + misses > 0) ? (double) hits / (hits + misses) : 0.0);
+    }
+      break;
+    case PROP_FRAGMENT_CACHE_BYTES_SAVED:
+    {
+      guint64 bytes_saved;
+
+      gss_fragment_cache_get_stats (server->fragment_cache, NULL, NULL,
+          &bytes_saved, NULL, NULL);
+      g_value_set_uint64 (value, bytes_saved);
+    }
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -868,6 +1190,8 @@ gss_server_setup_resources (GssServer * server)
 
   gss_server_add_resource (server, "/assets/", GSS_RESOURCE_PREFIX,
       NULL, gss_asset_get_resource, NULL, NULL, NULL);
+  gss_server_add_resource (server, "/cmaf/", GSS_RESOURCE_PREFIX,
+      NULL, gss_cmaf_get_resource, NULL, NULL, server);
 
   gss_playready_setup (server);
 }
@@ -1158,7 +1482,7 @@ gss_server_resource_callback (SoupServer * soupserver, SoupMessage * msg,
     soup_message_headers_append (msg->response_headers, "Cache-Control",
         "max-age=86400");
     inm = soup_message_headers_get_one (msg->request_headers, "If-None-Match");
-    if (inm && !strcmp (inm, t->resource->etag)) {
+    if (inm && gss_compress_etag_matches (inm, t->resource->etag)) {
       soup_message_set_status (msg, SOUP_STATUS_NOT_MODIFIED);
       return;
     }
@@ -1205,8 +1529,7 @@ gss_server_resource_callback (SoupServer * soupserver, SoupMessage * msg,
 
     len = t->s->len;
     content = g_string_free (t->s, FALSE);
-    soup_message_body_append (msg->response_body, SOUP_MEMORY_TAKE,
-        content, len);
+    gss_compress_append_body (t, content, len);
   }
 }
 
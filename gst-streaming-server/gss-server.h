@@ -34,6 +34,8 @@
 #include "gss-stream.h"
 #include "gss-resource.h"
 #include "gss-transaction.h"
+#include "gss-fd-cache.h"
+#include "gss-fragment-cache.h"
 
 G_BEGIN_DECLS
 
@@ -72,6 +74,17 @@ struct _GssServer
   gboolean enable_rtsp;
   gboolean enable_rtmp;
   gboolean enable_vod;
+  gboolean enable_zero_copy;
+  gboolean enable_compression;
+  int async_threads;
+  /* in kB */
+  int range_window_size;
+  gboolean enable_cmaf;
+  /* in ms */
+  int cmaf_segment_duration;
+  int cmaf_chunk_duration;
+  /* in ms */
+  int hls_segment_duration;
 
   gboolean enable_osplayer;
   gboolean enable_persona;
@@ -112,6 +125,11 @@ struct _GssServer
   GssAddrRangeList *kiosk_arl;
 
   GssPlayready *playready;
+
+  GssFdCache *fd_cache;
+  GssFragmentCache *fragment_cache;
+  GssLatencyHistogram *io_latency;
+  GssLatencyHistogram *encrypt_latency;
 };
 
 struct _GssServerClass
@@ -24,6 +24,7 @@
 #include <gst/gst.h>
 
 #include "gss-sglist.h"
+#include "gss-io.h"
 #include "gss-log.h"
 
 #include <string.h>
@@ -32,6 +33,8 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
 
 
 GssSGList *
@@ -71,43 +74,207 @@ gss_sglist_get_size (GssSGList * sglist)
   return size;
 }
 
+/* Chunks separated by a gap of at most this many bytes are fetched with
+ * a single preadv(), with the gap read into a scratch buffer.  In
+ * interleaved files the gaps are the samples of the other tracks. */
+#define GSS_SGLIST_MAX_GAP 16384
+#define GSS_SGLIST_MAX_IOV 64
+
+typedef struct _GssSGListRun GssSGListRun;
+struct _GssSGListRun
+{
+  struct iovec *iov;
+  int n_iov;
+  off_t offset;
+};
+
+/**
+ * gss_sglist_load:
+ * @sglist: a #GssSGList
+ * @fd: file descriptor to read from
+ * @dest: buffer of at least gss_sglist_get_size() bytes
+ * @error: location for a #GError, or %NULL
+ *
+ * Reads the chunks of @sglist from @fd into consecutive locations of
+ * @dest.  Runs of adjacent or nearly adjacent chunks are read with one
+ * preadv() each.  The file offset of @fd is not used, so the same
+ * descriptor may be read from several threads at once.
+ *
+ * Returns: %TRUE on success
+ */
 gboolean
 gss_sglist_load (GssSGList * sglist, int fd, guint8 * dest, GError ** error)
 {
+  GssSGListRun *reads;
+  GssSGListRun *run = NULL;
+  struct iovec *iov;
+  int n_reads = 0;
+  int n_iov = 0;
+  guint8 *scratch = NULL;
+  off_t end = 0;
+  gsize offset = 0;
+  gboolean ret = TRUE;
   int i;
-  off_t ret;
-  ssize_t n;
-  off_t offset = 0;
+
+  g_return_val_if_fail (sglist != NULL, FALSE);
+
+  /* each chunk needs at most one run, and one iovec plus one for the gap
+   * in front of it */
+  reads = g_new (GssSGListRun, sglist->n_chunks);
+  iov = g_new (struct iovec, 2 * sglist->n_chunks);
 
   for (i = 0; i < sglist->n_chunks; i++) {
-    GST_DEBUG ("chunk %d: %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
-        i, sglist->chunks[i].offset, sglist->chunks[i].size);
-    ret = lseek (fd, sglist->chunks[i].offset, SEEK_SET);
-    if (ret < 0) {
-      GST_WARNING ("failed to seek to %" G_GUINT64_FORMAT
-          " error=\"%s\"", sglist->chunks[i].offset, g_strerror (errno));
-      if (error) {
-        *error = g_error_new (_gss_error_quark, GSS_ERROR_FILE_SEEK,
-            "failed to seek on file");
+    GssSGChunk *chunk = &sglist->chunks[i];
+
+    GST_LOG ("chunk %d: %" G_GSIZE_FORMAT " %" G_GSIZE_FORMAT,
+        i, chunk->offset, chunk->size);
+    if (chunk->size == 0)
+      continue;
+
+    if (run && chunk->offset == (gsize) end) {
+      /* contiguous in both the file and @dest */
+      iov[n_iov - 1].iov_len += chunk->size;
+      end += chunk->size;
+    } else if (run && run->n_iov + 2 <= GSS_SGLIST_MAX_IOV &&
+        chunk->offset > (gsize) end &&
+        chunk->offset - end <= GSS_SGLIST_MAX_GAP) {
+      /* gaps of all runs share the scratch buffer, since its contents
+       * are never looked at */
+      if (scratch == NULL) {
+        scratch = g_malloc (GSS_SGLIST_MAX_GAP);
       }
-      return FALSE;
+      iov[n_iov].iov_base = scratch;
+      iov[n_iov].iov_len = chunk->offset - end;
+      n_iov++;
+      iov[n_iov].iov_base = dest + offset;
+      iov[n_iov].iov_len = chunk->size;
+      n_iov++;
+      run->n_iov += 2;
+      end = chunk->offset + chunk->size;
+    } else {
+      run = &reads[n_reads];
+      n_reads++;
+      run->iov = iov + n_iov;
+      run->n_iov = 1;
+      run->offset = chunk->offset;
+      iov[n_iov].iov_base = dest + offset;
+      iov[n_iov].iov_len = chunk->size;
+      n_iov++;
+      end = chunk->offset + chunk->size;
     }
+    offset += chunk->size;
+  }
 
-    n = read (fd, dest + offset, sglist->chunks[i].size);
-    if (n < sglist->chunks[i].size) {
-      GST_WARNING ("failed to read %" G_GUINT64_FORMAT " bytes at %"
-          G_GUINT64_FORMAT " error=\"%s\"",
-          sglist->chunks[i].size, sglist->chunks[i].offset, g_strerror (errno));
-      if (error) {
-        *error = g_error_new (_gss_error_quark, GSS_ERROR_FILE_READ,
-            "failed to read from file");
-      }
-      return FALSE;
+  for (i = 0; i < n_reads && ret; i++) {
+    ret = gss_io_preadv (fd, reads[i].iov, reads[i].n_iov, reads[i].offset,
+        error);
+  }
+
+  g_free (scratch);
+  g_free (iov);
+  g_free (reads);
+
+  return ret;
+}
+
+/**
+ * gss_sglist_advise:
+ * @sglist: a #GssSGList
+ * @fd: file descriptor the chunks are read from
+ * @advice: the hint to give
+ *
+ * Tells the kernel how the chunks of @sglist will be used, so it can
+ * start reading them into the page cache (%GSS_SGLIST_ADVICE_WILLNEED)
+ * or drop them from it (%GSS_SGLIST_ADVICE_DONTNEED).  Read-ahead covers
+ * the same runs as gss_sglist_load(), gaps included.  Only exact chunks
+ * are dropped, since the gaps between them may belong to other tracks
+ * that are still being read.  Does nothing where posix_fadvise() is not
+ * available.
+ */
+void
+gss_sglist_advise (GssSGList * sglist, int fd, GssSGListAdvice advice)
+{
+#ifdef HAVE_POSIX_FADVISE
+  gsize max_gap;
+  int fadvice;
+  off_t start = 0;
+  off_t end = 0;
+  gboolean have_run = FALSE;
+  int i;
+
+  g_return_if_fail (sglist != NULL);
+
+  if (advice == GSS_SGLIST_ADVICE_WILLNEED) {
+    max_gap = GSS_SGLIST_MAX_GAP;
+    fadvice = POSIX_FADV_WILLNEED;
+  } else {
+    max_gap = 0;
+    fadvice = POSIX_FADV_DONTNEED;
+  }
+
+  for (i = 0; i < sglist->n_chunks; i++) {
+    GssSGChunk *chunk = &sglist->chunks[i];
+
+    if (chunk->size == 0)
+      continue;
+
+    if (have_run && chunk->offset >= (gsize) end &&
+        chunk->offset - end <= max_gap) {
+      end = chunk->offset + chunk->size;
+      continue;
+    }
+    if (have_run) {
+      posix_fadvise (fd, start, end - start, fadvice);
     }
-    offset += sglist->chunks[i].size;
+    start = chunk->offset;
+    end = chunk->offset + chunk->size;
+    have_run = TRUE;
+  }
+  if (have_run) {
+    posix_fadvise (fd, start, end - start, fadvice);
   }
+#endif
+}
 
-  return TRUE;
+/**
+ * gss_sglist_coalesce:
+ * @sglist: a #GssSGList
+ *
+ * Merges chunks that are adjacent in the file and removes empty chunks,
+ * shrinking @sglist and its chunk array to the minimal set of extents.
+ * Unlike gss_sglist_merge(), this leaves no zero-size holes behind.
+ */
+void
+gss_sglist_coalesce (GssSGList * sglist)
+{
+  int i;
+  int j = -1;
+
+  g_return_if_fail (sglist != NULL);
+  g_return_if_fail (sglist->n_chunks > 0);
+
+  for (i = 0; i < sglist->n_chunks; i++) {
+    if (sglist->chunks[i].size == 0)
+      continue;
+    if (j >= 0 && sglist->chunks[i].offset ==
+        sglist->chunks[j].offset + sglist->chunks[j].size) {
+      sglist->chunks[j].size += sglist->chunks[i].size;
+    } else {
+      j++;
+      sglist->chunks[j] = sglist->chunks[i];
+    }
+  }
+  /* keep at least one (possibly empty) chunk, as gss_sglist_new() does */
+  if (j < 0) {
+    j = 0;
+    sglist->chunks[0].offset = 0;
+    sglist->chunks[0].size = 0;
+  }
+  if (sglist->n_chunks != j + 1) {
+    sglist->n_chunks = j + 1;
+    sglist->chunks = g_realloc (sglist->chunks,
+        sizeof (GssSGChunk) * sglist->n_chunks);
+  }
 }
 
 void
@@ -34,6 +34,11 @@ struct _GssSGChunk {
   gsize size;
 };
 
+typedef enum {
+  GSS_SGLIST_ADVICE_WILLNEED,
+  GSS_SGLIST_ADVICE_DONTNEED
+} GssSGListAdvice;
+
 struct _GssSGList {
   int n_chunks;
   GssSGChunk *chunks;
@@ -45,7 +50,9 @@ void gss_sglist_free (GssSGList *sglist);
 gsize gss_sglist_get_size (GssSGList *sglist);
 gboolean gss_sglist_load (GssSGList *sglist, int fd, guint8 *dest,
     GError **error);
+void gss_sglist_advise (GssSGList *sglist, int fd, GssSGListAdvice advice);
 void gss_sglist_merge (GssSGList *sglist);
+void gss_sglist_coalesce (GssSGList *sglist);
 
 
 G_END_DECLS
@@ -146,8 +146,8 @@ gss_stream_finalize (GObject * object)
   for (i = 0; i < GSS_STREAM_HLS_CHUNKS; i++) {
     GssHLSSegment *segment = &stream->chunks[i];
 
-    if (segment->buffer) {
-      soup_buffer_free (segment->buffer);
+    if (segment->buffers) {
+      g_ptr_array_free (segment->buffers, TRUE);
       g_free (segment->location);
     }
   }
@@ -155,6 +155,9 @@ gss_stream_finalize (GObject * object)
   if (stream->hls.index_buffer) {
     soup_buffer_free (stream->hls.index_buffer);
   }
+  if (stream->hls.index_gzip_buffer) {
+    soup_buffer_free (stream->hls.index_gzip_buffer);
+  }
 #define CLEANUP(x) do { \
   if (x) { \
     if (GST_OBJECT_REFCOUNT (x) != 1) \
@@ -164,6 +167,7 @@ gss_stream_finalize (GObject * object)
 } while (0)
 
   gss_stream_set_sink (stream, NULL);
+  gss_stream_free_cmaf (stream);
   CLEANUP (stream->src);
   CLEANUP (stream->sink);
   CLEANUP (stream->adapter);
@@ -565,6 +569,7 @@ void
 gss_stream_set_sink (GssStream * stream, GstElement * sink)
 {
   if (stream->sink) {
+    gss_stream_remove_cmaf (stream);
     g_object_unref (stream->sink);
   }
 
@@ -578,6 +583,9 @@ gss_stream_set_sink (GssStream * stream, GstElement * sink)
     if (stream->type == GSS_STREAM_TYPE_M2TS_H264BASE_AAC ||
         stream->type == GSS_STREAM_TYPE_M2TS_H264MAIN_AAC) {
       gss_stream_add_hls (stream);
+      if (stream->program && GSS_OBJECT_SERVER (stream->program)->enable_cmaf) {
+        gss_stream_add_cmaf (stream);
+      }
     }
   }
 }
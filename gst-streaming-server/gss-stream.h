@@ -29,6 +29,7 @@
 #include "gss-types.h"
 #include "gss-object.h"
 #include "gss-session.h"
+#include "gss-tsparse.h"
 
 G_BEGIN_DECLS
 
@@ -58,9 +59,15 @@ typedef enum {
 
 struct _GssHLSSegment {
   int index;
-  SoupBuffer *buffer;
+  /* SoupBuffers wrapping the GstBuffers of the segment */
+  GPtrArray *buffers;
   char *location;
-  int duration;
+  /* in units of the 90 kHz MPEG clock */
+  guint64 duration;
+  /* the segment starts a new timeline */
+  gboolean discontinuity;
+  /* number of discontinuities up to and including this segment */
+  int discontinuity_sequence;
 };
 
 struct _GssStream {
@@ -96,10 +103,27 @@ struct _GssStream {
   struct {
     gboolean need_index_update;
     SoupBuffer *index_buffer; /* contents of current index file */
+    SoupBuffer *index_gzip_buffer; /* index_buffer compressed, or NULL */
+    gboolean index_gzip_done; /* index_buffer was compressed, or too small */
 
     gboolean at_eos; /* true if sliding window is at the end of the stream */
+    int discontinuity_sequence;
+
+    /* only used in the streaming thread */
+    GssTsSegmenter segmenter;
   } hls;
 
+  /* low-latency CMAF */
+  struct {
+    GstElement *pipeline;
+    GstElement *src;
+    gulong probe_id;
+    GssCmafTrack *video;
+    GssCmafTrack *audio;
+    /* requests waiting for parts or segments */
+    GList *waiters;
+  } cmaf;
+
   /* FIXME move this into a private structure */
   void *rtsp_stream;
 };
@@ -123,6 +147,10 @@ GType gss_stream_type_get_type (void);
 void gss_stream_set_type (GssStream *stream, int type);
 
 void gss_stream_add_hls (GssStream *stream);
+void gss_stream_add_cmaf (GssStream *stream);
+void gss_stream_remove_cmaf (GssStream *stream);
+void gss_stream_free_cmaf (GssStream *stream);
+void gss_cmaf_get_resource (GssTransaction * t);
 GssStream * gss_stream_new (int type, int width, int height, int bitrate);
 void gss_stream_get_stats (GssStream *stream, guint64 *n_bytes_in,
     guint64 *n_bytes_out);
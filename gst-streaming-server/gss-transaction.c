@@ -25,6 +25,7 @@
 #include "gss-log.h"
 
 #include <string.h>
+#include <unistd.h>
 #include <json-glib/json-glib.h>
 
 static void gss_transaction_finalize (GssTransaction * t, SoupMessage * msg);
@@ -89,7 +90,10 @@ gss_transaction_finished (SoupMessage * msg, GssTransaction * t)
   }
   g_object_weak_unref (G_OBJECT (t->msg),
       (GWeakNotify) (gss_transaction_finalize), t);
-  gss_transaction_free (t);
+  /* a worker may still be producing a streamed response */
+  t->finished = TRUE;
+  if (t->async_pending == 0)
+    gss_transaction_free (t);
 }
 
 static void
@@ -182,53 +186,156 @@ gss_transaction_delay (GssTransaction * t, int msec)
   g_timeout_add (msec, unpause, new_t);
 }
 
-#define ASYNC_THREADS 1
+typedef struct _GssWorker GssWorker;
+struct _GssWorker
+{
+  GThread *thread;
+  gboolean running;
+  gint64 busy_time;
+  guint64 n_transactions;
+};
+
+/* The pool is resized without waiting for workers: surplus workers are
+ * sent an exit request through the queue and leave on their own once
+ * they get to it.  Exit requests that are still queued when the pool
+ * grows again are cancelled instead of starting new threads.  All of
+ * the counters below are protected by async_lock. */
 static GAsyncQueue *async_queue;
-static GThread *async_threads[ASYNC_THREADS];
+static GMutex async_lock;
+static int n_async_workers;
+static int n_async_running;
+static int n_async_exits;
+static int n_async_exits_cancelled;
+static GssWorker async_workers[GSS_TRANSACTION_MAX_ASYNC_THREADS];
 
 static gboolean
 gss_transaction_async_finish (gpointer priv)
 {
   GssTransaction *t = priv;
+  SoupMessage *msg = t->msg;
 
+  /* The client may have gone away while the worker was busy, in which
+   * case t->finished is set.  The message is kept alive until here, but
+   * its response must not be touched anymore. */
+  t->async_pending--;
   if (t->finish)
     t->finish (t, t->priv);
+  if (t->finished && t->async_pending == 0)
+    gss_transaction_free (t);
+  g_object_unref (msg);
 
   return FALSE;
 }
 
 static gpointer
-gss_transaction_async_thread (gpointer unused)
+gss_transaction_async_thread (gpointer priv)
 {
+  GssWorker *worker = priv;
   GssTransaction *t;
 
   while (TRUE) {
+    gint64 start;
+
     t = g_async_queue_pop (async_queue);
     if (t->server == NULL) {
+      gboolean cancelled;
+
+      /* a fake transaction asks one worker to exit */
       g_free (t);
-      g_thread_exit (NULL);
+      g_mutex_lock (&async_lock);
+      cancelled = (n_async_exits_cancelled > 0);
+      if (cancelled) {
+        n_async_exits_cancelled--;
+      } else {
+        n_async_exits--;
+        n_async_running--;
+        worker->running = FALSE;
+      }
+      g_mutex_unlock (&async_lock);
+      if (cancelled)
+        continue;
+      return NULL;
     }
 
-    t->async_process_time -= g_get_real_time ();
+    start = g_get_real_time ();
+    t->async_process_time -= start;
     if (t->process)
       t->process (t, t->priv);
     t->async_process_time += g_get_real_time ();
+
+    g_mutex_lock (&async_lock);
+    worker->busy_time += g_get_real_time () - start;
+    worker->n_transactions++;
+    g_mutex_unlock (&async_lock);
+
     g_idle_add (gss_transaction_async_finish, t);
   }
   return NULL;
 }
 
-void
-_priv_gss_transaction_initialize (void)
+static int
+gss_transaction_get_default_async_threads (void)
 {
+  long n;
+
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    return 1;
+  return MIN (n, GSS_TRANSACTION_MAX_ASYNC_THREADS);
+}
+
+/* Called with async_lock held.  Threads that have left are only joined
+ * here and in _priv_gss_transaction_cleanup(), when they are known to be
+ * exiting or gone. */
+static void
+gss_transaction_resize_workers (int n_workers)
+{
+  int n_current;
   int i;
 
+  n_current = n_async_running - n_async_exits;
+  if (n_workers > n_current) {
+    int n_cancel = MIN (n_workers - n_current, n_async_exits);
+
+    n_async_exits -= n_cancel;
+    n_async_exits_cancelled += n_cancel;
+    n_current += n_cancel;
+
+    for (i = 0; i < GSS_TRANSACTION_MAX_ASYNC_THREADS &&
+        n_current < n_workers; i++) {
+      GssWorker *worker = &async_workers[i];
+
+      if (worker->running)
+        continue;
+      if (worker->thread)
+        g_thread_join (worker->thread);
+      worker->running = TRUE;
+      worker->busy_time = 0;
+      worker->n_transactions = 0;
+      worker->thread = g_thread_new ("gss_worker",
+          gss_transaction_async_thread, worker);
+      n_async_running++;
+      n_current++;
+    }
+  } else {
+    for (i = n_workers; i < n_current; i++) {
+      /* Send a fake transaction to cause a thread to exit */
+      g_async_queue_push (async_queue, g_malloc0 (sizeof (GssTransaction)));
+      n_async_exits++;
+    }
+  }
+  n_async_workers = n_workers;
+}
+
+void
+_priv_gss_transaction_initialize (void)
+{
   async_queue = g_async_queue_new ();
 
-  for (i = 0; i < ASYNC_THREADS; i++) {
-    async_threads[i] =
-        g_thread_new ("gss_worker", gss_transaction_async_thread, NULL);
-  }
+  g_mutex_lock (&async_lock);
+  gss_transaction_resize_workers (gss_transaction_get_default_async_threads
+      ());
+  g_mutex_unlock (&async_lock);
 }
 
 void
@@ -236,18 +343,113 @@ _priv_gss_transaction_cleanup (void)
 {
   int i;
 
-  for (i = 0; i < ASYNC_THREADS; i++) {
-    GssTransaction *t = g_malloc0 (sizeof (GssTransaction));
-    /* Send a fake transaction to cause each thread to exit */
-    g_async_queue_push (async_queue, t);
-  }
-  for (i = 0; i < ASYNC_THREADS; i++) {
-    g_thread_join (async_threads[i]);
+  g_mutex_lock (&async_lock);
+  gss_transaction_resize_workers (0);
+  g_mutex_unlock (&async_lock);
+  for (i = 0; i < GSS_TRANSACTION_MAX_ASYNC_THREADS; i++) {
+    if (async_workers[i].thread) {
+      g_thread_join (async_workers[i].thread);
+      async_workers[i].thread = NULL;
+    }
   }
   g_async_queue_unref (async_queue);
   async_queue = NULL;
 }
 
+/**
+ * gss_transaction_set_async_threads:
+ * @n_threads: number of worker threads, or 0 for one per online CPU
+ *
+ * Resizes the pool of worker threads used by
+ * gss_transaction_process_async().  This does not wait for the workers:
+ * when the pool shrinks, transactions that are already queued are
+ * processed before the surplus workers exit.  Must be called from the
+ * main loop thread.
+ */
+void
+gss_transaction_set_async_threads (int n_threads)
+{
+  g_return_if_fail (n_threads >= 0);
+
+  if (n_threads == 0) {
+    n_threads = gss_transaction_get_default_async_threads ();
+  }
+  n_threads = MIN (n_threads, GSS_TRANSACTION_MAX_ASYNC_THREADS);
+
+  if (async_queue == NULL) {
+    async_queue = g_async_queue_new ();
+  }
+
+  g_mutex_lock (&async_lock);
+  if (n_threads != n_async_workers) {
+    GST_DEBUG ("resizing async worker pool from %d to %d threads",
+        n_async_workers, n_threads);
+    gss_transaction_resize_workers (n_threads);
+  }
+  g_mutex_unlock (&async_lock);
+}
+
+int
+gss_transaction_get_async_threads (void)
+{
+  return n_async_workers;
+}
+
+/**
+ * gss_transaction_get_async_queue_depth:
+ *
+ * Returns: the number of transactions waiting for a worker thread
+ */
+int
+gss_transaction_get_async_queue_depth (void)
+{
+  int depth;
+
+  if (async_queue == NULL)
+    return 0;
+
+  /* queued exit requests are not transactions */
+  g_mutex_lock (&async_lock);
+  depth = g_async_queue_length (async_queue) - n_async_exits -
+      n_async_exits_cancelled;
+  g_mutex_unlock (&async_lock);
+
+  return MAX (0, depth);
+}
+
+/**
+ * gss_transaction_get_async_busy_time:
+ * @worker: index of the worker thread, counting only running workers
+ * @n_transactions: (out) (allow-none): location for the number of
+ *   transactions processed by the worker
+ *
+ * Returns: the total time, in microseconds, that worker thread @worker
+ *   has spent processing transactions
+ */
+gint64
+gss_transaction_get_async_busy_time (int worker, guint64 * n_transactions)
+{
+  gint64 busy_time = 0;
+  int i;
+
+  g_return_val_if_fail (worker >= 0, 0);
+
+  g_mutex_lock (&async_lock);
+  for (i = 0; i < GSS_TRANSACTION_MAX_ASYNC_THREADS; i++) {
+    if (!async_workers[i].running)
+      continue;
+    if (worker-- == 0) {
+      busy_time = async_workers[i].busy_time;
+      if (n_transactions)
+        *n_transactions = async_workers[i].n_transactions;
+      break;
+    }
+  }
+  g_mutex_unlock (&async_lock);
+
+  return busy_time;
+}
+
 void
 gss_transaction_process_async (GssTransaction * t,
     GssTransactionFunc process, GssTransactionFunc finish, gpointer priv)
@@ -256,8 +458,12 @@ gss_transaction_process_async (GssTransaction * t,
     _priv_gss_transaction_initialize ();
   }
 
-  t->sync_process_time += g_get_real_time ();
+  /* streamed responses are processed in several steps */
+  if (t->sync_process_time < 0)
+    t->sync_process_time += g_get_real_time ();
 
+  t->async_pending++;
+  g_object_ref (t->msg);
   t->process = process;
   t->finish = finish;
   t->priv = priv;
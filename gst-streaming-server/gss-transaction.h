@@ -28,6 +28,8 @@
 
 G_BEGIN_DECLS
 
+#define GSS_TRANSACTION_MAX_ASYNC_THREADS 64
+
 typedef void (*GssTransactionCallback)(GssTransaction *transaction);
 typedef void (*GssTransactionFunc)(GssTransaction *transaction,
     gpointer priv);
@@ -53,6 +55,10 @@ struct _GssTransaction {
   GssTransactionFunc process;
   GssTransactionFunc finish;
   gpointer priv;
+
+  /*< private >*/
+  int async_pending;
+  gboolean finished;
 };
 
 GssTransaction * gss_transaction_new (GssServer *server,
@@ -66,6 +72,11 @@ void gss_transaction_delay (GssTransaction *t, int msec);
 void gss_transaction_dump (GssTransaction *t);
 void gss_transaction_process_async (GssTransaction *t,
     GssTransactionFunc process, GssTransactionFunc finish, gpointer priv);
+void gss_transaction_set_async_threads (int n_threads);
+int gss_transaction_get_async_threads (void);
+int gss_transaction_get_async_queue_depth (void);
+gint64 gss_transaction_get_async_busy_time (int worker,
+    guint64 *n_transactions);
 
 gchar *gss_json_gobject_to_data (GObject * gobject, gsize * length);
 
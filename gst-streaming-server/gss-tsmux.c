@@ -0,0 +1,730 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-tsmux.h"
+#include "gss-log.h"
+
+#include <string.h>
+
+/**
+ * SECTION:gss-tsmux
+ * @short_description: MPEG-TS packetizer for HLS segments
+ *
+ * Turns the samples of an H.264 video fragment and an AAC audio
+ * fragment into an MPEG transport stream with PAT and PMT, as used by
+ * HLS clients that don't support fragmented MP4.  Video samples are
+ * converted from length-prefixed NAL units to Annex B, with an access
+ * unit delimiter and, at the start of the segment, SPS and PPS from the
+ * avcC.  Audio samples get ADTS headers.
+ *
+ * The packetizer writes TS packets directly into the destination and
+ * doesn't allocate.  It is run twice per segment: once without a
+ * destination, to get the size, and once to write the packets.
+ *
+ * Segments are muxed independently and in any order, but clients play
+ * them back to back, so the continuity counters have to carry over
+ * from one segment to the next.  Each segment starts its counters at
+ * 0, and the PES packets of each PID are spread over a few more TS
+ * packets, so that the last counter of the segment is 15.  PAT and PMT
+ * are one packet each, and set the discontinuity indicator instead.
+ */
+
+#define PID_PMT 0x1000
+#define PID_VIDEO 0x100
+#define PID_AUDIO 0x101
+
+#define STREAM_TYPE_H264 0x1b
+#define STREAM_TYPE_AAC_ADTS 0x0f
+
+#define STREAM_ID_VIDEO 0xe0
+#define STREAM_ID_AUDIO 0xc0
+
+/* PTS and DTS are this far ahead of the PCR, which follows the decoding
+ * time of the samples, in 90 kHz units */
+#define GSS_TSMUX_DELAY 63000
+
+/* AAC frames per audio PES packet */
+#define GSS_TSMUX_MAX_AUDIO_FRAMES 8
+
+#define ADTS_HEADER_SIZE 7
+
+static const guint8 access_unit_delimiter[] = { 0, 0, 0, 1, 0x09, 0xf0 };
+static const guint8 start_code[] = { 0, 0, 0, 1 };
+
+static const int aac_sample_rates[] = {
+  96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+  16000, 12000, 11025, 8000, 7350
+};
+
+typedef struct _TsWriter TsWriter;
+struct _TsWriter
+{
+  /* NULL while computing the size */
+  guint8 *dest;
+  gsize pos;
+  guint8 cc_pat;
+  guint8 cc_pmt;
+  guint8 cc_video;
+  guint8 cc_audio;
+  /* TS packets still to be added to the PES packets of each PID */
+  int pad_video;
+  int pad_audio;
+};
+
+/* Splits one PES packet into TS packets */
+typedef struct _PesWriter PesWriter;
+struct _PesWriter
+{
+  TsWriter *w;
+  int pid;
+  guint8 *cc;
+  int *pad;
+  /* bytes of the PES packet, including the header, not written yet */
+  gsize remaining;
+  gboolean first;
+  gint64 pcr;
+  gboolean random_access;
+  guint8 *out;
+  int space;
+};
+
+typedef struct _AvcConfig AvcConfig;
+struct _AvcConfig
+{
+  int nal_length_size;
+  /* SPS and PPS entries of the avcC, each with a 16-bit size */
+  const guint8 *sps;
+  int n_sps;
+  const guint8 *pps;
+  int n_pps;
+  gsize param_sets_size;
+};
+
+typedef struct _AdtsConfig AdtsConfig;
+struct _AdtsConfig
+{
+  int profile;
+  int sample_rate_index;
+  int channels;
+};
+
+static guint32
+crc32_mpeg2 (const guint8 * data, gsize size)
+{
+  guint32 crc = 0xffffffff;
+  gsize i;
+  int j;
+
+  for (i = 0; i < size; i++) {
+    crc ^= (guint32) data[i] << 24;
+    for (j = 0; j < 8; j++) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+/* Returns the next packet, or NULL while computing the size */
+static guint8 *
+ts_writer_next_packet (TsWriter * w)
+{
+  guint8 *p = NULL;
+
+  if (w->dest)
+    p = w->dest + w->pos;
+  w->pos += GSS_TSMUX_PACKET_SIZE;
+  return p;
+}
+
+/* Writes a PSI section, which must fit into one packet */
+static void
+ts_writer_put_section (TsWriter * w, int pid, guint8 * cc,
+    const guint8 * section, int size)
+{
+  guint8 *p;
+  guint32 crc;
+  int counter = (*cc)++;
+
+  p = ts_writer_next_packet (w);
+  if (p == NULL)
+    return;
+
+  p[0] = 0x47;
+  p[1] = 0x40 | (pid >> 8);
+  p[2] = pid & 0xff;
+  p[3] = 0x30 | (counter & 0x0f);
+  /* adaptation field with the discontinuity indicator */
+  p[4] = 1;
+  p[5] = 0x80;
+  /* pointer field */
+  p[6] = 0;
+  memcpy (p + 7, section, size);
+  crc = crc32_mpeg2 (section, size);
+  GST_WRITE_UINT32_BE (p + 7 + size, crc);
+  memset (p + 11 + size, 0xff, GSS_TSMUX_PACKET_SIZE - 11 - size);
+}
+
+static void
+ts_writer_put_pat (TsWriter * w)
+{
+  guint8 section[12];
+
+  section[0] = 0x00;
+  /* section length, including the CRC */
+  section[1] = 0xb0;
+  section[2] = 13;
+  /* transport_stream_id */
+  section[3] = 0x00;
+  section[4] = 0x01;
+  /* version 0, current */
+  section[5] = 0xc1;
+  section[6] = 0x00;
+  section[7] = 0x00;
+  /* program 1 */
+  section[8] = 0x00;
+  section[9] = 0x01;
+  section[10] = 0xe0 | (PID_PMT >> 8);
+  section[11] = PID_PMT & 0xff;
+
+  ts_writer_put_section (w, 0, &w->cc_pat, section, sizeof (section));
+}
+
+static void
+ts_writer_put_pmt (TsWriter * w, gboolean have_video, gboolean have_audio)
+{
+  guint8 section[22];
+  int pcr_pid = have_video ? PID_VIDEO : PID_AUDIO;
+  int size = 12;
+
+  section[0] = 0x02;
+  /* program_number 1, version 0, current */
+  section[3] = 0x00;
+  section[4] = 0x01;
+  section[5] = 0xc1;
+  section[6] = 0x00;
+  section[7] = 0x00;
+  section[8] = 0xe0 | (pcr_pid >> 8);
+  section[9] = pcr_pid & 0xff;
+  /* no program info */
+  section[10] = 0xf0;
+  section[11] = 0x00;
+  if (have_video) {
+    section[size++] = STREAM_TYPE_H264;
+    section[size++] = 0xe0 | (PID_VIDEO >> 8);
+    section[size++] = PID_VIDEO & 0xff;
+    section[size++] = 0xf0;
+    section[size++] = 0x00;
+  }
+  if (have_audio) {
+    section[size++] = STREAM_TYPE_AAC_ADTS;
+    section[size++] = 0xe0 | (PID_AUDIO >> 8);
+    section[size++] = PID_AUDIO & 0xff;
+    section[size++] = 0xf0;
+    section[size++] = 0x00;
+  }
+  section[1] = 0xb0;
+  section[2] = size - 3 + 4;
+
+  ts_writer_put_section (w, PID_PMT, &w->cc_pmt, section, size);
+}
+
+static void
+pes_writer_open_packet (PesWriter * pw)
+{
+  guint8 *p;
+  int af_size = 0;
+  int space;
+  int counter;
+
+  if (pw->first && (pw->pcr >= 0 || pw->random_access))
+    af_size = 2 + ((pw->pcr >= 0) ? 6 : 0);
+  space = GSS_TSMUX_PACKET_SIZE - 4 - af_size;
+  if (!pw->first && *pw->pad > 0 && pw->remaining > 1) {
+    /* one byte of payload, the rest is stuffing */
+    af_size += space - 1;
+    space = 1;
+    (*pw->pad)--;
+  } else if (pw->remaining < (gsize) space) {
+    /* last packet, pad with adaptation field stuffing */
+    af_size += space - pw->remaining;
+    space = pw->remaining;
+  }
+
+  /* counted while computing the size, too */
+  counter = (*pw->cc)++;
+  p = ts_writer_next_packet (pw->w);
+  pw->space = space;
+  pw->out = NULL;
+  if (p == NULL) {
+    pw->first = FALSE;
+    return;
+  }
+
+  p[0] = 0x47;
+  p[1] = (pw->first ? 0x40 : 0x00) | (pw->pid >> 8);
+  p[2] = pw->pid & 0xff;
+  p[3] = (af_size ? 0x30 : 0x10) | (counter & 0x0f);
+  if (af_size > 0) {
+    guint8 *af = p + 4;
+    int n = 2;
+
+    af[0] = af_size - 1;
+    if (af_size > 1) {
+      af[1] = 0;
+      if (pw->first && pw->random_access)
+        af[1] |= 0x40;
+      if (pw->first && pw->pcr >= 0) {
+        guint64 base = pw->pcr & G_GUINT64_CONSTANT (0x1ffffffff);
+
+        af[1] |= 0x10;
+        af[2] = base >> 25;
+        af[3] = base >> 17;
+        af[4] = base >> 9;
+        af[5] = base >> 1;
+        af[6] = ((base & 1) << 7) | 0x7e;
+        af[7] = 0;
+        n = 8;
+      }
+      memset (af + n, 0xff, af_size - n);
+    }
+  }
+  pw->out = p + 4 + af_size;
+  pw->first = FALSE;
+}
+
+static void
+pes_writer_init (PesWriter * pw, TsWriter * w, int pid, guint8 * cc,
+    int *pad, gsize size, gint64 pcr, gboolean random_access)
+{
+  pw->w = w;
+  pw->pid = pid;
+  pw->cc = cc;
+  pw->pad = pad;
+  pw->remaining = size;
+  pw->first = TRUE;
+  pw->pcr = pcr;
+  pw->random_access = random_access;
+  pw->out = NULL;
+  pw->space = 0;
+}
+
+static void
+pes_writer_put (PesWriter * pw, const guint8 * data, gsize size)
+{
+  while (size > 0) {
+    gsize n;
+
+    if (pw->space == 0)
+      pes_writer_open_packet (pw);
+
+    n = MIN (size, pw->space);
+    if (pw->out) {
+      memcpy (pw->out, data, n);
+      pw->out += n;
+    }
+    data += n;
+    size -= n;
+    pw->space -= n;
+    pw->remaining -= n;
+  }
+}
+
+static void
+put_timestamp (guint8 * p, int prefix, guint64 ts)
+{
+  ts &= G_GUINT64_CONSTANT (0x1ffffffff);
+  p[0] = (prefix << 4) | ((ts >> 29) & 0x0e) | 1;
+  p[1] = ts >> 22;
+  p[2] = ((ts >> 14) & 0xfe) | 1;
+  p[3] = ts >> 7;
+  p[4] = ((ts << 1) & 0xfe) | 1;
+}
+
+/* Returns the size of the PES header */
+static int
+make_pes_header (guint8 * header, int stream_id, gsize payload_size,
+    guint64 pts, guint64 dts)
+{
+  int size;
+
+  header[0] = 0;
+  header[1] = 0;
+  header[2] = 1;
+  header[3] = stream_id;
+  /* data_alignment_indicator */
+  header[6] = 0x84;
+  if (pts != dts) {
+    header[7] = 0xc0;
+    header[8] = 10;
+    put_timestamp (header + 9, 3, pts);
+    put_timestamp (header + 14, 1, dts);
+    size = 19;
+  } else {
+    header[7] = 0x80;
+    header[8] = 5;
+    put_timestamp (header + 9, 2, pts);
+    size = 14;
+  }
+  /* video PES packets may be unbounded */
+  if (stream_id == STREAM_ID_VIDEO && size - 6 + payload_size > 0xffff) {
+    header[4] = 0;
+    header[5] = 0;
+  } else {
+    GST_WRITE_UINT16_BE (header + 4, size - 6 + payload_size);
+  }
+
+  return size;
+}
+
+/* 10 MHz to 90 kHz */
+static guint64
+ts_from_time (guint64 time)
+{
+  return time * 9 / 1000;
+}
+
+static gboolean
+avc_config_parse (AvcConfig * config, const guint8 * data, int size)
+{
+  const guint8 *end = data + size;
+  const guint8 *p;
+  int i;
+
+  memset (config, 0, sizeof (AvcConfig));
+  if (data == NULL || size < 7 || data[0] != 1)
+    return FALSE;
+
+  config->nal_length_size = (data[4] & 0x03) + 1;
+  config->n_sps = data[5] & 0x1f;
+  config->sps = data + 6;
+  p = config->sps;
+  for (i = 0; i < config->n_sps; i++) {
+    int n;
+
+    if (p + 2 > end)
+      return FALSE;
+    n = GST_READ_UINT16_BE (p);
+    if (p + 2 + n > end)
+      return FALSE;
+    config->param_sets_size += sizeof (start_code) + n;
+    p += 2 + n;
+  }
+  if (p + 1 > end)
+    return FALSE;
+  config->n_pps = p[0];
+  config->pps = p + 1;
+  p = config->pps;
+  for (i = 0; i < config->n_pps; i++) {
+    int n;
+
+    if (p + 2 > end)
+      return FALSE;
+    n = GST_READ_UINT16_BE (p);
+    if (p + 2 + n > end)
+      return FALSE;
+    config->param_sets_size += sizeof (start_code) + n;
+    p += 2 + n;
+  }
+
+  return TRUE;
+}
+
+static void
+put_param_sets (PesWriter * pw, const guint8 * p, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    int size = GST_READ_UINT16_BE (p);
+
+    pes_writer_put (pw, start_code, sizeof (start_code));
+    pes_writer_put (pw, p + 2, size);
+    p += 2 + size;
+  }
+}
+
+static guint
+read_nal_length (const guint8 * p, int nal_length_size)
+{
+  guint n = 0;
+  int i;
+
+  for (i = 0; i < nal_length_size; i++)
+    n = (n << 8) | p[i];
+  return n;
+}
+
+/* Gets the next NAL unit of a sample at *@p and advances *@p, skipping
+ * access unit delimiters since one is added anyway.  Returns FALSE at
+ * the end of the sample, or if the NAL unit doesn't fit into it. */
+static gboolean
+next_nal (const guint8 ** p, const guint8 * end, int nal_length_size,
+    const guint8 ** nal, gsize * nal_size)
+{
+  while (*p + nal_length_size <= end) {
+    gsize n = read_nal_length (*p, nal_length_size);
+
+    if (n > (gsize) (end - *p - nal_length_size))
+      return FALSE;
+    *nal = *p + nal_length_size;
+    *nal_size = n;
+    *p += nal_length_size + n;
+    if (n > 0 && ((*nal)[0] & 0x1f) != 9)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static void
+write_video_sample (TsWriter * w, AvcConfig * config, const guint8 * data,
+    gsize size, guint64 pts, guint64 dts, gboolean keyframe)
+{
+  PesWriter pw;
+  guint8 header[19];
+  int header_size;
+  gsize payload_size;
+  const guint8 *end = data + size;
+  const guint8 *p;
+  const guint8 *nal;
+  gsize nal_size;
+
+  payload_size = sizeof (access_unit_delimiter);
+  if (keyframe)
+    payload_size += config->param_sets_size;
+  p = data;
+  while (next_nal (&p, end, config->nal_length_size, &nal, &nal_size))
+    payload_size += sizeof (start_code) + nal_size;
+
+  header_size = make_pes_header (header, STREAM_ID_VIDEO, payload_size,
+      pts + GSS_TSMUX_DELAY, dts + GSS_TSMUX_DELAY);
+  pes_writer_init (&pw, w, PID_VIDEO, &w->cc_video, &w->pad_video,
+      header_size + payload_size, dts, keyframe);
+  pes_writer_put (&pw, header, header_size);
+  pes_writer_put (&pw, access_unit_delimiter, sizeof (access_unit_delimiter));
+  if (keyframe) {
+    put_param_sets (&pw, config->sps, config->n_sps);
+    put_param_sets (&pw, config->pps, config->n_pps);
+  }
+  p = data;
+  while (next_nal (&p, end, config->nal_length_size, &nal, &nal_size)) {
+    pes_writer_put (&pw, start_code, sizeof (start_code));
+    pes_writer_put (&pw, nal, nal_size);
+  }
+}
+
+static void
+adts_config_init (AdtsConfig * config, GssIsomTrack * track)
+{
+  const guint8 *data = track->esds.codec_data;
+  int sample_rate = track->mp4a.sample_rate >> 16;
+  guint i;
+
+  /* AAC LC, stereo */
+  config->profile = 2;
+  config->channels = 2;
+  config->sample_rate_index = 4;
+  for (i = 0; i < G_N_ELEMENTS (aac_sample_rates); i++) {
+    if (aac_sample_rates[i] == sample_rate)
+      config->sample_rate_index = i;
+  }
+
+  /* AudioSpecificConfig */
+  if (data && track->esds.codec_data_len >= 2) {
+    guint index = ((data[0] & 0x07) << 1) | (data[1] >> 7);
+
+    config->profile = data[0] >> 3;
+    if (index < G_N_ELEMENTS (aac_sample_rates)) {
+      config->sample_rate_index = index;
+      config->channels = (data[1] >> 3) & 0x0f;
+    }
+  }
+}
+
+static void
+make_adts_header (guint8 * header, AdtsConfig * config, gsize size)
+{
+  gsize frame_size = ADTS_HEADER_SIZE + size;
+
+  /* MPEG-4, no CRC */
+  header[0] = 0xff;
+  header[1] = 0xf1;
+  header[2] = ((config->profile - 1) << 6) |
+      (config->sample_rate_index << 2) | (config->channels >> 2);
+  header[3] = ((config->channels & 0x03) << 6) | (frame_size >> 11);
+  header[4] = frame_size >> 3;
+  header[5] = ((frame_size & 0x07) << 5) | 0x1f;
+  header[6] = 0xfc;
+}
+
+static void
+write_audio_samples (TsWriter * w, AdtsConfig * config, gboolean pcr,
+    const guint8 * data, const GssBoxTrunSample * samples, int n_samples,
+    guint64 dts)
+{
+  PesWriter pw;
+  guint8 header[19];
+  int header_size;
+  gsize payload_size = 0;
+  int i;
+
+  for (i = 0; i < n_samples; i++)
+    payload_size += ADTS_HEADER_SIZE + samples[i].size;
+
+  header_size = make_pes_header (header, STREAM_ID_AUDIO, payload_size,
+      dts + GSS_TSMUX_DELAY, dts + GSS_TSMUX_DELAY);
+  pes_writer_init (&pw, w, PID_AUDIO, &w->cc_audio, &w->pad_audio,
+      header_size + payload_size, pcr ? (gint64) dts : -1, TRUE);
+  pes_writer_put (&pw, header, header_size);
+  for (i = 0; i < n_samples; i++) {
+    guint8 adts[ADTS_HEADER_SIZE];
+
+    make_adts_header (adts, config, samples[i].size);
+    pes_writer_put (&pw, adts, ADTS_HEADER_SIZE);
+    pes_writer_put (&pw, data, samples[i].size);
+    data += samples[i].size;
+  }
+}
+
+static void
+ts_writer_write_segment (TsWriter * w, const GssTsMuxInput * video,
+    const GssTsMuxInput * audio, AvcConfig * avc, AdtsConfig * adts)
+{
+  GssBoxTrun *vtrun = NULL;
+  GssBoxTrun *atrun = NULL;
+  const guint8 *vdata = NULL;
+  const guint8 *adata = NULL;
+  guint64 vtime = 0;
+  guint64 atime = 0;
+  guint vi = 0;
+  guint ai = 0;
+
+  if (video) {
+    vtrun = &video->fragment->trun;
+    vdata = video->data;
+    vtime = video->fragment->timestamp;
+  }
+  if (audio) {
+    atrun = &audio->fragment->trun;
+    adata = audio->data;
+    atime = audio->fragment->timestamp;
+  }
+
+  ts_writer_put_pat (w);
+  ts_writer_put_pmt (w, video != NULL, audio != NULL);
+
+  while ((vtrun && vi < vtrun->sample_count) ||
+      (atrun && ai < atrun->sample_count)) {
+    if (atrun && ai < atrun->sample_count &&
+        (vtrun == NULL || vi == vtrun->sample_count || atime <= vtime)) {
+      guint64 dts = ts_from_time (atime);
+      gsize size = 0;
+      int n;
+
+      /* group frames up to the next video sample, within the limit of
+       * the PES packet length */
+      for (n = 0; ai + n < atrun->sample_count &&
+          n < GSS_TSMUX_MAX_AUDIO_FRAMES; n++) {
+        if (n > 0 && vtrun && vi < vtrun->sample_count && atime > vtime)
+          break;
+        if (n > 0 && size + (n + 1) * ADTS_HEADER_SIZE +
+            atrun->samples[ai + n].size > 0xff00)
+          break;
+        size += atrun->samples[ai + n].size;
+        atime += atrun->samples[ai + n].duration;
+      }
+      write_audio_samples (w, adts, vtrun == NULL, adata,
+          atrun->samples + ai, n, dts);
+      adata += size;
+      ai += n;
+    } else {
+      GssBoxTrunSample *sample = &vtrun->samples[vi];
+      guint64 dts = ts_from_time (vtime);
+      guint64 pts;
+
+      pts = ts_from_time (vtime + (gint32) sample->composition_time_offset);
+      /* fragments start at a sync sample */
+      write_video_sample (w, avc, vdata, sample->size, pts, dts, vi == 0);
+      vdata += sample->size;
+      vtime += sample->duration;
+      vi++;
+    }
+  }
+}
+
+/**
+ * gss_tsmux_write_segment:
+ * @video: (allow-none): H.264 video input
+ * @audio: (allow-none): AAC audio input
+ * @dest: (allow-none): destination for the TS packets
+ *
+ * Multiplexes the samples of @video and @audio into an MPEG transport
+ * stream, interleaved by decoding time.  The segment starts with PAT and
+ * PMT, and can be decoded independently if @video starts with a
+ * keyframe.  Timestamps are taken from the fragments, so consecutive
+ * segments have continuous timestamps.  Continuity counters start at 0
+ * and end at 15 in every segment, so they are continuous, too.
+ *
+ * If @dest is %NULL, only the size is computed.
+ *
+ * Returns: the size of the segment, or 0 if the codec data is invalid
+ */
+gsize
+gss_tsmux_write_segment (const GssTsMuxInput * video,
+    const GssTsMuxInput * audio, guint8 * dest)
+{
+  TsWriter w;
+  AvcConfig avc;
+  AdtsConfig adts;
+
+  g_return_val_if_fail (video != NULL || audio != NULL, 0);
+
+  if (video) {
+    if (!avc_config_parse (&avc, video->track->esds.codec_data,
+            video->track->esds.codec_data_len)) {
+      GST_WARNING ("invalid avcC");
+      return 0;
+    }
+  }
+  if (audio) {
+    adts_config_init (&adts, audio->track);
+  }
+
+  /* count the packets of each PID first */
+  memset (&w, 0, sizeof (w));
+  ts_writer_write_segment (&w, video, audio, &avc, &adts);
+
+  w.dest = dest;
+  w.pos = 0;
+  w.pad_video = (16 - (w.cc_video & 0x0f)) & 0x0f;
+  w.pad_audio = (16 - (w.cc_audio & 0x0f)) & 0x0f;
+  w.cc_pat = 0;
+  w.cc_pmt = 0;
+  w.cc_video = 0;
+  w.cc_audio = 0;
+  ts_writer_write_segment (&w, video, audio, &avc, &adts);
+  if (w.pad_video > 0 || w.pad_audio > 0) {
+    /* too little data to spread */
+    GST_DEBUG ("continuity counters not aligned");
+  }
+
+  return w.pos;
+}
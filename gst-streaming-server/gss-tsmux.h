@@ -0,0 +1,49 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_TSMUX_H
+#define _GSS_TSMUX_H
+
+#include "gss-isom.h"
+
+G_BEGIN_DECLS
+
+#define GSS_TSMUX_PACKET_SIZE 188
+
+typedef struct _GssTsMuxInput GssTsMuxInput;
+
+struct _GssTsMuxInput {
+  /* codec data is taken from track->esds */
+  GssIsomTrack *track;
+  /* samples are described by fragment->trun */
+  GssIsomFragment *fragment;
+  /* sample data, in the order of the sample table */
+  const guint8 *data;
+};
+
+
+gsize gss_tsmux_write_segment (const GssTsMuxInput *video,
+    const GssTsMuxInput *audio, guint8 *dest);
+
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,221 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-tsparse.h"
+
+#include <string.h>
+
+/**
+ * SECTION:gss-tsparse
+ * @short_description: MPEG-TS packet header parser
+ *
+ * Reads the fields of a TS packet that are needed to cut a transport
+ * stream into HLS segments: the random access indicator and PCR of the
+ * adaptation field, and the stream id, PTS and DTS of a PES packet
+ * starting in the packet.
+ *
+ * #GssTsSegmenter decides where to cut.  Segments are cut at random
+ * access points once they are at least the target duration long.
+ * Durations are measured with the DTS of the video stream, or its PTS
+ * when there is no DTS, or the PCR at random access points without a
+ * PES header.
+ *
+ * Without a DTS, frames that follow a key frame in decode order may be
+ * presented before it.  A timestamp up to max_reorder before the start
+ * of the segment is such a frame, and does not count as a jump.  A
+ * timestamp further back, or more than max_jump ahead, means that the
+ * source started a new timeline.  The segment is then cut at the next
+ * random access point, with the duration up to the last timestamp
+ * before the jump, and the next segment is marked as a discontinuity.
+ */
+
+#define GSS_TSPARSE_TIMESTAMP_MASK ((G_GUINT64_CONSTANT (1) << 33) - 1)
+
+static guint64
+gss_tsparse_timestamp (const guint8 * p)
+{
+  return ((guint64) (p[0] & 0x0e) << 29) | (p[1] << 22) |
+      ((p[2] & 0xfe) << 14) | (p[3] << 7) | (p[4] >> 1);
+}
+
+/**
+ * gss_tsparse_packet:
+ * @data: a TS packet of %GSS_TSPARSE_PACKET_SIZE bytes
+ * @info: (out): the fields of the packet
+ *
+ * Parses the headers of the packet at @data.  Fields that are not
+ * present are set to 0.
+ *
+ * Returns: FALSE if @data does not start with a sync byte
+ */
+gboolean
+gss_tsparse_packet (const guint8 * data, GssTsPacketInfo * info)
+{
+  const guint8 *p = data;
+  int offset = 4;
+
+  memset (info, 0, sizeof (GssTsPacketInfo));
+
+  if (p[0] != 0x47)
+    return FALSE;
+
+  info->pid = ((p[1] & 0x1f) << 8) | p[2];
+
+  if (p[3] & 0x20) {
+    int length = p[4];
+
+    if (length > 0) {
+      info->random_access = (p[5] >> 6) & 1;
+      if ((p[5] & 0x10) && length >= 7) {
+        info->have_pcr = TRUE;
+        info->pcr = ((guint64) p[6] << 25) | (p[7] << 17) | (p[8] << 9) |
+            (p[9] << 1) | (p[10] >> 7);
+      }
+    }
+    offset += 1 + length;
+  }
+
+  if ((p[1] & 0x40) && (p[3] & 0x10) &&
+      offset + 14 <= GSS_TSPARSE_PACKET_SIZE) {
+    const guint8 *pes = p + offset;
+
+    if (pes[0] == 0 && pes[1] == 0 && pes[2] == 1) {
+      info->stream_id = pes[3];
+      /* audio and video streams have the optional PES header */
+      if (((pes[3] & 0xe0) == 0xc0 || (pes[3] & 0xf0) == 0xe0) &&
+          (pes[7] & 0x80)) {
+        info->have_pts = TRUE;
+        info->pts = gss_tsparse_timestamp (pes + 9);
+        if ((pes[7] & 0x40) && offset + 19 <= GSS_TSPARSE_PACKET_SIZE) {
+          info->have_dts = TRUE;
+          info->dts = gss_tsparse_timestamp (pes + 14);
+        }
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+
+/**
+ * gss_tsparse_segmenter_reset:
+ * @segmenter: a #GssTsSegmenter
+ * @discontinuity: whether the first segment starts a new timeline
+ *
+ * Forgets the current segment.  The limits are kept.
+ */
+void
+gss_tsparse_segmenter_reset (GssTsSegmenter * segmenter,
+    gboolean discontinuity)
+{
+  segmenter->have_segment_start = FALSE;
+  segmenter->segment_start = 0;
+  segmenter->segment_end = 0;
+  segmenter->have_pcr = FALSE;
+  segmenter->last_pcr = 0;
+  segmenter->timestamp_jump = FALSE;
+  segmenter->discontinuity = discontinuity;
+}
+
+/**
+ * gss_tsparse_segmenter_push:
+ * @segmenter: a #GssTsSegmenter
+ * @info: the fields of the next packet
+ * @duration: (out): the duration of the segment that ends before the
+ *   packet, in units of the 90 kHz MPEG clock
+ * @discontinuity: (out): whether that segment starts a new timeline
+ *
+ * Returns: %GSS_TSPARSE_SEGMENT_START if the first segment starts with
+ *   the packet, %GSS_TSPARSE_SEGMENT_CUT if a segment ends before the
+ *   packet, setting @duration and @discontinuity, or
+ *   %GSS_TSPARSE_SEGMENT_NONE
+ */
+GssTsSegmentAction
+gss_tsparse_segmenter_push (GssTsSegmenter * segmenter,
+    const GssTsPacketInfo * info, guint64 * duration,
+    gboolean * discontinuity)
+{
+  gboolean is_video;
+  gboolean key_frame;
+  guint64 time;
+  guint64 delta;
+
+  if (info->have_pcr) {
+    segmenter->last_pcr = info->pcr;
+    segmenter->have_pcr = TRUE;
+  }
+
+  /* only cut at video key frames */
+  is_video = ((info->stream_id & 0xf0) == 0xe0);
+  key_frame = info->random_access && (info->stream_id == 0 || is_video);
+
+  if (is_video && info->have_dts) {
+    time = info->dts;
+  } else if (is_video && info->have_pts) {
+    time = info->pts;
+  } else if (key_frame && segmenter->have_pcr) {
+    time = segmenter->last_pcr;
+  } else {
+    return GSS_TSPARSE_SEGMENT_NONE;
+  }
+
+  if (!segmenter->have_segment_start) {
+    if (!key_frame)
+      return GSS_TSPARSE_SEGMENT_NONE;
+    /* the first segment starts with a random access point */
+    segmenter->segment_start = time;
+    segmenter->segment_end = 0;
+    segmenter->have_segment_start = TRUE;
+    return GSS_TSPARSE_SEGMENT_START;
+  }
+
+  delta = (time - segmenter->segment_start) & GSS_TSPARSE_TIMESTAMP_MASK;
+  if (((segmenter->segment_start - time) & GSS_TSPARSE_TIMESTAMP_MASK) <=
+      segmenter->max_reorder) {
+    /* presented before the key frame that started the segment */
+    delta = 0;
+  } else if (delta > segmenter->max_jump) {
+    segmenter->timestamp_jump = TRUE;
+  } else if (!segmenter->timestamp_jump) {
+    segmenter->segment_end = MAX (segmenter->segment_end, delta);
+  }
+
+  if (!key_frame)
+    return GSS_TSPARSE_SEGMENT_NONE;
+
+  if (segmenter->timestamp_jump) {
+    *duration = segmenter->segment_end;
+  } else {
+    if (delta < segmenter->target)
+      return GSS_TSPARSE_SEGMENT_NONE;
+    *duration = delta;
+  }
+  *discontinuity = segmenter->discontinuity;
+
+  segmenter->segment_start = time;
+  segmenter->segment_end = 0;
+  segmenter->discontinuity = segmenter->timestamp_jump;
+  segmenter->timestamp_jump = FALSE;
+
+  return GSS_TSPARSE_SEGMENT_CUT;
+}
@@ -0,0 +1,85 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2013 Rdio Inc <ingestions@rd.io>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_TSPARSE_H
+#define _GSS_TSPARSE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GSS_TSPARSE_PACKET_SIZE 188
+
+typedef struct _GssTsPacketInfo GssTsPacketInfo;
+
+struct _GssTsPacketInfo {
+  int pid;
+  gboolean random_access;
+  gboolean have_pcr;
+  /* PCR base, in units of the 90 kHz MPEG clock */
+  guint64 pcr;
+  /* stream id of the PES packet starting in the packet, or 0 */
+  int stream_id;
+  gboolean have_pts;
+  guint64 pts;
+  gboolean have_dts;
+  guint64 dts;
+};
+
+typedef enum {
+  GSS_TSPARSE_SEGMENT_NONE,
+  GSS_TSPARSE_SEGMENT_START,
+  GSS_TSPARSE_SEGMENT_CUT
+} GssTsSegmentAction;
+
+typedef struct _GssTsSegmenter GssTsSegmenter;
+
+struct _GssTsSegmenter {
+  /* limits, in units of the 90 kHz MPEG clock */
+  guint64 target;
+  guint64 max_jump;
+  guint64 max_reorder;
+
+  /*< private >*/
+  gboolean have_segment_start;
+  guint64 segment_start;
+  /* latest timestamp of the segment before a jump, from segment_start */
+  guint64 segment_end;
+  gboolean have_pcr;
+  guint64 last_pcr;
+  /* the timestamps jumped since segment_start */
+  gboolean timestamp_jump;
+  /* the segment being cut starts a new timeline */
+  gboolean discontinuity;
+};
+
+
+gboolean gss_tsparse_packet (const guint8 *data, GssTsPacketInfo *info);
+
+void gss_tsparse_segmenter_reset (GssTsSegmenter *segmenter,
+    gboolean discontinuity);
+GssTsSegmentAction gss_tsparse_segmenter_push (GssTsSegmenter *segmenter,
+    const GssTsPacketInfo *info, guint64 *duration, gboolean *discontinuity);
+
+
+G_END_DECLS
+
+#endif
+
@@ -37,13 +37,16 @@ typedef struct _GssServer GssServer;
 typedef struct _GssServerClass GssServerClass;
 typedef struct _GssConnection GssConnection;
 typedef struct _GssHLSSegment GssHLSSegment;
+typedef struct _GssCmafTrack GssCmafTrack;
 typedef struct _GssRtspStream GssRtspStream;
 typedef struct _GssMetrics GssMetrics;
+typedef struct _GssLatencyHistogram GssLatencyHistogram;
 typedef struct _GssResource GssResource;
 typedef struct _GssSession GssSession;
 typedef struct _GssTransaction GssTransaction;
 typedef struct _GssPlayready GssPlayready;
 typedef struct _GssPlayreadyClass GssPlayreadyClass;
+typedef struct _GssPlayreadyCipher GssPlayreadyCipher;
 
 
 G_END_DECLS
@@ -25,6 +25,7 @@
 #include "gss-html.h"
 #include "gss-adaptive.h"
 #include "gss-playready.h"
+#include "gss-compress.h"
 #include "gss-soup.h"
 
 
@@ -34,13 +35,60 @@ enum
   PROP_ENDPOINT,
   PROP_ARCHIVE_DIR,
   PROP_DIR_LEVELS,
-  PROP_CACHE_SIZE
+  PROP_CACHE_SIZE,
+  PROP_CACHE_MEMORY,
+  PROP_CACHE_MEMORY_USED,
+  PROP_CACHE_ENTRIES,
+  PROP_CACHE_HITS,
+  PROP_CACHE_MISSES,
+  PROP_CACHE_EVICTIONS,
+  PROP_READAHEAD_FRAGMENTS,
+  PROP_COLD_REQUEST_RATE
 };
 
 #define DEFAULT_ENDPOINT "vod"
 #define DEFAULT_ARCHIVE_DIR "vod"
 #define DEFAULT_DIR_LEVELS 0
 #define DEFAULT_CACHE_SIZE 100
+#define DEFAULT_CACHE_MEMORY 1024
+#define DEFAULT_READAHEAD_FRAGMENTS 2
+#define DEFAULT_COLD_REQUEST_RATE 20
+
+typedef struct _GssVodCacheEntry GssVodCacheEntry;
+struct _GssVodCacheEntry
+{
+  char *hash_key;
+  GssAdaptive *adaptive;
+  gsize memory_size;
+  GList *lru_link;
+};
+
+/* A stream being loaded by a worker thread, and the transactions
+ * waiting for it. */
+typedef struct _GssVodLoad GssVodLoad;
+struct _GssVodLoad
+{
+  GssVod *vod;
+  char *hash_key;
+  char *key;
+  char *dir;
+  char *version;
+  GssDrmType drm_type;
+  GssAdaptiveStream stream_type;
+  GssAdaptive *adaptive;
+  /* GssVodWaiter */
+  GList *waiters;
+};
+
+typedef struct _GssVodWaiter GssVodWaiter;
+struct _GssVodWaiter
+{
+  GssTransaction *t;
+  char *subpath;
+  GHashTable *query;
+  gulong finished_id;
+  gboolean finished;
+};
 
 static void gss_vod_finalize (GObject * object);
 static void gss_vod_set_property (GObject * object, guint prop_id,
@@ -49,21 +97,39 @@ static void gss_vod_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
 static void gss_vod_get_resource (GssTransaction * t);
 static void gss_vod_post_resource (GssTransaction * t);
-static GssAdaptive *gss_vod_get_adaptive (GssVod * vod, const char *key,
-    const char *version, GssDrmType drm_type, GssAdaptiveStream stream_type);
+static GssAdaptive *gss_vod_cache_lookup (GssVod * vod,
+    const char *hash_key);
+static void gss_vod_cache_insert (GssVod * vod, const char *hash_key,
+    GssAdaptive * adaptive);
+static void gss_vod_load (GssVod * vod, GssTransaction * t,
+    const char *hash_key, const char *key, const char *version,
+    GssDrmType drm_type, GssAdaptiveStream stream_type, const char *subpath);
 static void gss_vod_get_adaptive_resource (GssTransaction * t);
 static void gss_vod_attach (GssObject * object, GssServer * server);
 static void gss_vod_player_get_resource (GssTransaction * t);
+static void gss_vod_cache_trim (GssVod * vod);
+static void gss_vod_cache_update_size (GssVod * vod, const char *hash_key);
+static void gss_vod_update_hints (GssVod * vod);
 
 G_DEFINE_TYPE (GssVod, gss_vod, GSS_TYPE_MODULE);
 
 static GObjectClass *parent_class;
 
+static void
+gss_vod_cache_entry_free (GssVodCacheEntry * entry)
+{
+  gss_adaptive_unref (entry->adaptive);
+  g_free (entry->hash_key);
+  g_free (entry);
+}
+
 static void
 gss_vod_init (GssVod * vod)
 {
-  vod->cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-      (GDestroyNotify) gss_adaptive_free);
+  vod->cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) gss_vod_cache_entry_free);
+  g_queue_init (&vod->cache_lru);
+  vod->pending_loads = g_hash_table_new (g_str_hash, g_str_equal);
 }
 
 static void
@@ -95,6 +161,50 @@ gss_vod_class_init (GssVodClass * vod_class)
           "Number of streams to hold in memory.", 1, 10000, DEFAULT_CACHE_SIZE,
           (GParamFlags) (G_PARAM_CONSTRUCT | G_PARAM_READWRITE |
               G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (vod_class),
+      PROP_CACHE_MEMORY, g_param_spec_int ("cache-memory", "Cache Memory",
+          "Approximate memory (in MB) used for stream metadata before the "
+          "least recently used streams are dropped.", 1, G_MAXINT,
+          DEFAULT_CACHE_MEMORY,
+          (GParamFlags) (G_PARAM_CONSTRUCT | G_PARAM_READWRITE |
+              G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (vod_class),
+      PROP_CACHE_MEMORY_USED, g_param_spec_uint64 ("cache-memory-used",
+          "Cache Memory Used", "Cache memory used (in bytes)",
+          0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (vod_class),
+      PROP_CACHE_ENTRIES, g_param_spec_int ("cache-entries", "Cache Entries",
+          "Number of streams currently in memory", 0, G_MAXINT, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (vod_class),
+      PROP_CACHE_HITS, g_param_spec_uint64 ("cache-hits", "Cache Hits",
+          "Cache Hits", 0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (vod_class),
+      PROP_CACHE_MISSES, g_param_spec_uint64 ("cache-misses", "Cache Misses",
+          "Cache Misses", 0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (vod_class),
+      PROP_CACHE_EVICTIONS, g_param_spec_uint64 ("cache-evictions",
+          "Cache Evictions", "Cache Evictions", 0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (vod_class),
+      PROP_READAHEAD_FRAGMENTS, g_param_spec_int ("readahead-fragments",
+          "Read-ahead Fragments",
+          "Number of fragments following a requested fragment to read "
+          "ahead into the page cache (0 disables read-ahead)", 0, 16,
+          DEFAULT_READAHEAD_FRAGMENTS,
+          (GParamFlags) (G_PARAM_CONSTRUCT | G_PARAM_READWRITE |
+              G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (vod_class),
+      PROP_COLD_REQUEST_RATE, g_param_spec_int ("cold-request-rate",
+          "Cold Request Rate",
+          "Streams with fewer fragment requests per minute than this are "
+          "dropped from the page cache after being served (0 disables)",
+          0, G_MAXINT, DEFAULT_COLD_REQUEST_RATE,
+          (GParamFlags) (G_PARAM_CONSTRUCT | G_PARAM_READWRITE |
+              G_PARAM_STATIC_STRINGS)));
 
   parent_class = g_type_class_peek_parent (vod_class);
 }
@@ -109,6 +219,8 @@ gss_vod_finalize (GObject * object)
   g_free (vod->endpoint);
   g_free (vod->archive_dir);
   g_hash_table_unref (vod->cache);
+  g_queue_clear (&vod->cache_lru);
+  g_hash_table_unref (vod->pending_loads);
 
   parent_class->finalize (object);
 }
@@ -141,6 +253,19 @@ gss_vod_set_property (GObject * object, guint prop_id,
       break;
     case PROP_CACHE_SIZE:
       vod->cache_size = g_value_get_int (value);
+      gss_vod_cache_trim (vod);
+      break;
+    case PROP_CACHE_MEMORY:
+      vod->cache_memory = g_value_get_int (value);
+      gss_vod_cache_trim (vod);
+      break;
+    case PROP_READAHEAD_FRAGMENTS:
+      vod->readahead_fragments = g_value_get_int (value);
+      gss_vod_update_hints (vod);
+      break;
+    case PROP_COLD_REQUEST_RATE:
+      vod->cold_request_rate = g_value_get_int (value);
+      gss_vod_update_hints (vod);
       break;
     default:
       g_assert_not_reached ();
@@ -169,6 +294,30 @@ gss_vod_get_property (GObject * object, guint prop_id,
     case PROP_CACHE_SIZE:
       g_value_set_int (value, vod->cache_size);
       break;
+    case PROP_CACHE_MEMORY:
+      g_value_set_int (value, vod->cache_memory);
+      break;
+    case PROP_CACHE_MEMORY_USED:
+      g_value_set_uint64 (value, vod->cache_memory_used);
+      break;
+    case PROP_CACHE_ENTRIES:
+      g_value_set_int (value, g_queue_get_length (&vod->cache_lru));
+      break;
+    case PROP_CACHE_HITS:
+      g_value_set_uint64 (value, vod->cache_hits);
+      break;
+    case PROP_CACHE_MISSES:
+      g_value_set_uint64 (value, vod->cache_misses);
+      break;
+    case PROP_CACHE_EVICTIONS:
+      g_value_set_uint64 (value, vod->cache_evictions);
+      break;
+    case PROP_READAHEAD_FRAGMENTS:
+      g_value_set_int (value, vod->readahead_fragments);
+      break;
+    case PROP_COLD_REQUEST_RATE:
+      g_value_set_int (value, vod->cold_request_rate);
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -304,6 +453,7 @@ gss_vod_get_adaptive_resource (GssTransaction * t)
   char *content_version;
   GssAdaptive *adaptive;
   const char *path;
+  char *hash_key;
   char *drm;
   char *stream;
   GssDrmType drm_type;
@@ -335,17 +485,27 @@ gss_vod_get_adaptive_resource (GssTransaction * t)
     goto error;
   }
 
-  adaptive =
-      gss_vod_get_adaptive (vod, key, content_version, drm_type, stream_type);
-  if (adaptive == NULL) {
-    GST_DEBUG ("failed to load %s", key);
-    gss_transaction_error_not_found (t, "failed to load");
+  if (!gss_adaptive_stream_supports_drm (stream_type, drm_type)) {
+    gss_transaction_error_not_found (t, "drm type not supported for stream");
     goto error;
   }
 
   GST_DEBUG ("subpath: %s", path);
 
-  gss_adaptive_get_resource (t, adaptive, path);
+  hash_key = g_strdup_printf ("%s/%s/%s/%s",
+      key, content_version, gss_drm_get_drm_name (drm_type),
+      gss_adaptive_stream_get_name (stream_type));
+
+  adaptive = gss_vod_cache_lookup (vod, hash_key);
+  if (adaptive) {
+    gss_adaptive_get_resource (t, adaptive, path);
+    gss_adaptive_unref (adaptive);
+    gss_vod_cache_update_size (vod, hash_key);
+  } else {
+    gss_vod_load (vod, t, hash_key, key, content_version, drm_type,
+        stream_type, path);
+  }
+  g_free (hash_key);
 
 error:
   g_free (key);
@@ -354,55 +514,276 @@ error:
   g_free (drm);
 }
 
+static void
+gss_vod_cache_remove (GssVod * vod, GssVodCacheEntry * entry)
+{
+  g_queue_delete_link (&vod->cache_lru, entry->lru_link);
+  vod->cache_memory_used -= entry->memory_size;
+  /* frees entry */
+  g_hash_table_remove (vod->cache, entry->hash_key);
+}
+
+/* Drops least recently used streams until the cache is within both the
+ * entry count and the memory limits.  The most recently used stream is
+ * always kept.  Transactions still using an evicted stream hold their
+ * own reference to it. */
+static void
+gss_vod_cache_trim (GssVod * vod)
+{
+  guint64 limit = (guint64) vod->cache_memory * 1024 * 1024;
+
+  if (vod->cache == NULL)
+    return;
+
+  while (g_queue_get_length (&vod->cache_lru) > 1 &&
+      (g_queue_get_length (&vod->cache_lru) > (guint) vod->cache_size ||
+          vod->cache_memory_used > limit)) {
+    GssVodCacheEntry *entry = g_queue_peek_tail (&vod->cache_lru);
+
+    GST_DEBUG ("evicting %s (%" G_GSIZE_FORMAT " bytes)", entry->hash_key,
+        entry->memory_size);
+    gss_vod_cache_remove (vod, entry);
+    vod->cache_evictions++;
+  }
+}
+
+/* Streams grow after they are loaded, as compressed manifests are added,
+ * so the size of an entry is refreshed after each request. */
+static void
+gss_vod_cache_update_size (GssVod * vod, const char *hash_key)
+{
+  GssVodCacheEntry *entry;
+  gsize size;
+
+  entry = g_hash_table_lookup (vod->cache, hash_key);
+  if (entry == NULL)
+    return;
+
+  size = gss_adaptive_get_memory_size (entry->adaptive);
+  if (size == entry->memory_size)
+    return;
+
+  vod->cache_memory_used -= entry->memory_size;
+  vod->cache_memory_used += size;
+  entry->memory_size = size;
+  gss_vod_cache_trim (vod);
+}
+
+static void
+gss_vod_set_adaptive_hints (GssVod * vod, GssAdaptive * adaptive)
+{
+  adaptive->readahead_fragments = vod->readahead_fragments;
+  adaptive->cold_request_rate = vod->cold_request_rate;
+}
+
+/* Passes changed page cache hint settings on to the cached streams. */
+static void
+gss_vod_update_hints (GssVod * vod)
+{
+  GList *g;
+
+  for (g = vod->cache_lru.head; g; g = g->next) {
+    GssVodCacheEntry *entry = g->data;
+
+    gss_vod_set_adaptive_hints (vod, entry->adaptive);
+  }
+}
+
+static char *
+gss_vod_get_dir (GssVod * vod, const char *key)
+{
+  switch (vod->dir_levels) {
+    case 0:
+      return g_strdup_printf ("%s/%s", vod->archive_dir, key);
+    case 1:
+      return g_strdup_printf ("%s/%c/%s", vod->archive_dir, key[0], key);
+    case 2:
+      return g_strdup_printf ("%s/%c/%c/%s", vod->archive_dir, key[0], key[1],
+          key);
+    case 3:
+      return g_strdup_printf ("%s/%c/%c/%c/%s", vod->archive_dir, key[0],
+          key[1], key[2], key);
+    default:
+      g_assert_not_reached ();
+  }
+  return NULL;
+}
+
+/* Returns a new reference to the cached stream, or NULL if it has not
+ * been loaded yet. */
 static GssAdaptive *
-gss_vod_get_adaptive (GssVod * vod, const char *key, const char *version,
-    GssDrmType drm_type, GssAdaptiveStream stream_type)
+gss_vod_cache_lookup (GssVod * vod, const char *hash_key)
 {
-  GssAdaptive *adaptive;
-  char *hash_key;
+  GssVodCacheEntry *entry;
 
-  hash_key = g_strdup_printf ("%s/%s/%s/%s",
-      key, version, gss_drm_get_drm_name (drm_type),
-      gss_adaptive_stream_get_name (stream_type));
+  entry = g_hash_table_lookup (vod->cache, hash_key);
+  if (entry == NULL) {
+    vod->cache_misses++;
+    return NULL;
+  }
 
-  adaptive = g_hash_table_lookup (vod->cache, hash_key);
-  if (adaptive == NULL) {
-    char *dir;
-
-    switch (vod->dir_levels) {
-      case 0:
-        dir = g_strdup_printf ("%s/%s", vod->archive_dir, key);
-        break;
-      case 1:
-        dir = g_strdup_printf ("%s/%c/%s", vod->archive_dir, key[0], key);
-        break;
-      case 2:
-        dir =
-            g_strdup_printf ("%s/%c/%c/%s", vod->archive_dir, key[0], key[1],
-            key);
-        break;
-      case 3:
-        dir =
-            g_strdup_printf ("%s/%c/%c/%c/%s", vod->archive_dir, key[0], key[1],
-            key[2], key);
-        break;
-      default:
-        g_assert_not_reached ();
-    }
+  g_queue_unlink (&vod->cache_lru, entry->lru_link);
+  g_queue_push_head_link (&vod->cache_lru, entry->lru_link);
+  vod->cache_hits++;
+  return gss_adaptive_ref (entry->adaptive);
+}
 
-    adaptive =
-        gss_adaptive_load (GSS_OBJECT_SERVER (vod), key, dir, version, drm_type,
-        stream_type);
-    g_free (dir);
-    if (adaptive == NULL) {
-      g_free (hash_key);
-      return NULL;
-    }
-    g_hash_table_replace (vod->cache, hash_key, adaptive);
+/* Takes ownership of adaptive. */
+static void
+gss_vod_cache_insert (GssVod * vod, const char *hash_key,
+    GssAdaptive * adaptive)
+{
+  GssVodCacheEntry *entry;
+
+  entry = g_new0 (GssVodCacheEntry, 1);
+  entry->hash_key = g_strdup (hash_key);
+  entry->adaptive = adaptive;
+  entry->memory_size = gss_adaptive_get_memory_size (adaptive);
+  gss_vod_set_adaptive_hints (vod, adaptive);
+  g_queue_push_head (&vod->cache_lru, entry);
+  entry->lru_link = g_queue_peek_head_link (&vod->cache_lru);
+  g_hash_table_replace (vod->cache, entry->hash_key, entry);
+  vod->cache_memory_used += entry->memory_size;
+
+  gss_vod_cache_trim (vod);
+}
+
+static void
+gss_vod_load_async (GssTransaction * t, gpointer priv)
+{
+  GssVodLoad *load = priv;
+
+  load->adaptive = gss_adaptive_load (t->server, load->key, load->dir,
+      load->version, load->drm_type, load->stream_type);
+}
+
+static void
+gss_vod_load_async_finish (GssTransaction * t, gpointer priv)
+{
+  GssVodLoad *load = priv;
+  GssVod *vod = load->vod;
+  GList *g;
+
+  g_hash_table_remove (vod->pending_loads, load->hash_key);
+
+  if (load->adaptive) {
+    gss_vod_cache_insert (vod, load->hash_key, load->adaptive);
   } else {
-    g_free (hash_key);
+    GST_DEBUG ("failed to load %s", load->key);
+  }
+
+  for (g = load->waiters; g; g = g_list_next (g)) {
+    GssVodWaiter *waiter = g->data;
+
+    /* Clients that went away are skipped, their transactions are
+     * gone.  The resource handler may pause the message again to
+     * finish the response asynchronously. */
+    if (!waiter->finished) {
+      g_signal_handler_disconnect (waiter->t->msg, waiter->finished_id);
+      soup_server_unpause_message (waiter->t->soupserver, waiter->t->msg);
+      waiter->t->query = waiter->query;
+      if (load->adaptive) {
+        gss_adaptive_get_resource (waiter->t, load->adaptive,
+            waiter->subpath);
+      } else {
+        gss_transaction_error_not_found (waiter->t, "failed to load");
+      }
+      waiter->t->query = NULL;
+
+      /* as in gss_server_resource_callback(), for handlers that write
+       * the response into t->s */
+      if (waiter->t->s) {
+        gsize len = waiter->t->s->len;
+
+        gss_compress_append_body (waiter->t,
+            g_string_free (waiter->t->s, FALSE), len);
+        waiter->t->s = NULL;
+      }
+    }
+
+    if (waiter->query)
+      g_hash_table_unref (waiter->query);
+    g_free (waiter->subpath);
+    g_free (waiter);
   }
-  return adaptive;
+  g_list_free (load->waiters);
+
+  if (load->adaptive)
+    gss_vod_cache_update_size (vod, load->hash_key);
+
+  g_free (load->hash_key);
+  g_free (load->key);
+  g_free (load->dir);
+  g_free (load->version);
+  g_free (load);
+}
+
+static void
+gss_vod_waiter_finished (SoupMessage * msg, GssVodWaiter * waiter)
+{
+  g_signal_handler_disconnect (msg, waiter->finished_id);
+  waiter->finished = TRUE;
+}
+
+static GHashTable *
+copy_query (GHashTable * query)
+{
+  GHashTable *copy;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (query == NULL)
+    return NULL;
+
+  copy = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_hash_table_iter_init (&iter, query);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    g_hash_table_insert (copy, g_strdup (key), g_strdup (value));
+  }
+  return copy;
+}
+
+/* Pauses the transaction until the stream has been loaded by a worker
+ * thread.  Requests for a stream that is already being loaded wait for
+ * that load instead of starting another one. */
+static void
+gss_vod_load (GssVod * vod, GssTransaction * t, const char *hash_key,
+    const char *key, const char *version, GssDrmType drm_type,
+    GssAdaptiveStream stream_type, const char *subpath)
+{
+  GssVodLoad *load;
+  GssVodWaiter *waiter;
+
+  soup_server_pause_message (t->soupserver, t->msg);
+
+  /* soup frees the query table when the handler returns */
+  waiter = g_new0 (GssVodWaiter, 1);
+  waiter->t = t;
+  waiter->subpath = g_strdup (subpath);
+  waiter->query = copy_query (t->query);
+  waiter->finished_id = g_signal_connect (t->msg, "finished",
+      G_CALLBACK (gss_vod_waiter_finished), waiter);
+
+  load = g_hash_table_lookup (vod->pending_loads, hash_key);
+  if (load) {
+    GST_DEBUG ("waiting for load of %s", hash_key);
+    load->waiters = g_list_append (load->waiters, waiter);
+    return;
+  }
+
+  load = g_new0 (GssVodLoad, 1);
+  load->vod = vod;
+  load->hash_key = g_strdup (hash_key);
+  load->key = g_strdup (key);
+  load->dir = gss_vod_get_dir (vod, key);
+  load->version = g_strdup (version);
+  load->drm_type = drm_type;
+  load->stream_type = stream_type;
+  load->waiters = g_list_append (NULL, waiter);
+  g_hash_table_insert (vod->pending_loads, load->hash_key, load);
+
+  gss_transaction_process_async (t, gss_vod_load_async,
+      gss_vod_load_async_finish, load);
 }
 
 static void
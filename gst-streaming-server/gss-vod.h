@@ -46,12 +46,23 @@ typedef struct _GssVodClass GssVodClass;
 struct _GssVod {
   GssModule module;
   GHashTable *cache;
+  /* GssVodCacheEntry, most recently used at head */
+  GQueue cache_lru;
+  guint64 cache_memory_used;
+  guint64 cache_hits;
+  guint64 cache_misses;
+  guint64 cache_evictions;
+  /* GssVodLoad, by hash key */
+  GHashTable *pending_loads;
 
   /* properties */
   char *endpoint;
   char *archive_dir;
   int dir_levels;
   int cache_size;
+  int cache_memory;
+  int readahead_fragments;
+  int cold_request_rate;
 };
 
 struct _GssVodClass {
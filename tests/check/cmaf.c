@@ -0,0 +1,263 @@
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_VALGRIND_H
+# include <valgrind/valgrind.h>
+#else
+# define RUNNING_ON_VALGRIND FALSE
+#endif
+
+#include "gst-streaming-server/gss-cmaf.h"
+#include <gst/check/gstcheck.h>
+#include <string.h>
+
+/* avcC with one SPS and one PPS, 4-byte NAL lengths */
+static const guint8 avcc[] = {
+  0x01, 0x64, 0x00, 0x1f, 0xff, 0xe1, 0x00, 0x04, 0x67, 0x64, 0x00, 0x1f,
+  0x01, 0x00, 0x02, 0x68, 0xee
+};
+
+/* AAC LC, 44.1 kHz, stereo */
+static const guint8 audio_specific_config[] = { 0x12, 0x10 };
+
+/* 25 frames per second, one sync sample every 2 seconds */
+#define FRAME_DURATION 400000
+#define GOP_LENGTH 50
+
+static void
+push_frames (GssCmafTrack * track, int first, int n)
+{
+  guint8 data[100];
+  int i;
+
+  memset (data, 0, sizeof (data));
+  for (i = first; i < first + n; i++) {
+    guint64 dts = (guint64) i * FRAME_DURATION;
+
+    GST_WRITE_UINT32_BE (data, sizeof (data) - 4);
+    data[4] = (i % GOP_LENGTH == 0) ? 0x65 : 0x41;
+    gss_cmaf_track_push_sample (track, data, sizeof (data), dts,
+        dts + FRAME_DURATION, (i % GOP_LENGTH == 0));
+  }
+}
+
+static gboolean
+has_box (SoupBuffer * buffer, gsize offset, const char *fourcc)
+{
+  return buffer->length >= offset + 8 &&
+      memcmp (buffer->data + offset + 4, fourcc, 4) == 0;
+}
+
+static int n_notify;
+
+static void
+notify (GssCmafTrack * track, gpointer priv)
+{
+  n_notify++;
+}
+
+GST_START_TEST (test_cmaf_segments)
+{
+  GssCmafTrack *track;
+  GssCmafSegment *segment;
+  GssCmafChunk *chunk;
+  GString *s;
+  int i;
+
+  track = gss_cmaf_track_new_video (avcc, sizeof (avcc), 640, 360);
+  fail_unless (track != NULL);
+  fail_unless (strcmp (track->codec, "avc1.64001f") == 0);
+  fail_unless (has_box (track->init_segment, 0, "ftyp"));
+  fail_unless (memcmp (track->init_segment->data + 8, "cmfc", 4) == 0);
+  gss_cmaf_track_set_durations (track, 20000000, 5000000);
+  track->notify = notify;
+  n_notify = 0;
+
+  /* samples before the first sync sample are dropped */
+  push_frames (track, GOP_LENGTH - 3, 3);
+  fail_unless (track->n_segments == 0);
+
+  push_frames (track, GOP_LENGTH, 3 * GOP_LENGTH + 1);
+  fail_unless (track->n_segments == 4);
+  fail_unless (gss_cmaf_track_get_first_segment (track) == 0);
+
+  /* chunks are at most 500 ms long, and segments end at the sync
+   * samples after 2 seconds */
+  for (i = 0; i < 3; i++) {
+    segment = gss_cmaf_track_get_segment (track, i);
+    fail_unless (segment != NULL);
+    fail_unless (segment->complete);
+    fail_unless (segment->index == i);
+    fail_unless (segment->timestamp ==
+        (guint64) (i + 1) * GOP_LENGTH * FRAME_DURATION);
+    fail_unless (segment->duration == GOP_LENGTH * FRAME_DURATION);
+    fail_unless (segment->chunks->len == 5);
+  }
+  fail_unless (n_notify == 3 * 5 + 3);
+
+  segment = gss_cmaf_track_get_segment (track, 0);
+  chunk = &g_array_index (segment->chunks, GssCmafChunk, 0);
+  fail_unless (chunk->independent);
+  fail_unless (chunk->duration == 12 * FRAME_DURATION);
+  fail_unless (has_box (chunk->buffer, 0, "moof"));
+  fail_unless (has_box (chunk->buffer, GST_READ_UINT32_BE (chunk->buffer->data),
+          "mdat"));
+  fail_unless (GST_READ_UINT32_BE (chunk->buffer->data) + 8 + 12 * 100 ==
+      chunk->buffer->length);
+  chunk = &g_array_index (segment->chunks, GssCmafChunk, 1);
+  fail_if (chunk->independent);
+
+  /* the segment in progress has no chunks yet */
+  segment = gss_cmaf_track_get_segment (track, 3);
+  fail_unless (segment != NULL);
+  fail_if (segment->complete);
+  fail_unless (segment->chunks->len == 0);
+  fail_unless (gss_cmaf_track_get_segment (track, 4) == NULL);
+
+  fail_unless (gss_cmaf_track_has_part (track, 2, 3));
+  fail_unless (gss_cmaf_track_has_part (track, 2, -1));
+  fail_if (gss_cmaf_track_has_part (track, 3, 0));
+  fail_if (gss_cmaf_track_has_part (track, 3, -1));
+
+  s = g_string_new ("");
+  gss_cmaf_track_append_hls_playlist (track, s, "v/");
+  fail_unless (strstr (s->str, "#EXT-X-TARGETDURATION:2\n") != NULL);
+  fail_unless (strstr (s->str, "#EXT-X-PART-INF:PART-TARGET=0.500\n") != NULL);
+  fail_unless (strstr (s->str, "#EXT-X-MAP:URI=\"v/init.mp4\"\n") != NULL);
+  fail_unless (strstr (s->str,
+          "#EXT-X-PART:DURATION=0.480,URI=\"v/1.0.m4s\",INDEPENDENT=YES\n")
+      != NULL);
+  fail_unless (strstr (s->str, "#EXTINF:2.000,\nv/2.m4s\n") != NULL);
+  fail_unless (strstr (s->str,
+          "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"v/3.0.m4s\"\n") != NULL);
+  fail_unless (strstr (s->str, "#EXT-X-ENDLIST") == NULL);
+  g_string_free (s, TRUE);
+
+  s = g_string_new ("");
+  gss_cmaf_track_append_dash_segment_template (track, s, "0/v/");
+  fail_unless (strstr (s->str, "availabilityTimeOffset=\"1.500\"") != NULL);
+  fail_unless (strstr (s->str, "<S t=\"20000000\" d=\"20000000\"/>") != NULL);
+  g_string_free (s, TRUE);
+
+  /* the end of the stream completes the last segment */
+  gss_cmaf_track_finish (track);
+  segment = gss_cmaf_track_get_segment (track, 3);
+  fail_unless (segment->complete);
+  fail_unless (segment->chunks->len == 1);
+  fail_unless (gss_cmaf_track_has_part (track, 4, 0));
+
+  s = g_string_new ("");
+  gss_cmaf_track_append_hls_playlist (track, s, "v/");
+  fail_unless (strstr (s->str, "#EXT-X-ENDLIST\n") != NULL);
+  fail_unless (strstr (s->str, "PRELOAD-HINT") == NULL);
+  g_string_free (s, TRUE);
+
+  gss_cmaf_track_free (track);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_cmaf_window)
+{
+  GssCmafTrack *track;
+  GString *s;
+
+  track = gss_cmaf_track_new_video (avcc, sizeof (avcc), 640, 360);
+  gss_cmaf_track_set_durations (track, 20000000, 5000000);
+
+  push_frames (track, 0, (GSS_CMAF_SEGMENTS + 2) * GOP_LENGTH + 1);
+  fail_unless (track->n_segments == GSS_CMAF_SEGMENTS + 3);
+  fail_unless (gss_cmaf_track_get_first_segment (track) == 3);
+  fail_unless (gss_cmaf_track_get_segment (track, 2) == NULL);
+  fail_unless (gss_cmaf_track_get_segment (track, 3)->index == 3);
+
+  /* parts that fell out of the window are never going to arrive */
+  fail_unless (gss_cmaf_track_has_part (track, 2, 0));
+
+  s = g_string_new ("");
+  gss_cmaf_track_append_hls_playlist (track, s, "v/");
+  fail_unless (strstr (s->str, "#EXT-X-MEDIA-SEQUENCE:3\n") != NULL);
+  fail_unless (strstr (s->str, "\nv/2.m4s") == NULL);
+  /* only the last segments are listed with their parts */
+  fail_unless (strstr (s->str, "\"v/3.0.m4s") == NULL);
+  fail_unless (strstr (s->str, "\"v/11.0.m4s") != NULL);
+  g_string_free (s, TRUE);
+
+  gss_cmaf_track_free (track);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_cmaf_audio)
+{
+  GssCmafTrack *track;
+  GssCmafSegment *segment;
+  guint8 data[200];
+  int i;
+
+  track = gss_cmaf_track_new_audio (audio_specific_config,
+      sizeof (audio_specific_config), 44100, 2);
+  fail_unless (track != NULL);
+  fail_unless (strcmp (track->codec, "mp4a.40.2") == 0);
+  fail_unless (has_box (track->init_segment, 0, "ftyp"));
+  gss_cmaf_track_set_durations (track, 20000000, 5000000);
+
+  /* every audio sample is a sync sample */
+  memset (data, 0x21, sizeof (data));
+  for (i = 0; i < 100; i++) {
+    guint64 t = (guint64) i * 232200;
+
+    gss_cmaf_track_push_sample (track, data, sizeof (data), t, t, TRUE);
+  }
+  gss_cmaf_track_finish (track);
+
+  fail_unless (track->n_segments == 2);
+  segment = gss_cmaf_track_get_segment (track, 0);
+  fail_unless (segment->complete);
+  fail_unless (segment->duration >= 20000000);
+  fail_unless (g_array_index (segment->chunks, GssCmafChunk, 1).independent);
+
+  gss_cmaf_track_free (track);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_cmaf_finish_empty)
+{
+  GssCmafTrack *track;
+
+  track = gss_cmaf_track_new_video (avcc, sizeof (avcc), 640, 360);
+  track->notify = notify;
+  n_notify = 0;
+
+  /* waiters are told about the end of a stream without segments */
+  gss_cmaf_track_finish (track);
+  fail_unless (n_notify == 1);
+  fail_unless (gss_cmaf_track_has_part (track, 0, 0));
+  gss_cmaf_track_finish (track);
+  fail_unless (n_notify == 1);
+
+  gss_cmaf_track_free (track);
+}
+
+GST_END_TEST;
+
+
+static Suite *
+gss_cmaf_suite (void)
+{
+  Suite *s = suite_create ("GssCmaf");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_cmaf_segments);
+  tcase_add_test (tc_chain, test_cmaf_window);
+  tcase_add_test (tc_chain, test_cmaf_audio);
+  tcase_add_test (tc_chain, test_cmaf_finish_empty);
+
+  return s;
+}
+
+GST_CHECK_MAIN (gss_cmaf);
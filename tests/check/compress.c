@@ -0,0 +1,105 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_VALGRIND_H
+# include <valgrind/valgrind.h>
+#else
+# define RUNNING_ON_VALGRIND FALSE
+#endif
+
+#include "gst-streaming-server/gss-compress.h"
+#include <gst/check/gstcheck.h>
+#include <gio/gio.h>
+#include <string.h>
+
+GST_START_TEST (test_content_type)
+{
+  fail_unless (gss_compress_content_type_is_text ("text/html;charset=utf-8"));
+  fail_unless (gss_compress_content_type_is_text ("text/css"));
+  fail_unless (gss_compress_content_type_is_text ("video/x-mpegurl"));
+  fail_unless (gss_compress_content_type_is_text ("application/dash+xml"));
+  fail_if (gss_compress_content_type_is_text ("application/dash+xmlfoo"));
+  fail_if (gss_compress_content_type_is_text ("video/mp4"));
+  fail_if (gss_compress_content_type_is_text ("image/png"));
+  fail_if (gss_compress_content_type_is_text (NULL));
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_gzip)
+{
+  GConverter *decompressor;
+  GConverterResult result;
+  SoupBuffer *buffer;
+  GString *s;
+  char *out;
+  gsize bytes_read;
+  gsize bytes_written;
+  int i;
+
+  s = g_string_new ("");
+  for (i = 0; i < 1000; i++) {
+    g_string_append_printf (s, "        <S d=\"%d\" />\n", 20000000 + i % 3);
+  }
+
+  buffer = gss_compress_gzip (s->str, s->len);
+  fail_unless (buffer != NULL);
+  fail_unless (buffer->length < s->len / 4);
+  /* gzip magic */
+  fail_unless ((guint8) buffer->data[0] == 0x1f);
+  fail_unless ((guint8) buffer->data[1] == 0x8b);
+
+  decompressor = G_CONVERTER (g_zlib_decompressor_new
+      (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  out = g_malloc (s->len + 1);
+  result = g_converter_convert (decompressor, buffer->data, buffer->length,
+      out, s->len + 1, G_CONVERTER_INPUT_AT_END, &bytes_read, &bytes_written,
+      NULL);
+  fail_unless (result == G_CONVERTER_FINISHED);
+  fail_unless (bytes_read == buffer->length);
+  fail_unless (bytes_written == s->len);
+  fail_unless (memcmp (out, s->str, s->len) == 0);
+  g_object_unref (decompressor);
+  g_free (out);
+  soup_buffer_free (buffer);
+
+  /* too small to bother */
+  fail_unless (gss_compress_gzip ("#EXTM3U\n", 8) == NULL);
+
+  g_string_free (s, TRUE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_etag)
+{
+  char *etag;
+
+  etag = gss_compress_get_gzip_etag ("abcd");
+  fail_unless (gss_compress_etag_matches (etag, "abcd"));
+  fail_unless (gss_compress_etag_matches ("abcd", "abcd"));
+  fail_if (gss_compress_etag_matches ("abc", "abcd"));
+  fail_if (gss_compress_etag_matches ("abcde", "abcd"));
+  fail_if (gss_compress_etag_matches ("abcd-gzipx", "abcd"));
+  g_free (etag);
+}
+
+GST_END_TEST;
+
+
+static Suite *
+gss_compress_suite (void)
+{
+  Suite *s = suite_create ("GssCompress");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_content_type);
+  tcase_add_test (tc_chain, test_gzip);
+  tcase_add_test (tc_chain, test_etag);
+
+  return s;
+}
+
+GST_CHECK_MAIN (gss_compress);
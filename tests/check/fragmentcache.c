@@ -0,0 +1,148 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_VALGRIND_H
+# include <valgrind/valgrind.h>
+#else
+# define RUNNING_ON_VALGRIND FALSE
+#endif
+
+#include "gst-streaming-server/gss-fragment-cache.h"
+#include <gst/check/gstcheck.h>
+
+static SoupBuffer *
+new_fragment (gsize size)
+{
+  return soup_buffer_new (SOUP_MEMORY_TAKE, g_malloc0 (size), size);
+}
+
+/* misses @key and offers a new fragment, like a request would */
+static void
+request_fragment (GssFragmentCache * cache, const char *key, gsize size)
+{
+  SoupBuffer *buffer;
+
+  buffer = gss_fragment_cache_lookup (cache, key);
+  if (buffer == NULL) {
+    buffer = new_fragment (size);
+    gss_fragment_cache_insert (cache, key, buffer);
+  }
+  soup_buffer_free (buffer);
+}
+
+GST_START_TEST (test_fragment_cache_admission)
+{
+  GssFragmentCache *cache;
+  SoupBuffer *buffer;
+  SoupBuffer *cached;
+  guint64 hits, misses, bytes_saved;
+  gsize size;
+  int n_entries;
+
+  cache = gss_fragment_cache_new (1000);
+
+  /* first miss is not admitted */
+  buffer = new_fragment (100);
+  fail_unless (gss_fragment_cache_lookup (cache, "a") == NULL);
+  gss_fragment_cache_insert (cache, "a", buffer);
+  soup_buffer_free (buffer);
+  fail_unless (gss_fragment_cache_lookup (cache, "b") == NULL);
+
+  /* second miss is */
+  buffer = new_fragment (100);
+  fail_unless (gss_fragment_cache_lookup (cache, "a") == NULL);
+  gss_fragment_cache_insert (cache, "a", buffer);
+
+  cached = gss_fragment_cache_lookup (cache, "a");
+  fail_unless (cached != NULL);
+  fail_unless (cached->data == buffer->data);
+  soup_buffer_free (cached);
+  soup_buffer_free (buffer);
+
+  gss_fragment_cache_get_stats (cache, &hits, &misses, &bytes_saved, &size,
+      &n_entries);
+  fail_unless (hits == 1);
+  fail_unless (misses == 3);
+  fail_unless (bytes_saved == 100);
+  fail_unless (size == 100);
+  fail_unless (n_entries == 1);
+
+  gss_fragment_cache_invalidate_prefix (cache, "a");
+  fail_unless (gss_fragment_cache_lookup (cache, "a") == NULL);
+  gss_fragment_cache_get_stats (cache, NULL, NULL, NULL, &size, &n_entries);
+  fail_unless (size == 0);
+  fail_unless (n_entries == 0);
+
+  gss_fragment_cache_free (cache);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_fragment_cache_eviction)
+{
+  GssFragmentCache *cache;
+  SoupBuffer *buffer;
+  gsize size;
+  int n_entries;
+  int i;
+
+  cache = gss_fragment_cache_new (300);
+
+  for (i = 0; i < 2; i++) {
+    request_fragment (cache, "a", 100);
+    request_fragment (cache, "b", 100);
+    request_fragment (cache, "c", 100);
+  }
+  gss_fragment_cache_get_stats (cache, NULL, NULL, NULL, &size, &n_entries);
+  fail_unless (size == 300);
+  fail_unless (n_entries == 3);
+
+  /* touch "a", so that "b" is the least recently used */
+  buffer = gss_fragment_cache_lookup (cache, "a");
+  fail_unless (buffer != NULL);
+  soup_buffer_free (buffer);
+
+  request_fragment (cache, "d", 100);
+  request_fragment (cache, "d", 100);
+
+  buffer = gss_fragment_cache_lookup (cache, "b");
+  fail_unless (buffer == NULL);
+  buffer = gss_fragment_cache_lookup (cache, "a");
+  fail_unless (buffer != NULL);
+  soup_buffer_free (buffer);
+  buffer = gss_fragment_cache_lookup (cache, "d");
+  fail_unless (buffer != NULL);
+  soup_buffer_free (buffer);
+
+  /* fragments larger than the whole budget are never admitted */
+  request_fragment (cache, "e", 400);
+  request_fragment (cache, "e", 400);
+  buffer = gss_fragment_cache_lookup (cache, "e");
+  fail_unless (buffer == NULL);
+
+  gss_fragment_cache_set_max_size (cache, 100);
+  gss_fragment_cache_get_stats (cache, NULL, NULL, NULL, &size, &n_entries);
+  fail_unless (size == 100);
+  fail_unless (n_entries == 1);
+
+  gss_fragment_cache_free (cache);
+}
+
+GST_END_TEST;
+
+
+static Suite *
+gss_fragment_cache_suite (void)
+{
+  Suite *s = suite_create ("GssFragmentCache");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_fragment_cache_admission);
+  tcase_add_test (tc_chain, test_fragment_cache_eviction);
+
+  return s;
+}
+
+GST_CHECK_MAIN (gss_fragment_cache);
@@ -0,0 +1,214 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_VALGRIND_H
+# include <valgrind/valgrind.h>
+#else
+# define RUNNING_ON_VALGRIND FALSE
+#endif
+
+#include "gst-streaming-server/gss-playready.h"
+#include <gst/check/gstcheck.h>
+#include <openssl/evp.h>
+#include <string.h>
+
+#define N_SAMPLES 60
+#define SAMPLE_SIZE 50000
+
+static const guint8 content_key[16] = {
+  0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+  0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+
+/* Fragment with every sample split into a clear header and an encrypted
+ * body, and every third sample further split into several subsamples
+ * with lengths that are not multiples of the AES block size. */
+static GssIsomFragment *
+create_fragment (int n_samples, int sample_size)
+{
+  GssIsomFragment *fragment;
+  int i;
+  int j;
+
+  fragment = gss_isom_fragment_new ();
+  fragment->trun.sample_count = n_samples;
+  fragment->trun.samples = g_malloc0 (sizeof (GssBoxTrunSample) * n_samples);
+  fragment->sample_encryption.present = TRUE;
+  fragment->sample_encryption.sample_count = n_samples;
+  fragment->sample_encryption.samples =
+      g_malloc0 (sizeof (GssBoxUUIDSampleEncryptionSample) * n_samples);
+  fragment->mdat_size = 8;
+  for (i = 0; i < n_samples; i++) {
+    GssBoxUUIDSampleEncryptionSample *sample =
+        &fragment->sample_encryption.samples[i];
+    int remaining = sample_size;
+
+    fragment->trun.samples[i].size = sample_size;
+    fragment->mdat_size += sample_size;
+    sample->iv = G_GUINT64_CONSTANT (0x0123456789abcdef) + i;
+    if (i % 3 == 0) {
+      sample->num_entries = 0;
+      continue;
+    }
+    sample->num_entries = (i % 3 == 1) ? 1 : 5;
+    sample->entries = g_malloc0 (sizeof (GssBoxUUIDSampleEncryptionSampleEntry)
+        * sample->num_entries);
+    for (j = 0; j < sample->num_entries; j++) {
+      int clear = 5 + j;
+      int encrypted = (j == sample->num_entries - 1) ?
+          remaining - clear : sample_size / 8 + 7 * j;
+
+      sample->entries[j].bytes_of_clear_data = clear;
+      sample->entries[j].bytes_of_encrypted_data = encrypted;
+      remaining -= clear + encrypted;
+    }
+  }
+
+  return fragment;
+}
+
+static guint8 *
+create_mdat (GssIsomFragment * fragment)
+{
+  guint8 *data;
+  int i;
+
+  data = g_malloc (fragment->mdat_size);
+  for (i = 0; i < fragment->mdat_size; i++) {
+    data[i] = i * 7 + (i >> 8);
+  }
+  return data;
+}
+
+/* Reference implementation: a fresh key setup for every sample, and one
+ * cipher call per subsample. */
+static void
+encrypt_samples_reference (GssIsomFragment * fragment, guint8 * mdat_data)
+{
+  GssBoxTrun *trun = &fragment->trun;
+  GssBoxUUIDSampleEncryption *se = &fragment->sample_encryption;
+  guint64 sample_offset = 8;
+  EVP_CIPHER_CTX *ctx;
+  int i;
+  int j;
+
+  ctx = EVP_CIPHER_CTX_new ();
+  for (i = 0; i < trun->sample_count; i++) {
+    unsigned char raw_iv[16];
+    int len;
+
+    memset (raw_iv, 0, 16);
+    GST_WRITE_UINT64_BE (raw_iv, se->samples[i].iv);
+    EVP_EncryptInit_ex (ctx, EVP_aes_128_ctr (), NULL, content_key, raw_iv);
+
+    if (se->samples[i].num_entries == 0) {
+      EVP_EncryptUpdate (ctx, mdat_data + sample_offset, &len,
+          mdat_data + sample_offset, trun->samples[i].size);
+    } else {
+      guint64 offset = sample_offset;
+
+      for (j = 0; j < se->samples[i].num_entries; j++) {
+        offset += se->samples[i].entries[j].bytes_of_clear_data;
+        EVP_EncryptUpdate (ctx, mdat_data + offset, &len, mdat_data + offset,
+            se->samples[i].entries[j].bytes_of_encrypted_data);
+        offset += se->samples[i].entries[j].bytes_of_encrypted_data;
+      }
+    }
+    sample_offset += trun->samples[i].size;
+  }
+  EVP_CIPHER_CTX_free (ctx);
+}
+
+GST_START_TEST (test_encrypt_samples)
+{
+  GssPlayreadyCipher *cipher;
+  GssIsomFragment *fragment;
+  guint8 *data;
+  guint8 *ref;
+
+  fragment = create_fragment (N_SAMPLES, SAMPLE_SIZE);
+  data = create_mdat (fragment);
+  ref = create_mdat (fragment);
+
+  cipher = gss_playready_cipher_new (content_key);
+  gss_playready_encrypt_samples (fragment, data, cipher);
+  encrypt_samples_reference (fragment, ref);
+
+  fail_unless (memcmp (data, ref, fragment->mdat_size) == 0);
+
+  /* the cipher is reusable */
+  gss_playready_encrypt_samples (fragment, data, cipher);
+  encrypt_samples_reference (fragment, ref);
+  fail_unless (memcmp (data, ref, fragment->mdat_size) == 0);
+
+  /* split across threads */
+  gss_playready_cipher_set_parallel_threshold (cipher, 1);
+  gss_playready_encrypt_samples (fragment, data, cipher);
+  encrypt_samples_reference (fragment, ref);
+  fail_unless (memcmp (data, ref, fragment->mdat_size) == 0);
+
+  gss_playready_cipher_free (cipher);
+  gss_isom_fragment_free (fragment);
+  g_free (data);
+  g_free (ref);
+}
+
+GST_END_TEST;
+
+/* Not a correctness test: reports fragment encryption throughput
+ * compared to the reference implementation. */
+GST_START_TEST (test_encrypt_samples_speed)
+{
+  GssPlayreadyCipher *cipher;
+  GssIsomFragment *fragment;
+  guint8 *data;
+  gint64 start;
+  gint64 t_cipher;
+  gint64 t_reference;
+  int n_iterations = RUNNING_ON_VALGRIND ? 1 : 20;
+  int i;
+
+  /* small samples, like audio, where key setup dominates */
+  fragment = create_fragment (2000, 400);
+  data = create_mdat (fragment);
+  cipher = gss_playready_cipher_new (content_key);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n_iterations; i++) {
+    gss_playready_encrypt_samples (fragment, data, cipher);
+  }
+  t_cipher = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n_iterations; i++) {
+    encrypt_samples_reference (fragment, data);
+  }
+  t_reference = g_get_monotonic_time () - start;
+
+  GST_INFO ("%d byte fragment: %" G_GINT64_FORMAT " us per fragment, "
+      "reference %" G_GINT64_FORMAT " us", fragment->mdat_size,
+      t_cipher / n_iterations, t_reference / n_iterations);
+
+  gss_playready_cipher_free (cipher);
+  gss_isom_fragment_free (fragment);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+
+static Suite *
+gss_playready_suite (void)
+{
+  Suite *s = suite_create ("GssPlayready");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_encrypt_samples);
+  tcase_add_test (tc_chain, test_encrypt_samples_speed);
+
+  return s;
+}
+
+GST_CHECK_MAIN (gss_playready);
@@ -13,6 +13,9 @@
 #include "gst-streaming-server/gss-sglist.h"
 #include <gst/check/gstcheck.h>
 
+#include <string.h>
+#include <unistd.h>
+
 GST_START_TEST (test_sglist)
 {
   GssSGList *sglist;
@@ -42,6 +45,84 @@ GST_START_TEST (test_sglist)
 
 GST_END_TEST;
 
+GST_START_TEST (test_sglist_coalesce)
+{
+  GssSGList *sglist;
+
+  sglist = gss_sglist_new (5);
+
+  sglist->chunks[0].offset = 0x000;
+  sglist->chunks[0].size = 0x100;
+  sglist->chunks[1].offset = 0x100;
+  sglist->chunks[1].size = 0x100;
+  sglist->chunks[2].offset = 0x400;
+  sglist->chunks[2].size = 0x0;
+  sglist->chunks[3].offset = 0x400;
+  sglist->chunks[3].size = 0x80;
+  sglist->chunks[4].offset = 0x480;
+  sglist->chunks[4].size = 0x80;
+
+  gss_sglist_coalesce (sglist);
+
+  fail_unless (sglist->n_chunks == 2);
+  fail_unless (sglist->chunks[0].offset == 0x000);
+  fail_unless (sglist->chunks[0].size == 0x200);
+  fail_unless (sglist->chunks[1].offset == 0x400);
+  fail_unless (sglist->chunks[1].size == 0x100);
+  fail_unless (gss_sglist_get_size (sglist) == 0x300);
+
+  gss_sglist_free (sglist);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_sglist_load)
+{
+  GssSGList *sglist;
+  GError *error = NULL;
+  guint8 data[0x10000];
+  guint8 dest[0x400];
+  char *filename;
+  int fd;
+  int i;
+
+  for (i = 0; i < sizeof (data); i++) {
+    data[i] = i * 7 + (i >> 8);
+  }
+  fd = g_file_open_tmp (NULL, &filename, NULL);
+  fail_unless (fd >= 0);
+  fail_unless (write (fd, data, sizeof (data)) == sizeof (data));
+
+  /* adjacent, a small gap, a large gap and a backwards jump */
+  sglist = gss_sglist_new (4);
+  sglist->chunks[0].offset = 0x1000;
+  sglist->chunks[0].size = 0x100;
+  sglist->chunks[1].offset = 0x1100;
+  sglist->chunks[1].size = 0x100;
+  sglist->chunks[2].offset = 0x1300;
+  sglist->chunks[2].size = 0x100;
+  sglist->chunks[3].offset = 0x0;
+  sglist->chunks[3].size = 0x100;
+
+  fail_unless (gss_sglist_load (sglist, fd, dest, &error));
+  fail_unless (memcmp (dest, data + 0x1000, 0x200) == 0);
+  fail_unless (memcmp (dest + 0x200, data + 0x1300, 0x100) == 0);
+  fail_unless (memcmp (dest + 0x300, data, 0x100) == 0);
+
+  /* past the end of the file */
+  sglist->chunks[3].offset = sizeof (data) - 0x80;
+  fail_if (gss_sglist_load (sglist, fd, dest, &error));
+  fail_unless (error != NULL);
+  g_clear_error (&error);
+
+  gss_sglist_free (sglist);
+  close (fd);
+  unlink (filename);
+  g_free (filename);
+}
+
+GST_END_TEST;
+
 
 static Suite *
 gss_sglist_suite (void)
@@ -51,6 +132,8 @@ gss_sglist_suite (void)
 
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, test_sglist);
+  tcase_add_test (tc_chain, test_sglist_coalesce);
+  tcase_add_test (tc_chain, test_sglist_load);
 
   return s;
 }
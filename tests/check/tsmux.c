@@ -0,0 +1,248 @@
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_VALGRIND_H
+# include <valgrind/valgrind.h>
+#else
+# define RUNNING_ON_VALGRIND FALSE
+#endif
+
+#include "gst-streaming-server/gss-tsmux.h"
+#include <gst/check/gstcheck.h>
+#include <string.h>
+
+/* avcC with one SPS and one PPS, 4-byte NAL lengths */
+static const guint8 avcc[] = {
+  0x01, 0x64, 0x00, 0x1f, 0xff, 0xe1, 0x00, 0x04, 0x67, 0x64, 0x00, 0x1f,
+  0x01, 0x00, 0x02, 0x68, 0xee
+};
+
+/* AAC LC, 44.1 kHz, stereo */
+static const guint8 audio_specific_config[] = { 0x12, 0x10 };
+
+static const int video_sizes[] = { 1000, 200, 10 };
+static const int audio_sizes[] = { 100, 371, 5, 183, 184 };
+
+typedef struct
+{
+  GssIsomTrack track;
+  GssIsomFragment fragment;
+  GssBoxTrunSample samples[8];
+  guint8 data[2048];
+} TestStream;
+
+static void
+setup_video (TestStream * s)
+{
+  guint8 *p = s->data;
+  guint i;
+
+  memset (s, 0, sizeof (TestStream));
+  s->track.esds.codec_data = (guint8 *) avcc;
+  s->track.esds.codec_data_len = sizeof (avcc);
+  s->fragment.timestamp = 10000000;
+  s->fragment.trun.sample_count = G_N_ELEMENTS (video_sizes);
+  s->fragment.trun.samples = s->samples;
+  for (i = 0; i < G_N_ELEMENTS (video_sizes); i++) {
+    int nal_size = video_sizes[i] - 4;
+
+    s->samples[i].size = video_sizes[i];
+    s->samples[i].duration = 400000;
+    s->samples[i].composition_time_offset = (i == 1) ? 800000 : 0;
+    GST_WRITE_UINT32_BE (p, nal_size);
+    memset (p + 4, i + 1, nal_size);
+    p[4] = (i == 0) ? 0x65 : 0x41;
+    p += video_sizes[i];
+  }
+}
+
+static void
+setup_audio (TestStream * s)
+{
+  guint8 *p = s->data;
+  guint i;
+
+  memset (s, 0, sizeof (TestStream));
+  s->track.esds.codec_data = (guint8 *) audio_specific_config;
+  s->track.esds.codec_data_len = sizeof (audio_specific_config);
+  s->track.mp4a.sample_rate = (guint32) 44100 << 16;
+  s->fragment.timestamp = 10000000;
+  s->fragment.trun.sample_count = G_N_ELEMENTS (audio_sizes);
+  s->fragment.trun.samples = s->samples;
+  for (i = 0; i < G_N_ELEMENTS (audio_sizes); i++) {
+    s->samples[i].size = audio_sizes[i];
+    s->samples[i].duration = 232200;
+    memset (p, 0x80 + i, audio_sizes[i]);
+    p += audio_sizes[i];
+  }
+}
+
+/* Concatenates the payloads of the packets of @pid.  Returns the number
+ * of PES packets started. */
+static int
+collect_pid (const guint8 * data, gsize size, int pid, GByteArray * out)
+{
+  int n_pes = 0;
+  gsize i;
+
+  for (i = 0; i < size; i += GSS_TSMUX_PACKET_SIZE) {
+    const guint8 *p = data + i;
+    int offset = 4;
+
+    fail_unless (p[0] == 0x47);
+    if ((((p[1] & 0x1f) << 8) | p[2]) != pid)
+      continue;
+    if (p[1] & 0x40)
+      n_pes++;
+    if (p[3] & 0x20)
+      offset += 1 + p[4];
+    fail_unless (p[3] & 0x10);
+    fail_unless (offset <= GSS_TSMUX_PACKET_SIZE);
+    g_byte_array_append (out, p + offset, GSS_TSMUX_PACKET_SIZE - offset);
+  }
+  return n_pes;
+}
+
+/* Checks that the continuity counters of @pid count up from 0, and
+ * returns the number of packets */
+static int
+check_continuity (const guint8 * data, gsize size, int pid)
+{
+  int n = 0;
+  gsize i;
+
+  for (i = 0; i < size; i += GSS_TSMUX_PACKET_SIZE) {
+    const guint8 *p = data + i;
+
+    if ((((p[1] & 0x1f) << 8) | p[2]) != pid)
+      continue;
+    fail_unless ((p[3] & 0x0f) == (n & 0x0f));
+    n++;
+  }
+  return n;
+}
+
+static guint8 *
+mux (const GssTsMuxInput * video, const GssTsMuxInput * audio, gsize * size)
+{
+  guint8 *data;
+
+  *size = gss_tsmux_write_segment (video, audio, NULL);
+  fail_unless (*size > 0);
+  fail_unless (*size % GSS_TSMUX_PACKET_SIZE == 0);
+  data = g_malloc (*size);
+  fail_unless (gss_tsmux_write_segment (video, audio, data) == *size);
+
+  return data;
+}
+
+GST_START_TEST (test_tsmux_segment)
+{
+  static TestStream video, audio;
+  GssTsMuxInput vin, ain;
+  GByteArray *pes;
+  guint8 *data;
+  gsize size;
+  gsize pos;
+  guint i;
+
+  setup_video (&video);
+  setup_audio (&audio);
+  vin.track = &video.track;
+  vin.fragment = &video.fragment;
+  vin.data = video.data;
+  ain.track = &audio.track;
+  ain.fragment = &audio.fragment;
+  ain.data = audio.data;
+
+  data = mux (&vin, &ain, &size);
+
+  /* PAT, then PMT */
+  fail_unless (data[1] == 0x40 && data[2] == 0x00);
+  fail_unless (data[GSS_TSMUX_PACKET_SIZE + 1] == 0x50);
+  fail_unless (data[GSS_TSMUX_PACKET_SIZE + 2] == 0x00);
+
+  /* segments are played back to back, so each PES PID ends with a
+   * continuity counter of 15, and PAT and PMT are marked discontinuous */
+  fail_unless (check_continuity (data, size, 0x100) % 16 == 0);
+  fail_unless (check_continuity (data, size, 0x101) % 16 == 0);
+  fail_unless ((data[3] & 0x20) && (data[5] & 0x80));
+  fail_unless ((data[GSS_TSMUX_PACKET_SIZE + 3] & 0x20) &&
+      (data[GSS_TSMUX_PACKET_SIZE + 5] & 0x80));
+
+  /* one PES packet per video sample, starting with AUD, SPS and PPS */
+  pes = g_byte_array_new ();
+  fail_unless (collect_pid (data, size, 0x100, pes) == 3);
+  fail_unless (pes->data[3] == 0xe0);
+  pos = 9 + pes->data[8];
+  fail_unless (memcmp (pes->data + pos, "\0\0\0\1\x09\xf0\0\0\0\1\x67", 11) == 0);
+  fail_unless (pes->data[pos + 6 + 8 + 4] == 0x68);
+  fail_unless (pes->data[pos + 6 + 8 + 6 + 4] == 0x65);
+  g_byte_array_free (pes, TRUE);
+
+  /* ADTS frames in the audio PES packets */
+  pes = g_byte_array_new ();
+  fail_unless (collect_pid (data, size, 0x101, pes) >= 1);
+  fail_unless (pes->data[3] == 0xc0);
+  pos = 9 + pes->data[8];
+  for (i = 0; i < G_N_ELEMENTS (audio_sizes); i++) {
+    int frame_size;
+
+    if (pes->data[pos] == 0x00) {
+      /* next PES packet */
+      fail_unless (pes->data[pos + 3] == 0xc0);
+      pos += 9 + pes->data[pos + 8];
+    }
+    fail_unless (pes->data[pos] == 0xff);
+    fail_unless ((pes->data[pos + 1] & 0xf6) == 0xf0);
+    frame_size = ((pes->data[pos + 3] & 0x03) << 11) |
+        (pes->data[pos + 4] << 3) | (pes->data[pos + 5] >> 5);
+    fail_unless (frame_size == 7 + audio_sizes[i]);
+    fail_unless (pes->data[pos + 7] == 0x80 + i);
+    pos += frame_size;
+  }
+  g_byte_array_free (pes, TRUE);
+  g_free (data);
+
+  /* single streams */
+  data = mux (&vin, NULL, &size);
+  g_free (data);
+  data = mux (NULL, &ain, &size);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_tsmux_invalid_avcc)
+{
+  static TestStream video;
+  GssTsMuxInput vin;
+
+  setup_video (&video);
+  video.track.esds.codec_data_len = 4;
+  vin.track = &video.track;
+  vin.fragment = &video.fragment;
+  vin.data = video.data;
+
+  fail_unless (gss_tsmux_write_segment (&vin, NULL, NULL) == 0);
+}
+
+GST_END_TEST;
+
+
+static Suite *
+gss_tsmux_suite (void)
+{
+  Suite *s = suite_create ("GssTsMux");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_tsmux_segment);
+  tcase_add_test (tc_chain, test_tsmux_invalid_avcc);
+
+  return s;
+}
+
+GST_CHECK_MAIN (gss_tsmux);
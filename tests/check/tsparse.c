@@ -0,0 +1,294 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_VALGRIND_H
+# include <valgrind/valgrind.h>
+#else
+# define RUNNING_ON_VALGRIND FALSE
+#endif
+
+#include "gst-streaming-server/gss-tsparse.h"
+#include <gst/check/gstcheck.h>
+#include <string.h>
+
+static void
+put_timestamp (guint8 * p, int prefix, guint64 ts)
+{
+  p[0] = (prefix << 4) | ((ts >> 29) & 0x0e) | 1;
+  p[1] = ts >> 22;
+  p[2] = ((ts >> 14) & 0xfe) | 1;
+  p[3] = ts >> 7;
+  p[4] = ((ts << 1) & 0xfe) | 1;
+}
+
+/* Writes a packet starting a PES packet of @stream_id, with an
+ * adaptation field if @random_access or @pcr >= 0 */
+static void
+make_pes_packet (guint8 * p, int pid, int stream_id, gboolean random_access,
+    gint64 pcr, guint64 pts)
+{
+  int offset = 4;
+
+  memset (p, 0xff, GSS_TSPARSE_PACKET_SIZE);
+  p[0] = 0x47;
+  p[1] = 0x40 | (pid >> 8);
+  p[2] = pid & 0xff;
+  p[3] = 0x10;
+  if (random_access || pcr >= 0) {
+    p[3] |= 0x20;
+    p[4] = (pcr >= 0) ? 7 : 1;
+    p[5] = (random_access ? 0x40 : 0) | ((pcr >= 0) ? 0x10 : 0);
+    if (pcr >= 0) {
+      p[6] = pcr >> 25;
+      p[7] = pcr >> 17;
+      p[8] = pcr >> 9;
+      p[9] = pcr >> 1;
+      p[10] = ((pcr & 1) << 7) | 0x7e;
+      p[11] = 0;
+    }
+    offset += 1 + p[4];
+  }
+  p[offset] = 0;
+  p[offset + 1] = 0;
+  p[offset + 2] = 1;
+  p[offset + 3] = stream_id;
+  p[offset + 4] = 0;
+  p[offset + 5] = 0;
+  p[offset + 6] = 0x84;
+  p[offset + 7] = 0x80;
+  p[offset + 8] = 5;
+  put_timestamp (p + offset + 9, 2, pts);
+}
+
+GST_START_TEST (test_tsparse_pes)
+{
+  guint8 p[GSS_TSPARSE_PACKET_SIZE];
+  GssTsPacketInfo info;
+  guint64 big = (G_GUINT64_CONSTANT (1) << 33) - 90000;
+
+  /* video key frame with PCR, near the 33-bit wraparound */
+  make_pes_packet (p, 0x100, 0xe0, TRUE, big - 63000, big);
+  fail_unless (gss_tsparse_packet (p, &info));
+  fail_unless (info.pid == 0x100);
+  fail_unless (info.random_access);
+  fail_unless (info.have_pcr);
+  fail_unless (info.pcr == big - 63000);
+  fail_unless (info.stream_id == 0xe0);
+  fail_unless (info.have_pts);
+  fail_unless (info.pts == big);
+
+  /* audio, without adaptation field */
+  make_pes_packet (p, 0x101, 0xc0, FALSE, -1, 123456);
+  fail_unless (gss_tsparse_packet (p, &info));
+  fail_unless (info.pid == 0x101);
+  fail_if (info.random_access);
+  fail_if (info.have_pcr);
+  fail_unless (info.stream_id == 0xc0);
+  fail_unless (info.have_pts);
+  fail_unless (info.pts == 123456);
+
+  /* random access indicator only */
+  make_pes_packet (p, 0x100, 0xe0, TRUE, -1, 90000);
+  fail_unless (gss_tsparse_packet (p, &info));
+  fail_unless (info.random_access);
+  fail_if (info.have_pcr);
+  fail_unless (info.pts == 90000);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_tsparse_dts)
+{
+  guint8 p[GSS_TSPARSE_PACKET_SIZE];
+  GssTsPacketInfo info;
+  guint8 *pes;
+
+  make_pes_packet (p, 0x100, 0xe0, TRUE, -1, 96000);
+  /* PTS and DTS, without adaptation field stuffing */
+  pes = p + 6;
+  pes[7] = 0xc0;
+  pes[8] = 10;
+  put_timestamp (pes + 9, 3, 96000);
+  put_timestamp (pes + 14, 1, 90000);
+  fail_unless (gss_tsparse_packet (p, &info));
+  fail_unless (info.have_pts);
+  fail_unless (info.pts == 96000);
+  fail_unless (info.have_dts);
+  fail_unless (info.dts == 90000);
+
+  /* PTS only */
+  make_pes_packet (p, 0x100, 0xe0, TRUE, -1, 96000);
+  fail_unless (gss_tsparse_packet (p, &info));
+  fail_unless (info.have_pts);
+  fail_if (info.have_dts);
+}
+
+GST_END_TEST;
+
+#define MAX_CUTS 16
+
+typedef struct
+{
+  int n_cuts;
+  guint64 durations[MAX_CUTS];
+  gboolean discontinuities[MAX_CUTS];
+} Cuts;
+
+/* Pushes @n_frames frames of 30 fps video in decode order, starting at
+ * @start, to @segmenter.  GOPs are one second of I B B P B B ..., with
+ * the two B frames after each reference frame presented before it. */
+static void
+push_frames (GssTsSegmenter * segmenter, guint64 start, int n_frames,
+    gboolean with_dts, Cuts * cuts)
+{
+  const guint64 mask = (G_GUINT64_CONSTANT (1) << 33) - 1;
+  int d;
+
+  for (d = 0; d < n_frames; d++) {
+    GssTsPacketInfo info;
+    guint64 duration;
+    gboolean discontinuity;
+    int k = d - d % 3;
+    int n = (d % 3 == 0) ? k + 2 : k + d % 3 - 1;
+
+    memset (&info, 0, sizeof (info));
+    info.pid = 0x100;
+    info.stream_id = 0xe0;
+    info.random_access = (d % 30 == 0);
+    info.have_pts = TRUE;
+    info.pts = (start + n * 3000) & mask;
+    if (with_dts) {
+      info.have_dts = TRUE;
+      info.dts = (start + (d - 1) * 3000) & mask;
+    }
+
+    if (gss_tsparse_segmenter_push (segmenter, &info, &duration,
+            &discontinuity) == GSS_TSPARSE_SEGMENT_CUT) {
+      fail_unless (info.random_access);
+      fail_unless (cuts->n_cuts < MAX_CUTS);
+      cuts->durations[cuts->n_cuts] = duration;
+      cuts->discontinuities[cuts->n_cuts] = discontinuity;
+      cuts->n_cuts++;
+    }
+  }
+}
+
+static void
+init_segmenter (GssTsSegmenter * segmenter)
+{
+  memset (segmenter, 0, sizeof (GssTsSegmenter));
+  /* 2 second segments, as in the HLS server */
+  segmenter->target = 2 * 90000;
+  segmenter->max_reorder = 2 * 90000;
+  segmenter->max_jump = 3 * segmenter->max_reorder;
+  gss_tsparse_segmenter_reset (segmenter, FALSE);
+}
+
+GST_START_TEST (test_tsparse_segmenter_reorder)
+{
+  GssTsSegmenter segmenter;
+  Cuts cuts;
+  guint64 wrap = G_GUINT64_CONSTANT (1) << 33;
+  int with_dts;
+  int i;
+
+  for (with_dts = 0; with_dts < 2; with_dts++) {
+    init_segmenter (&segmenter);
+    memset (&cuts, 0, sizeof (cuts));
+    /* crosses the 33-bit wraparound */
+    push_frames (&segmenter, wrap - 270000, 7 * 30, with_dts, &cuts);
+
+    fail_unless (cuts.n_cuts == 3);
+    for (i = 0; i < cuts.n_cuts; i++) {
+      fail_unless (cuts.durations[i] == 180000);
+      fail_if (cuts.discontinuities[i]);
+    }
+  }
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_tsparse_segmenter_jump)
+{
+  GssTsSegmenter segmenter;
+  Cuts cuts;
+
+  init_segmenter (&segmenter);
+  memset (&cuts, 0, sizeof (cuts));
+  push_frames (&segmenter, 9000000, 3 * 30, FALSE, &cuts);
+  /* the source restarts 10 seconds back */
+  push_frames (&segmenter, 9000000 - 900000, 5 * 30, FALSE, &cuts);
+
+  fail_unless (cuts.n_cuts == 4);
+  fail_unless (cuts.durations[0] == 180000);
+  fail_if (cuts.discontinuities[0]);
+  /* cut at the first key frame after the jump, up to the last frame
+   * before it */
+  fail_unless (cuts.durations[1] == 27 * 3000);
+  fail_if (cuts.discontinuities[1]);
+  fail_unless (cuts.durations[2] == 180000);
+  fail_unless (cuts.discontinuities[2]);
+  fail_unless (cuts.durations[3] == 180000);
+  fail_if (cuts.discontinuities[3]);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_tsparse_other)
+{
+  guint8 p[GSS_TSPARSE_PACKET_SIZE];
+  GssTsPacketInfo info;
+
+  /* continuation of a PES packet, not parsed as a header */
+  make_pes_packet (p, 0x100, 0xe0, FALSE, -1, 90000);
+  p[1] &= ~0x40;
+  fail_unless (gss_tsparse_packet (p, &info));
+  fail_unless (info.stream_id == 0);
+  fail_if (info.have_pts);
+
+  /* adaptation field only, with stuffing */
+  memset (p, 0xff, sizeof (p));
+  p[0] = 0x47;
+  p[1] = 0x01;
+  p[2] = 0x00;
+  p[3] = 0x20;
+  p[4] = 183;
+  p[5] = 0x00;
+  fail_unless (gss_tsparse_packet (p, &info));
+  fail_if (info.random_access);
+  fail_unless (info.stream_id == 0);
+
+  /* empty adaptation field */
+  make_pes_packet (p, 0x100, 0xe0, TRUE, -1, 90000);
+  p[4] = 0;
+  memmove (p + 5, p + 6, sizeof (p) - 6);
+  fail_unless (gss_tsparse_packet (p, &info));
+  fail_if (info.random_access);
+  fail_unless (info.have_pts);
+
+  /* lost sync */
+  p[0] = 0x46;
+  fail_if (gss_tsparse_packet (p, &info));
+}
+
+GST_END_TEST;
+
+
+static Suite *
+gss_tsparse_suite (void)
+{
+  Suite *s = suite_create ("GssTsParse");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_tsparse_pes);
+  tcase_add_test (tc_chain, test_tsparse_other);
+  tcase_add_test (tc_chain, test_tsparse_dts);
+  tcase_add_test (tc_chain, test_tsparse_segmenter_reorder);
+  tcase_add_test (tc_chain, test_tsparse_segmenter_jump);
+
+  return s;
+}
+
+GST_CHECK_MAIN (gss_tsparse);
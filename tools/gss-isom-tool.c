@@ -10,12 +10,15 @@
 gboolean verbose = FALSE;
 gboolean dump = FALSE;
 gboolean fragment = FALSE;
+gboolean write_index = FALSE;
 
 static GOptionEntry entries[] = {
   {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Be verbose", NULL},
   {"dump", 'd', 0, G_OPTION_ARG_NONE, &dump, "Dump file to readable output",
       NULL},
   {"fragment", 'd', 0, G_OPTION_ARG_NONE, &fragment, "Fragment file", NULL},
+  {"write-index", 'i', 0, G_OPTION_ARG_NONE, &write_index,
+      "Write fragment index used by the server to load the file", NULL},
   {NULL}
 };
 
@@ -78,6 +81,23 @@ main (int argc, char *argv[])
       gss_isom_track_serialize_dash (track, &data, &size);
       g_file_set_contents ("out.mov", (gchar *) data, size, NULL);
     }
+    if (write_index) {
+      if (file->movie->tracks[0]->n_fragments == 0) {
+        gss_isom_parser_fragmentize (file, FALSE);
+      }
+
+      if (!gss_isom_parser_save_index (file, &error)) {
+        g_print ("failed to write index for %s: %s\n", argv[i],
+            error->message);
+        g_clear_error (&error);
+      } else if (verbose) {
+        char *index_filename;
+
+        index_filename = gss_isom_parser_get_index_filename (argv[i]);
+        g_print ("wrote %s\n", index_filename);
+        g_free (index_filename);
+      }
+    }
 
     gss_isom_parser_free (file);
   }